@@ -16,13 +16,8 @@ void AdaGrad::sgd_update(
   }
   for (const auto& w : grad->weights) {
     int index = w.first;
-    FEATURE_TYPE value = w.second;
-
-    // update history
-    FEATURE_TYPE& weight_hist = lr_model->weights_hist_[index];
-    weight_hist += value * value;
-    lr_model->weights_[index] += learning_rate * value /
-      (adagrad_epsilon + std::sqrt(weight_hist));
+    update_weight(lr_model->weights_[index], lr_model->weights_hist_[index],
+                  w.second);
   }
 }
 
@@ -11,6 +11,17 @@ class AdaGrad: public OptimizationMethod {
    void sgd_update(
           std::unique_ptr<SparseLRModel>& lr_model, 
           const ModelGradient* gradient);
+
+   // defined here so that ModelUpdater can inline it
+   void update_weight(FEATURE_TYPE& weight,
+                      FEATURE_TYPE& weight_hist,
+                      FEATURE_TYPE value) const final {
+     // update history
+     weight_hist += value * value;
+     weight +=
+         learning_rate * value / (adagrad_epsilon + std::sqrt(weight_hist));
+   }
+   bool allows_concurrent_updates() const override { return true; }
  
  private:
     double adagrad_epsilon;
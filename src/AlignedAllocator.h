@@ -0,0 +1,50 @@
+#ifndef _ALIGNED_ALLOCATOR_H_
+#define _ALIGNED_ALLOCATOR_H_
+
+#include <cstddef>
+#include <new>
+
+namespace cirrus {
+
+/**
+  * Allocator of memory aligned to Alignment bytes (a cache line by
+  * default), for containers such as std::vector
+  */
+template <typename T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+  using value_type = T;
+
+  template <typename U>
+  struct rebind {
+    using other = AlignedAllocator<U, Alignment>;
+  };
+
+  AlignedAllocator() = default;
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+  T* allocate(std::size_t n) {
+    return static_cast<T*>(
+        ::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+  }
+
+  void deallocate(T* ptr, std::size_t) {
+    ::operator delete(ptr, std::align_val_t(Alignment));
+  }
+};
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment>&,
+                const AlignedAllocator<U, Alignment>&) {
+  return true;
+}
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment>&,
+                const AlignedAllocator<U, Alignment>&) {
+  return false;
+}
+
+}  // namespace cirrus
+
+#endif  // _ALIGNED_ALLOCATOR_H_
@@ -0,0 +1,115 @@
+#include "AsyncGradientSender.h"
+
+#include <limits>
+
+namespace cirrus {
+
+AsyncGradientSender::AsyncGradientSender(
+    uint64_t max_in_flight,
+    std::function<void(const LRSparseGradient&)> send)
+    : max_in_flight_(max_in_flight),
+      send_(std::move(send)),
+      coalescer_(1, std::numeric_limits<uint64_t>::max(),
+                 std::numeric_limits<uint64_t>::max()),
+      merged_(0) {
+  if (max_in_flight == 0) {
+    throw std::runtime_error("Wrong max number of gradients in flight");
+  }
+  thread_ = std::thread(&AsyncGradientSender::sender_loop, this);
+}
+
+AsyncGradientSender::~AsyncGradientSender() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void AsyncGradientSender::send(const LRSparseGradient& gradient) {
+  std::unique_lock<std::mutex> lock(lock_);
+  cv_.wait(lock, [this]() {
+    return num_in_flight_ < max_in_flight_ || error_;
+  });
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+
+  if (free_.empty()) {
+    free_.emplace_back(0);
+  }
+  LRSparseGradient copy = std::move(free_.back());
+  free_.pop_back();
+  copy.weights.assign(gradient.weights.begin(), gradient.weights.end());
+  copy.setVersion(gradient.getVersion());
+  queue_.push_back(std::move(copy));
+  ++num_in_flight_;
+  cv_.notify_all();
+}
+
+void AsyncGradientSender::flush() {
+  std::unique_lock<std::mutex> lock(lock_);
+  cv_.wait(lock, [this]() { return num_in_flight_ == 0 || error_; });
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+}
+
+uint64_t AsyncGradientSender::get_num_sends() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return num_sends_;
+}
+
+uint64_t AsyncGradientSender::get_num_merged() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return num_merged_;
+}
+
+void AsyncGradientSender::sender_loop() {
+  std::vector<LRSparseGradient> batch;
+  std::unique_lock<std::mutex> lock(lock_);
+  try {
+    while (true) {
+      cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;  // stopped with nothing left to send
+      }
+      while (!queue_.empty()) {
+        batch.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+      }
+      lock.unlock();
+
+      if (batch.size() == 1) {
+        send_(batch[0]);
+      } else {
+        // the queue backed up: send all its gradients at once
+        for (const auto& gradient : batch) {
+          coalescer_.add(0, gradient);
+        }
+        coalescer_.take(0, &merged_);
+        merged_.setVersion(batch.back().getVersion());
+        send_(merged_);
+      }
+
+      lock.lock();
+      ++num_sends_;
+      num_merged_ += batch.size() - 1;
+      num_in_flight_ -= batch.size();
+      for (auto& gradient : batch) {
+        free_.push_back(std::move(gradient));
+      }
+      batch.clear();
+      cv_.notify_all();
+    }
+  } catch (...) {
+    if (!lock.owns_lock()) {
+      lock.lock();
+    }
+    error_ = std::current_exception();
+    cv_.notify_all();
+  }
+}
+
+}  // namespace cirrus
@@ -0,0 +1,85 @@
+#ifndef _ASYNC_GRADIENT_SENDER_H_
+#define _ASYNC_GRADIENT_SENDER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "GradientCoalescer.h"
+#include "ModelGradient.h"
+
+namespace cirrus {
+
+/**
+  * Sends the LR gradients of a worker from a background thread so the
+  * worker does not wait on the network.
+  *
+  * Gradients are copied into reusable gradients and queued. When more
+  * than one gradient is queued by the time the previous send completes,
+  * the queued gradients are merged (summed by index) and sent as one.
+  * The worker only blocks once max_in_flight gradients are queued or
+  * being sent.
+  */
+class AsyncGradientSender {
+ public:
+  /**
+    * @param max_in_flight Most gradients queued or being sent (> 0)
+    * @param send Sends a gradient. Only called from the sender thread
+    */
+  AsyncGradientSender(uint64_t max_in_flight,
+                      std::function<void(const LRSparseGradient&)> send);
+
+  /**
+    * Send the queued gradients and stop the sender thread
+    */
+  ~AsyncGradientSender();
+
+  AsyncGradientSender(const AsyncGradientSender&) = delete;
+  AsyncGradientSender& operator=(const AsyncGradientSender&) = delete;
+
+  /**
+    * Queue a copy of gradient
+    * Rethrows the errors of the sender thread
+    */
+  void send(const LRSparseGradient& gradient);
+
+  /**
+    * Wait until all queued gradients are sent
+    * Rethrows the errors of the sender thread
+    */
+  void flush();
+
+  uint64_t get_num_sends() const;   //< messages sent
+  uint64_t get_num_merged() const;  //< gradients merged into others
+
+ private:
+  void sender_loop();
+
+  uint64_t max_in_flight_;
+  std::function<void(const LRSparseGradient&)> send_;
+
+  mutable std::mutex lock_;
+  std::condition_variable cv_;
+  std::deque<LRSparseGradient> queue_;
+  std::vector<LRSparseGradient> free_;  //< reusable gradients
+  uint64_t num_in_flight_ = 0;          //< queued or being sent
+  uint64_t num_sends_ = 0;
+  uint64_t num_merged_ = 0;
+  bool stop_ = false;
+  std::exception_ptr error_;
+
+  // only used by the sender thread
+  GradientCoalescer coalescer_;
+  LRSparseGradient merged_;
+
+  std::thread thread_;
+};
+
+}  // namespace cirrus
+
+#endif  // _ASYNC_GRADIENT_SENDER_H_
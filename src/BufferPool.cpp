@@ -0,0 +1,134 @@
+#include "BufferPool.h"
+
+#include <sys/mman.h>
+
+#include <stdexcept>
+#include <string>
+
+namespace cirrus {
+
+#define NUM_SIZE_CLASSES 52  //< MIN_BUFFER_SIZE (2^12) up to 2^63 bytes
+
+BufferPool::Buffer::Buffer(Buffer&& other)
+    : pool_(other.pool_), data_(other.data_), size_(other.size_) {
+  other.pool_ = nullptr;
+  other.data_ = nullptr;
+  other.size_ = 0;
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) {
+  if (this != &other) {
+    release();
+    pool_ = other.pool_;
+    data_ = other.data_;
+    size_ = other.size_;
+    other.pool_ = nullptr;
+    other.data_ = nullptr;
+    other.size_ = 0;
+  }
+  return *this;
+}
+
+void BufferPool::Buffer::release() {
+  if (data_ != nullptr) {
+    pool_->put(data_, size_);
+  }
+  pool_ = nullptr;
+  data_ = nullptr;
+  size_ = 0;
+}
+
+BufferPool::BufferPool(uint64_t max_idle_bytes)
+    : max_idle_bytes_(max_idle_bytes), idle_(NUM_SIZE_CLASSES) {}
+
+BufferPool::~BufferPool() {
+  for (uint32_t i = 0; i < idle_.size(); ++i) {
+    for (const auto& data : idle_[i]) {
+      deallocate(data, MIN_BUFFER_SIZE << i);
+    }
+  }
+}
+
+uint32_t BufferPool::size_class(uint64_t size) {
+  uint32_t size_class = 0;
+  while ((MIN_BUFFER_SIZE << size_class) < size) {
+    if (++size_class == NUM_SIZE_CLASSES) {
+      throw std::runtime_error("Buffer too large: " + std::to_string(size));
+    }
+  }
+  return size_class;
+}
+
+char* BufferPool::allocate(uint64_t size) {
+  if (size < HUGE_PAGE_SIZE) {
+    return new char[size];
+  }
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("Error allocating buffer of size " +
+                             std::to_string(size));
+  }
+#ifdef MADV_HUGEPAGE
+  // only a hint, buffers work the same with regular pages
+  madvise(data, size, MADV_HUGEPAGE);
+#endif
+  return static_cast<char*>(data);
+}
+
+void BufferPool::deallocate(char* data, uint64_t size) {
+  if (size < HUGE_PAGE_SIZE) {
+    delete[] data;
+  } else {
+    munmap(data, size);
+  }
+}
+
+BufferPool::Buffer BufferPool::get(uint64_t size) {
+  uint32_t size_class = BufferPool::size_class(size);
+  uint64_t class_size = MIN_BUFFER_SIZE << size_class;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    in_use_bytes_ += class_size;
+    if (!idle_[size_class].empty()) {
+      char* data = idle_[size_class].back();
+      idle_[size_class].pop_back();
+      idle_bytes_ -= class_size;
+      return Buffer(this, data, class_size);
+    }
+  }
+
+  // allocations of large buffers don't hold up other threads
+  try {
+    return Buffer(this, allocate(class_size), class_size);
+  } catch (...) {
+    std::lock_guard<std::mutex> guard(lock_);
+    in_use_bytes_ -= class_size;
+    throw;
+  }
+}
+
+void BufferPool::put(char* data, uint64_t size) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    in_use_bytes_ -= size;
+    if (idle_bytes_ + size <= max_idle_bytes_) {
+      idle_[size_class(size)].push_back(data);
+      idle_bytes_ += size;
+      return;
+    }
+  }
+  deallocate(data, size);
+}
+
+uint64_t BufferPool::in_use_bytes() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return in_use_bytes_;
+}
+
+uint64_t BufferPool::idle_bytes() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return idle_bytes_;
+}
+
+}  // namespace cirrus
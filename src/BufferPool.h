@@ -0,0 +1,93 @@
+#ifndef _BUFFER_POOL_H_
+#define _BUFFER_POOL_H_
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace cirrus {
+
+/**
+  * Recycles the buffers requests are read into and replies are built in.
+  * Buffers come in power of two size classes. The ones of HUGE_PAGE_SIZE
+  * and up are mapped on their own and backed by transparent huge pages,
+  * smaller ones come from the heap. A buffer given back is kept for the
+  * next request of its class as long as the pool keeps less than
+  * max_idle_bytes, so memory use follows the bytes in flight rather than
+  * the largest message a thread could see.
+  */
+class BufferPool {
+ public:
+  static const uint64_t MIN_BUFFER_SIZE = 4 * 1024;
+  static const uint64_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+  /**
+    * A buffer of the pool, given back when destroyed
+    */
+  class Buffer {
+   public:
+    Buffer() = default;
+    Buffer(Buffer&& other);
+    Buffer& operator=(Buffer&& other);
+    ~Buffer() { release(); }
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    char* data() const { return data_; }
+    uint64_t size() const { return size_; }  //< can be more than asked for
+
+    /**
+      * Give the buffer back to the pool before it is destroyed
+      */
+    void release();
+
+   private:
+    friend class BufferPool;
+
+    Buffer(BufferPool* pool, char* data, uint64_t size)
+        : pool_(pool), data_(data), size_(size) {}
+
+    BufferPool* pool_ = nullptr;
+    char* data_ = nullptr;
+    uint64_t size_ = 0;
+  };
+
+  /**
+    * @param max_idle_bytes Most bytes kept in buffers nobody uses
+    */
+  explicit BufferPool(uint64_t max_idle_bytes);
+
+  /**
+    * All buffers have to be given back before the pool is destroyed
+    */
+  ~BufferPool();
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  /**
+    * A buffer of at least size bytes
+    */
+  Buffer get(uint64_t size);
+
+  uint64_t in_use_bytes() const;  //< bytes of the buffers not given back
+  uint64_t idle_bytes() const;    //< bytes kept for reuse
+
+ private:
+  void put(char* data, uint64_t size);
+
+  static uint32_t size_class(uint64_t size);
+  static char* allocate(uint64_t size);
+  static void deallocate(char* data, uint64_t size);
+
+  uint64_t max_idle_bytes_;
+  mutable std::mutex lock_;
+  std::vector<std::vector<char*>> idle_;  //< idle buffers of each class
+  uint64_t in_use_bytes_ = 0;
+  uint64_t idle_bytes_ = 0;
+};
+
+}  // namespace cirrus
+
+#endif  // _BUFFER_POOL_H_
@@ -5,6 +5,7 @@
 #include <sstream>
 #include <string>
 #include <Utils.h>
+#include <Quantization.h>
 
 namespace cirrus {
 
@@ -68,6 +69,31 @@ void Configuration::print() const {
     std::cout << "checkpoint_frequency: " << checkpoint_frequency << std::endl;
     std::cout << "checkpoint_s3_bucket: " << checkpoint_s3_bucket << std::endl;
     std::cout << "checkpoint_s3_keyname: " << checkpoint_s3_keyname << std::endl;
+    std::cout << "checkpoint_path: " << checkpoint_path << std::endl;
+    std::cout << "ps_server_mode: " << ps_server_mode << std::endl;
+    std::cout << "ps_update_mode: " << ps_update_mode << std::endl;
+    std::cout << "ps_shards:";
+    for (const auto& shard : ps_shards) {
+      std::cout << " " << shard.first << ":" << shard.second;
+    }
+    std::cout << std::endl;
+    std::cout << "ps_shard_scheme: " << ps_shard_scheme << std::endl;
+    std::cout << "grad_coalesce_window: " << grad_coalesce_window << std::endl;
+    std::cout << "grad_coalesce_max_delay_ms: " << grad_coalesce_max_delay_ms
+              << std::endl;
+    std::cout << "worker_push_pull: " << worker_push_pull << std::endl;
+    std::cout << "grad_quantization: " << grad_quantization << std::endl;
+    std::cout << "grad_top_k: " << grad_top_k << std::endl;
+    std::cout << "grad_top_k_percent: " << grad_top_k_percent << std::endl;
+    std::cout << "metrics_path: " << metrics_path << std::endl;
+    std::cout << "kv_store_max_mb: " << kv_store_max_mb << std::endl;
+    std::cout << "worker_pipeline_depth: " << worker_pipeline_depth
+      << std::endl;
+    std::cout << "grad_max_in_flight: " << grad_max_in_flight << std::endl;
+    std::cout << "ssp_staleness: " << ssp_staleness << std::endl;
+    std::cout << "worker_multiplex: " << worker_multiplex << std::endl;
+    std::cout << "shm_ring_size_kb: " << shm_ring_size_kb << std::endl;
+    std::cout << "num_factors: " << num_factors << std::endl;
     if (nusers || nitems) {
       std::cout
         << "users: " << nusers << std::endl
@@ -98,9 +124,59 @@ void Configuration::check() const {
       throw std::runtime_error(
              "Choose a valid update rule: adagrad, nesterov, momentum, or sgd");
   }
-  if (checkpoint_frequency > 0
-          && (checkpoint_s3_bucket == "" || checkpoint_s3_keyname == "")) {
-      throw std::runtime_error("Wrong checkpoing configuration parameters");
+  // checkpoints are only written to a local file, not to S3
+  if (checkpoint_frequency > 0 && checkpoint_path == "") {
+      throw std::runtime_error("checkpoint_frequency needs checkpoint_path");
+  }
+  if (ps_server_mode != "poll" && ps_server_mode != "epoll" &&
+      ps_server_mode != "io_uring") {
+    throw std::runtime_error("ps_server_mode must be poll, epoll or io_uring");
+  }
+  if (ps_update_mode != "global" && ps_update_mode != "striped" &&
+      ps_update_mode != "hogwild") {
+    throw std::runtime_error(
+        "ps_update_mode must be global, striped or hogwild");
+  }
+  if (ps_shard_scheme != "range" && ps_shard_scheme != "hash") {
+    throw std::runtime_error("ps_shard_scheme must be range or hash");
+  }
+  if (grad_quantization != "none" && grad_quantization != "fp16" &&
+      grad_quantization != "bf16" && grad_quantization != "int8") {
+    throw std::runtime_error(
+        "grad_quantization must be none, fp16, bf16 or int8");
+  }
+  if (grad_top_k_percent < 0 || grad_top_k_percent > 100) {
+    throw std::runtime_error("grad_top_k_percent must be between 0 and 100");
+  }
+  if (grad_top_k > 0 && grad_top_k_percent > 0) {
+    throw std::runtime_error(
+        "Can't use both grad_top_k and grad_top_k_percent");
+  }
+  if (grad_coalesce_window > 1 && grad_coalesce_max_delay_ms == 0) {
+    throw std::runtime_error("grad_coalesce_max_delay_ms must be positive");
+  }
+  if (kv_store_max_mb == 0) {
+    throw std::runtime_error("kv_store_max_mb must be positive");
+  }
+  if (worker_pipeline_depth > 0 && worker_push_pull) {
+    throw std::runtime_error(
+        "Can't use both worker_pipeline_depth and worker_push_pull");
+  }
+  if (grad_max_in_flight > 0 &&
+      (worker_push_pull || worker_pipeline_depth > 0)) {
+    throw std::runtime_error(
+        "grad_max_in_flight can't be used with worker_push_pull or "
+        "worker_pipeline_depth");
+  }
+  if (ssp_staleness < -1) {
+    throw std::runtime_error("ssp_staleness must be -1 (disabled) or more");
+  }
+  if (shm_ring_size_kb != 0 && shm_ring_size_kb < 4) {
+    throw std::runtime_error("shm_ring_size_kb must be 0 (disabled) or 4+");
+  }
+  if (num_factors == 0 || num_factors > MAX_NUM_FACTORS) {
+    throw std::runtime_error("num_factors must be between 1 and " +
+                             std::to_string(MAX_NUM_FACTORS));
   }
 }
 
@@ -174,6 +250,8 @@ void Configuration::parse_line(const std::string& line) {
        iss >> checkpoint_s3_bucket;
     } else if (s == "checkpoint_s3_keyname:") {
        iss >> checkpoint_s3_keyname;
+    } else if (s == "checkpoint_path:") {
+       iss >> checkpoint_path;
     } else if (s == "normalize:") {
       int n;
       iss >> n;
@@ -223,6 +301,56 @@ void Configuration::parse_line(const std::string& line) {
       use_grad_threshold = string_to<bool>(b);
     } else if (s == "grad_threshold:") {
       iss >> grad_threshold;
+    } else if (s == "ps_server_mode:") {
+      iss >> ps_server_mode;
+    } else if (s == "ps_update_mode:") {
+      iss >> ps_update_mode;
+    } else if (s == "ps_shards:") {
+      // comma separated list of ip:port
+      std::string shards;
+      iss >> shards;
+      ps_shards.clear();
+      std::istringstream shards_iss(shards);
+      std::string shard;
+      while (getline(shards_iss, shard, ',')) {
+        size_t index = shard.rfind(":");
+        if (index == std::string::npos) {
+          throw std::runtime_error("Wrong ps shard address: " + shard);
+        }
+        ps_shards.push_back(std::make_pair(
+            shard.substr(0, index),
+            string_to<int>(shard.substr(index + 1))));
+      }
+    } else if (s == "ps_shard_scheme:") {
+      iss >> ps_shard_scheme;
+    } else if (s == "grad_coalesce_window:") {
+      iss >> grad_coalesce_window;
+    } else if (s == "grad_coalesce_max_delay_ms:") {
+      iss >> grad_coalesce_max_delay_ms;
+    } else if (s == "worker_push_pull:") {
+      iss >> worker_push_pull;
+    } else if (s == "grad_quantization:") {
+      iss >> grad_quantization;
+    } else if (s == "grad_top_k:") {
+      iss >> grad_top_k;
+    } else if (s == "grad_top_k_percent:") {
+      iss >> grad_top_k_percent;
+    } else if (s == "metrics_path:") {
+      iss >> metrics_path;
+    } else if (s == "kv_store_max_mb:") {
+      iss >> kv_store_max_mb;
+    } else if (s == "worker_pipeline_depth:") {
+      iss >> worker_pipeline_depth;
+    } else if (s == "grad_max_in_flight:") {
+      iss >> grad_max_in_flight;
+    } else if (s == "ssp_staleness:") {
+      iss >> ssp_staleness;
+    } else if (s == "worker_multiplex:") {
+      iss >> worker_multiplex;
+    } else if (s == "shm_ring_size_kb:") {
+      iss >> shm_ring_size_kb;
+    } else if (s == "num_factors:") {
+      iss >> num_factors;
     } else if (s.find_first_not_of("\t\n\v\f\r") ==
                std::string::npos) {  // Ignore lines with whitespace
     } else {
@@ -410,4 +538,147 @@ std::string Configuration::get_checkpoint_s3_keyname() const {
   return checkpoint_s3_keyname;
 }
 
+std::string Configuration::get_checkpoint_path() const {
+  return checkpoint_path;
+}
+
+/**
+  * Get the event loop used by the parameter server (poll, epoll or
+  * io_uring)
+  */
+std::string Configuration::get_ps_server_mode() const {
+  return ps_server_mode;
+}
+
+/**
+  * Get how the parameter server synchronizes model updates
+  * (global, striped or hogwild)
+  */
+std::string Configuration::get_ps_update_mode() const {
+  return ps_update_mode;
+}
+
+/**
+  * Get the list of parameter server shards (ip, port)
+  */
+const std::vector<std::pair<std::string, int>>& Configuration::get_ps_shards()
+    const {
+  return ps_shards;
+}
+
+/**
+  * Get how model indices are partitioned across shards (range or hash)
+  */
+std::string Configuration::get_ps_shard_scheme() const {
+  return ps_shard_scheme;
+}
+
+/**
+  * Get max number of LR gradients merged by the parameter server before
+  * applying them to the model
+  */
+uint64_t Configuration::get_grad_coalesce_window() const {
+  return grad_coalesce_window;
+}
+
+/**
+  * Get max time (ms) a gradient waits in the coalescing window
+  */
+uint64_t Configuration::get_grad_coalesce_max_delay_ms() const {
+  return grad_coalesce_max_delay_ms;
+}
+
+/**
+  * Get whether LR workers push a gradient and pull the model for the next
+  * minibatch in a single round trip
+  */
+bool Configuration::get_worker_push_pull() const {
+  return worker_push_pull;
+}
+
+/**
+  * Get the Quantization of the gradient values sent by workers
+  */
+uint32_t Configuration::get_grad_quantization() const {
+  return quantization_from_name(grad_quantization);
+}
+
+/**
+  * Get the number of largest gradient entries LR workers send
+  * (0: all entries, unless grad_top_k_percent is set)
+  */
+uint64_t Configuration::get_grad_top_k() const {
+  return grad_top_k;
+}
+
+/**
+  * Get the percentage of the entries of each LR gradient workers send
+  * (0: disabled)
+  */
+double Configuration::get_grad_top_k_percent() const {
+  return grad_top_k_percent;
+}
+
+/**
+  * Get the local file where the parameter server writes its metrics
+  * (empty: disabled)
+  */
+std::string Configuration::get_metrics_path() const {
+  return metrics_path;
+}
+
+/**
+  * Get the memory cap (MB) of the values of the key-value store
+  */
+uint64_t Configuration::get_kv_store_max_mb() const {
+  return kv_store_max_mb;
+}
+
+/**
+  * Get the number of gradients of a worker the models it pulls may miss
+  * (0: no pipelining)
+  */
+uint64_t Configuration::get_worker_pipeline_depth() const {
+  return worker_pipeline_depth;
+}
+
+/**
+  * Get the most LR gradients a worker has queued or being sent in the
+  * background (0: sent by the worker thread)
+  */
+uint64_t Configuration::get_grad_max_in_flight() const {
+  return grad_max_in_flight;
+}
+
+/**
+  * Get the most minibatches a worker may be ahead of the slowest live
+  * worker (-1: no bound)
+  */
+int64_t Configuration::get_ssp_staleness() const {
+  return ssp_staleness;
+}
+
+/**
+  * Get whether the parameter server interfaces of a worker share one
+  * connection per parameter server
+  */
+bool Configuration::get_worker_multiplex() const {
+  return worker_multiplex;
+}
+
+/**
+  * Get the size (KB) of each shared memory ring of workers on the host of
+  * the parameter server (0: they use sockets)
+  */
+uint64_t Configuration::get_shm_ring_size_kb() const {
+  return shm_ring_size_kb;
+}
+
+/**
+  * Get the number of factors of the users and items of MF models
+  */
+uint64_t Configuration::get_num_factors() const {
+  return num_factors;
+}
+
 }  // namespace cirrus
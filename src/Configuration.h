@@ -2,6 +2,10 @@
 #define _CONFIGURATION_H_
 
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "config.h"
 
 namespace cirrus {
 
@@ -124,10 +128,15 @@ class Configuration {
 
     /**
       * Model checkpointing
+      * With checkpoint_path the parameter server writes its models to that
+      * local file every checkpoint_frequency secs and restores them from it
+      * when it starts. checkpoint_s3_bucket and checkpoint_s3_keyname are
+      * not used by the parameter server
       */
     uint64_t get_checkpoint_frequency() const;
     std::string get_checkpoint_s3_bucket() const;
     std::string get_checkpoint_s3_keyname() const;
+    std::string get_checkpoint_path() const;
 
 
     /**
@@ -141,6 +150,103 @@ class Configuration {
 
     double get_momentum_beta() const;
 
+    std::string get_ps_server_mode() const;
+    std::string get_ps_update_mode() const;
+
+    /**
+      * Parameter server shards (ip and port of each shard)
+      * Empty when a single parameter server holds the whole model
+      */
+    const std::vector<std::pair<std::string, int>>& get_ps_shards() const;
+    std::string get_ps_shard_scheme() const;
+
+    /**
+      * Gradient coalescing in the parameter server
+      * Up to grad_coalesce_window LR gradients are merged before being
+      * applied, waiting at most grad_coalesce_max_delay_ms
+      */
+    uint64_t get_grad_coalesce_window() const;
+    uint64_t get_grad_coalesce_max_delay_ms() const;
+
+    /**
+      * LR workers send the gradient of a minibatch together with the
+      * indices of the next minibatch and get those weights back in the
+      * same round trip
+      */
+    bool get_worker_push_pull() const;
+
+    /**
+      * Workers send gradient values as fp16, bf16 or int8 (stochastically
+      * rounded) when the parameter server supports WIRE_FORMAT_QUANTIZED
+      */
+    uint32_t get_grad_quantization() const;
+
+    /**
+      * LR workers only send the grad_top_k (or grad_top_k_percent) entries
+      * of each gradient with the largest magnitude and add the others to
+      * the next gradients
+      */
+    uint64_t get_grad_top_k() const;
+    double get_grad_top_k_percent() const;
+
+    /**
+      * Local file where the parameter server writes its metrics (JSON, see
+      * PSMetrics) every second. Empty: disabled
+      */
+    std::string get_metrics_path() const;
+
+    /**
+      * Most memory (MB) taken by the values of the parameter server
+      * key-value store. The least recently used values are evicted
+      */
+    uint64_t get_kv_store_max_mb() const;
+
+    /**
+      * Workers pull the models of the next minibatches and push their
+      * gradients from a background thread while computing. The model of a
+      * minibatch misses at most this many of the last gradients of the
+      * worker. 0: sequential pull, compute, push
+      */
+    uint64_t get_worker_pipeline_depth() const;
+
+    /**
+      * LR workers send gradients from a background thread. Gradients that
+      * queue up behind a send are merged into one. The worker blocks when
+      * this many gradients are queued or being sent. 0: the worker thread
+      * sends each gradient
+      */
+    uint64_t get_grad_max_in_flight() const;
+
+    /**
+      * Stale synchronous parallel mode. Workers report how many minibatches
+      * they finished to the parameter server. A worker more than this many
+      * minibatches ahead of the slowest live registered task waits before
+      * pulling its next model. -1: fully asynchronous
+      */
+    int64_t get_ssp_staleness() const;
+
+    /**
+      * The parameter server interfaces of a worker (model pulls, gradient
+      * pushes, key-value operations) share one connection per parameter
+      * server. Requests carry ids and replies can come back in any order,
+      * so the threads of the worker do not wait for each other's replies
+      */
+    bool get_worker_multiplex() const;
+
+    /**
+      * Workers on the host of the parameter server send requests and get
+      * replies through a pair of shared memory rings of this size (KB)
+      * instead of the loopback socket. Not used with worker_multiplex.
+      * 0: always use sockets
+      */
+    uint64_t get_shm_ring_size_kb() const;
+
+    /**
+      * Rank of the MF model: number of factors of each user and item.
+      * Workers get it from the parameter server replies.
+      */
+    uint64_t get_num_factors() const;
+
  public:
     /**
       * Parse a specific line in the config file
@@ -200,8 +306,66 @@ class Configuration {
     uint64_t checkpoint_frequency = 0;  // how often (secs) to checkpoint model
     std::string checkpoint_s3_bucket = "";  // s3 bucket where to store model
     std::string checkpoint_s3_keyname = "";  // s3 key where to store model
+    std::string checkpoint_path = "";  // local file where to store model
 
     double momentum_beta = 0.0;
+
+    // poll: poll threads hand requests to worker threads through a queue
+    // epoll: each worker thread runs its own epoll loop over its connections
+    // io_uring: like epoll, with an io_uring instance per worker thread
+    //   (Linux 6.0 or later)
+    std::string ps_server_mode = "poll";
+
+    // global: one lock for all model updates
+    // striped: striped locks for LR weights, per-row locks for MF
+    // hogwild: lock-free updates
+    std::string ps_update_mode = "global";
+
+    // parameter servers that hold a shard of the models each
+    std::vector<std::pair<std::string, int>> ps_shards;
+    // range: each shard owns a contiguous range of indices
+    // hash: index i is owned by shard i % ps_shards.size()
+    std::string ps_shard_scheme = "range";
+
+    // number of LR gradients merged before applying them (0 or 1: disabled)
+    uint64_t grad_coalesce_window = 0;
+    // max time (ms) a gradient waits in the coalescing window
+    uint64_t grad_coalesce_max_delay_ms = 10;
+
+    // push gradients and pull the next model in one round trip
+    bool worker_push_pull = false;
+
+    // encoding of the gradient values sent by workers: none, fp16, bf16, int8
+    std::string grad_quantization = "none";
+
+    // entries of each LR gradient sent by workers (0: all)
+    uint64_t grad_top_k = 0;
+    // percentage of the entries of each LR gradient sent (0: all)
+    double grad_top_k_percent = 0;
+
+    // local file where the parameter server dumps its metrics
+    std::string metrics_path = "";
+
+    // memory cap of the values of the key-value store (MB)
+    uint64_t kv_store_max_mb = 1024;
+
+    // gradients a pulled model may miss when pipelining (0: disabled)
+    uint64_t worker_pipeline_depth = 0;
+
+    // LR gradients queued or being sent in the background (0: disabled)
+    uint64_t grad_max_in_flight = 0;
+
+    // most minibatches a worker may be ahead of the slowest one (-1: off)
+    int64_t ssp_staleness = -1;
+
+    // one connection per parameter server for all threads of a worker
+    bool worker_multiplex = false;
+
+    // shared memory rings of local workers (KB, 0: sockets only)
+    uint64_t shm_ring_size_kb = 1024;
+
+    // factors of each user and item of MF models
+    uint64_t num_factors = NUM_FACTORS;
 };
 
 }  // namespace cirrus
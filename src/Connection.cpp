@@ -0,0 +1,276 @@
+#include "Connection.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "config.h"
+#include "Constants.h"
+#include "Utils.h"
+
+namespace cirrus {
+
+#define MIN_READ_SIZE (64 * 1024)
+#define MAX_IDLE_BUFFER_SIZE (1024 * 1024)  //< bigger reply queues are freed
+
+Connection::Connection(int sock, BufferPool* pool)
+    : sock_(sock), pool_(pool) {}
+
+/**
+  * Requests are an operation id (uint32_t) followed by either
+  * nothing, arguments of a fixed size, or the size of the rest of the
+  * message (uint32_t) and the rest of the message. SET_VALUE sends the key
+  * before the size of the value
+  */
+bool Connection::frame_size(const char* data,
+                            uint64_t available,
+                            uint64_t* size) {
+  *size = 0;
+  if (available < sizeof(uint32_t)) {
+    return true;
+  }
+  uint32_t operation;
+  std::memcpy(&operation, data, sizeof(uint32_t));
+
+  uint64_t args_size = 0;    //< fixed size arguments
+  bool has_size = false;     //< size of the rest follows the fixed arguments
+  switch (operation) {
+    case GET_LR_FULL_MODEL:
+    case GET_MF_FULL_MODEL:
+    case GET_NUM_CONNS:
+    case GET_NUM_UPDATES:
+    case KILL_SIGNAL:
+    case GET_METRICS:
+    case ENABLE_REQUEST_IDS:
+      break;
+    case GET_TASK_STATUS:
+    case DEREGISTER_TASK:
+    case NEGOTIATE_WIRE_FORMAT:
+      args_size = sizeof(uint32_t);
+      break;
+    case SET_TASK_STATUS:
+    case REGISTER_TASK:
+      args_size = sizeof(uint32_t) * 2;
+      break;
+    case GET_LR_MODEL_DELTA:
+      args_size = sizeof(uint64_t);
+      break;
+    case ADVANCE_CLOCK:
+      args_size = sizeof(uint32_t) + sizeof(uint64_t);
+      break;
+    case GET_VALUE:
+      args_size = KEY_SIZE;
+      break;
+    case SET_VALUE:
+      args_size = KEY_SIZE;
+      has_size = true;
+      break;
+    case SEND_LR_GRADIENT:
+    case SEND_MF_GRADIENT:
+    case GET_LR_SPARSE_MODEL:
+    case GET_MF_SPARSE_MODEL:
+    case SEND_LR_GRADIENT_GET_SPARSE_MODEL:
+    case MULTI_GET_VALUE:
+    case MULTI_SET_VALUE:
+    case ATTACH_SHM:
+      has_size = true;
+      break;
+    default:
+      return false;
+  }
+
+  uint64_t header_size = sizeof(uint32_t) + args_size;
+  if (!has_size) {
+    *size = header_size;
+    return true;
+  }
+  if (available < header_size + sizeof(uint32_t)) {
+    return true;
+  }
+  uint32_t rest_size;
+  std::memcpy(&rest_size, data + header_size, sizeof(uint32_t));
+  *size = header_size + sizeof(uint32_t) + rest_size;
+  return *size <= MAX_REQUEST_SIZE;
+}
+
+void Connection::frame() {
+  // with request ids, the id comes before the operation
+  uint64_t id_size = request_ids_ ? sizeof(uint32_t) : 0;
+  uint64_t available = in_end_ - in_begin_;
+  uint64_t size = 0;
+  if (available >= id_size &&
+      !frame_size(in_.data() + in_begin_ + id_size, available - id_size,
+                  &size)) {
+    failed_ = true;
+    return;
+  }
+  if (size != 0) {
+    size += id_size;
+  }
+  request_size_ = (size != 0 && available >= size) ? size : 0;
+  frame_size_ = size;
+  request_offset_ = id_size;
+  if (request_size_ != 0 && request_ids_) {
+    std::memcpy(&request_id_, in_.data() + in_begin_, sizeof(uint32_t));
+  }
+}
+
+void Connection::reserve_input() {
+  uint64_t buffered = in_end_ - in_begin_;
+  uint64_t needed = std::max<uint64_t>(frame_size_, buffered + MIN_READ_SIZE);
+  if (in_.size() - in_begin_ >= needed) {
+    return;
+  }
+  if (in_.size() < needed) {
+    BufferPool::Buffer bigger = pool_->get(needed);
+    if (buffered != 0) {
+      std::memcpy(bigger.data(), in_.data() + in_begin_, buffered);
+    }
+    in_ = std::move(bigger);
+  } else {
+    std::memmove(in_.data(), in_.data() + in_begin_, buffered);
+  }
+  in_begin_ = 0;
+  in_end_ = buffered;
+}
+
+bool Connection::read_available() {
+  uint64_t read_ns = thread_io_counters().read_ns;
+  bool open = true;
+  while (!has_request() && !failed_) {
+    reserve_input();
+    ssize_t ret = read_some(sock_, in_.data() + in_end_, in_.size() - in_end_);
+    if (ret <= 0) {
+      open = (ret == 0);
+      break;
+    }
+    in_end_ += ret;
+    frame();
+  }
+  request_read_ns_ += thread_io_counters().read_ns - read_ns;
+  return open && !failed_;
+}
+
+bool Connection::receive(const char* data, uint64_t size) {
+  // the bytes were already taken from the socket: all of them are kept,
+  // requests after the first one included
+  while (size > 0 && !failed_) {
+    reserve_input();
+    uint64_t n = std::min<uint64_t>(size, in_.size() - in_end_);
+    std::memcpy(in_.data() + in_end_, data, n);
+    in_end_ += n;
+    data += n;
+    size -= n;
+    if (!has_request()) {
+      frame();
+    }
+  }
+  return !failed_;
+}
+
+void Connection::pop_request() {
+  in_begin_ += request_size_;
+  request_size_ = 0;
+  request_read_ns_ = 0;
+  frame_size_ = 0;
+  if (in_begin_ == in_end_) {
+    in_begin_ = in_end_ = 0;
+    in_.release();
+    return;
+  }
+  // requests sent back to back can already be here
+  frame();
+}
+
+void Connection::enable_request_ids() {
+  request_ids_ = true;
+}
+
+void Connection::reply(const void* data, uint64_t size) {
+  if (request_ids_) {
+    // sent by end_request once the whole reply is known
+    const char* ptr = static_cast<const char*>(data);
+    tagged_reply_.insert(tagged_reply_.end(), ptr, ptr + size);
+    return;
+  }
+  write(data, size);
+}
+
+/**
+  * FORMAT of the reply to a request with an id
+  * request id (uint32_t)
+  * size of the reply (uint32_t)
+  * reply
+  * Requests without a reply get nothing
+  */
+void Connection::end_request() {
+  if (!request_ids_ || tagged_reply_.empty()) {
+    return;
+  }
+  if (tagged_reply_.size() > UINT32_MAX) {
+    failed_ = true;
+  } else {
+    uint32_t header[2] = {request_id_,
+                          static_cast<uint32_t>(tagged_reply_.size())};
+    write(header, sizeof(header));
+    write(tagged_reply_.data(), tagged_reply_.size());
+  }
+  if (tagged_reply_.capacity() > MAX_IDLE_BUFFER_SIZE) {
+    std::vector<char>().swap(tagged_reply_);
+  } else {
+    tagged_reply_.clear();
+  }
+}
+
+void Connection::write(const void* data, uint64_t size) {
+  if (failed_) {
+    return;
+  }
+  const char* ptr = static_cast<const char*>(data);
+  if (!has_pending_replies() && !defer_writes_) {
+    ssize_t sent = send_some(sock_, ptr, size);
+    if (sent < 0) {
+      failed_ = true;
+      return;
+    }
+    ptr += sent;
+    size -= sent;
+  }
+  out_.insert(out_.end(), ptr, ptr + size);
+}
+
+void Connection::take_replies(std::vector<char>* replies) {
+  if (replies->capacity() > MAX_IDLE_BUFFER_SIZE) {
+    std::vector<char>().swap(*replies);
+  } else {
+    replies->clear();
+  }
+  out_.swap(*replies);
+  if (out_begin_ != 0) {
+    replies->erase(replies->begin(), replies->begin() + out_begin_);
+    out_begin_ = 0;
+  }
+}
+
+bool Connection::flush() {
+  while (has_pending_replies()) {
+    ssize_t sent =
+        send_some(sock_, out_.data() + out_begin_, out_.size() - out_begin_);
+    if (sent < 0) {
+      failed_ = true;
+      return false;
+    }
+    if (sent == 0) {
+      return true;
+    }
+    out_begin_ += sent;
+  }
+  out_begin_ = 0;
+  if (out_.capacity() > MAX_IDLE_BUFFER_SIZE) {
+    std::vector<char>().swap(out_);
+  } else {
+    out_.clear();
+  }
+  return true;
+}
+
+}  // namespace cirrus
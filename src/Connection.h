@@ -0,0 +1,158 @@
+#ifndef _CONNECTION_H_
+#define _CONNECTION_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "BufferPool.h"
+#include "WireFormat.h"
+
+namespace cirrus {
+
+/**
+  * Parameter server side of a client connection.
+  * Requests are read without blocking and buffered until they are complete,
+  * and replies are queued and written without blocking. A client that stalls
+  * in the middle of a message never holds a worker thread.
+  *
+  * A connection is used by one thread at a time: the thread that polls its
+  * socket or the worker thread the poller handed it to.
+  * Requests are read into buffers of a pool, sized to the request, which go
+  * back to the pool once all requests read were served.
+  */
+class Connection {
+ public:
+  static constexpr uint64_t MAX_REQUEST_SIZE = 120 * 1024 * 1024;
+
+  /**
+    * @param pool Pool of the buffers requests are read into. Has to outlive
+    *        the connection
+    */
+  Connection(int sock, BufferPool* pool);
+
+  int sock() const { return sock_; }
+
+  /**
+    * Read what the socket has, until a request is complete or the read
+    * would block
+    * @return false if the peer closed the connection or sent a request
+    *         that can't be framed. Complete requests can still be served
+    */
+  bool read_available();
+
+  /**
+    * Add bytes the owner read from the socket (io_uring mode)
+    * @return false if a request can't be framed. Complete requests can
+    *         still be served
+    */
+  bool receive(const char* data, uint64_t size);
+
+  /**
+    * Whether a whole request is buffered
+    */
+  bool has_request() const { return request_size_ != 0; }
+
+  /**
+    * The first buffered request: operation id followed by its arguments
+    */
+  const char* request() const {
+    return in_.data() + in_begin_ + request_offset_;
+  }
+  uint64_t request_size() const { return request_size_ - request_offset_; }
+  uint64_t request_read_ns() const { return request_read_ns_; }
+
+  /**
+    * Drop the first request (see request()) after serving it
+    */
+  void pop_request();
+
+  /**
+    * From the next request on, requests start with an id and the replies
+    * to each request are sent as one message tagged with it (see
+    * end_request), so a client can share the connection between threads
+    */
+  void enable_request_ids();
+
+  /**
+    * Queue a reply. It is written right away if nothing is queued before
+    * it, only what the socket does not take is copied. With request ids,
+    * replies are held until the request is done
+    */
+  void reply(const void* data, uint64_t size);
+
+  /**
+    * The first request was served: send its reply, tagged with its id,
+    * when request ids are enabled
+    */
+  void end_request();
+
+  /**
+    * Write queued replies without blocking
+    * @return false on socket error
+    */
+  bool flush();
+
+  bool has_pending_replies() const { return out_begin_ < out_.size(); }
+
+  /**
+    * Replies are only queued, the owner writes them (io_uring mode, see
+    * take_replies)
+    */
+  void defer_writes() { defer_writes_ = true; }
+  bool writes_deferred() const { return defer_writes_; }
+
+  /**
+    * Hand the queued replies over to the owner to write them. The cleared
+    * buffer given in exchange queues the next replies, so the replies
+    * handed over stay in place while they are written
+    */
+  void take_replies(std::vector<char>* replies);
+
+  /**
+    * The connection can't be served anymore, its owner closes it
+    */
+  void set_failed() { failed_ = true; }
+  bool failed() const { return failed_; }
+
+  uint32_t wire_format = WIRE_FORMAT_RAW;  //< negotiated by the client
+  uint32_t events = 0;  //< events its owner waits for (epoll mode)
+
+  /**
+    * Size of the request at the front of data (operation id included)
+    * @return false if the request is malformed. Sets size to 0 if more
+    *         bytes are needed to know it
+    */
+  static bool frame_size(const char* data, uint64_t available, uint64_t* size);
+
+ private:
+  // frame the request at in_begin_, fails the connection if malformed
+  void frame();
+  // write now what the socket takes, queue the rest
+  void write(const void* data, uint64_t size);
+  // make room in in_ for the first request, or for a read until its size
+  // is known
+  void reserve_input();
+
+  int sock_;
+  BufferPool* pool_;
+  bool failed_ = false;
+  bool defer_writes_ = false;      //< see defer_writes
+
+  BufferPool::Buffer in_;          //< requests read so far
+  uint64_t in_begin_ = 0;          //< first unserved byte of in_
+  uint64_t in_end_ = 0;            //< end of the bytes read
+  uint64_t frame_size_ = 0;        //< size of the first request if known
+  uint64_t request_size_ = 0;      //< size of the first request if complete
+  uint64_t request_read_ns_ = 0;   //< time reading the first request
+  bool request_ids_ = false;       //< see enable_request_ids
+  uint32_t request_id_ = 0;        //< id of the first request
+  uint64_t request_offset_ = 0;    //< size of the id before the request
+  std::vector<char> tagged_reply_;  //< reply of the first request so far
+
+  std::vector<char> out_;          //< replies not written yet
+  uint64_t out_begin_ = 0;         //< first unwritten byte of out_
+};
+
+}  // namespace cirrus
+
+#endif  // _CONNECTION_H_
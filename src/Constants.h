@@ -17,7 +17,17 @@ enum PS_OP {
   KILL_SIGNAL,
   GET_VALUE,
   SET_VALUE,
-  DEREGISTER_TASK
+  DEREGISTER_TASK,
+  GET_LR_MODEL_DELTA,
+  SEND_LR_GRADIENT_GET_SPARSE_MODEL,
+  NEGOTIATE_WIRE_FORMAT,
+  GET_METRICS,
+  MULTI_GET_VALUE,
+  MULTI_SET_VALUE,
+  ADVANCE_CLOCK,
+  ENABLE_REQUEST_IDS,
+  ATTACH_SHM,
+  NUM_PS_OPS  // number of operations, keep last
 };
 
 #define MAGIC_NUMBER (0x1337)
@@ -37,13 +37,15 @@ ErrorSparseTask::ErrorSparseTask(uint64_t model_size,
   std::atomic_init(&curr_error, 0.0);
 }
 
-std::unique_ptr<CirrusModel> get_model(const Configuration& config,
+// LR models are kept across calls and patched with the weights that changed
+CirrusModel* get_model(const Configuration& config,
         const std::string& ps_ip, uint64_t ps_port) {
   static PSSparseServerInterface* psi;
+  static std::unique_ptr<CirrusModel> model;
   static bool first_time = true;
   if (first_time) {
     first_time = false;
-    psi = new PSSparseServerInterface(ps_ip, ps_port);
+    psi = new PSSparseServerInterface(ps_ip, ps_port, config);
 
     while (true) {
       try {
@@ -55,9 +57,15 @@ std::unique_ptr<CirrusModel> get_model(const Configuration& config,
     }
   }
 
-  bool use_col_filtering =
-    config.get_model_type() == Configuration::COLLABORATIVE_FILTERING;
-  return psi->get_full_model(use_col_filtering);
+  if (config.get_model_type() == Configuration::COLLABORATIVE_FILTERING) {
+    model = psi->get_full_model(true);
+  } else {
+    if (!model) {
+      model = std::make_unique<SparseLRModel>(0);
+    }
+    psi->get_lr_model_delta(dynamic_cast<SparseLRModel*>(model.get()));
+  }
+  return model.get();
 }
 
 void ErrorSparseTask::error_response() {
@@ -179,7 +187,7 @@ void ErrorSparseTask::run(const Configuration& config,
       std::cout << "[ERROR_TASK] getting the full model"
         << "\n";
 #endif
-      std::unique_ptr<CirrusModel> model = get_model(config, ps_ip, ps_port);
+      CirrusModel* model = get_model(config, ps_ip, ps_port);
 
 #ifdef DEBUG
       std::cout << "[ERROR_TASK] received the model" << std::endl;
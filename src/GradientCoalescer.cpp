@@ -0,0 +1,143 @@
+#include "GradientCoalescer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "Utils.h"
+
+namespace cirrus {
+
+static const uint32_t EMPTY_SLOT = UINT32_MAX;
+static const uint64_t INITIAL_SLOTS = 1024;
+
+static inline uint64_t slot_of(uint32_t index, uint64_t mask) {
+  // multiplicative hashing spreads consecutive indices
+  return (index * 2654435761U) & mask;
+}
+
+/**
+  * LSD radix sort of gradient entries by index, one byte per pass
+  * Much cheaper than a comparison sort for the thousands of entries of a
+  * merged gradient
+  */
+static void sort_by_index(std::vector<std::pair<int, FEATURE_TYPE>>* entries,
+                          std::vector<std::pair<int, FEATURE_TYPE>>* tmp) {
+  uint32_t max_index = 0;
+  for (const auto& e : *entries) {
+    max_index = std::max(max_index, static_cast<uint32_t>(e.first));
+  }
+  tmp->resize(entries->size());
+  for (uint32_t shift = 0; shift < 32 && (max_index >> shift) > 0;
+       shift += 8) {
+    uint32_t offsets[257] = {0};
+    for (const auto& e : *entries) {
+      offsets[((e.first >> shift) & 0xff) + 1]++;
+    }
+    for (int i = 1; i < 257; ++i) {
+      offsets[i] += offsets[i - 1];
+    }
+    for (const auto& e : *entries) {
+      (*tmp)[offsets[(e.first >> shift) & 0xff]++] = e;
+    }
+    entries->swap(*tmp);
+  }
+}
+
+GradientCoalescer::Window::Window()
+    : keys(INITIAL_SLOTS, EMPTY_SLOT), values(INITIAL_SLOTS, 0) {}
+
+void GradientCoalescer::Window::add(uint32_t index, FEATURE_TYPE value) {
+  uint64_t mask = keys.size() - 1;
+  uint64_t slot = slot_of(index, mask);
+  while (keys[slot] != EMPTY_SLOT && keys[slot] != index) {
+    slot = (slot + 1) & mask;
+  }
+  if (keys[slot] == EMPTY_SLOT) {
+    keys[slot] = index;
+    used.push_back(slot);
+  }
+  values[slot] += value;
+
+  // keep the table at most half full
+  if (used.size() * 2 > keys.size()) {
+    grow();
+  }
+}
+
+void GradientCoalescer::Window::grow() {
+  std::vector<uint32_t> old_keys(keys.size() * 2, EMPTY_SLOT);
+  std::vector<FEATURE_TYPE> old_values(values.size() * 2, 0);
+  old_keys.swap(keys);
+  old_values.swap(values);
+
+  uint64_t mask = keys.size() - 1;
+  for (auto& slot : used) {
+    uint32_t index = old_keys[slot];
+    uint64_t new_slot = slot_of(index, mask);
+    while (keys[new_slot] != EMPTY_SLOT) {
+      new_slot = (new_slot + 1) & mask;
+    }
+    keys[new_slot] = index;
+    values[new_slot] = old_values[slot];
+    slot = new_slot;
+  }
+}
+
+GradientCoalescer::GradientCoalescer(uint32_t num_windows,
+                                     uint64_t window_size,
+                                     uint64_t max_delay_us)
+    : num_windows_(num_windows),
+      window_size_(window_size),
+      max_delay_us_(max_delay_us),
+      windows_(new Window[num_windows]) {
+  std::atomic_init(&num_flushes_, 0UL);
+}
+
+bool GradientCoalescer::add(uint32_t window_id,
+                            const LRSparseGradient& gradient) {
+  Window& window = windows_[window_id];
+  std::lock_guard<std::mutex> guard(window.lock);
+  if (window.num_pending == 0) {
+    window.start_us = get_time_us();
+  }
+  for (const auto& w : gradient.weights) {
+    if (w.first < 0) {
+      throw std::runtime_error("Wrong gradient index");
+    }
+    window.add(w.first, w.second);
+  }
+  return ++window.num_pending >= window_size_;
+}
+
+bool GradientCoalescer::take(uint32_t window_id, LRSparseGradient* merged) {
+  Window& window = windows_[window_id];
+  std::lock_guard<std::mutex> guard(window.lock);
+  if (window.num_pending == 0) {
+    return false;
+  }
+
+  merged->weights.clear();
+  merged->weights.reserve(window.used.size());
+  for (const auto& slot : window.used) {
+    merged->weights.push_back(
+        std::make_pair(window.keys[slot], window.values[slot]));
+    window.keys[slot] = EMPTY_SLOT;
+    window.values[slot] = 0;
+  }
+  // applying the merged gradient in index order walks the model sequentially
+  sort_by_index(&merged->weights, &window.sort_buffer);
+
+  window.used.clear();
+  window.num_pending = 0;
+  num_flushes_++;
+  return true;
+}
+
+bool GradientCoalescer::is_stale(uint32_t window_id) const {
+  const Window& window = windows_[window_id];
+  std::lock_guard<std::mutex> guard(window.lock);
+  return window.num_pending > 0 &&
+         get_time_us() - window.start_us >= max_delay_us_;
+}
+
+}  // namespace cirrus
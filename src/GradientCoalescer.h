@@ -0,0 +1,90 @@
+#ifndef _GRADIENT_COALESCER_H_
+#define _GRADIENT_COALESCER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ModelGradient.h"
+
+namespace cirrus {
+
+/**
+  * Merges the LR gradients that arrive within a window into one gradient
+  * sorted by index. The parameter server applies the merged gradient in a
+  * single pass instead of one update per gradient, which saves lock
+  * acquisitions and model accesses when gradients share hot indices.
+  *
+  * Each worker thread merges into its own window so merging runs in
+  * parallel. A window is flushed when it holds window_size gradients or
+  * when its oldest gradient is older than max_delay_us.
+  */
+class GradientCoalescer {
+ public:
+  /**
+    * @param num_windows Number of windows (one per worker thread)
+    * @param window_size Max number of gradients merged together
+    * @param max_delay_us Max time a gradient can wait before being applied
+    */
+  GradientCoalescer(uint32_t num_windows,
+                    uint64_t window_size,
+                    uint64_t max_delay_us);
+
+  /**
+    * Merge a gradient into a window
+    * @return true if the window is full and should be flushed
+    */
+  bool add(uint32_t window_id, const LRSparseGradient& gradient);
+
+  /**
+    * Move the content of a window into merged and start a new window
+    * @return false if there was nothing to flush
+    */
+  bool take(uint32_t window_id, LRSparseGradient* merged);
+
+  /**
+    * Whether the oldest gradient of a window exceeded max_delay_us
+    */
+  bool is_stale(uint32_t window_id) const;
+
+  uint32_t get_num_windows() const { return num_windows_; }
+  uint64_t get_max_delay_us() const { return max_delay_us_; }
+
+  /**
+    * Number of merged gradients handed out so far
+    */
+  uint64_t get_num_flushes() const { return num_flushes_; }
+
+ private:
+  /**
+    * Sums of the gradients in a window kept in an open addressing table
+    * indexed by weight index. The table only grows with the number of
+    * distinct indices in the window, not with the model size
+    */
+  struct Window {
+    Window();
+
+    void add(uint32_t index, FEATURE_TYPE value);
+    void grow();
+
+    mutable std::mutex lock;
+    std::vector<uint32_t> keys;        //< weight index of each slot
+    std::vector<FEATURE_TYPE> values;  //< accumulated value of each slot
+    std::vector<uint32_t> used;        //< slots in use
+    std::vector<std::pair<int, FEATURE_TYPE>> sort_buffer;
+    uint64_t num_pending = 0;          //< gradients merged in this window
+    uint64_t start_us = 0;             //< arrival time of first gradient
+  };
+
+  uint32_t num_windows_;
+  uint64_t window_size_;
+  uint64_t max_delay_us_;
+  std::unique_ptr<Window[]> windows_;
+  std::atomic<uint64_t> num_flushes_;
+};
+
+}  // namespace cirrus
+
+#endif  // _GRADIENT_COALESCER_H_
@@ -0,0 +1,81 @@
+#include "GradientCompressor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace cirrus {
+
+GradientCompressor::GradientCompressor(uint64_t model_size,
+                                       uint64_t top_k,
+                                       double top_percent)
+    : top_k_(top_k),
+      top_percent_(top_percent),
+      residual_(model_size, 0),
+      is_pending_(model_size, false) {
+  if (top_k == 0 && (top_percent <= 0 || top_percent > 100)) {
+    throw std::runtime_error("Wrong top-k compression parameters");
+  }
+}
+
+uint64_t GradientCompressor::num_to_send(uint64_t gradient_size) const {
+  if (top_k_ > 0) {
+    return top_k_;
+  }
+  return std::max<uint64_t>(1, std::ceil(gradient_size * top_percent_ / 100));
+}
+
+LRSparseGradient GradientCompressor::compress(
+    const LRSparseGradient& gradient) {
+  for (const auto& w : gradient.weights) {
+    uint32_t index = w.first;
+    if (index >= residual_.size()) {
+      throw std::runtime_error("Gradient index out of bounds");
+    }
+    if (!is_pending_[index]) {
+      is_pending_[index] = true;
+      pending_.push_back(index);
+    }
+    residual_[index] += w.second;
+  }
+
+  auto larger = [this](uint32_t a, uint32_t b) {
+    return std::abs(residual_[a]) > std::abs(residual_[b]);
+  };
+  uint64_t to_send = num_to_send(gradient.weights.size());
+
+  // drop the smallest residuals past the limit
+  uint64_t limit = to_send * RESIDUAL_LIMIT;
+  if (pending_.size() > limit) {
+    std::nth_element(pending_.begin(), pending_.begin() + limit,
+                     pending_.end(), larger);
+    for (uint64_t i = limit; i < pending_.size(); ++i) {
+      residual_[pending_[i]] = 0;
+      is_pending_[pending_[i]] = false;
+    }
+    pending_.resize(limit);
+  }
+
+  // move the k largest residuals to the front in linear time
+  uint64_t k = std::min<uint64_t>(to_send, pending_.size());
+  if (k < pending_.size()) {
+    std::nth_element(pending_.begin(), pending_.begin() + k, pending_.end(),
+                     larger);
+  }
+
+  std::vector<std::pair<int, FEATURE_TYPE>> sent;
+  sent.reserve(k);
+  for (uint64_t i = 0; i < k; ++i) {
+    uint32_t index = pending_[i];
+    sent.push_back(std::make_pair(index, residual_[index]));
+    residual_[index] = 0;
+    is_pending_[index] = false;
+  }
+  pending_.erase(pending_.begin(), pending_.begin() + k);
+
+  LRSparseGradient result(std::move(sent));
+  result.setVersion(gradient.getVersion());
+  return result;
+}
+
+}  // namespace cirrus
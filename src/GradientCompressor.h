@@ -0,0 +1,60 @@
+#ifndef _GRADIENT_COMPRESSOR_H_
+#define _GRADIENT_COMPRESSOR_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "ModelGradient.h"
+
+namespace cirrus {
+
+/**
+  * Worker side top-k sparsification of LR gradients with error feedback.
+  * Only the entries with the largest magnitude are sent to the parameter
+  * server. The rest is kept in a residual that is added to the next
+  * gradients, so small values are delayed instead of lost.
+  *
+  * The residual keeps at most RESIDUAL_LIMIT times as many entries as are
+  * sent and drops the smallest ones beyond that, so the work per gradient
+  * does not grow with the number of weights ever touched.
+  */
+class GradientCompressor {
+ public:
+  static const uint64_t RESIDUAL_LIMIT = 16;  //< entries kept per entry sent
+
+  /**
+    * @param model_size Number of weights of the model
+    * @param top_k Number of entries sent per gradient (0: use top_percent)
+    * @param top_percent Percentage of the entries of each gradient sent
+    */
+  GradientCompressor(uint64_t model_size,
+                     uint64_t top_k,
+                     double top_percent);
+
+  /**
+    * Add gradient to the residual and take the largest entries out of it
+    * @return Gradient to send, with the version of gradient
+    */
+  LRSparseGradient compress(const LRSparseGradient& gradient);
+
+  /**
+    * Number of weights with a value in the residual
+    */
+  uint64_t get_residual_size() const { return pending_.size(); }
+
+ private:
+  /**
+    * Number of entries sent for a gradient with gradient_size entries
+    */
+  uint64_t num_to_send(uint64_t gradient_size) const;
+
+  uint64_t top_k_;
+  double top_percent_;
+  std::vector<FEATURE_TYPE> residual_;  //< unsent value of every weight
+  std::vector<bool> is_pending_;        //< whether a weight is in pending_
+  std::vector<uint32_t> pending_;       //< weights with a residual
+};
+
+}  // namespace cirrus
+
+#endif  // _GRADIENT_COMPRESSOR_H_
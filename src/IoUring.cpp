@@ -0,0 +1,320 @@
+#include "IoUring.h"
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+namespace cirrus {
+
+// multishot receives came last (Linux 6.0)
+#ifdef IORING_RECV_MULTISHOT
+
+#define BUFFER_GROUP (0)
+#define CQ_ENTRIES_PER_SQ_ENTRY (8)
+
+static int sys_io_uring_setup(uint32_t entries, struct io_uring_params* p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd,
+                              uint32_t to_submit,
+                              uint32_t min_complete,
+                              uint32_t flags,
+                              void* arg,
+                              size_t arg_size) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg,
+                 arg_size);
+}
+
+static int sys_io_uring_register(int fd,
+                                 uint32_t opcode,
+                                 void* arg,
+                                 uint32_t nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void* map_ring(int fd, uint64_t size, uint64_t offset) {
+  void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, offset);
+  if (mem == MAP_FAILED) {
+    throw std::runtime_error("Error mapping io_uring queues");
+  }
+  return mem;
+}
+
+bool IoUring::supported() {
+  try {
+    IoUring ring(2);
+    ring.provide_buffers(1, 4096);
+    return true;
+  } catch (const std::runtime_error&) {
+    return false;
+  }
+}
+
+IoUring::IoUring(uint32_t entries) {
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = entries * CQ_ENTRIES_PER_SQ_ENTRY;
+  fd_ = sys_io_uring_setup(entries, &params);
+  if (fd_ < 0) {
+    throw std::runtime_error("Error setting up io_uring. errno: " +
+                             std::to_string(errno));
+  }
+  // waits with a timeout need IORING_ENTER_EXT_ARG
+  if (!(params.features & IORING_FEAT_EXT_ARG) ||
+      !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    close(fd_);
+    throw std::runtime_error("io_uring of this kernel is too old");
+  }
+
+  try {
+    // both queues are in one mapping
+    rings_size_ = std::max<uint64_t>(
+        params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+    rings_ = map_ring(fd_, rings_size_, IORING_OFF_SQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = static_cast<struct io_uring_sqe*>(
+        map_ring(fd_, sqes_size_, IORING_OFF_SQES));
+  } catch (const std::runtime_error&) {
+    if (rings_) {
+      munmap(rings_, rings_size_);
+    }
+    close(fd_);
+    throw;
+  }
+
+  char* rings = static_cast<char*>(rings_);
+  sq_head_ = reinterpret_cast<uint32_t*>(rings + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<uint32_t*>(rings + params.sq_off.tail);
+  sq_array_ = reinterpret_cast<uint32_t*>(rings + params.sq_off.array);
+  sq_mask_ = *reinterpret_cast<uint32_t*>(rings + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  sqe_tail_ = *sq_tail_;
+
+  cq_head_ = reinterpret_cast<uint32_t*>(rings + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<uint32_t*>(rings + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<uint32_t*>(rings + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(rings + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+  // closing the instance cancels what is in flight
+  close(fd_);
+  munmap(sqes_, sqes_size_);
+  munmap(rings_, rings_size_);
+  if (buf_ring_) {
+    munmap(buf_ring_, buf_ring_size_);
+  }
+}
+
+void IoUring::provide_buffers(uint32_t num_buffers, uint32_t buffer_size) {
+  if (buf_ring_ || num_buffers == 0 ||
+      (num_buffers & (num_buffers - 1)) != 0 || num_buffers > 32768) {
+    throw std::runtime_error("Wrong io_uring buffers");
+  }
+  // the ring of buffer descriptors has to be page aligned
+  buf_ring_size_ = num_buffers * sizeof(struct io_uring_buf);
+  void* mem = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    throw std::runtime_error("Error allocating io_uring buffer ring");
+  }
+  buf_ring_ = static_cast<struct io_uring_buf*>(mem);
+
+  struct io_uring_buf_reg reg;
+  std::memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+  reg.ring_entries = num_buffers;
+  reg.bgid = BUFFER_GROUP;
+  if (sys_io_uring_register(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    munmap(buf_ring_, buf_ring_size_);
+    buf_ring_ = nullptr;
+    throw std::runtime_error("Error registering io_uring buffers. errno: " +
+                             std::to_string(errno));
+  }
+
+  num_buffers_ = num_buffers;
+  buffer_size_ = buffer_size;
+  buffers_.reset(new char[static_cast<uint64_t>(num_buffers) * buffer_size]);
+  for (uint32_t i = 0; i < num_buffers; ++i) {
+    recycle_buffer(i);
+  }
+}
+
+const char* IoUring::buffer(int32_t id) const {
+  return buffers_.get() + static_cast<uint64_t>(id) * buffer_size_;
+}
+
+/**
+  * The ring is used as an array of struct io_uring_buf, with the tail in
+  * the resv field of the first one: in C++ the bufs member of struct
+  * io_uring_buf_ring does not start at its beginning
+  */
+void IoUring::recycle_buffer(int32_t id) {
+  struct io_uring_buf* buf = &buf_ring_[buf_tail_ & (num_buffers_ - 1)];
+  buf->addr = reinterpret_cast<uint64_t>(buffer(id));
+  buf->len = buffer_size_;
+  buf->bid = id;
+  ++buf_tail_;
+  // the kernel sees the buffer once the tail moves past it
+  __atomic_store_n(&buf_ring_[0].resv, buf_tail_, __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe* IoUring::get_sqe() {
+  // an entry can only be reused once the kernel took it
+  while (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) ==
+         sq_entries_) {
+    if (enter(0, 0) != EBUSY) {
+      continue;
+    }
+    // the completion queue is full: keep its entries for the next
+    // submit_and_wait to make room
+    if (*cq_head_ == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      throw std::runtime_error("io_uring submission queue is stuck");
+    }
+    reap(&reaped_);
+  }
+  uint32_t index = sqe_tail_ & sq_mask_;
+  struct io_uring_sqe* sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  ++sqe_tail_;
+  ++to_submit_;
+  return sqe;
+}
+
+void IoUring::accept_multishot(int sock, uint64_t user_data) {
+  struct io_uring_sqe* sqe = get_sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = sock;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = user_data;
+}
+
+void IoUring::recv_multishot(int sock, uint64_t user_data) {
+  struct io_uring_sqe* sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = sock;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->user_data = user_data;
+}
+
+void IoUring::send(int sock,
+                   const void* data,
+                   uint32_t size,
+                   uint64_t user_data) {
+  struct io_uring_sqe* sqe = get_sqe();
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = sock;
+  sqe->addr = reinterpret_cast<uint64_t>(data);
+  sqe->len = size;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = user_data;
+}
+
+int IoUring::enter(uint32_t min_complete, uint32_t timeout_ms) {
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+  uint32_t flags = 0;
+  struct __kernel_timespec timeout;
+  struct io_uring_getevents_arg arg;
+  if (min_complete > 0) {
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    std::memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = reinterpret_cast<uint64_t>(&timeout);
+    flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+  }
+  int ret = sys_io_uring_enter(fd_, to_submit_, min_complete, flags,
+                               min_complete > 0 ? &arg : nullptr,
+                               min_complete > 0 ? sizeof(arg) : 0);
+  if (ret >= 0) {
+    to_submit_ -= std::min<uint32_t>(ret, to_submit_);
+    return 0;
+  }
+  // EBUSY: completions have to be consumed before submitting more
+  if (errno != ETIME && errno != EINTR && errno != EBUSY &&
+      errno != EAGAIN) {
+    throw std::runtime_error("Error calling io_uring_enter. errno: " +
+                             std::to_string(errno));
+  }
+  return errno;
+}
+
+void IoUring::submit_and_wait(uint32_t timeout_ms,
+                              std::vector<Completion>* completions) {
+  completions->clear();
+  completions->swap(reaped_);
+  bool ready = !completions->empty() ||
+               *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  if (!ready || to_submit_ > 0) {
+    enter(ready ? 0 : 1, timeout_ms);
+  }
+  reap(completions);
+}
+
+void IoUring::reap(std::vector<Completion>* completions) {
+  uint32_t head = *cq_head_;
+  uint32_t tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const struct io_uring_cqe& cqe = cqes_[head & cq_mask_];
+    Completion completion;
+    completion.user_data = cqe.user_data;
+    completion.result = cqe.res;
+    completion.more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+    completion.buffer = (cqe.flags & IORING_CQE_F_BUFFER)
+                            ? static_cast<int32_t>(
+                                  cqe.flags >> IORING_CQE_BUFFER_SHIFT)
+                            : -1;
+    completions->push_back(completion);
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+#else  // IORING_RECV_MULTISHOT
+
+bool IoUring::supported() {
+  return false;
+}
+
+IoUring::IoUring(uint32_t) {
+  throw std::runtime_error("io_uring is not supported by this build");
+}
+
+IoUring::~IoUring() {}
+
+void IoUring::provide_buffers(uint32_t, uint32_t) {}
+
+const char* IoUring::buffer(int32_t) const {
+  return nullptr;
+}
+
+void IoUring::recycle_buffer(int32_t) {}
+
+void IoUring::accept_multishot(int, uint64_t) {}
+
+void IoUring::recv_multishot(int, uint64_t) {}
+
+void IoUring::send(int, const void*, uint32_t, uint64_t) {}
+
+void IoUring::submit_and_wait(uint32_t, std::vector<Completion>*) {}
+
+#endif  // IORING_RECV_MULTISHOT
+
+}  // namespace cirrus
@@ -0,0 +1,124 @@
+#ifndef _IO_URING_H_
+#define _IO_URING_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf;
+
+namespace cirrus {
+
+/**
+  * Minimal io_uring instance, used through the system calls (no liburing).
+  *
+  * Operations are queued in the submission queue and submitted together
+  * by submit_and_wait, which also collects the completions: one system
+  * call for the I/O of many connections.
+  * Multishot receives pick their buffer from a ring of buffers provided
+  * by provide_buffers, each completion says which buffer has the data.
+  * Needs Linux 6.0 or later, and kernel headers as recent to be built in.
+  *
+  * An instance is used by one thread.
+  */
+class IoUring {
+ public:
+  struct Completion {
+    uint64_t user_data;  //< user data of the operation
+    int32_t result;      //< bytes or socket, -errno on failure
+    bool more;           //< the multishot operation goes on
+    int32_t buffer;      //< provided buffer with the data, -1 if none
+  };
+
+  /**
+    * Whether io_uring with provided buffer rings can be used here
+    */
+  static bool supported();
+
+  /**
+    * @param entries Size of the submission queue (power of 2). The
+    *        completion queue is bigger, multishot operations complete many
+    *        times
+    */
+  explicit IoUring(uint32_t entries);
+  ~IoUring();
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  /**
+    * Register the buffers multishot receives fill
+    * @param num_buffers Number of buffers (power of 2)
+    */
+  void provide_buffers(uint32_t num_buffers, uint32_t buffer_size);
+  const char* buffer(int32_t id) const;
+
+  /**
+    * Give a buffer back to the kernel once its data was used
+    */
+  void recycle_buffer(int32_t id);
+
+  /**
+    * Accept connections on a listening socket until cancelled or failed
+    */
+  void accept_multishot(int sock, uint64_t user_data);
+
+  /**
+    * Receive into provided buffers until the peer closes or it fails
+    */
+  void recv_multishot(int sock, uint64_t user_data);
+
+  /**
+    * Send data, which has to stay valid until the send completes
+    */
+  void send(int sock, const void* data, uint32_t size, uint64_t user_data);
+
+  /**
+    * Submit the queued operations and wait up to timeout_ms for at least
+    * one completion
+    * @param completions Set to the completions, which are consumed
+    */
+  void submit_and_wait(uint32_t timeout_ms,
+                       std::vector<Completion>* completions);
+
+ private:
+  // next free submission entry, zeroed. Submits if the queue is full
+  struct io_uring_sqe* get_sqe();
+  // 0, or the errno of a submission to retry (EBUSY, EAGAIN, ...)
+  int enter(uint32_t min_complete, uint32_t timeout_ms);
+  // move the completions in the queue to the end of completions
+  void reap(std::vector<Completion>* completions);
+
+  int fd_ = -1;
+  void* rings_ = nullptr;  //< submission and completion queues
+  uint64_t rings_size_ = 0;
+  struct io_uring_sqe* sqes_ = nullptr;
+  uint64_t sqes_size_ = 0;
+
+  uint32_t* sq_head_ = nullptr;
+  uint32_t* sq_tail_ = nullptr;
+  uint32_t* sq_array_ = nullptr;
+  uint32_t sq_mask_ = 0;
+  uint32_t sq_entries_ = 0;
+  uint32_t sqe_tail_ = 0;   //< end of the entries filled so far
+  uint32_t to_submit_ = 0;  //< entries filled but not submitted
+
+  uint32_t* cq_head_ = nullptr;
+  uint32_t* cq_tail_ = nullptr;
+  uint32_t cq_mask_ = 0;
+  struct io_uring_cqe* cqes_ = nullptr;
+  std::vector<Completion> reaped_;  //< taken out of a full queue by get_sqe
+
+  struct io_uring_buf* buf_ring_ = nullptr;
+  uint64_t buf_ring_size_ = 0;
+  uint32_t num_buffers_ = 0;
+  uint32_t buffer_size_ = 0;
+  uint16_t buf_tail_ = 0;  //< end of the buffers given to the kernel
+  std::unique_ptr<char[]> buffers_;
+};
+
+}  // namespace cirrus
+
+#endif  // _IO_URING_H_
@@ -0,0 +1,191 @@
+#include "KVStore.h"
+
+#include <cstring>
+
+namespace cirrus {
+
+KVStore::KVStore(uint64_t max_bytes, BufferPool* pool)
+    : max_shard_bytes_(max_bytes / NUM_SHARDS),
+      pool_(pool),
+      shards_(new Shard[NUM_SHARDS]) {}
+
+bool KVStore::Key::operator==(const Key& other) const {
+  return std::memcmp(bytes, other.bytes, KEY_SIZE) == 0;
+}
+
+/**
+  * FNV-1a
+  */
+uint64_t KVStore::hash(const Key& key) {
+  uint64_t hash = 14695981039346656037UL;
+  for (uint32_t i = 0; i < KEY_SIZE; ++i) {
+    hash ^= static_cast<unsigned char>(key.bytes[i]);
+    hash *= 1099511628211UL;
+  }
+  return hash;
+}
+
+uint32_t KVStore::slot_class(uint32_t size) {
+  uint32_t slot_class = 0;
+  while (slot_class < NUM_SLOT_CLASSES &&
+         (MIN_SLOT_SIZE << slot_class) < size) {
+    ++slot_class;
+  }
+  return slot_class;
+}
+
+uint64_t KVStore::value_cost(uint32_t size) {
+  uint32_t size_class = slot_class(size);
+  if (size_class < NUM_SLOT_CLASSES) {
+    return MIN_SLOT_SIZE << size_class;
+  }
+  // size of the buffer the pool hands out
+  uint64_t cost = BufferPool::MIN_BUFFER_SIZE;
+  while (cost < size) {
+    cost <<= 1;
+  }
+  return cost;
+}
+
+void KVStore::allocate_value(Shard& shard, Entry& entry, uint32_t size) {
+  entry.size = size;
+  entry.slot_class = slot_class(size);
+  if (entry.slot_class == NUM_SLOT_CLASSES) {
+    entry.large = pool_->get(size);
+    entry.value = entry.large.data();
+    return;
+  }
+
+  std::vector<char*>& free_slots = shard.free_slots[entry.slot_class];
+  if (!free_slots.empty()) {
+    entry.value = free_slots.back();
+    free_slots.pop_back();
+    return;
+  }
+  uint64_t slot_size = MIN_SLOT_SIZE << entry.slot_class;
+  if (static_cast<uint64_t>(shard.slab_end - shard.slab_next) < slot_size) {
+    // the rest of the previous slab is too small for this slot
+    shard.slabs.push_back(pool_->get(SLAB_SIZE));
+    shard.slab_next = shard.slabs.back().data();
+    shard.slab_end = shard.slab_next + SLAB_SIZE;
+  }
+  entry.value = shard.slab_next;
+  shard.slab_next += slot_size;
+}
+
+void KVStore::free_value(Shard& shard, Entry& entry) {
+  if (entry.slot_class == NUM_SLOT_CLASSES) {
+    entry.large.release();
+  } else {
+    shard.free_slots[entry.slot_class].push_back(entry.value);
+  }
+  shard.bytes -= value_cost(entry.size);
+  entry.value = nullptr;
+}
+
+void KVStore::link_newest(Shard& shard, Entry& entry) {
+  entry.older = shard.newest;
+  entry.newer = nullptr;
+  if (shard.newest) {
+    shard.newest->newer = &entry;
+  } else {
+    shard.oldest = &entry;
+  }
+  shard.newest = &entry;
+}
+
+void KVStore::unlink(Shard& shard, Entry& entry) {
+  if (entry.newer) {
+    entry.newer->older = entry.older;
+  } else {
+    shard.newest = entry.older;
+  }
+  if (entry.older) {
+    entry.older->newer = entry.newer;
+  } else {
+    shard.oldest = entry.newer;
+  }
+  entry.newer = entry.older = nullptr;
+}
+
+void KVStore::erase(Shard& shard, Entry& entry) {
+  unlink(shard, entry);
+  free_value(shard, entry);
+  Key key = entry.key;
+  shard.entries.erase(key);
+}
+
+bool KVStore::set(const char* key, const char* value, uint32_t size) {
+  Key k;
+  std::memcpy(k.bytes, key, KEY_SIZE);
+  Shard& shard = shard_of(k);
+  uint64_t cost = value_cost(size);
+
+  std::lock_guard<std::mutex> guard(shard.lock);
+  auto it = shard.entries.find(k);
+  if (cost > max_shard_bytes_) {
+    if (it != shard.entries.end()) {
+      erase(shard, it->second);
+    }
+    return false;
+  }
+
+  Entry* entry = nullptr;
+  if (it != shard.entries.end()) {
+    entry = &it->second;
+    unlink(shard, *entry);
+    free_value(shard, *entry);
+  } else {
+    entry = &shard.entries[k];
+    entry->key = k;
+  }
+  while (shard.bytes + cost > max_shard_bytes_) {
+    erase(shard, *shard.oldest);
+  }
+
+  allocate_value(shard, *entry, size);
+  std::memcpy(entry->value, value, size);
+  shard.bytes += cost;
+  link_newest(shard, *entry);
+  return true;
+}
+
+bool KVStore::get(const char* key,
+                  const std::function<void(const char*, uint32_t)>& f) {
+  Key k;
+  std::memcpy(k.bytes, key, KEY_SIZE);
+  Shard& shard = shard_of(k);
+
+  std::lock_guard<std::mutex> guard(shard.lock);
+  auto it = shard.entries.find(k);
+  if (it == shard.entries.end()) {
+    return false;
+  }
+  Entry& entry = it->second;
+  if (shard.newest != &entry) {
+    unlink(shard, entry);
+    link_newest(shard, entry);
+  }
+  f(entry.value, entry.size);
+  return true;
+}
+
+uint64_t KVStore::num_entries() const {
+  uint64_t num_entries = 0;
+  for (uint32_t i = 0; i < NUM_SHARDS; ++i) {
+    std::lock_guard<std::mutex> guard(shards_[i].lock);
+    num_entries += shards_[i].entries.size();
+  }
+  return num_entries;
+}
+
+uint64_t KVStore::value_bytes() const {
+  uint64_t bytes = 0;
+  for (uint32_t i = 0; i < NUM_SHARDS; ++i) {
+    std::lock_guard<std::mutex> guard(shards_[i].lock);
+    bytes += shards_[i].bytes;
+  }
+  return bytes;
+}
+
+}  // namespace cirrus
@@ -0,0 +1,117 @@
+#ifndef _KV_STORE_H_
+#define _KV_STORE_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "BufferPool.h"
+#include "config.h"
+
+namespace cirrus {
+
+/**
+  * Key-value store of the parameter server (SET_VALUE / GET_VALUE).
+  * Keys are KEY_SIZE bytes kept inline, so lookups allocate nothing.
+  * The store is split in NUM_SHARDS shards picked by the hash of the key,
+  * each with its own lock, hash map and LRU list.
+  * Values are copied into slots carved out of slabs of a buffer pool, or
+  * into buffers of their own when larger than the biggest slot. Each shard
+  * keeps up to max_bytes / NUM_SHARDS bytes of values and evicts its least
+  * recently used entries to make room for new ones.
+  */
+class KVStore {
+ public:
+  static const uint32_t SHARD_BITS = 4;
+  static const uint32_t NUM_SHARDS = 1 << SHARD_BITS;
+  static const uint32_t MIN_SLOT_SIZE = 16;
+  static const uint32_t NUM_SLOT_CLASSES = 9;  //< 16 B to 4 KB slots
+  static const uint64_t SLAB_SIZE = 64 * 1024;
+
+  /**
+    * @param max_bytes Most bytes used by values (size of their slots)
+    * @param pool Pool values are allocated from. Has to outlive the store
+    */
+  KVStore(uint64_t max_bytes, BufferPool* pool);
+
+  /**
+    * Store a copy of a value, replacing the previous one
+    * @param key KEY_SIZE bytes
+    * @return false if the value is too large for the store. The key is
+    *         removed from the store
+    */
+  bool set(const char* key, const char* value, uint32_t size);
+
+  /**
+    * Call f with the value of a key while its shard is locked
+    * @param key KEY_SIZE bytes
+    * @return false if the key is not in the store
+    */
+  bool get(const char* key,
+           const std::function<void(const char*, uint32_t)>& f);
+
+  uint64_t num_entries() const;
+  uint64_t value_bytes() const;  //< bytes of the slots of the values
+
+ private:
+  struct Key {
+    char bytes[KEY_SIZE];
+
+    bool operator==(const Key& other) const;
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const { return hash(key); }
+  };
+
+  struct Entry {
+    Key key;
+    char* value = nullptr;
+    uint32_t size = 0;
+    uint32_t slot_class = 0;    //< NUM_SLOT_CLASSES for large values
+    BufferPool::Buffer large;   //< value larger than the biggest slot
+    Entry* newer = nullptr;     //< LRU list
+    Entry* older = nullptr;
+  };
+
+  struct alignas(64) Shard {
+    std::mutex lock;
+    std::unordered_map<Key, Entry, KeyHash> entries;
+    Entry* newest = nullptr;
+    Entry* oldest = nullptr;
+    uint64_t bytes = 0;  //< bytes of the slots of the values
+
+    std::vector<char*> free_slots[NUM_SLOT_CLASSES];
+    std::vector<BufferPool::Buffer> slabs;
+    char* slab_next = nullptr;  //< unused part of the last slab
+    char* slab_end = nullptr;
+  };
+
+  static uint64_t hash(const Key& key);
+  static uint32_t slot_class(uint32_t size);
+  // bytes a value of size takes from its shard
+  static uint64_t value_cost(uint32_t size);
+
+  // the hash maps use the low bits of the hash
+  Shard& shard_of(const Key& key) {
+    return shards_[hash(key) >> (64 - SHARD_BITS)];
+  }
+
+  void allocate_value(Shard& shard, Entry& entry, uint32_t size);
+  void free_value(Shard& shard, Entry& entry);
+  void link_newest(Shard& shard, Entry& entry);
+  void unlink(Shard& shard, Entry& entry);
+  // remove an entry (the iterator of entry is invalidated)
+  void erase(Shard& shard, Entry& entry);
+
+  uint64_t max_shard_bytes_;
+  BufferPool* pool_;
+  std::unique_ptr<Shard[]> shards_;
+};
+
+}  // namespace cirrus
+
+#endif  // _KV_STORE_H_
@@ -0,0 +1,103 @@
+#ifndef _LATENCY_HISTOGRAM_H_
+#define _LATENCY_HISTOGRAM_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace cirrus {
+
+/**
+  * Log-bucketed histogram of latencies (in a unit chosen by the caller)
+  * Each power of two is split into SUB_BUCKETS linear buckets so percentiles
+  * are accurate to ~12%. Meant to be owned by a single writer thread; readers
+  * can take snapshots concurrently without any locking.
+  */
+class LatencyHistogram {
+ public:
+  static constexpr int SUB_BUCKET_BITS = 3;
+  static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static constexpr int MAX_EXP = 40;  //< values up to 2^40
+  static constexpr int NUM_BUCKETS =
+      (MAX_EXP - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+  LatencyHistogram() {
+    for (auto& c : counts_) {
+      std::atomic_init(&c, 0UL);
+    }
+  }
+
+  /**
+    * Record one value. Only the owner thread should call this
+    */
+  void record(uint64_t value) {
+    auto& c = counts_[bucket_of(value)];
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  /**
+    * Add the counts of this histogram to counts (of size NUM_BUCKETS)
+    */
+  void add_to(std::vector<uint64_t>* counts) const {
+    counts->resize(NUM_BUCKETS, 0);
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+      (*counts)[i] += counts_[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  static int bucket_of(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+      return value;
+    }
+    int exp = 63 - __builtin_clzll(value);
+    if (exp > MAX_EXP) {
+      return NUM_BUCKETS - 1;
+    }
+    int sub = (value >> (exp - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (exp - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+  }
+
+  /**
+    * Upper bound of the values that fall in a given bucket
+    */
+  static uint64_t bucket_value(int bucket) {
+    if (bucket < SUB_BUCKETS) {
+      return bucket;
+    }
+    int exp = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub + 1) << (exp - SUB_BUCKET_BITS)) - 1;
+  }
+
+  /**
+    * Compute the given percentile (0-100) over a set of bucket counts
+    */
+  static uint64_t percentile(const std::vector<uint64_t>& counts, double p) {
+    uint64_t total = 0;
+    for (const auto& c : counts) {
+      total += c;
+    }
+    if (total == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * total);
+    if (rank >= total) {
+      rank = total - 1;
+    }
+    uint64_t seen = 0;
+    for (uint64_t i = 0; i < counts.size(); ++i) {
+      seen += counts[i];
+      if (seen > rank) {
+        return bucket_value(i);
+      }
+    }
+    return bucket_value(counts.size() - 1);
+  }
+
+ private:
+  std::atomic<uint64_t> counts_[NUM_BUCKETS];
+};
+
+}  // namespace cirrus
+
+#endif  // _LATENCY_HISTOGRAM_H_
@@ -16,7 +16,11 @@ void LogisticSparseTaskS3::push_gradient(LRSparseGradient* lrg) {
   auto before_push_us = get_time_us();
   std::cout << "Publishing gradients" << std::endl;
 #endif
-  psint->send_lr_gradient(*lrg);
+  if (gradient_sender) {
+    gradient_sender->send(*lrg);
+  } else {
+    psint->send_lr_gradient(*lrg);
+  }
 #ifdef DEBUG
   std::cout << "Published gradients!" << std::endl;
   auto elapsed_push_us = get_time_us() - before_push_us;
@@ -37,6 +41,28 @@ void LogisticSparseTaskS3::push_gradient(LRSparseGradient* lrg) {
 #endif
 }
 
+void LogisticSparseTaskS3::push_gradient_pull_model(
+    LRSparseGradient* lrg,
+    std::shared_ptr<SparseDataset>& dataset,
+    S3SparseIterator& s3_iter,
+    SparseLRModel& model) {
+  std::shared_ptr<SparseDataset> next_dataset;
+  while (!get_dataset_minibatch(next_dataset, s3_iter)) {
+  }
+#ifdef DEBUG
+  auto before_push_us = get_time_us();
+#endif
+  psint->send_lr_gradient_get_sparse_model(*lrg, *next_dataset, model, config);
+#ifdef DEBUG
+  std::cout << "[WORKER] "
+      << "Worker task published gradient and got model"
+      << " with version: " << lrg->getVersion()
+      << " took(us): " << (get_time_us() - before_push_us)
+      << "\n";
+#endif
+  dataset = next_dataset;
+}
+
 // get samples and labels data
 bool LogisticSparseTaskS3::get_dataset_minibatch(
     std::shared_ptr<SparseDataset>& dataset,
@@ -73,9 +99,17 @@ void LogisticSparseTaskS3::run(const Configuration& config,
   uint64_t num_s3_batches = config.get_limit_samples() / config.get_s3_size();
   this->config = config;
 
-  psint = new PSSparseServerInterface(ps_ip, ps_port);
+  psint = new PSSparseServerInterface(ps_ip, ps_port, config);
   psint->connect();
-  sparse_model_get = std::make_unique<SparseModelGet>(ps_ip, ps_port);
+  sparse_model_get =
+      std::make_unique<SparseModelGet>(ps_ip, ps_port, config);
+  if (config.get_grad_max_in_flight() > 0) {
+    gradient_sender = std::make_unique<AsyncGradientSender>(
+        config.get_grad_max_in_flight(),
+        [this](const LRSparseGradient& gradient) {
+          psint->send_lr_gradient(gradient);
+        });
+  }
   
   std::cout << "[WORKER] " << "num s3 batches: " << num_s3_batches
     << std::endl;
@@ -92,31 +126,80 @@ void LogisticSparseTaskS3::run(const Configuration& config,
 
   uint64_t version = 1;
   SparseLRModel model(1 << config.get_model_bits());
+  if (config.get_grad_top_k() > 0 || config.get_grad_top_k_percent() > 0) {
+    gradient_compressor = std::make_unique<GradientCompressor>(
+        (1ULL << config.get_model_bits()) + 1, config.get_grad_top_k(),
+        config.get_grad_top_k_percent());
+  }
+
+  // in stale synchronous parallel mode, workers give their clock (number
+  // of minibatches done) to the parameter server before pulling a model
+  bool ssp = config.get_ssp_staleness() >= 0;
+  // the pipeline fetches ahead of the gradients it pushed, so its clock is
+  // the number of gradients pushed (only used by the pipeline thread)
+  uint64_t num_pushed = 0;
+
+  // the pipeline gets the data and models of the next minibatches and
+  // pushes the gradients from its own thread
+  std::unique_ptr<Pipeline> pipeline;
+  if (config.get_worker_pipeline_depth() > 0) {
+    pipeline = std::make_unique<Pipeline>(
+        config.get_worker_pipeline_depth(),
+        [&config]() {
+          return std::make_unique<PipelineWork>(1 << config.get_model_bits());
+        },
+        [this, &s3_iter, ssp, worker, &num_pushed](PipelineWork* work) {
+          while (!get_dataset_minibatch(work->dataset, s3_iter)) {
+          }
+          if (ssp) {
+            sparse_model_get->wait_for_clock(worker, num_pushed);
+          }
+          sparse_model_get->get_new_model_inplace(
+              *work->dataset, work->model, this->config);
+        },
+        [this, &num_pushed](std::unique_ptr<ModelGradient>& gradient) {
+          push_gradient(dynamic_cast<LRSparseGradient*>(gradient.get()));
+          ++num_pushed;
+        });
+  }
 
   bool printed_rate = false;
   int count = 0;
   auto start_time = get_time_ms();
+  // in push-pull mode the model of the next minibatch comes back with
+  // the reply to the gradient
+  std::shared_ptr<SparseDataset> dataset;
+  bool have_model = false;
   while (1) {
     // get data, labels and model
 #ifdef DEBUG
     std::cout << get_time_us() << " [WORKER] running phase 1" << std::endl;
+    auto now = get_time_us();
 #endif
-    std::shared_ptr<SparseDataset> dataset;
-    if (!get_dataset_minibatch(dataset, s3_iter)) {
-      continue;
-    }
+    SparseLRModel* minibatch_model = &model;
+    if (pipeline) {
+      PipelineWork& work = pipeline->next();
+      dataset = work.dataset;
+      minibatch_model = &work.model;
+    } else if (!have_model) {
+      if (!get_dataset_minibatch(dataset, s3_iter)) {
+        continue;
+      }
 #ifdef DEBUG
-    std::cout << get_time_us() << " [WORKER] phase 1 done. Getting the model" << std::endl;
-    //dataset->check();
-    //dataset->print_info();
-    auto now = get_time_us();
+      std::cout << get_time_us() << " [WORKER] phase 1 done. Getting the model" << std::endl;
+      //dataset->check();
+      //dataset->print_info();
+      now = get_time_us();
 #endif
+      // we get the model subset with just the right amount of weights
+      if (ssp) {
+        sparse_model_get->wait_for_clock(worker, count);
+      }
+      sparse_model_get->get_new_model_inplace(*dataset, model, config);
+    }
     // compute mini batch gradient
     std::unique_ptr<ModelGradient> gradient;
 
-    // we get the model subset with just the right amount of weights
-    sparse_model_get->get_new_model_inplace(*dataset, model, config);
-
 #ifdef DEBUG
     std::cout << "get model elapsed(us): " << get_time_us() - now << std::endl;
     std::cout << "Checking model" << std::endl;
@@ -126,7 +209,7 @@ void LogisticSparseTaskS3::run(const Configuration& config,
 #endif
 
     try {
-      gradient = model.minibatch_grad_sparse(*dataset, config);
+      gradient = minibatch_model->minibatch_grad_sparse(*dataset, config);
     } catch(const std::runtime_error& e) {
       std::cout << "Error. " << e.what() << std::endl;
       exit(-1);
@@ -144,7 +227,23 @@ void LogisticSparseTaskS3::run(const Configuration& config,
 
     try {
       LRSparseGradient* lrg = dynamic_cast<LRSparseGradient*>(gradient.get());
-      push_gradient(lrg);
+      if (gradient_compressor) {
+        // the entries not sent now are sent with later gradients
+        gradient = std::make_unique<LRSparseGradient>(
+            gradient_compressor->compress(*lrg));
+        lrg = dynamic_cast<LRSparseGradient*>(gradient.get());
+      }
+      if (pipeline) {
+        pipeline->push(std::move(gradient));
+      } else if (config.get_worker_push_pull()) {
+        if (ssp) {
+          sparse_model_get->wait_for_clock(worker, count + 1);
+        }
+        push_gradient_pull_model(lrg, dataset, s3_iter, model);
+        have_model = true;
+      } else {
+        push_gradient(lrg);
+      }
     } catch(...) {
       std::cout << "[WORKER] "
         << "Worker task error doing put of gradient" << "\n";
@@ -163,6 +262,9 @@ void LogisticSparseTaskS3::run(const Configuration& config,
       }
     }
     if (test_iters > 0 && count > test_iters) {
+      // push the queued gradients
+      pipeline.reset();
+      gradient_sender.reset();
       exit(0);
     }
   }
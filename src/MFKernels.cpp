@@ -0,0 +1,306 @@
+#include "MFKernels.h"
+
+#include <type_traits>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MF_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace cirrus {
+
+// Kernels are templates over the number of factors N, with 0 for any
+// number: with a constant N the loops are unrolled and have no tail
+
+template <uint64_t N>
+static FEATURE_TYPE dot_scalar(const FEATURE_TYPE* a,
+                               const FEATURE_TYPE* b,
+                               uint64_t n) {
+  n = N ? N : n;
+  FEATURE_TYPE res = 0;
+  for (uint64_t i = 0; i < n; ++i) {
+    res += a[i] * b[i];
+  }
+  return res;
+}
+
+template <uint64_t N>
+static void update_scalar(FEATURE_TYPE* user,
+                          FEATURE_TYPE* item,
+                          uint64_t n,
+                          FEATURE_TYPE learning_rate,
+                          FEATURE_TYPE error,
+                          FEATURE_TYPE user_reg,
+                          FEATURE_TYPE item_reg) {
+  n = N ? N : n;
+  for (uint64_t i = 0; i < n; ++i) {
+    user[i] += learning_rate * (error * item[i] - user_reg * user[i]);
+    item[i] += learning_rate * (error * user[i] - item_reg * item[i]);
+  }
+}
+
+template <uint64_t N>
+static void add_scalar(FEATURE_TYPE* row,
+                       const FEATURE_TYPE* delta,
+                       uint64_t n) {
+  n = N ? N : n;
+  for (uint64_t i = 0; i < n; ++i) {
+    row[i] += delta[i];
+  }
+}
+
+#define MF_KERNELS(isa, n) \
+  { #isa, n, dot_##isa<n>, update_##isa<n>, add_##isa<n> }
+
+// generic kernels first, then the specialized ranks
+#define MF_KERNEL_SET(isa)                                               \
+  {                                                                      \
+    MF_KERNELS(isa, 0), MF_KERNELS(isa, 8), MF_KERNELS(isa, 16),         \
+        MF_KERNELS(isa, 32), MF_KERNELS(isa, 64), MF_KERNELS(isa, 128)  \
+  }
+#define NUM_RANKS (6)
+
+static const MFKernels SCALAR_KERNELS[NUM_RANKS] = MF_KERNEL_SET(scalar);
+
+#ifdef MF_KERNELS_X86
+
+static_assert(std::is_same<FEATURE_TYPE, float>::value,
+              "The vector kernels work on float weights");
+
+#define AVX2 __attribute__((target("avx2,fma")))
+#define AVX512 __attribute__((target("avx512f")))
+
+// the first n lanes (n < 8)
+AVX2 static inline __m256i mask_avx2(uint64_t n) {
+  return _mm256_cmpgt_epi32(_mm256_set1_epi32(n),
+                            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+AVX2 static inline float sum_avx2(__m256 v) {
+  __m128 sum =
+      _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+  return _mm_cvtss_f32(sum);
+}
+
+template <uint64_t N>
+AVX2 static float dot_avx2(const float* a, const float* b, uint64_t n) {
+  n = N ? N : n;
+  __m256 sum = _mm256_setzero_ps();
+  uint64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    sum = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum);
+  }
+  if (i < n) {
+    __m256i mask = mask_avx2(n - i);
+    sum = _mm256_fmadd_ps(_mm256_maskload_ps(a + i, mask),
+                          _mm256_maskload_ps(b + i, mask), sum);
+  }
+  return sum_avx2(sum);
+}
+
+AVX2 static inline void update_lanes_avx2(__m256* user,
+                                          __m256* item,
+                                          __m256 learning_rate,
+                                          __m256 error,
+                                          __m256 user_reg,
+                                          __m256 item_reg) {
+  __m256 user_delta =
+      _mm256_fmsub_ps(error, *item, _mm256_mul_ps(user_reg, *user));
+  *user = _mm256_fmadd_ps(learning_rate, user_delta, *user);
+  __m256 item_delta =
+      _mm256_fmsub_ps(error, *user, _mm256_mul_ps(item_reg, *item));
+  *item = _mm256_fmadd_ps(learning_rate, item_delta, *item);
+}
+
+template <uint64_t N>
+AVX2 static void update_avx2(float* user,
+                             float* item,
+                             uint64_t n,
+                             float learning_rate,
+                             float error,
+                             float user_reg,
+                             float item_reg) {
+  n = N ? N : n;
+  __m256 lr = _mm256_set1_ps(learning_rate);
+  __m256 e = _mm256_set1_ps(error);
+  __m256 ureg = _mm256_set1_ps(user_reg);
+  __m256 ireg = _mm256_set1_ps(item_reg);
+  uint64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 u = _mm256_loadu_ps(user + i);
+    __m256 it = _mm256_loadu_ps(item + i);
+    update_lanes_avx2(&u, &it, lr, e, ureg, ireg);
+    _mm256_storeu_ps(user + i, u);
+    _mm256_storeu_ps(item + i, it);
+  }
+  if (i < n) {
+    __m256i mask = mask_avx2(n - i);
+    __m256 u = _mm256_maskload_ps(user + i, mask);
+    __m256 it = _mm256_maskload_ps(item + i, mask);
+    update_lanes_avx2(&u, &it, lr, e, ureg, ireg);
+    _mm256_maskstore_ps(user + i, mask, u);
+    _mm256_maskstore_ps(item + i, mask, it);
+  }
+}
+
+template <uint64_t N>
+AVX2 static void add_avx2(float* row, const float* delta, uint64_t n) {
+  n = N ? N : n;
+  uint64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(row + i, _mm256_add_ps(_mm256_loadu_ps(row + i),
+                                            _mm256_loadu_ps(delta + i)));
+  }
+  if (i < n) {
+    __m256i mask = mask_avx2(n - i);
+    _mm256_maskstore_ps(row + i, mask,
+                        _mm256_add_ps(_mm256_maskload_ps(row + i, mask),
+                                      _mm256_maskload_ps(delta + i, mask)));
+  }
+}
+
+// the first n lanes (n < 16)
+static inline __mmask16 mask_avx512(uint64_t n) {
+  return static_cast<__mmask16>((1U << n) - 1);
+}
+
+// gcc 12 warns about the undefined pass through of the unmasked shuffles,
+// casts and _mm512_reduce_add_ps, hence the masks with every lane set
+AVX512 static inline float sum_avx512(__m512 v) {
+  __m512 sum = _mm512_add_ps(v, _mm512_maskz_shuffle_f32x4(0xffff, v, v, 0x4e));
+  sum = _mm512_add_ps(sum, _mm512_maskz_shuffle_f32x4(0xffff, sum, sum, 0xb1));
+  __m128 quarter = _mm512_maskz_extractf32x4_ps(0xf, sum, 0);
+  quarter = _mm_add_ps(quarter, _mm_movehl_ps(quarter, quarter));
+  quarter = _mm_add_ss(quarter, _mm_shuffle_ps(quarter, quarter, 0x55));
+  return _mm_cvtss_f32(quarter);
+}
+
+template <uint64_t N>
+AVX512 static float dot_avx512(const float* a, const float* b, uint64_t n) {
+  n = N ? N : n;
+  __m512 sum = _mm512_setzero_ps();
+  uint64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    sum = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum);
+  }
+  if (i < n) {
+    __mmask16 mask = mask_avx512(n - i);
+    sum = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                          _mm512_maskz_loadu_ps(mask, b + i), sum);
+  }
+  return sum_avx512(sum);
+}
+
+AVX512 static inline void update_lanes_avx512(__m512* user,
+                                              __m512* item,
+                                              __m512 learning_rate,
+                                              __m512 error,
+                                              __m512 user_reg,
+                                              __m512 item_reg) {
+  __m512 user_delta =
+      _mm512_fmsub_ps(error, *item, _mm512_mul_ps(user_reg, *user));
+  *user = _mm512_fmadd_ps(learning_rate, user_delta, *user);
+  __m512 item_delta =
+      _mm512_fmsub_ps(error, *user, _mm512_mul_ps(item_reg, *item));
+  *item = _mm512_fmadd_ps(learning_rate, item_delta, *item);
+}
+
+template <uint64_t N>
+AVX512 static void update_avx512(float* user,
+                                 float* item,
+                                 uint64_t n,
+                                 float learning_rate,
+                                 float error,
+                                 float user_reg,
+                                 float item_reg) {
+  n = N ? N : n;
+  __m512 lr = _mm512_set1_ps(learning_rate);
+  __m512 e = _mm512_set1_ps(error);
+  __m512 ureg = _mm512_set1_ps(user_reg);
+  __m512 ireg = _mm512_set1_ps(item_reg);
+  uint64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 u = _mm512_loadu_ps(user + i);
+    __m512 it = _mm512_loadu_ps(item + i);
+    update_lanes_avx512(&u, &it, lr, e, ureg, ireg);
+    _mm512_storeu_ps(user + i, u);
+    _mm512_storeu_ps(item + i, it);
+  }
+  if (i < n) {
+    __mmask16 mask = mask_avx512(n - i);
+    __m512 u = _mm512_maskz_loadu_ps(mask, user + i);
+    __m512 it = _mm512_maskz_loadu_ps(mask, item + i);
+    update_lanes_avx512(&u, &it, lr, e, ureg, ireg);
+    _mm512_mask_storeu_ps(user + i, mask, u);
+    _mm512_mask_storeu_ps(item + i, mask, it);
+  }
+}
+
+template <uint64_t N>
+AVX512 static void add_avx512(float* row, const float* delta, uint64_t n) {
+  n = N ? N : n;
+  uint64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(row + i, _mm512_add_ps(_mm512_loadu_ps(row + i),
+                                            _mm512_loadu_ps(delta + i)));
+  }
+  if (i < n) {
+    __mmask16 mask = mask_avx512(n - i);
+    _mm512_mask_storeu_ps(
+        row + i, mask,
+        _mm512_add_ps(_mm512_maskz_loadu_ps(mask, row + i),
+                      _mm512_maskz_loadu_ps(mask, delta + i)));
+  }
+}
+
+static const MFKernels AVX2_KERNELS[NUM_RANKS] = MF_KERNEL_SET(avx2);
+static const MFKernels AVX512_KERNELS[NUM_RANKS] = MF_KERNEL_SET(avx512);
+
+#endif  // MF_KERNELS_X86
+
+// kernel set of an instruction set, nullptr if the cpu can't run it
+static const MFKernels* kernel_set(const std::string& name) {
+  if (name == "scalar") {
+    return SCALAR_KERNELS;
+  }
+#ifdef MF_KERNELS_X86
+  if (name == "avx2" && __builtin_cpu_supports("avx2") &&
+      __builtin_cpu_supports("fma")) {
+    return AVX2_KERNELS;
+  }
+  if (name == "avx512" && __builtin_cpu_supports("avx512f")) {
+    return AVX512_KERNELS;
+  }
+#endif
+  return nullptr;
+}
+
+static const MFKernels* for_rank(const MFKernels* set, uint64_t nfactors) {
+  for (uint64_t i = 1; i < NUM_RANKS; ++i) {
+    if (set[i].nfactors == nfactors) {
+      return &set[i];
+    }
+  }
+  return &set[0];
+}
+
+const MFKernels* MFKernels::get(const std::string& name, uint64_t nfactors) {
+  const MFKernels* set = kernel_set(name);
+  return set ? for_rank(set, nfactors) : nullptr;
+}
+
+const MFKernels& MFKernels::get(uint64_t nfactors) {
+  static const MFKernels* best = []() {
+    for (const char* name : {"avx512", "avx2"}) {
+      if (const MFKernels* set = kernel_set(name)) {
+        return set;
+      }
+    }
+    return SCALAR_KERNELS;
+  }();
+  return *for_rank(best, nfactors);
+}
+
+}  // namespace cirrus
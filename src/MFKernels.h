@@ -0,0 +1,71 @@
+#ifndef _MF_KERNELS_H_
+#define _MF_KERNELS_H_
+
+#include <cstdint>
+#include <string>
+
+#include "config.h"
+
+namespace cirrus {
+
+/**
+  * Vector kernels of the matrix factorization model, over the factors of
+  * a user or item row.
+  * There is a set of kernels per instruction set: AVX-512, AVX2 with FMA
+  * and scalar. The vector ones are only compiled for their instruction
+  * set, so binaries built without -march flags still run everywhere, and
+  * get() picks the best set the cpu supports when first called.
+  * Each set has generic kernels and kernels specialized for 8, 16, 32, 64
+  * and 128 factors, whose loops are fully unrolled. Those take n to be
+  * their nfactors.
+  * Vector kernels round differently than the scalar ones (fused multiply
+  * adds, order of the sums).
+  */
+struct MFKernels {
+  const char* name;
+  uint64_t nfactors;  //< factors the kernels are specialized for (0: any)
+
+  /**
+    * Dot product of two rows of n factors
+    */
+  FEATURE_TYPE (*dot)(const FEATURE_TYPE* a,
+                      const FEATURE_TYPE* b,
+                      uint64_t n);
+
+  /**
+    * SGD step of the factors of a user and an item rated with a
+    * prediction error of error:
+    * user += learning_rate * (error * item - user_reg * user)
+    * item += learning_rate * (error * user - item_reg * item), with the
+    * updated user factors
+    */
+  void (*update)(FEATURE_TYPE* user,
+                 FEATURE_TYPE* item,
+                 uint64_t n,
+                 FEATURE_TYPE learning_rate,
+                 FEATURE_TYPE error,
+                 FEATURE_TYPE user_reg,
+                 FEATURE_TYPE item_reg);
+
+  /**
+    * row += delta, over n weights
+    */
+  void (*add)(FEATURE_TYPE* row, const FEATURE_TYPE* delta, uint64_t n);
+
+  /**
+    * Kernels of the best instruction set of this cpu for rows of nfactors
+    * factors: specialized ones if there are, generic ones otherwise
+    */
+  static const MFKernels& get(uint64_t nfactors);
+
+  /**
+    * Kernels of an instruction set (scalar, avx2 or avx512) for rows of
+    * nfactors factors
+    * @return nullptr if the cpu or the build can't run them
+    */
+  static const MFKernels* get(const std::string& name, uint64_t nfactors);
+};
+
+}  // namespace cirrus
+
+#endif  // _MF_KERNELS_H_
@@ -4,6 +4,7 @@
 #include <Eigen/Dense>
 #include <Checksum.h>
 #include <algorithm>
+#include <cstring>
 #include <ModelGradient.h>
 
 //#define DEBUG
@@ -28,30 +29,38 @@ void MFModel::initialize_reg_params() {
 }
 
 // FORMAT
-// Number of users (32bits)
-// Number of factors (32bits)
-// Sample1: factor 1 (FEATURE_TYPE) | factor 2 | factor 3 
-// Sample2 : ...
+// Number of users (64bits)
+// Number of items (64bits)
+// Number of factors (64bits)
+// User row 1: bias (FEATURE_TYPE) | factor 1 | factor 2 | ... | padding
+// User row 2: ...
+// Item row 1: ...
 // ....
 
+uint64_t MFModel::row_stride(uint64_t nfactors) {
+  const uint64_t line = 64 / sizeof(FEATURE_TYPE);
+  return (1 + nfactors + line - 1) / line * line;
+}
+
 void MFModel::initialize_data(uint64_t users, uint64_t items, uint64_t nfactors) {
-  user_weights_.resize(users * nfactors);
-  item_weights_.resize(items * nfactors);
   global_bias_ = 3.604;
 
-  user_bias_.resize(users);
-  item_bias_.resize(items);
-
   initialize_reg_params();
 
   nusers_ = users;
   nitems_ = items;
   nfactors_ = nfactors;
+  row_stride_ = row_stride(nfactors);
+  kernels_ = &MFKernels::get(nfactors);
+  user_rows_.assign(users * row_stride_, 0);
+  item_rows_.assign(items * row_stride_, 0);
 
   randomize();
 
   std::cout << "Initializing MFModel nusers: " << nusers_
             << " nitems: " << nitems_
+            << " nfactors: " << nfactors_
+            << " kernels: " << kernels_->name
             << std::endl;
 }
 
@@ -84,10 +93,7 @@ MFModel::serialize() const {
 
 uint64_t MFModel::getSerializedSize() const {
     return sizeof(uint64_t) * 3 + // nusers + nitem + nfactors
-      user_bias_.size() * sizeof(FEATURE_TYPE) +
-      item_bias_.size() * sizeof(FEATURE_TYPE) +
-      user_weights_.size() * sizeof(FEATURE_TYPE) +
-      item_weights_.size() * sizeof(FEATURE_TYPE);
+      (user_rows_.size() + item_rows_.size()) * sizeof(FEATURE_TYPE);
 }
 
 void MFModel::serializeTo(void* mem) const {
@@ -106,18 +112,11 @@ void MFModel::serializeTo(void* mem) const {
     store_value<uint64_t>(data, nitems_);
     store_value<uint64_t>(data, nfactors_);
 
-    for (const auto& v : user_bias_) {
-      store_value<FEATURE_TYPE>(data, v);
-    }
-    for (const auto& v : item_bias_) {
-      store_value<FEATURE_TYPE>(data, v);
-    }
-    for (const auto& v : user_weights_) {
-      store_value<FEATURE_TYPE>(data, v);
-    }
-    for (const auto& v : item_weights_) {
-      store_value<FEATURE_TYPE>(data, v);
-    }
+    std::memcpy(data, user_rows_.data(),
+                user_rows_.size() * sizeof(FEATURE_TYPE));
+    data += user_rows_.size() * sizeof(FEATURE_TYPE);
+    std::memcpy(data, item_rows_.data(),
+                item_rows_.size() * sizeof(FEATURE_TYPE));
 }
 
 void MFModel::loadSerialized(const void* data) {
@@ -125,6 +124,10 @@ void MFModel::loadSerialized(const void* data) {
   nusers_ = load_value<uint64_t>(data);
   nitems_ = load_value<uint64_t>(data);
   nfactors_ = load_value<uint64_t>(data);
+  if (nfactors_ == 0 || nfactors_ > MAX_NUM_FACTORS) {
+    throw std::runtime_error("Wrong number of factors: " +
+                             std::to_string(nfactors_));
+  }
 
 #ifdef DEBUG
   std::cout << "loadSerialized"
@@ -135,35 +138,18 @@ void MFModel::loadSerialized(const void* data) {
 #endif
 
   global_bias_ = 3.604;
-  user_weights_.resize(nusers_ * nfactors_);
-  item_weights_.resize(nitems_ * nfactors_);
-  user_bias_.resize(nusers_);
-  item_bias_.resize(nitems_);
-
-  // read user bias
-  for (uint32_t i = 0; i < nusers_; ++i) {
-    FEATURE_TYPE user_bias = load_value<FEATURE_TYPE>(data);
-    user_bias_[i] = user_bias;
-  }
-  // read item bias
-  for (uint32_t i = 0; i < nitems_; ++i) {
-    FEATURE_TYPE item_bias = load_value<FEATURE_TYPE>(data);
-    item_bias_[i] = item_bias;
-  }
-  // read user weights
-  for (uint32_t i = 0; i < nusers_; ++i) {
-    for (uint32_t j = 0; j < nfactors_; ++j) {
-      FEATURE_TYPE user_weight = load_value<FEATURE_TYPE>(data);
-      get_user_weights(i, j) = user_weight;
-    }
-  }
-  // read item weights
-  for (uint32_t i = 0; i < nitems_; ++i) {
-    for (uint32_t j = 0; j < nfactors_; ++j) {
-      FEATURE_TYPE item_weight = load_value<FEATURE_TYPE>(data);
-      get_item_weights(i, j) = item_weight;
-    }
-  }
+  row_stride_ = row_stride(nfactors_);
+  kernels_ = &MFKernels::get(nfactors_);
+  user_rows_.resize(nusers_ * row_stride_);
+  item_rows_.resize(nitems_ * row_stride_);
+
+  // rows are serialized with their padding
+  const char* rows = reinterpret_cast<const char*>(data);
+  std::memcpy(user_rows_.data(), rows,
+              user_rows_.size() * sizeof(FEATURE_TYPE));
+  rows += user_rows_.size() * sizeof(FEATURE_TYPE);
+  std::memcpy(item_rows_.data(), rows,
+              item_rows_.size() * sizeof(FEATURE_TYPE));
 }
 
 /**
@@ -194,48 +180,34 @@ void MFModel::sgd_update(double learning_rate,
         const ModelGradient* gradient) {
   const MFSparseGradient* grad_ptr = dynamic_cast<const MFSparseGradient*>(gradient);
   assert(grad_ptr);
+  add_gradient(grad_ptr->view());
+}
 
-  // apply grad to users_bias_grad
-  for (const auto& v : grad_ptr->users_bias_grad) {
-      user_bias_[v.first] += v.second;
-  }
-  for (const auto& v : grad_ptr->items_bias_grad) {
-      item_bias_[v.first] += v.second;
+void MFModel::add_gradient(const MFGradientView& gradient) {
+  assert(gradient.nfactors == nfactors_);
+  for (uint32_t i = 0; i < gradient.users.size; ++i) {
+    get_user_bias(gradient.users.ids[i]) += gradient.users.biases[i];
+    kernels_->add(&get_user_weights(gradient.users.ids[i], 0),
+                  gradient.users.factors + i * nfactors_, nfactors_);
   }
-  for (const auto& v : grad_ptr->users_weights_grad) {
-    int user_id = v.first;
-    assert(v.second.size() == NUM_FACTORS);
-    for (uint32_t i = 0; i < v.second.size(); ++i) {
-      get_user_weights(user_id, i) += v.second[i];
-    }
-  }
-  for (const auto& v : grad_ptr->items_weights_grad) {
-    int item_id = v.first;
-    assert(v.second.size() == NUM_FACTORS);
-    for (uint32_t i = 0; i < v.second.size(); ++i) {
-      get_item_weights(item_id, i) += v.second[i];
-    }
+  for (uint32_t i = 0; i < gradient.items.size; ++i) {
+    get_item_bias(gradient.items.ids[i]) += gradient.items.biases[i];
+    kernels_->add(&get_item_weights(gradient.items.ids[i], 0),
+                  gradient.items.factors + i * nfactors_, nfactors_);
   }
 }
 
 FEATURE_TYPE MFModel::predict(uint32_t userId, uint32_t itemId) const {
+  const FEATURE_TYPE* user = user_row(userId);
+  const FEATURE_TYPE* item = item_row(itemId);
+  FEATURE_TYPE res = global_bias_ + user[0] + item[0] +
+                     kernels_->dot(user + 1, item + 1, nfactors_);
 #ifdef DEBUG
-  FEATURE_TYPE res = global_bias_ + user_bias_.at(userId) + item_bias_.at(itemId);
-#else
-  FEATURE_TYPE res = global_bias_ + user_bias_[userId] + item_bias_[itemId];
-#endif
-  for (uint32_t i = 0; i < nfactors_; ++i) {
-    res += get_user_weights(userId, i) * get_item_weights(itemId, i);
-#ifdef DEBUG
-    if (std::isnan(res) || std::isinf(res)) {
-      std::cout << "userId: " << userId << " itemId: " << itemId
-        << " get_user_weights(userId, i): " << get_user_weights(userId, i)
-        << " get_item_weights(itemId, i): " << get_item_weights(itemId, i)
-        << std::endl;
-      throw std::runtime_error("nan error in predict");
-    }
-#endif
+  if (std::isnan(res) || std::isinf(res)) {
+    std::cout << "userId: " << userId << " itemId: " << itemId << std::endl;
+    throw std::runtime_error("nan error in predict");
   }
+#endif
   return res;
 }
 
@@ -248,22 +220,32 @@ std::unique_ptr<ModelGradient> MFModel::minibatch_grad(
 }
 
 FEATURE_TYPE& MFModel::get_user_weights(uint64_t userId, uint64_t factor) {
-  return user_weights_.at(userId * nfactors_ + factor);
+  if (userId >= nusers_ || factor >= nfactors_) {
+    throw std::runtime_error("User weight index too large");
+  }
+  return user_row(userId)[1 + factor];
 }
 
 FEATURE_TYPE& MFModel::get_item_weights(uint64_t itemId, uint64_t factor) {
-  if (itemId >= nitems_) {
+  if (itemId >= nitems_ || factor >= nfactors_) {
     std::cout << "itemId: " << itemId << " nitems_: " << nitems_ << std::endl;
+    throw std::runtime_error("Item weight index too large");
   }
-  return item_weights_.at(itemId * nfactors_ + factor);
+  return item_row(itemId)[1 + factor];
 }
 
 const FEATURE_TYPE& MFModel::get_user_weights(uint64_t userId, uint64_t factor) const {
-  return user_weights_.at(userId * nfactors_ + factor);
+  if (userId >= nusers_ || factor >= nfactors_) {
+    throw std::runtime_error("User weight index too large");
+  }
+  return user_row(userId)[1 + factor];
 }
 
 const FEATURE_TYPE& MFModel::get_item_weights(uint64_t itemId, uint64_t factor) const {
-  return item_weights_.at(itemId * nfactors_ + factor);
+  if (itemId >= nitems_ || factor >= nfactors_) {
+    throw std::runtime_error("Item weight index too large");
+  }
+  return item_row(itemId)[1 + factor];
 }
 
 void MFModel::sgd_update(
@@ -278,6 +260,16 @@ void MFModel::sgd_update(
       uint64_t itemId = dataset.data_[i][j].first;
       FEATURE_TYPE rating = dataset.data_[i][j].second;
 
+      if (itemId >= nitems_ || user >= nusers_) {
+        std::cout
+          << "itemId: " << itemId
+          << " nitems_: " << nitems_
+          << " user: " << user
+          << " nusers_: " << nusers_
+          << std::endl;
+        throw std::runtime_error("Wrong value here");
+      }
+
       FEATURE_TYPE pred = predict(user, itemId);
       FEATURE_TYPE error = rating - pred;
 
@@ -291,53 +283,26 @@ void MFModel::sgd_update(
         << std::endl;
 #endif
 
-      if (itemId >= nitems_ || user >= nusers_) {
-        std::cout
-          << "itemId: " << itemId
-          << " nitems_: " << nitems_
-          << " user: " << user
-          << " nusers_: " << nusers_
-          << std::endl;
-        throw std::runtime_error("Wrong value here");
-      }
-      user_bias_[user] += learning_rate * (error - user_bias_reg_ * user_bias_[user]);
-      item_bias_[itemId] += learning_rate * (error - item_bias_reg_ * item_bias_[itemId]);
+      FEATURE_TYPE* user_w = user_row(user);
+      FEATURE_TYPE* item_w = item_row(itemId);
+      user_w[0] += learning_rate * (error - user_bias_reg_ * user_w[0]);
+      item_w[0] += learning_rate * (error - item_bias_reg_ * item_w[0]);
 
-#ifdef DEBUG
-      if (std::isnan(user_bias_[user]) || std::isnan(item_bias_[itemId]) ||
-          std::isinf(user_bias_[user]) || std::isinf(item_bias_[itemId]))
-        throw std::runtime_error("nan in user_bias or item_bias");
-#endif
-
-      // update user latent factors
-      for (uint64_t k = 0; k < nfactors_; ++k) {
-        FEATURE_TYPE delta_user_w =
-          learning_rate * (error * get_item_weights(itemId, k) - user_fact_reg_ * get_user_weights(user, k));
-        //std::cout << "delta_user_w: " << delta_user_w << std::endl;
-        get_user_weights(user, k) += delta_user_w;
-#ifdef DEBUG
-        if (std::isnan(get_user_weights(user, k)) || std::isinf(get_user_weights(user, k))) {
-          throw std::runtime_error("nan in user weight");
-        }
-#endif
-      }
+      // update user latent factors, then item latent factors with the
+      // updated user factors
+      kernels_->update(user_w + 1, item_w + 1, nfactors_, learning_rate,
+                       error, user_fact_reg_, item_fact_reg_);
 
-      // update item latent factors
-      for (uint64_t k = 0; k < nfactors_; ++k) {
-        FEATURE_TYPE delta_item_w =
-          learning_rate * (error * get_user_weights(user, k) - item_fact_reg_ * get_item_weights(itemId, k));
-        //std::cout << "delta_item_w: " << delta_item_w << std::endl;
-        get_item_weights(itemId, k) += delta_item_w;
 #ifdef DEBUG
-        if (std::isnan(get_item_weights(itemId, k)) || std::isinf(get_item_weights(itemId, k))) {
+      for (uint64_t k = 0; k <= nfactors_; ++k) {
+        if (std::isnan(user_w[k]) || std::isinf(user_w[k]) ||
+            std::isnan(item_w[k]) || std::isinf(item_w[k])) {
           std::cout << "error: " << error << std::endl;
-          std::cout << "user weight: " << get_user_weights(user, k) << std::endl;
-          std::cout << "item weight: " << get_item_weights(itemId, k) << std::endl;
           std::cout << "learning_rate: " << learning_rate << std::endl;
-          throw std::runtime_error("nan in item weight");
+          throw std::runtime_error("nan in user or item row");
         }
-#endif
       }
+#endif
     }
   }
 }
@@ -375,6 +340,9 @@ std::pair<double, double> MFModel::calc_loss(SparseDataset& dataset, uint32_t st
 #endif
       FEATURE_TYPE rating = dataset.data_.at(userId).at(j).second;
 
+      if (off_userId >= nusers_ || movieId >= nitems_) {
+        throw std::runtime_error("Rating out of the model in calc_loss");
+      }
       FEATURE_TYPE prediction = predict(off_userId, movieId);
       FEATURE_TYPE e = rating - prediction;
 
@@ -422,29 +390,45 @@ std::unique_ptr<ModelGradient> MFModel::loadGradient(void* mem) const {
 }
 
 double MFModel::checksum() const {
-  return crc32(user_weights_.data(), user_weights_.size() * sizeof(FEATURE_TYPE));
+  return crc32(user_rows_.data(), user_rows_.size() * sizeof(FEATURE_TYPE));
 }
 
 void MFModel::print() const {
     std::cout << "MODEL user weights: ";
-    for (uint64_t i = 0; i < user_weights_.size(); ++i) {
-      std::cout << " " << user_weights_[i];
+    for (uint64_t i = 0; i < nusers_; ++i) {
+      for (uint64_t j = 0; j < nfactors_; ++j) {
+        std::cout << " " << user_row(i)[1 + j];
+      }
     }
     std::cout << std::endl;
 }
 
 FEATURE_TYPE& MFModel::get_user_bias(uint64_t userId) {
-  if (userId >= user_bias_.size()) {
+  if (userId >= nusers_) {
     throw std::runtime_error("User bias index too large");
   }
-  return user_bias_.at(userId);
+  return user_row(userId)[0];
 }
 
 FEATURE_TYPE& MFModel::get_item_bias(uint64_t itemId) {
-  if (itemId >= item_bias_.size()) {
+  if (itemId >= nitems_) {
+    throw std::runtime_error("Item bias index too large");
+  }
+  return item_row(itemId)[0];
+}
+
+const FEATURE_TYPE& MFModel::get_user_bias(uint64_t userId) const {
+  if (userId >= nusers_) {
+    throw std::runtime_error("User bias index too large");
+  }
+  return user_row(userId)[0];
+}
+
+const FEATURE_TYPE& MFModel::get_item_bias(uint64_t itemId) const {
+  if (itemId >= nitems_) {
     throw std::runtime_error("Item bias index too large");
   }
-  return item_bias_.at(itemId);
+  return item_row(itemId)[0];
 }
 
 }  // namespace cirrus
@@ -3,6 +3,8 @@
 
 #include <vector>
 #include <utility>
+#include <AlignedAllocator.h>
+#include <MFKernels.h>
 #include <Model.h>
 #include <Matrix.h>
 #include <Dataset.h>
@@ -13,11 +15,14 @@ namespace cirrus {
 
 /**
   * Matrix Factorization model
-  * Model is represented with a vector of FEATURE_TYPEs
+  * Each user and item has a row with its bias followed by its factors,
+  * padded with zeros to a multiple of a cache line. Rows are cache line
+  * aligned so that a row is read with one or two vector loads.
   */
 
 class MFModel : public CirrusModel {
  public:
+    friend class ModelUpdater;
     /**
       * MFModel constructor from weight vector
       * @param w Array of model weights
@@ -70,6 +75,12 @@ class MFModel : public CirrusModel {
      */
     void sgd_update(double learning_rate, const ModelGradient* gradient);
 
+    /**
+     * Adds a sparse gradient to the biases and factors it has
+     * @param gradient Gradient with as many factors as the model
+     */
+    void add_gradient(const MFGradientView& gradient);
+
     /**
      * Returns the size of the model weights serialized
      * @returns Size of the model when serialized
@@ -142,6 +153,22 @@ class MFModel : public CirrusModel {
       */
     uint64_t size() const;
 
+    /**
+      * Number of weights of a row with nfactors factors, padding included
+      */
+    static uint64_t row_stride(uint64_t nfactors);
+
+    /**
+      * Number of factors of each user and item
+      */
+    uint64_t get_nfactors() const { return nfactors_; }
+
+    /**
+      * Number of users and items of the model
+      */
+    uint64_t get_nusers() const { return nusers_; }
+    uint64_t get_nitems() const { return nitems_; }
+
  private:
     void initialize_reg_params();
     void initialize_data(uint64_t, uint64_t, uint64_t);
@@ -152,6 +179,8 @@ class MFModel : public CirrusModel {
     uint64_t nusers_;
     uint64_t nitems_;
     uint64_t nfactors_;
+    uint64_t row_stride_ = 0;
+    const MFKernels* kernels_ = nullptr;  //< for nfactors_ factors
 
  public:
     const FEATURE_TYPE& get_user_weights(uint64_t userId, uint64_t factor) const;
@@ -160,12 +189,29 @@ class MFModel : public CirrusModel {
     FEATURE_TYPE& get_item_weights(uint64_t itemId, uint64_t factor);
     FEATURE_TYPE& get_user_bias(uint64_t userId);
     FEATURE_TYPE& get_item_bias(uint64_t itemId);
+    const FEATURE_TYPE& get_user_bias(uint64_t userId) const;
+    const FEATURE_TYPE& get_item_bias(uint64_t itemId) const;
 
-    std::vector<FEATURE_TYPE> user_weights_;
-    std::vector<FEATURE_TYPE> item_weights_;
-
-    std::vector<FEATURE_TYPE> user_bias_;
-    std::vector<FEATURE_TYPE> item_bias_;
+    /**
+      * Row of a user or item: bias, then factors. Not bounds checked
+      */
+    FEATURE_TYPE* user_row(uint64_t userId) {
+      return &user_rows_[userId * row_stride_];
+    }
+    FEATURE_TYPE* item_row(uint64_t itemId) {
+      return &item_rows_[itemId * row_stride_];
+    }
+    const FEATURE_TYPE* user_row(uint64_t userId) const {
+      return &user_rows_[userId * row_stride_];
+    }
+    const FEATURE_TYPE* item_row(uint64_t itemId) const {
+      return &item_rows_[itemId * row_stride_];
+    }
+
+    using Rows = std::vector<FEATURE_TYPE, AlignedAllocator<FEATURE_TYPE>>;
+
+    Rows user_rows_;  //< nusers_ rows of row_stride_ weights
+    Rows item_rows_;  //< nitems_ rows of row_stride_ weights
 
     FEATURE_TYPE user_bias_reg_;
     FEATURE_TYPE item_bias_reg_;
@@ -73,10 +73,10 @@ void MFNetflixTask::run(const Configuration& config,
   uint64_t num_s3_batches = config.get_limit_samples() / config.get_s3_size();
   this->config = config;
 
-  psint = std::make_unique<PSSparseServerInterface>(ps_ip, ps_port);
+  psint = std::make_unique<PSSparseServerInterface>(ps_ip, ps_port, config);
   psint->connect();
 
-  mf_model_get = std::make_unique<MFModelGet>(ps_ip, ps_port);
+  mf_model_get = std::make_unique<MFModelGet>(ps_ip, ps_port, config);
 
   std::cout << "[WORKER] " << "num s3 batches: " << num_s3_batches
     << std::endl;
@@ -115,9 +115,62 @@ void MFNetflixTask::run(const Configuration& config,
                            config.get_minibatch_size(), false, worker, false,
                            false);
 
+  // in stale synchronous parallel mode, workers give their clock (number
+  // of minibatches done) to the parameter server before pulling a model
+  bool ssp = config.get_ssp_staleness() >= 0;
+  // the pipeline fetches ahead of the gradients it pushed, so its clock is
+  // the number of gradients pushed (only used by the pipeline thread)
+  uint64_t num_pushed = 0;
+
+  // the pipeline gets the data and models of the next minibatches and
+  // pushes the gradients from its own thread
+  std::unique_ptr<Pipeline> pipeline;
+  if (config.get_worker_pipeline_depth() > 0) {
+    pipeline = std::make_unique<Pipeline>(
+        config.get_worker_pipeline_depth(),
+        []() { return std::make_unique<PipelineWork>(); },
+        [&, this](PipelineWork* work) {
+          while (!get_dataset_minibatch(work->dataset, s3_iter)) {
+          }
+          if (ssp) {
+            mf_model_get->wait_for_clock(worker, num_pushed);
+          }
+          work->sample_index = sample_index;
+          work->model = mf_model_get->get_new_model(
+              *work->dataset, sample_index, config.get_minibatch_size());
+          sample_index += config.get_minibatch_size();
+          if (sample_index + config.get_minibatch_size() > sample_high) {
+            sample_index = sample_low;
+          }
+        },
+        [this, &num_pushed](std::unique_ptr<ModelGradient>& gradient) {
+          push_gradient(*dynamic_cast<MFSparseGradient*>(gradient.get()));
+          ++num_pushed;
+        });
+  }
+
   std::cout << "[WORKER] starting loop" << std::endl;
   int count = 0;
   while (1) {
+    if (pipeline) {
+      PipelineWork& work = pipeline->next();
+      std::unique_ptr<ModelGradient> gradient;
+      try {
+        gradient = work.model.minibatch_grad(
+            *work.dataset, config, work.sample_index);
+        pipeline->push(std::move(gradient));
+      } catch(...) {
+        std::cout << "There was an error computing the gradient" << std::endl;
+        exit(-1);
+      }
+      count++;
+      if (test_iters > 0 && count > test_iters) {
+        pipeline.reset();  // push the queued gradients
+        exit(0);
+      }
+      continue;
+    }
+
     // get data, labels and model
 #ifdef DEBUG
     std::cout << "[WORKER] running phase 1" << std::endl;
@@ -137,6 +190,9 @@ void MFNetflixTask::run(const Configuration& config,
     std::unique_ptr<ModelGradient> gradient;
 
     // we get the model subset with just the right amount of weights
+    if (ssp) {
+      mf_model_get->wait_for_clock(worker, count);
+    }
     SparseMFModel model =
       mf_model_get->get_new_model(
               *dataset, sample_index, config.get_minibatch_size());
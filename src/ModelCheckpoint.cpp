@@ -0,0 +1,138 @@
+#include "ModelCheckpoint.h"
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "Checksum.h"
+#include "MFModel.h"
+
+namespace cirrus {
+
+static std::runtime_error checkpoint_error(const std::string& what,
+                                           const std::string& path) {
+  return std::runtime_error(what + " " + path + ": " + strerror(errno));
+}
+
+uint64_t ModelCheckpoint::num_weights(const Header& header) {
+  return header.lr_size * 2 +
+         (header.nusers + header.nitems) * MFModel::row_stride(header.nfactors);
+}
+
+void ModelCheckpoint::save(const std::string& path,
+                           Header header,
+                           const std::function<void(FEATURE_TYPE*)>& fill) {
+  uint64_t weights_size = num_weights(header) * sizeof(FEATURE_TYPE);
+  uint64_t size = sizeof(Header) + weights_size;
+
+  std::string tmp_path = path + ".tmp";
+  int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    throw checkpoint_error("Error creating checkpoint", tmp_path);
+  }
+  void* data = MAP_FAILED;
+  try {
+    if (ftruncate(fd, size) != 0) {
+      throw checkpoint_error("Error sizing checkpoint", tmp_path);
+    }
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      throw checkpoint_error("Error mapping checkpoint", tmp_path);
+    }
+    // the weights go straight to the page cache and are written back as
+    // the file is synced
+    FEATURE_TYPE* weights =
+        reinterpret_cast<FEATURE_TYPE*>(reinterpret_cast<Header*>(data) + 1);
+    fill(weights);
+    header.checksum = crc32(weights, weights_size);
+    *reinterpret_cast<Header*>(data) = header;
+    if (msync(data, size, MS_SYNC) != 0 || fsync(fd) != 0) {
+      throw checkpoint_error("Error syncing checkpoint", tmp_path);
+    }
+  } catch (...) {
+    if (data != MAP_FAILED) {
+      munmap(data, size);
+    }
+    close(fd);
+    unlink(tmp_path.c_str());
+    throw;
+  }
+  munmap(data, size);
+  close(fd);
+
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    throw checkpoint_error("Error renaming checkpoint", tmp_path);
+  }
+
+  // make the rename itself durable
+  std::vector<char> dir(path.begin(), path.end());
+  dir.push_back('\0');
+  int dir_fd = ::open(dirname(dir.data()), O_RDONLY | O_DIRECTORY);
+  if (dir_fd != -1) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+}
+
+ModelCheckpoint::~ModelCheckpoint() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+}
+
+bool ModelCheckpoint::open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    if (errno == ENOENT) {
+      return false;
+    }
+    throw checkpoint_error("Error opening checkpoint", path);
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw checkpoint_error("Error reading checkpoint", path);
+  }
+  size_ = st.st_size;
+  if (size_ < sizeof(Header)) {
+    close(fd);
+    throw std::runtime_error("Checkpoint too small: " + path);
+  }
+
+  data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data_ == MAP_FAILED) {
+    data_ = nullptr;
+    throw checkpoint_error("Error mapping checkpoint", path);
+  }
+  // the whole file is read once, in order
+  madvise(data_, size_, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+  header_ = reinterpret_cast<const Header*>(data_);
+  weights_ = reinterpret_cast<const FEATURE_TYPE*>(header_ + 1);
+  if (header_->magic != MAGIC) {
+    throw std::runtime_error("Not a checkpoint: " + path);
+  }
+  if (header_->format_version != FORMAT_VERSION ||
+      header_->feature_size != sizeof(FEATURE_TYPE)) {
+    throw std::runtime_error("Unsupported checkpoint format: " + path);
+  }
+  uint64_t weights_size = num_weights(*header_) * sizeof(FEATURE_TYPE);
+  if (size_ != sizeof(Header) + weights_size) {
+    throw std::runtime_error("Checkpoint has the wrong size: " + path);
+  }
+  if (crc32(weights_, weights_size) != header_->checksum) {
+    throw std::runtime_error("Checkpoint is corrupted: " + path);
+  }
+  return true;
+}
+
+}  // namespace cirrus
@@ -0,0 +1,75 @@
+#ifndef _MODEL_CHECKPOINT_H_
+#define _MODEL_CHECKPOINT_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "config.h"
+
+namespace cirrus {
+
+/**
+  * Checkpoint file of the models kept by a parameter server
+  * FORMAT
+  * Header
+  * LR weights (lr_size * FEATURE_TYPE)
+  * LR weights history, used by AdaGrad (lr_size * FEATURE_TYPE)
+  * MF user rows (nusers * MFModel::row_stride(nfactors) * FEATURE_TYPE)
+  * MF item rows (nitems * MFModel::row_stride(nfactors) * FEATURE_TYPE)
+  * Rows hold a bias, the factors and padding, as in MFModel
+  */
+class ModelCheckpoint {
+ public:
+  static const uint32_t MAGIC = 0x54504b43;  // "CKPT"
+  static const uint32_t FORMAT_VERSION = 2;
+
+  struct Header {
+    uint32_t magic = MAGIC;
+    uint32_t format_version = FORMAT_VERSION;
+    uint64_t lr_size = 0;
+    uint64_t nusers = 0;
+    uint64_t nitems = 0;
+    uint64_t nfactors = 0;
+    uint32_t checksum = 0;  //< crc32 of the weights
+    uint32_t feature_size = sizeof(FEATURE_TYPE);
+  };
+
+  /**
+    * Number of weights stored in a checkpoint
+    */
+  static uint64_t num_weights(const Header& header);
+
+  /**
+    * Write a checkpoint to path atomically: the file is written next to
+    * path, synced to disk and then renamed over path. The weights are
+    * written in place in the mapped file, so saving does not need a copy
+    * of the models in memory
+    * @param fill Writes num_weights(header) weights laid out as in FORMAT
+    */
+  static void save(const std::string& path,
+                   Header header,
+                   const std::function<void(FEATURE_TYPE*)>& fill);
+
+  ModelCheckpoint() = default;
+  ~ModelCheckpoint();
+
+  /**
+    * Map the checkpoint at path and check it is valid
+    * @return false if there is no checkpoint at path
+    */
+  bool open(const std::string& path);
+
+  const Header& header() const { return *header_; }
+  const FEATURE_TYPE* weights() const { return weights_; }
+
+ private:
+  void* data_ = nullptr;  //< mapped file
+  uint64_t size_ = 0;
+  const Header* header_ = nullptr;
+  const FEATURE_TYPE* weights_ = nullptr;
+};
+
+}  // namespace cirrus
+
+#endif  // _MODEL_CHECKPOINT_H_
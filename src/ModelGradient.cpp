@@ -3,7 +3,11 @@
 #include <algorithm>
 #include <Utils.h>
 #include <cassert>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
 #include "Constants.h"
+#include "WireFormat.h"
 
 namespace cirrus {
 
@@ -156,6 +160,90 @@ uint64_t LRSparseGradient::getSerializedSize() const {
     sizeof(int) * 2; // version + number of weights
 }
 
+/** Format:
+ * version (int)
+ * number of weights N (int)
+ * quantization (uint32_t), only in WIRE_FORMAT_QUANTIZED
+ * N indices encoded with encode_sorted_indices
+ * N weights (N * FEATURE_TYPE or quantized with quantize_values)
+ */
+uint64_t LRSparseGradient::serializeCompact(void* mem,
+                                            uint32_t format,
+                                            uint32_t quantization) const {
+  auto by_index = [](const std::pair<int, FEATURE_TYPE>& a,
+                     const std::pair<int, FEATURE_TYPE>& b) {
+    return a.first < b.first;
+  };
+  std::vector<std::pair<int, FEATURE_TYPE>> sorted;
+  const std::vector<std::pair<int, FEATURE_TYPE>>* entries = &weights;
+  if (!std::is_sorted(weights.begin(), weights.end(), by_index)) {
+    sorted = weights;
+    std::sort(sorted.begin(), sorted.end(), by_index);
+    entries = &sorted;
+  }
+  if (format != WIRE_FORMAT_QUANTIZED) {
+    quantization = QUANTIZE_NONE;
+  }
+
+  char* data = reinterpret_cast<char*>(mem);
+  store_value<int>(data, version);
+  store_value<int>(data, entries->size());
+  if (format == WIRE_FORMAT_QUANTIZED) {
+    store_value<uint32_t>(data, quantization);
+  }
+  std::vector<uint32_t> indices(entries->size());
+  std::vector<FEATURE_TYPE> values(entries->size());
+  for (uint64_t i = 0; i < entries->size(); ++i) {
+    indices[i] = (*entries)[i].first;
+    values[i] = (*entries)[i].second;
+  }
+  data = encode_sorted_indices(indices.data(), indices.size(), data);
+  data = quantize_values(values.data(), values.size(), quantization, data);
+  return data - reinterpret_cast<char*>(mem);
+}
+
+uint64_t LRSparseGradient::getCompactSizeBound() const {
+  return sizeof(int) * 2 + sizeof(uint32_t) +
+         max_encoded_indices_size(weights.size()) +
+         max_quantized_size(weights.size());
+}
+
+void LRSparseGradient::loadSerializedCompact(const void* mem,
+                                             uint64_t size,
+                                             uint32_t format) {
+  const char* data = reinterpret_cast<const char*>(mem);
+  const char* end = data + size;
+  uint32_t header_size = sizeof(int) * 2;
+  if (format == WIRE_FORMAT_QUANTIZED) {
+    header_size += sizeof(uint32_t);
+  }
+  if (size < header_size) {
+    throw std::runtime_error("Truncated gradient");
+  }
+  version = load_value<int>(data);
+  int num_weights = load_value<int>(data);
+  // every index takes at least a byte
+  if (num_weights < 0 || static_cast<uint64_t>(num_weights) > size) {
+    throw std::runtime_error("Wrong number of weights");
+  }
+  uint32_t quantization = QUANTIZE_NONE;
+  if (format == WIRE_FORMAT_QUANTIZED) {
+    quantization = load_value<uint32_t>(data);
+  }
+
+  std::vector<uint32_t> indices(num_weights);
+  data = decode_sorted_indices(data, end, num_weights, indices.data());
+  weights.resize(num_weights);
+  for (int i = 0; i < num_weights; ++i) {
+    weights[i].first = indices[i];
+  }
+  // values are dequantized straight into the weights the updates read
+  dequantize_values(data, end, num_weights, quantization,
+                    [this](uint64_t i, FEATURE_TYPE value) {
+                      weights[i].second = value;
+                    });
+}
+
 void LRSparseGradient::print() const {
   std::cout << "Printing LRSparseGradient. version: " << version << std::endl;
   for (const auto &v : weights) {
@@ -310,120 +398,302 @@ void MFGradient::check_values() const {
   }
 }
 
-MFSparseGradient::MFSparseGradient() {
-  //users_bias_grad.resize(nusers);
-  //users_weights_grad.resize(nusers);
+MFSparseGradient::MFSparseGradient(uint32_t nfactors) : nfactors(nfactors) {}
+
+uint32_t MFSparseGradient::Entries::add(int id, uint32_t nfactors) {
+  ids.push_back(id);
+  biases.push_back(0);
+  factors.resize(factors.size() + nfactors);
+  return ids.size() - 1;
+}
+
+void MFSparseGradient::Entries::resize(uint32_t size, uint32_t nfactors) {
+  ids.resize(size);
+  biases.resize(size);
+  factors.resize(static_cast<uint64_t>(size) * nfactors);
+}
+
+MFGradientEntries MFSparseGradient::Entries::view() const {
+  MFGradientEntries entries;
+  entries.size = ids.size();
+  entries.ids = ids.data();
+  entries.biases = biases.data();
+  entries.factors = factors.data();
+  return entries;
+}
+
+void MFSparseGradient::reserve(uint32_t nusers, uint32_t nitems) {
+  users.ids.reserve(nusers);
+  users.biases.reserve(nusers);
+  users.factors.reserve(static_cast<uint64_t>(nusers) * nfactors);
+  items.ids.reserve(nitems);
+  items.biases.reserve(nitems);
+  items.factors.reserve(static_cast<uint64_t>(nitems) * nfactors);
+}
+
+MFGradientView MFSparseGradient::view() const {
+  MFGradientView view;
+  view.nfactors = nfactors;
+  view.users = users.view();
+  view.items = items.view();
+  return view;
+}
+
+// bytes taken by count users or items in the raw format
+static uint64_t raw_entries_size(uint64_t count, uint32_t nfactors) {
+  return count * (sizeof(int) + (1 + nfactors) * sizeof(FEATURE_TYPE));
+}
 
-  //items_bias_grad.resize(nitems);
-  //items_weights_grad.resize(nitems);
+// copy count values between an array and serialized memory
+template <typename T>
+static void store_array(char*& data, const T* values, uint64_t count) {
+  if (count > 0) {
+    std::memcpy(data, values, count * sizeof(T));
+  }
+  data += count * sizeof(T);
+}
+
+template <typename T>
+static void load_array(const char*& data, T* values, uint64_t count) {
+  if (count > 0) {
+    std::memcpy(values, data, count * sizeof(T));
+  }
+  data += count * sizeof(T);
 }
 
 /** FORMAT of the Matrix Factorization sparse gradient
- * number of users (uint32_t)
- * number of items (uint32_t)
- * user_bias [# users] (FEATURE_TYPE)
- * item_bias [# items] (FEATURE_TYPE)
- * user weights grad id (uint32_t) and [# users * NUM_FACTORS] (uint32_t + FEATURE_TYPE)
- * item_weights_grad id (uint32_t) [# items * NUM_FACTORS] (uint32_t + FEATURE_TYPE)
+ * magic number (uint32_t)
+ * number of users U (uint32_t)
+ * number of items I (uint32_t)
+ * number of factors F (uint32_t)
+ * U user ids (int), U user biases, U * F user factors (FEATURE_TYPE)
+ * I item ids (int), I item biases, I * F item factors (FEATURE_TYPE)
+ * magic number (uint32_t)
+ * Users and items are the arrays of MFGradientEntries, which lets
+ * MFGradientView read a serialized gradient in place.
  */
 uint64_t MFSparseGradient::getSerializedSize() const {
-  return sizeof(uint32_t) * (2 + 2) // also count magic values
-    + users_bias_grad.size() * (sizeof(int) + sizeof(FEATURE_TYPE))
-    + items_bias_grad.size() * (sizeof(int) + sizeof(FEATURE_TYPE))
-    + users_weights_grad.size() * (sizeof(int) + NUM_FACTORS * sizeof(FEATURE_TYPE))
-    + items_weights_grad.size() *  (sizeof(int) + NUM_FACTORS * sizeof(FEATURE_TYPE));
+  return sizeof(uint32_t) * (3 + 2) // also count magic values
+    + raw_entries_size(num_users(), nfactors)
+    + raw_entries_size(num_items(), nfactors);
 }
 
 void MFSparseGradient::serialize(void *mem) const {
-  store_value<uint32_t>(mem, MAGIC_NUMBER); // magic value
-  store_value<uint32_t>(mem, users_bias_grad.size());
-  store_value<uint32_t>(mem, items_bias_grad.size());
-
-  // First we serialize the bias values
-  for (const auto& user_bias : users_bias_grad) {
-    store_value<int>(mem, user_bias.first);
-    store_value<FEATURE_TYPE>(mem, user_bias.second);
-  }
-  for (const auto& bias_grad : items_bias_grad) {
-    store_value<int>(mem, bias_grad.first);
-    store_value<FEATURE_TYPE>(mem, bias_grad.second);
-  }
-
-  // Second we serialize the weight gradients
-  assert(users_weights_grad.size() == users_bias_grad.size());
-  for (const auto& user : users_weights_grad) {
-    store_value<int>(mem, user.first);
-    assert(user.second.size() == NUM_FACTORS);
-    for (const auto& weight_grad : user.second) {
-      store_value<FEATURE_TYPE>(mem, weight_grad);
-    }
+  char* data = reinterpret_cast<char*>(mem);
+  store_value<uint32_t>(data, MAGIC_NUMBER); // magic value
+  store_value<uint32_t>(data, num_users());
+  store_value<uint32_t>(data, num_items());
+  store_value<uint32_t>(data, nfactors);
+  for (const Entries* entries : {&users, &items}) {
+    store_array(data, entries->ids.data(), entries->ids.size());
+    store_array(data, entries->biases.data(), entries->biases.size());
+    store_array(data, entries->factors.data(), entries->factors.size());
   }
-
-  assert(items_weights_grad.size() == items_bias_grad.size());
-  for (const auto& item : items_weights_grad) {
-    //std::cout << "Serializing itemId: " << item.first << std::endl;
-    store_value<int>(mem, item.first);
-    assert(item.second.size() == NUM_FACTORS);
-    for (const auto& weight_grad : item.second) {
-      store_value<FEATURE_TYPE>(mem, weight_grad);
-    }
-  }
-  store_value<uint32_t>(mem, 0x1338); // magic value
+  store_value<uint32_t>(data, 0x1338); // magic value
 }
 
 void MFSparseGradient::loadSerialized(const void* mem) {
-  uint32_t magic_value = load_value<uint32_t>(mem);
+  const char* data = reinterpret_cast<const char*>(mem);
+  uint32_t magic_value = load_value<uint32_t>(data);
   assert(magic_value == MAGIC_NUMBER);
-  uint32_t users_size = load_value<uint32_t>(mem);
-  uint32_t items_size = load_value<uint32_t>(mem);
-  //users_bias_grad.reserve(users_size);
-  //items_bias_grad.reserve(items_size);
-  
-  for (uint32_t i = 0; i < users_size; ++i) {
-    int user_id = load_value<int>(mem);
-    FEATURE_TYPE user_bias = load_value<FEATURE_TYPE>(mem);
-    users_bias_grad[user_id] = user_bias;
-  }
-  for (uint32_t i = 0; i < items_size; ++i) {
-    int item_id = load_value<int>(mem);
-    FEATURE_TYPE item_grad = load_value<FEATURE_TYPE>(mem);
-    items_bias_grad[item_id] = item_grad;
-  }
-  for (uint32_t i = 0; i < users_size; ++i) {
-    std::pair<int, std::vector<FEATURE_TYPE>> user_weights_grad;
-    user_weights_grad.first = load_value<int>(mem);
-    user_weights_grad.second.reserve(NUM_FACTORS);
-    for (uint32_t j = 0; j < NUM_FACTORS; ++j) {
-      FEATURE_TYPE weight = load_value<FEATURE_TYPE>(mem);
-      user_weights_grad.second.push_back(weight);
-    }
-    users_weights_grad.push_back(user_weights_grad);
-  }
-  
-  for (uint32_t i = 0; i < items_size; ++i) {
-    std::pair<int, std::vector<FEATURE_TYPE>> item_weights_grad;
-    item_weights_grad.first = load_value<int>(mem);
-    //std::cout << "loadSerialized itemId: " << item_weights_grad.first << std::endl;
-    item_weights_grad.second.reserve(NUM_FACTORS);
-    for (uint32_t j = 0; j < NUM_FACTORS; ++j) {
-      FEATURE_TYPE weight = load_value<FEATURE_TYPE>(mem);
-      item_weights_grad.second.push_back(weight);
-    }
-    items_weights_grad.push_back(item_weights_grad);
+  uint32_t users_size = load_value<uint32_t>(data);
+  uint32_t items_size = load_value<uint32_t>(data);
+  nfactors = load_value<uint32_t>(data);
+  if (nfactors == 0 || nfactors > MAX_NUM_FACTORS) {
+    throw std::runtime_error("Wrong MF gradient");
+  }
+  users.resize(users_size, nfactors);
+  items.resize(items_size, nfactors);
+  for (Entries* entries : {&users, &items}) {
+    load_array(data, entries->ids.data(), entries->ids.size());
+    load_array(data, entries->biases.data(), entries->biases.size());
+    load_array(data, entries->factors.data(), entries->factors.size());
   }
-  magic_value = load_value<uint32_t>(mem);
+  magic_value = load_value<uint32_t>(data);
   assert(magic_value == 0x1338);
 }
 
-void MFSparseGradient::check_values() const {
-  for (const auto& user : users_weights_grad) {
-    if (user.first < 0) {
-      throw std::runtime_error("Wrong id");
+// users or items of a serialized gradient starting at data
+static const char* view_entries(const char* data,
+                                uint32_t nfactors,
+                                MFGradientEntries* entries) {
+  entries->ids = reinterpret_cast<const int*>(data);
+  data += entries->size * sizeof(int);
+  entries->biases = reinterpret_cast<const FEATURE_TYPE*>(data);
+  data += entries->size * sizeof(FEATURE_TYPE);
+  entries->factors = reinterpret_cast<const FEATURE_TYPE*>(data);
+  return data +
+         static_cast<uint64_t>(entries->size) * nfactors * sizeof(FEATURE_TYPE);
+}
+
+MFGradientView MFGradientView::of_serialized(const void* mem, uint64_t size) {
+  const char* data = reinterpret_cast<const char*>(mem);
+  if (reinterpret_cast<uintptr_t>(data) % alignof(FEATURE_TYPE) != 0) {
+    throw std::runtime_error("Unaligned MF gradient");
+  }
+  if (size < sizeof(uint32_t) * 5 ||
+      load_value<uint32_t>(data) != MAGIC_NUMBER) {
+    throw std::runtime_error("Wrong MF gradient");
+  }
+  MFGradientView view;
+  view.users.size = load_value<uint32_t>(data);
+  view.items.size = load_value<uint32_t>(data);
+  view.nfactors = load_value<uint32_t>(data);
+  if (view.nfactors == 0 || view.nfactors > MAX_NUM_FACTORS ||
+      size != sizeof(uint32_t) * 5 +
+                  raw_entries_size(view.users.size, view.nfactors) +
+                  raw_entries_size(view.items.size, view.nfactors)) {
+    throw std::runtime_error("Wrong MF gradient");
+  }
+  data = view_entries(data, view.nfactors, &view.users);
+  data = view_entries(data, view.nfactors, &view.items);
+  if (load_value<uint32_t>(data) != 0x1338) {
+    throw std::runtime_error("Wrong MF gradient");
+  }
+  return view;
+}
+
+void MFGradientView::check_bounds(uint64_t nusers,
+                                  uint64_t nitems,
+                                  uint64_t nfactors) const {
+  if (this->nfactors != nfactors) {
+    throw std::runtime_error(
+        "MF gradient has " + std::to_string(this->nfactors) +
+        " factors, the model " + std::to_string(nfactors));
+  }
+  auto check_ids = [](const MFGradientEntries& entries, uint64_t count) {
+    for (uint32_t i = 0; i < entries.size; ++i) {
+      if (entries.ids[i] < 0 ||
+          static_cast<uint64_t>(entries.ids[i]) >= count) {
+        throw std::runtime_error("MF row out of bounds: " +
+                                 std::to_string(entries.ids[i]));
+      }
     }
+  };
+  check_ids(users, nusers);
+  check_ids(items, nitems);
+}
+
+// ids, biases and factors of users or items in a compact MF gradient,
+// sorted by id
+static char* serialize_compact_entries(const MFGradientEntries& entries,
+                                       uint32_t nfactors,
+                                       uint32_t quantization,
+                                       char* data) {
+  std::vector<uint32_t> order(entries.size);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&entries](uint32_t a, uint32_t b) {
+    return entries.ids[a] < entries.ids[b];
+  });
+  std::vector<uint32_t> ids(entries.size);
+  std::vector<FEATURE_TYPE> biases(entries.size);
+  std::vector<FEATURE_TYPE> factors(static_cast<uint64_t>(entries.size) *
+                                    nfactors);
+  for (uint64_t i = 0; i < order.size(); ++i) {
+    ids[i] = entries.ids[order[i]];
+    biases[i] = entries.biases[order[i]];
+    std::copy_n(entries.factors + static_cast<uint64_t>(order[i]) * nfactors,
+                nfactors, &factors[i * nfactors]);
   }
-  for (const auto& item : items_weights_grad) {
-    if (item.first < 0) {
-      throw std::runtime_error("Wrong id");
+  data = encode_sorted_indices(ids.data(), ids.size(), data);
+  data = quantize_values(biases.data(), biases.size(), quantization, data);
+  return quantize_values(factors.data(), factors.size(), quantization, data);
+}
+
+/** FORMAT of the compact Matrix Factorization sparse gradient
+ * magic number (uint32_t)
+ * number of users U (uint32_t)
+ * number of items I (uint32_t)
+ * number of factors F (uint32_t)
+ * quantization (uint32_t), only in WIRE_FORMAT_QUANTIZED
+ * U user ids (encoded), U user biases and U * F user factors
+ * I item ids (encoded), I item biases and I * F item factors
+ * magic number (uint32_t)
+ * Ids are encoded with encode_sorted_indices. Biases and factors are
+ * FEATURE_TYPE or quantized with quantize_values, one call per array.
+ */
+uint64_t MFSparseGradient::serializeCompact(void* mem,
+                                            uint32_t format,
+                                            uint32_t quantization) const {
+  if (format != WIRE_FORMAT_QUANTIZED) {
+    quantization = QUANTIZE_NONE;
+  }
+  char* data = reinterpret_cast<char*>(mem);
+  store_value<uint32_t>(data, MAGIC_NUMBER);
+  store_value<uint32_t>(data, num_users());
+  store_value<uint32_t>(data, num_items());
+  store_value<uint32_t>(data, nfactors);
+  if (format == WIRE_FORMAT_QUANTIZED) {
+    store_value<uint32_t>(data, quantization);
+  }
+  data = serialize_compact_entries(users.view(), nfactors, quantization, data);
+  data = serialize_compact_entries(items.view(), nfactors, quantization, data);
+  store_value<uint32_t>(data, 0x1338);
+  return data - reinterpret_cast<char*>(mem);
+}
+
+uint64_t MFSparseGradient::getCompactSizeBound() const {
+  uint64_t bound = sizeof(uint32_t) * 6;
+  for (uint64_t count : {num_users(), num_items()}) {
+    bound += max_encoded_indices_size(count) + max_quantized_size(count) +
+             max_quantized_size(count * nfactors);
+  }
+  return bound;
+}
+
+void MFSparseGradient::loadSerializedCompact(const void* mem,
+                                             uint64_t size,
+                                             uint32_t format) {
+  const char* data = reinterpret_cast<const char*>(mem);
+  const char* end = data + size;
+  uint32_t header_size = sizeof(uint32_t) * 5;
+  if (format == WIRE_FORMAT_QUANTIZED) {
+    header_size += sizeof(uint32_t);
+  }
+  if (size < header_size || load_value<uint32_t>(data) != MAGIC_NUMBER) {
+    throw std::runtime_error("Wrong MF gradient");
+  }
+  uint32_t users_size = load_value<uint32_t>(data);
+  uint32_t items_size = load_value<uint32_t>(data);
+  nfactors = load_value<uint32_t>(data);
+  // every id takes at least a byte
+  if (nfactors == 0 || nfactors > MAX_NUM_FACTORS ||
+      static_cast<uint64_t>(users_size) + items_size > size) {
+    throw std::runtime_error("Wrong MF gradient");
+  }
+  uint32_t quantization = QUANTIZE_NONE;
+  if (format == WIRE_FORMAT_QUANTIZED) {
+    quantization = load_value<uint32_t>(data);
+  }
+
+  auto load_entries = [&](uint32_t count, Entries* entries) {
+    entries->resize(count, nfactors);
+    // ids are read as uint32_t, same size as int
+    data = decode_sorted_indices(
+        data, end, count, reinterpret_cast<uint32_t*>(entries->ids.data()));
+    data = dequantize_values(data, end, count, quantization,
+                             [entries](uint64_t i, FEATURE_TYPE value) {
+                               entries->biases[i] = value;
+                             });
+    data = dequantize_values(data, end, entries->factors.size(), quantization,
+                             [entries](uint64_t i, FEATURE_TYPE value) {
+                               entries->factors[i] = value;
+                             });
+  };
+  load_entries(users_size, &users);
+  load_entries(items_size, &items);
+  if (static_cast<uint64_t>(end - data) < sizeof(uint32_t) ||
+      load_value<uint32_t>(data) != 0x1338) {
+    throw std::runtime_error("Wrong MF gradient");
+  }
+}
+
+void MFSparseGradient::check_values() const {
+  for (const Entries* entries : {&users, &items}) {
+    for (const auto& id : entries->ids) {
+      if (id < 0) {
+        throw std::runtime_error("Wrong id");
+      }
     }
   }
 }
@@ -7,6 +7,8 @@
 #include <iostream>
 #include <unordered_map>
 #include <config.h>
+#include <Quantization.h>
+#include <WireFormat.h>
 
 namespace cirrus {
 
@@ -93,8 +95,13 @@ class LRSparseGradient : public ModelGradient {
     friend class Momentum;
     friend class SGD;
     friend class Nesterov;
+    friend class ModelUpdater;
     friend class LRModel;
     friend class SparseLRModel;
+    friend class PSSparseServerInterface;
+    friend class GradientCoalescer;
+    friend class GradientCompressor;
+    friend class AsyncGradientSender;
 
     virtual ~LRSparseGradient() = default;
 
@@ -108,6 +115,21 @@ class LRSparseGradient : public ModelGradient {
     void serialize(void*) const override;
     uint64_t getSerializedSize() const override;
 
+    /**
+      * Serialization in WIRE_FORMAT_VARINT (weights sorted by index) or
+      * WIRE_FORMAT_QUANTIZED
+      * @param mem Has room for getCompactSizeBound() bytes
+      * @param quantization Encoding of the values in WIRE_FORMAT_QUANTIZED
+      * @return Number of bytes used
+      */
+    uint64_t serializeCompact(void* mem,
+                              uint32_t format = WIRE_FORMAT_VARINT,
+                              uint32_t quantization = QUANTIZE_NONE) const;
+    uint64_t getCompactSizeBound() const;
+    void loadSerializedCompact(const void* mem,
+                               uint64_t size,
+                               uint32_t format = WIRE_FORMAT_VARINT);
+
     void print() const override;
     void check_values() const override;
  protected:
@@ -154,39 +176,121 @@ class MFGradient : public ModelGradient {
     std::vector<std::vector<FEATURE_TYPE>> weights;
 };
 
+/**
+  * Users or items of a sparse MF gradient as flat arrays: entry i has id
+  * ids[i], bias gradient biases[i] and the nfactors factor gradients at
+  * factors + i * nfactors
+  */
+struct MFGradientEntries {
+  uint32_t size = 0;
+  const int* ids = nullptr;
+  const FEATURE_TYPE* biases = nullptr;
+  const FEATURE_TYPE* factors = nullptr;
+};
+
+/**
+  * Read only view of a sparse MF gradient, over a MFSparseGradient or over
+  * a gradient serialized in WIRE_FORMAT_RAW, which has the same layout.
+  * The memory it views must outlive it
+  */
+struct MFGradientView {
+  uint32_t nfactors = 0;
+  MFGradientEntries users;
+  MFGradientEntries items;
+
+  /**
+    * View of a gradient serialized by MFSparseGradient::serialize, without
+    * copying it
+    * @param mem Serialized gradient, aligned to alignof(FEATURE_TYPE)
+    * @param size Size of the serialized gradient, checked against its header
+    */
+  static MFGradientView of_serialized(const void* mem, uint64_t size);
+
+  /**
+    * Throw if the gradient does not fit a model with nusers users, nitems
+    * items and nfactors factors, before any of it is applied
+    */
+  void check_bounds(uint64_t nusers, uint64_t nitems, uint64_t nfactors) const;
+};
+
+/**
+  * Sparse gradient of the MF model. Users and items are kept as flat
+  * arrays (see MFGradientEntries) so building, serializing and loading it
+  * does not allocate per user or item
+  */
 class MFSparseGradient : public ModelGradient {
  public:
-    friend class MFModel;
-
-    MFSparseGradient();
+    /**
+      * @param nfactors Number of factors of each user and item
+      */
+    explicit MFSparseGradient(uint32_t nfactors = NUM_FACTORS);
     virtual ~MFSparseGradient() = default;
 
     void loadSerialized(const void*);
     void serialize(void*) const override;
     uint64_t getSerializedSize() const override;
 
+    /**
+      * Serialization in WIRE_FORMAT_VARINT (ids sorted) or
+      * WIRE_FORMAT_QUANTIZED
+      * @param mem Has room for getCompactSizeBound() bytes
+      * @param quantization Encoding of the values in WIRE_FORMAT_QUANTIZED
+      * @return Number of bytes used
+      */
+    uint64_t serializeCompact(void* mem,
+                              uint32_t format = WIRE_FORMAT_VARINT,
+                              uint32_t quantization = QUANTIZE_NONE) const;
+    uint64_t getCompactSizeBound() const;
+    void loadSerializedCompact(const void* mem,
+                               uint64_t size,
+                               uint32_t format = WIRE_FORMAT_VARINT);
+
     void print() const {
-      std::cout << users_bias_grad.size() << " / " << users_weights_grad.size() << std::endl;
-      std::cout << items_bias_grad.size() << " / " << items_weights_grad.size() << std::endl;
+      std::cout << num_users() << " users / " << num_items() << " items"
+                << std::endl;
     }
     void check_values() const override;
- public:
-    void check() {
-      assert(users_bias_grad.size() == users_weights_grad.size());
-      assert(items_bias_grad.size() == items_weights_grad.size());
+
+    /**
+      * Append a user (item) with zero gradients. Pointers to the factors
+      * of the gradient are invalidated
+      * @return Index of the user (item) in the gradient
+      */
+    uint32_t add_user(int id) { return users.add(id, nfactors); }
+    uint32_t add_item(int id) { return items.add(id, nfactors); }
+
+    void reserve(uint32_t nusers, uint32_t nitems);
+
+    uint32_t num_users() const { return users.ids.size(); }
+    uint32_t num_items() const { return items.ids.size(); }
+
+    FEATURE_TYPE& user_bias(uint32_t i) { return users.biases[i]; }
+    FEATURE_TYPE& item_bias(uint32_t i) { return items.biases[i]; }
+    FEATURE_TYPE* user_factors(uint32_t i) {
+      return &users.factors[static_cast<uint64_t>(i) * nfactors];
+    }
+    FEATURE_TYPE* item_factors(uint32_t i) {
+      return &items.factors[static_cast<uint64_t>(i) * nfactors];
     }
 
-    // [D * K]
-    std::unordered_map<int, FEATURE_TYPE> users_bias_grad;
-    std::unordered_map<int, FEATURE_TYPE> items_bias_grad;
-    //std::vector<FEATURE_TYPE> items_bias_grad;
-
-    // user id and then weights
-    std::vector<
-      std::pair<int, std::vector<FEATURE_TYPE>>> users_weights_grad;
-    // item id and then weights
-    std::vector<
-      std::pair<int, std::vector<FEATURE_TYPE>>> items_weights_grad;
+    MFGradientView view() const;
+
+    uint32_t nfactors;  //< size of each factors vector
+
+ private:
+    // users or items, laid out as in MFGradientEntries
+    struct Entries {
+      std::vector<int> ids;
+      std::vector<FEATURE_TYPE> biases;
+      std::vector<FEATURE_TYPE> factors;
+
+      uint32_t add(int id, uint32_t nfactors);
+      void resize(uint32_t size, uint32_t nfactors);
+      MFGradientEntries view() const;
+    };
+
+    Entries users;
+    Entries items;
 };
 
 } // namespace cirrus
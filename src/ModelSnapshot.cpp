@@ -0,0 +1,109 @@
+#include "ModelSnapshot.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace cirrus {
+
+ModelSnapshot::ModelSnapshot() {
+  std::atomic_init(&out_, static_cast<FEATURE_TYPE*>(nullptr));
+  std::atomic_init(&epoch_, 0UL);
+  std::atomic_init(&pinned_, false);
+}
+
+void ModelSnapshot::copy(
+    const std::vector<Region>& regions,
+    FEATURE_TYPE* out,
+    const std::function<std::unique_lock<std::mutex>()>& block_updates) {
+  std::lock_guard<std::mutex> guard(readers_lock_);
+  {
+    std::unique_lock<std::mutex> lock = block_updates();
+    pin(regions, out);
+  }
+  finish();
+}
+
+void ModelSnapshot::pin(const std::vector<Region>& regions,
+                        FEATURE_TYPE* out) {
+  if (pinned()) {
+    throw std::runtime_error("Model snapshot already pinned");
+  }
+
+  if (regions_.empty()) {
+    // page tables are built once and never change afterwards, so updaters
+    // can use them without locking
+    uint64_t num_pages = 0;
+    uint64_t offset = 0;
+    for (const auto& region : regions) {
+      out_offset_.push_back(offset);
+      first_page_.push_back(num_pages);
+      offset += region.size;
+      num_pages += (region.size + PAGE_SIZE - 1) / PAGE_SIZE;
+    }
+    page_locks_.reset(new SpinLock[num_pages]);
+    page_epoch_.reset(new std::atomic<uint64_t>[num_pages]);
+    for (uint64_t i = 0; i < num_pages; ++i) {
+      std::atomic_init(&page_epoch_[i], 0UL);
+    }
+    regions_ = regions;
+  } else if (regions.size() != regions_.size() ||
+             !std::equal(regions.begin(), regions.end(), regions_.begin(),
+                         [](const Region& a, const Region& b) {
+                           return a.data == b.data && a.size == b.size;
+                         })) {
+    throw std::runtime_error("Model snapshot regions changed");
+  }
+
+  // updaters read the epoch before out_
+  out_.store(out, std::memory_order_relaxed);
+  epoch_.store(epoch_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  pinned_.store(true, std::memory_order_release);
+}
+
+void ModelSnapshot::finish() {
+  for (uint32_t r = 0; r < regions_.size(); ++r) {
+    uint64_t num_pages = (regions_[r].size + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (uint64_t page = 0; page < num_pages; ++page) {
+      copy_page(r, page);
+    }
+  }
+  // every page now has the current epoch so late updaters copy nothing
+  pinned_.store(false, std::memory_order_release);
+}
+
+void ModelSnapshot::preserve(uint32_t region,
+                             uint64_t begin,
+                             uint64_t count) {
+  if (region >= regions_.size() || count == 0 ||
+      begin >= regions_[region].size) {
+    return;
+  }
+  uint64_t end = std::min(begin + count, regions_[region].size);
+  for (uint64_t page = begin / PAGE_SIZE; page <= (end - 1) / PAGE_SIZE;
+       ++page) {
+    copy_page(region, page);
+  }
+}
+
+void ModelSnapshot::copy_page(uint32_t region, uint64_t page) {
+  uint64_t page_id = first_page_[region] + page;
+  uint64_t epoch = epoch_.load(std::memory_order_acquire);
+  if (page_epoch_[page_id].load(std::memory_order_acquire) == epoch) {
+    return;
+  }
+
+  page_locks_[page_id].wait();
+  if (page_epoch_[page_id].load(std::memory_order_relaxed) != epoch) {
+    const Region& r = regions_[region];
+    uint64_t begin = page * PAGE_SIZE;
+    uint64_t end = std::min(begin + PAGE_SIZE, r.size);
+    std::copy(r.data + begin, r.data + end,
+              out_.load(std::memory_order_relaxed) + out_offset_[region] +
+                  begin);
+    page_epoch_[page_id].store(epoch, std::memory_order_release);
+  }
+  page_locks_[page_id].signal();
+}
+
+}  // namespace cirrus
@@ -0,0 +1,81 @@
+#ifndef _MODEL_SNAPSHOT_H_
+#define _MODEL_SNAPSHOT_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Synchronization.h"
+#include "config.h"
+
+namespace cirrus {
+
+/**
+  * Copy-on-write snapshots of the weight arrays of a model.
+  * A reader pins a snapshot and then copies the model into its buffer page
+  * by page, without blocking updates. An updater that is about to write to
+  * a page the reader has not copied yet copies the page into the snapshot
+  * first, so the snapshot keeps the values the model had when it was pinned.
+  * Updates only pay for this while a snapshot is pinned, at most once per
+  * page they touch.
+  */
+class ModelSnapshot {
+ public:
+  static const uint64_t PAGE_SIZE = 1024;  //< weights per page
+
+  /**
+    * A weight array of the model
+    */
+  struct Region {
+    const FEATURE_TYPE* data;
+    uint64_t size;
+  };
+
+  ModelSnapshot();
+
+  /**
+    * Copy the regions one after the other into out, as they were when
+    * block_updates() returned. Updates are only blocked while the snapshot
+    * is pinned, not during the copy. Concurrent copies wait for each other.
+    * The regions must be the same (and not reallocated) across copies
+    * @param block_updates Returns a lock that blocks updates to the regions
+    */
+  void copy(const std::vector<Region>& regions,
+            FEATURE_TYPE* out,
+            const std::function<std::unique_lock<std::mutex>()>& block_updates);
+
+  bool pinned() const { return pinned_.load(std::memory_order_acquire); }
+
+  /**
+    * To be called before writing entries [begin, begin + count) of a region
+    * Only needed when pinned() is true
+    */
+  void preserve(uint32_t region, uint64_t begin, uint64_t count);
+
+ private:
+  void pin(const std::vector<Region>& regions, FEATURE_TYPE* out);
+
+  // copy the pages not already copied by updaters and release the snapshot
+  void finish();
+
+  // copy a page of a region into the snapshot unless it was already copied
+  void copy_page(uint32_t region, uint64_t page);
+
+  std::vector<Region> regions_;
+  std::vector<uint64_t> out_offset_;  //< where each region goes in out_
+  std::vector<uint64_t> first_page_;  //< first page number of each region
+  std::unique_ptr<SpinLock[]> page_locks_;
+  std::unique_ptr<std::atomic<uint64_t>[]> page_epoch_;  //< epoch copied
+
+  std::atomic<FEATURE_TYPE*> out_;
+  std::atomic<uint64_t> epoch_;  //< epoch of the current snapshot
+  std::atomic<bool> pinned_;
+  std::mutex readers_lock_;  //< one snapshot at a time
+};
+
+}  // namespace cirrus
+
+#endif  // _MODEL_SNAPSHOT_H_
@@ -0,0 +1,312 @@
+#include "ModelUpdater.h"
+#include "AdaGrad.h"
+#include "PSMetrics.h"
+#include "SGD.h"
+#include "Utils.h"
+
+namespace cirrus {
+
+ModelUpdater::ModelUpdater(Mode mode,
+                           uint64_t lr_model_size,
+                           uint64_t nusers,
+                           uint64_t nitems)
+    : mode_(mode),
+      nusers_(nusers),
+      nitems_(nitems),
+      lr_versions_(lr_model_size) {
+  while (lr_model_size > 0 &&
+         ((lr_model_size - 1) >> stripe_shift_) >= NUM_STRIPES) {
+    stripe_shift_++;
+  }
+  if (mode_ == STRIPED) {
+    stripes_.reset(new Stripe[NUM_STRIPES]);
+    mf_row_locks_.reset(new SpinLock[nusers_ + nitems_]);
+  }
+}
+
+ModelUpdater::Mode ModelUpdater::mode_from_string(const std::string& mode) {
+  if (mode == "global") {
+    return GLOBAL;
+  } else if (mode == "striped") {
+    return STRIPED;
+  } else if (mode == "hogwild") {
+    return HOGWILD;
+  }
+  throw std::runtime_error("Unknown update mode: " + mode);
+}
+
+void ModelUpdater::check_optimizer(
+    const OptimizationMethod& opt_method) const {
+  // momentum methods keep a single running average across all weights
+  if (mode_ != GLOBAL && !opt_method.allows_concurrent_updates()) {
+    throw std::runtime_error(
+        "Concurrent ps_update_mode only supports adagrad and sgd");
+  }
+}
+
+std::unique_lock<std::mutex> ModelUpdater::read_lock() {
+  if (mode_ == GLOBAL) {
+    return std::unique_lock<std::mutex>(global_lock_);
+  }
+  return std::unique_lock<std::mutex>();
+}
+
+void ModelUpdater::serialize_lr_model(const SparseLRModel& model,
+                                      char* mem) {
+  store_value<int>(mem, model.weights_.size());
+  lr_snapshot_.copy({{model.weights_.data(), model.weights_.size()}},
+                    reinterpret_cast<FEATURE_TYPE*>(mem),
+                    [this]() { return read_lock(); });
+}
+
+void ModelUpdater::serialize_mf_model(const MFModel& model, char* mem) {
+  store_value<uint64_t>(mem, model.nusers_);
+  store_value<uint64_t>(mem, model.nitems_);
+  store_value<uint64_t>(mem, model.nfactors_);
+  mf_snapshot_.copy({{model.user_rows_.data(), model.user_rows_.size()},
+                     {model.item_rows_.data(), model.item_rows_.size()}},
+                    reinterpret_cast<FEATURE_TYPE*>(mem),
+                    [this]() { return read_lock(); });
+}
+
+uint64_t ModelUpdater::lr_changed_pages(uint64_t since,
+                                        std::vector<uint32_t>* pages) {
+  return lr_versions_.changed_since(since, pages);
+}
+
+ModelCheckpoint::Header ModelUpdater::checkpoint_header(
+    const SparseLRModel& lr_model,
+    const MFModel& mf_model) {
+  ModelCheckpoint::Header header;
+  header.lr_size = lr_model.weights_.size();
+  header.nusers = mf_model.nusers_;
+  header.nitems = mf_model.nitems_;
+  header.nfactors = mf_model.nfactors_;
+  return header;
+}
+
+void ModelUpdater::copy_checkpoint(const SparseLRModel& lr_model,
+                                   const MFModel& mf_model,
+                                   FEATURE_TYPE* weights) {
+  checkpoint_snapshot_.copy(
+      {{lr_model.weights_.data(), lr_model.weights_.size()},
+       {lr_model.weights_hist_.data(), lr_model.weights_hist_.size()},
+       {mf_model.user_rows_.data(), mf_model.user_rows_.size()},
+       {mf_model.item_rows_.data(), mf_model.item_rows_.size()}},
+      weights, [this]() { return read_lock(); });
+}
+
+void ModelUpdater::load_checkpoint(const ModelCheckpoint& checkpoint,
+                                   SparseLRModel* lr_model,
+                                   MFModel* mf_model) {
+  const ModelCheckpoint::Header& header = checkpoint.header();
+  if (header.lr_size != lr_model->weights_.size() ||
+      header.nusers != mf_model->nusers_ ||
+      header.nitems != mf_model->nitems_ ||
+      header.nfactors != mf_model->nfactors_) {
+    throw std::runtime_error(
+        "Checkpoint does not match the configuration"
+        " lr_size: " + std::to_string(header.lr_size) +
+        " nusers: " + std::to_string(header.nusers) +
+        " nitems: " + std::to_string(header.nitems) +
+        " nfactors: " + std::to_string(header.nfactors));
+  }
+
+  const FEATURE_TYPE* data = checkpoint.weights();
+  for (auto* v : {&lr_model->weights_, &lr_model->weights_hist_}) {
+    std::copy(data, data + v->size(), v->begin());
+    data += v->size();
+  }
+  for (auto* v : {&mf_model->user_rows_, &mf_model->item_rows_}) {
+    std::copy(data, data + v->size(), v->begin());
+    data += v->size();
+  }
+}
+
+void ModelUpdater::preserve_lr_entries(const LRSparseGradient& gradient) {
+  bool full_model = lr_snapshot_.pinned();
+  bool checkpoint = checkpoint_snapshot_.pinned();
+  if (!full_model && !checkpoint) {
+    return;
+  }
+  for (const auto& w : gradient.weights) {
+    if (full_model) {
+      lr_snapshot_.preserve(0, w.first, 1);
+    }
+    if (checkpoint) {
+      // the weight and its history
+      checkpoint_snapshot_.preserve(0, w.first, 1);
+      checkpoint_snapshot_.preserve(1, w.first, 1);
+    }
+  }
+}
+
+void ModelUpdater::preserve_mf_entries(const MFModel& model,
+                                       const MFGradientView& gradient) {
+  if (mf_snapshot_.pinned()) {
+    preserve_mf_rows(&mf_snapshot_, 0, model, gradient);
+  }
+  if (checkpoint_snapshot_.pinned()) {
+    preserve_mf_rows(&checkpoint_snapshot_, 2, model, gradient);
+  }
+}
+
+void ModelUpdater::preserve_mf_rows(ModelSnapshot* snapshot,
+                                    uint32_t first_region,
+                                    const MFModel& model,
+                                    const MFGradientView& gradient) {
+  // the bias and the factors of a row
+  for (uint32_t i = 0; i < gradient.users.size; ++i) {
+    snapshot->preserve(
+        first_region,
+        &model.get_user_bias(gradient.users.ids[i]) - model.user_rows_.data(),
+        1 + gradient.nfactors);
+  }
+  for (uint32_t i = 0; i < gradient.items.size; ++i) {
+    snapshot->preserve(
+        first_region + 1,
+        &model.get_item_bias(gradient.items.ids[i]) - model.item_rows_.data(),
+        1 + gradient.nfactors);
+  }
+}
+
+void ModelUpdater::apply_lr_gradient(std::unique_ptr<SparseLRModel>& model,
+                                     OptimizationMethod* opt_method,
+                                     const LRSparseGradient& gradient) {
+  PageVersions::Update update(&lr_versions_);
+  if (update.tracking()) {
+    for (const auto& w : gradient.weights) {
+      update.mark(w.first);
+    }
+  }
+
+  if (mode_ == GLOBAL) {
+    TimedLock<std::mutex> guard(&global_lock_);
+    preserve_lr_entries(gradient);
+    opt_method->sgd_update(model, &gradient);
+    return;
+  }
+
+  preserve_lr_entries(gradient);
+
+  // dispatch once per gradient so that per-weight updates get inlined
+  if (const AdaGrad* adagrad = dynamic_cast<const AdaGrad*>(opt_method)) {
+    apply_lr_entries(model.get(), *adagrad, gradient);
+  } else if (const SGD* sgd = dynamic_cast<const SGD*>(opt_method)) {
+    apply_lr_entries(model.get(), *sgd, gradient);
+  } else {
+    apply_lr_entries(model.get(), *opt_method, gradient);
+  }
+}
+
+template <typename Opt>
+void ModelUpdater::apply_lr_entries(SparseLRModel* model,
+                                    const Opt& opt_method,
+                                    const LRSparseGradient& gradient) {
+  FEATURE_TYPE* weights = model->weights_.data();
+  FEATURE_TYPE* weights_hist = model->weights_hist_.data();
+  const auto& entries = gradient.weights;
+
+  if (mode_ == HOGWILD) {
+    for (const auto& w : entries) {
+      int index = w.first;
+      FEATURE_TYPE weight = relaxed_load(&weights[index]);
+      FEATURE_TYPE weight_hist = relaxed_load(&weights_hist[index]);
+      opt_method.update_weight(weight, weight_hist, w.second);
+      relaxed_store(&weights[index], weight);
+      relaxed_store(&weights_hist[index], weight_hist);
+    }
+    return;
+  }
+
+  // Group the entries by stripe (counting sort) so that each stripe lock
+  // is taken once per gradient. Only one lock is held at a time.
+  uint32_t stripe_begin[NUM_STRIPES + 1] = {0};
+  for (const auto& w : entries) {
+    stripe_begin[((w.first >> stripe_shift_) % NUM_STRIPES) + 1]++;
+  }
+  for (uint64_t s = 0; s < NUM_STRIPES; ++s) {
+    stripe_begin[s + 1] += stripe_begin[s];
+  }
+
+  static thread_local std::vector<uint32_t> order;
+  order.resize(entries.size());
+  uint32_t next[NUM_STRIPES];
+  std::copy(stripe_begin, stripe_begin + NUM_STRIPES, next);
+  for (uint32_t i = 0; i < entries.size(); ++i) {
+    order[next[(entries[i].first >> stripe_shift_) % NUM_STRIPES]++] = i;
+  }
+
+  for (uint64_t s = 0; s < NUM_STRIPES; ++s) {
+    if (stripe_begin[s] == stripe_begin[s + 1]) {
+      continue;
+    }
+    TimedLock<SpinLock> guard(&stripes_[s].lock);
+    for (uint32_t i = stripe_begin[s]; i < stripe_begin[s + 1]; ++i) {
+      const auto& w = entries[order[i]];
+      opt_method.update_weight(weights[w.first], weights_hist[w.first],
+                               w.second);
+    }
+  }
+}
+
+SpinLock* ModelUpdater::mf_row_lock(bool is_user, uint64_t id) {
+  if ((is_user && id >= nusers_) || (!is_user && id >= nitems_)) {
+    throw std::runtime_error("MF row out of bounds: " + std::to_string(id));
+  }
+  if (mode_ != STRIPED) {
+    return nullptr;
+  }
+  return &mf_row_locks_[is_user ? id : nusers_ + id];
+}
+
+void ModelUpdater::add_to_row(FEATURE_TYPE* row,
+                              const FEATURE_TYPE* delta,
+                              uint64_t size,
+                              SpinLock* lock) {
+  if (mode_ == HOGWILD) {
+    for (uint64_t i = 0; i < size; ++i) {
+      relaxed_store(&row[i], relaxed_load(&row[i]) + delta[i]);
+    }
+    return;
+  }
+
+  // rows are held for a handful of instructions, only time the waits
+  TimedLock<SpinLock> guard(lock, false);
+  MFKernels::get(size).add(row, delta, size);
+}
+
+void ModelUpdater::apply_mf_gradient(MFModel* model,
+                                     const MFGradientView& gradient) {
+  if (gradient.nfactors != model->nfactors_) {
+    throw std::runtime_error(
+        "MF gradient has " + std::to_string(gradient.nfactors) +
+        " factors, the model " + std::to_string(model->nfactors_));
+  }
+  if (mode_ == GLOBAL) {
+    TimedLock<std::mutex> guard(&global_lock_);
+    preserve_mf_entries(*model, gradient);
+    model->add_gradient(gradient);
+    return;
+  }
+
+  preserve_mf_entries(*model, gradient);
+
+  const uint64_t nfactors = gradient.nfactors;
+  for (uint32_t i = 0; i < gradient.users.size; ++i) {
+    int id = gradient.users.ids[i];
+    SpinLock* lock = mf_row_lock(true, id);
+    add_to_row(&model->get_user_bias(id), &gradient.users.biases[i], 1, lock);
+    add_to_row(&model->get_user_weights(id, 0),
+               gradient.users.factors + i * nfactors, nfactors, lock);
+  }
+  for (uint32_t i = 0; i < gradient.items.size; ++i) {
+    int id = gradient.items.ids[i];
+    SpinLock* lock = mf_row_lock(false, id);
+    add_to_row(&model->get_item_bias(id), &gradient.items.biases[i], 1, lock);
+    add_to_row(&model->get_item_weights(id, 0),
+               gradient.items.factors + i * nfactors, nfactors, lock);
+  }
+}
+
+}  // namespace cirrus
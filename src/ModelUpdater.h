@@ -0,0 +1,162 @@
+#ifndef _MODEL_UPDATER_H_
+#define _MODEL_UPDATER_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "MFModel.h"
+#include "ModelCheckpoint.h"
+#include "ModelGradient.h"
+#include "ModelSnapshot.h"
+#include "OptimizationMethod.h"
+#include "PageVersions.h"
+#include "SparseLRModel.h"
+#include "Synchronization.h"
+
+namespace cirrus {
+
+/**
+  * Relaxed atomic accesses to model weights (hogwild updates)
+  */
+template <typename T>
+inline T relaxed_load(const T* ptr) {
+  T value;
+  __atomic_load(ptr, &value, __ATOMIC_RELAXED);
+  return value;
+}
+
+template <typename T>
+inline void relaxed_store(T* ptr, T value) {
+  __atomic_store(ptr, &value, __ATOMIC_RELAXED);
+}
+
+/**
+  * Applies gradients to the models kept by the parameter server.
+  * Modes:
+  * global: a single lock serializes all updates
+  * striped: the LR model is split in NUM_STRIPES contiguous index ranges,
+  *          each protected by a spinlock. MF users/items have per-row
+  *          spinlocks
+  * hogwild: no locks, weights are read and written with relaxed atomics
+  */
+class ModelUpdater {
+ public:
+  enum Mode { GLOBAL, STRIPED, HOGWILD };
+
+  /**
+    * @param mode Synchronization mode
+    * @param lr_model_size Number of weights of the LR model
+    * @param nusers Number of users of the MF model
+    * @param nitems Number of items of the MF model
+    */
+  ModelUpdater(Mode mode,
+               uint64_t lr_model_size,
+               uint64_t nusers,
+               uint64_t nitems);
+
+  static Mode mode_from_string(const std::string& mode);
+
+  /**
+    * Throw if opt_method can't be used in this mode. The concurrent modes
+    * apply the entries of a gradient independently with update_weight()
+    */
+  void check_optimizer(const OptimizationMethod& opt_method) const;
+
+  void apply_lr_gradient(std::unique_ptr<SparseLRModel>& model,
+                         OptimizationMethod* opt_method,
+                         const LRSparseGradient& gradient);
+  void apply_mf_gradient(MFModel* model, const MFGradientView& gradient);
+
+  /**
+    * Serialize a whole model into mem (same format as serializeTo)
+    * Updates are only blocked while a snapshot is pinned, not during the
+    * copy. Only GLOBAL mode gives readers a consistent view of the model
+    */
+  void serialize_lr_model(const SparseLRModel& model, char* mem);
+  void serialize_mf_model(const MFModel& model, char* mem);
+
+  /**
+    * Header of a checkpoint of both models
+    */
+  static ModelCheckpoint::Header checkpoint_header(
+      const SparseLRModel& lr_model,
+      const MFModel& mf_model);
+
+  /**
+    * Copy both models and the AdaGrad history into weights, laid out as in
+    * a ModelCheckpoint. Like serialize_lr_model, updates keep going while
+    * we copy and the copy is consistent in GLOBAL mode
+    * @param weights Has room for ModelCheckpoint::num_weights() weights
+    */
+  void copy_checkpoint(const SparseLRModel& lr_model,
+                       const MFModel& mf_model,
+                       FEATURE_TYPE* weights);
+
+  /**
+    * Load both models from a checkpoint (no updates should be running)
+    */
+  void load_checkpoint(const ModelCheckpoint& checkpoint,
+                       SparseLRModel* lr_model,
+                       MFModel* mf_model);
+
+  /**
+    * Pages of the LR model changed since a version (see PageVersions)
+    * @return Version to ask for next time
+    */
+  uint64_t lr_changed_pages(uint64_t since, std::vector<uint32_t>* pages);
+
+  Mode get_mode() const { return mode_; }
+
+ private:
+  static const uint64_t NUM_STRIPES = 64;
+
+  // keep each stripe lock in its own cache line
+  struct alignas(64) Stripe {
+    SpinLock lock;
+  };
+
+  // apply an LR gradient with an optimizer known at compile time
+  template <typename Opt>
+  void apply_lr_entries(SparseLRModel* model,
+                        const Opt& opt_method,
+                        const LRSparseGradient& gradient);
+
+  // blocks updates in GLOBAL mode
+  std::unique_lock<std::mutex> read_lock();
+
+  // copy the pages a gradient is about to write into pinned snapshots
+  void preserve_lr_entries(const LRSparseGradient& gradient);
+  void preserve_mf_entries(const MFModel& model,
+                           const MFGradientView& gradient);
+  // first_region: region of the user bias in the snapshot
+  void preserve_mf_rows(ModelSnapshot* snapshot,
+                        uint32_t first_region,
+                        const MFModel& model,
+                        const MFGradientView& gradient);
+
+  SpinLock* mf_row_lock(bool is_user, uint64_t id);
+
+  // add delta to a row of the MF model protected by lock
+  void add_to_row(FEATURE_TYPE* row,
+                  const FEATURE_TYPE* delta,
+                  uint64_t size,
+                  SpinLock* lock);
+
+  Mode mode_;
+  uint64_t stripe_shift_ = 0;  //< index >> stripe_shift_ gives the stripe
+  uint64_t nusers_;
+  uint64_t nitems_;
+  std::mutex global_lock_;
+  std::unique_ptr<Stripe[]> stripes_;
+  std::unique_ptr<SpinLock[]> mf_row_locks_;  //< users followed by items
+
+  ModelSnapshot lr_snapshot_;
+  ModelSnapshot mf_snapshot_;  //< user rows, item rows
+  ModelSnapshot checkpoint_snapshot_;  //< LR weights and history, then MF
+  PageVersions lr_versions_;
+};
+
+}  // namespace cirrus
+
+#endif  // _MODEL_UPDATER_H_
@@ -0,0 +1,164 @@
+#include "MuxConnection.h"
+
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+#include "Constants.h"
+#include "Utils.h"
+
+namespace cirrus {
+
+std::shared_ptr<MuxConnection> MuxConnection::get(const std::string& ip,
+                                                  int port) {
+  static std::mutex registry_lock;
+  static std::map<std::pair<std::string, int>, std::weak_ptr<MuxConnection>>
+      registry;
+
+  std::lock_guard<std::mutex> guard(registry_lock);
+  std::weak_ptr<MuxConnection>& entry = registry[std::make_pair(ip, port)];
+  std::shared_ptr<MuxConnection> conn = entry.lock();
+  if (!conn || conn->closed()) {
+    conn = std::make_shared<MuxConnection>(ip, port);
+    entry = conn;
+  }
+  return conn;
+}
+
+MuxConnection::MuxConnection(const std::string& ip, int port) {
+  if ((sock_ = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    throw std::runtime_error("Error when creating socket.");
+  }
+  int opt = 1;
+  if (setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt))) {
+    close(sock_);
+    throw std::runtime_error("Error setting socket options.");
+  }
+
+  struct sockaddr_in serv_addr;
+  std::memset(&serv_addr, 0, sizeof(serv_addr));
+  serv_addr.sin_family = AF_INET;
+  serv_addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, ip.c_str(), &serv_addr.sin_addr) != 1) {
+    close(sock_);
+    throw std::runtime_error("Address family invalid or invalid "
+        "IP address passed in");
+  }
+  if (::connect(sock_, (struct sockaddr*) &serv_addr, sizeof(serv_addr)) <
+      0) {
+    close(sock_);
+    throw std::runtime_error("Failed to make contact with server with ip: " +
+                             ip + " port: " + std::to_string(port) + "\n");
+  }
+
+  // the reply to this request has no id yet
+  uint32_t operation = ENABLE_REQUEST_IDS;
+  uint32_t enabled = 0;
+  if (send_all(sock_, &operation, sizeof(uint32_t)) == -1 ||
+      read_all(sock_, &enabled, sizeof(uint32_t)) == 0 || enabled != 1) {
+    close(sock_);
+    throw std::runtime_error("Error enabling request ids");
+  }
+  reader_ = std::thread(&MuxConnection::reader_loop, this);
+}
+
+MuxConnection::~MuxConnection() {
+  // wakes up the reader thread
+  shutdown(sock_, SHUT_RDWR);
+  reader_.join();
+  close(sock_);
+}
+
+uint32_t MuxConnection::send(const void* data, uint64_t size) {
+  std::lock_guard<std::mutex> guard(send_lock_);
+  uint32_t id = next_id_++;
+  struct iovec iov[2];
+  iov[0].iov_base = &id;
+  iov[0].iov_len = sizeof(uint32_t);
+  iov[1].iov_base = const_cast<void*>(data);
+  iov[1].iov_len = size;
+  struct msghdr msg;
+  std::memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+
+  // resume after partial sends
+  while (msg.msg_iovlen > 0) {
+    ssize_t ret = sendmsg(sock_, &msg, 0);
+    if (ret == -1) {
+      throw std::runtime_error("Error sending request");
+    }
+    uint64_t sent = ret;
+    while (msg.msg_iovlen > 0 && sent >= msg.msg_iov[0].iov_len) {
+      sent -= msg.msg_iov[0].iov_len;
+      ++msg.msg_iov;
+      --msg.msg_iovlen;
+    }
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov[0].iov_base =
+          static_cast<char*>(msg.msg_iov[0].iov_base) + sent;
+      msg.msg_iov[0].iov_len -= sent;
+    }
+  }
+  return id;
+}
+
+std::vector<char> MuxConnection::wait_reply(uint32_t id) {
+  std::unique_lock<std::mutex> lock(lock_);
+  cv_.wait(lock, [this, id]() {
+    return closed_ || replies_.find(id) != replies_.end();
+  });
+  auto it = replies_.find(id);
+  if (it == replies_.end()) {
+    throw std::runtime_error("Connection closed before the reply");
+  }
+  std::vector<char> reply = std::move(it->second);
+  replies_.erase(it);
+  return reply;
+}
+
+bool MuxConnection::closed() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return closed_;
+}
+
+/**
+  * FORMAT of a reply
+  * request id (uint32_t)
+  * size of the reply (uint32_t)
+  * reply
+  */
+void MuxConnection::reader_loop() {
+  try {
+    while (true) {
+      uint32_t header[2];
+      if (read_all(sock_, header, sizeof(header)) == 0) {
+        break;
+      }
+      std::vector<char> reply(header[1]);
+      if (header[1] > 0 && read_all(sock_, reply.data(), header[1]) == 0) {
+        break;
+      }
+      {
+        std::lock_guard<std::mutex> guard(lock_);
+        replies_[header[0]] = std::move(reply);
+      }
+      cv_.notify_all();
+    }
+  } catch (const std::runtime_error&) {
+    // read errors close the connection like the end of the stream
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    closed_ = true;
+  }
+  cv_.notify_all();
+}
+
+}  // namespace cirrus
@@ -0,0 +1,82 @@
+#ifndef _MUX_CONNECTION_H_
+#define _MUX_CONNECTION_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace cirrus {
+
+/**
+  * Connection to a parameter server shared by the threads of a process.
+  * Each request is tagged with an id (ENABLE_REQUEST_IDS) and the server
+  * tags its reply with the same id, so a thread can send its request
+  * while others wait for theirs. A reader thread reads the replies and
+  * hands each one to the thread waiting for it, in whatever order they
+  * arrive.
+  *
+  * Requests are sent whole (the id and then the request, in one call) so
+  * requests of different threads never interleave.
+  */
+class MuxConnection {
+ public:
+  /**
+    * Connection to ip:port shared with the other callers, made if there
+    * is none or the previous one was closed
+    */
+  static std::shared_ptr<MuxConnection> get(const std::string& ip, int port);
+
+  /**
+    * Connect and switch the connection to requests with ids
+    */
+  MuxConnection(const std::string& ip, int port);
+
+  /**
+    * Stop the reader thread and close the connection. Replies not waited
+    * for are dropped
+    */
+  ~MuxConnection();
+
+  MuxConnection(const MuxConnection&) = delete;
+  MuxConnection& operator=(const MuxConnection&) = delete;
+
+  /**
+    * Send a request (operation id followed by its arguments)
+    * @return Id of the request, to wait for its reply with. Requests the
+    *         server does not reply to must not be waited for
+    */
+  uint32_t send(const void* data, uint64_t size);
+
+  /**
+    * Wait for the whole reply to a request
+    * Throws if the connection is closed first
+    */
+  std::vector<char> wait_reply(uint32_t id);
+
+  bool closed() const;
+
+ private:
+  void reader_loop();
+
+  int sock_ = -1;
+
+  std::mutex send_lock_;
+  uint32_t next_id_ = 0;
+
+  mutable std::mutex lock_;
+  std::condition_variable cv_;
+  // replies read but not waited for yet, by request id
+  std::unordered_map<uint32_t, std::vector<char>> replies_;
+  bool closed_ = false;
+
+  std::thread reader_;
+};
+
+}  // namespace cirrus
+
+#endif  // _MUX_CONNECTION_H_
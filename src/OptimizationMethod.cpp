@@ -10,4 +10,14 @@ void OptimizationMethod::edit_weight(double& weight) {
   return;
 }
 
+void OptimizationMethod::update_weight(FEATURE_TYPE&,
+                                       FEATURE_TYPE&,
+                                       FEATURE_TYPE) const {
+  throw std::runtime_error("Per-weight updates not supported");
+}
+
+bool OptimizationMethod::allows_concurrent_updates() const {
+  return false;
+}
+
 }  // namespace cirrus
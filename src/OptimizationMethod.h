@@ -20,6 +20,20 @@ class OptimizationMethod {
       const ModelGradient* gradient) = 0;
    virtual void edit_weight(double& weight);
 
+   /**
+     * Apply a single gradient entry to a weight and its update history.
+     * Used by ModelUpdater, which takes care of synchronization
+     */
+   virtual void update_weight(FEATURE_TYPE& weight,
+                              FEATURE_TYPE& weight_hist,
+                              FEATURE_TYPE value) const;
+
+   /**
+     * Whether the entries of a gradient can be applied independently
+     * (and concurrently) with update_weight()
+     */
+   virtual bool allows_concurrent_updates() const;
+
  protected:
    double learning_rate;
 };
@@ -0,0 +1,224 @@
+#include "PSMetrics.h"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace cirrus {
+
+// request handled by the calling thread
+static thread_local PSMetrics::RequestTimer* current_request = nullptr;
+
+PSMetrics::ThreadMetrics::ThreadMetrics() {
+  for (int op = 0; op < NUM_PS_OPS; ++op) {
+    std::atomic_init(&bytes_in[op], 0UL);
+    std::atomic_init(&bytes_out[op], 0UL);
+  }
+  std::atomic_init(&lock_hold_ns, 0UL);
+}
+
+PSMetrics::PSMetrics(uint32_t num_threads)
+    : num_threads_(num_threads), threads_(new ThreadMetrics[num_threads]) {}
+
+PSMetrics::RequestTimer::RequestTimer(PSMetrics* metrics,
+                                      uint32_t thread_number,
+                                      uint64_t start_us)
+    : metrics_(metrics), thread_number_(thread_number) {
+  if (thread_number >= metrics->num_threads_) {
+    throw std::runtime_error("Wrong metrics thread number");
+  }
+  uint64_t now_us = get_time_us();
+  queue_wait_ns_ =
+      (start_us != 0 && now_us > start_us) ? (now_us - start_us) * 1000 : 0;
+  start_ns_ = get_monotonic_time_ns();
+  io_start_ = thread_io_counters();
+  lap_ns_ = start_ns_;
+  lap_io_ns_ = io_start_.read_ns + io_start_.send_ns;
+  lap_lock_ns_ = 0;
+  current_request = this;
+}
+
+PSMetrics::RequestTimer::~RequestTimer() {
+  current_request = nullptr;
+  if (operation_ >= NUM_PS_OPS) {
+    return;
+  }
+
+  const IOCounters& io = thread_io_counters();
+  stage_ns_[STAGE_QUEUE_WAIT] = queue_wait_ns_;
+  stage_ns_[STAGE_READ] = io.read_ns - io_start_.read_ns + read_ns_;
+  stage_ns_[STAGE_SEND] = io.send_ns - io_start_.send_ns;
+  stage_ns_[STAGE_LOCK_WAIT] = lock_wait_ns_;
+  stage_ns_[STAGE_TOTAL] =
+      queue_wait_ns_ + get_monotonic_time_ns() - start_ns_;
+  has_stage_[STAGE_QUEUE_WAIT] = queue_wait_ns_ != 0;
+  has_stage_[STAGE_READ] =
+      io.bytes_read != io_start_.bytes_read || read_bytes_ != 0;
+  has_stage_[STAGE_SEND] = io.bytes_sent != io_start_.bytes_sent;
+  has_stage_[STAGE_TOTAL] = true;
+
+  ThreadMetrics& thread = metrics_->threads_[thread_number_];
+  for (uint32_t stage = 0; stage < NUM_PS_STAGES; ++stage) {
+    if (has_stage_[stage]) {
+      thread.stages[operation_][stage].record(stage_ns_[stage]);
+    }
+  }
+  add(&thread.bytes_in[operation_],
+      io.bytes_read - io_start_.bytes_read + read_bytes_);
+  add(&thread.bytes_out[operation_], io.bytes_sent - io_start_.bytes_sent);
+  add(&thread.lock_hold_ns, lock_hold_ns_);
+}
+
+void PSMetrics::RequestTimer::add_read(uint64_t bytes, uint64_t ns) {
+  read_bytes_ += bytes;
+  read_ns_ += ns;
+}
+
+void PSMetrics::RequestTimer::lap(PSStage stage) {
+  uint64_t now = get_monotonic_time_ns();
+  const IOCounters& io = thread_io_counters();
+  uint64_t io_ns = io.read_ns + io.send_ns;
+  uint64_t elapsed = now - lap_ns_;
+  uint64_t excluded = (io_ns - lap_io_ns_) + (lock_wait_ns_ - lap_lock_ns_);
+  stage_ns_[stage] += elapsed > excluded ? elapsed - excluded : 0;
+  has_stage_[stage] = true;
+  lap_ns_ = now;
+  lap_io_ns_ = io_ns;
+  lap_lock_ns_ = lock_wait_ns_;
+}
+
+void PSMetrics::lap(PSStage stage) {
+  if (current_request) {
+    current_request->lap(stage);
+  }
+}
+
+bool PSMetrics::is_timing() {
+  return current_request != nullptr;
+}
+
+void PSMetrics::add_lock_wait(uint64_t ns) {
+  if (current_request) {
+    current_request->lock_wait_ns_ += ns;
+    current_request->has_stage_[STAGE_LOCK_WAIT] = true;
+  }
+}
+
+void PSMetrics::add_lock_hold(uint64_t ns) {
+  if (current_request) {
+    current_request->lock_hold_ns_ += ns;
+  }
+}
+
+void PSMetrics::add_to(uint32_t operation,
+                       PSStage stage,
+                       std::vector<uint64_t>* counts) const {
+  for (uint32_t i = 0; i < num_threads_; ++i) {
+    threads_[i].stages[operation][stage].add_to(counts);
+  }
+}
+
+std::string PSMetrics::stage_name(PSStage stage) {
+  switch (stage) {
+    case STAGE_QUEUE_WAIT:
+      return "queue_wait";
+    case STAGE_READ:
+      return "read";
+    case STAGE_DESERIALIZE:
+      return "deserialize";
+    case STAGE_LOCK_WAIT:
+      return "lock_wait";
+    case STAGE_APPLY:
+      return "apply";
+    case STAGE_SERIALIZE:
+      return "serialize";
+    case STAGE_SEND:
+      return "send";
+    case STAGE_TOTAL:
+      return "total";
+    default:
+      throw std::runtime_error("Unknown stage");
+  }
+}
+
+/**
+  * FORMAT
+  * {"uptime_sec": N, "lock_hold_ns": N,
+  *  "ops": {"<op name>": {"count": N, "bytes_in": N, "bytes_out": N,
+  *          "stages": {"<stage name>": {"count": N, "p50_ns": N,
+  *                     "p90_ns": N, "p99_ns": N, "p999_ns": N}, ...}},
+  *          ...},
+  *  "ssp": {...}}
+  * Operations that were never called and stages a request did not go
+  * through are left out. Percentiles are upper bounds of histogram buckets.
+  * "ssp" (see SSPClock::to_json) is only there in stale synchronous mode
+  */
+std::string PSMetrics::to_json(
+    const std::map<int, std::string>& operation_to_name,
+    uint64_t uptime_sec,
+    const std::string& ssp_json) const {
+  uint64_t lock_hold_ns = 0;
+  for (uint32_t i = 0; i < num_threads_; ++i) {
+    lock_hold_ns += threads_[i].lock_hold_ns.load(std::memory_order_relaxed);
+  }
+
+  std::ostringstream out;
+  out << "{\"uptime_sec\": " << uptime_sec
+      << ", \"lock_hold_ns\": " << lock_hold_ns << ", \"ops\": {";
+  bool first_op = true;
+  for (int op = 0; op < NUM_PS_OPS; ++op) {
+    std::vector<uint64_t> total(LatencyHistogram::NUM_BUCKETS, 0);
+    add_to(op, STAGE_TOTAL, &total);
+    uint64_t count = 0;
+    for (const auto& c : total) {
+      count += c;
+    }
+    if (count == 0) {
+      continue;
+    }
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    for (uint32_t i = 0; i < num_threads_; ++i) {
+      bytes_in += threads_[i].bytes_in[op].load(std::memory_order_relaxed);
+      bytes_out += threads_[i].bytes_out[op].load(std::memory_order_relaxed);
+    }
+
+    auto name = operation_to_name.find(op);
+    out << (first_op ? "" : ", ") << "\""
+        << (name != operation_to_name.end() ? name->second
+                                             : std::to_string(op))
+        << "\": {\"count\": " << count << ", \"bytes_in\": " << bytes_in
+        << ", \"bytes_out\": " << bytes_out << ", \"stages\": {";
+    first_op = false;
+
+    bool first_stage = true;
+    for (uint32_t stage = 0; stage < NUM_PS_STAGES; ++stage) {
+      std::vector<uint64_t> counts(LatencyHistogram::NUM_BUCKETS, 0);
+      add_to(op, static_cast<PSStage>(stage), &counts);
+      uint64_t stage_count = 0;
+      for (const auto& c : counts) {
+        stage_count += c;
+      }
+      if (stage_count == 0) {
+        continue;
+      }
+      out << (first_stage ? "" : ", ") << "\""
+          << stage_name(static_cast<PSStage>(stage))
+          << "\": {\"count\": " << stage_count
+          << ", \"p50_ns\": " << LatencyHistogram::percentile(counts, 50)
+          << ", \"p90_ns\": " << LatencyHistogram::percentile(counts, 90)
+          << ", \"p99_ns\": " << LatencyHistogram::percentile(counts, 99)
+          << ", \"p999_ns\": " << LatencyHistogram::percentile(counts, 99.9)
+          << "}";
+      first_stage = false;
+    }
+    out << "}}";
+  }
+  out << "}";
+  if (!ssp_json.empty()) {
+    out << ", \"ssp\": " << ssp_json;
+  }
+  out << "}";
+  return out.str();
+}
+
+}  // namespace cirrus
@@ -0,0 +1,192 @@
+#ifndef _PS_METRICS_H_
+#define _PS_METRICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Constants.h"
+#include "LatencyHistogram.h"
+#include "Synchronization.h"
+#include "Utils.h"
+
+namespace cirrus {
+
+/**
+  * Stages of a parameter server request
+  */
+enum PSStage : uint32_t {
+  STAGE_QUEUE_WAIT,   //< from the socket being readable to being handled
+  STAGE_READ,         //< reading the request from the socket
+  STAGE_DESERIALIZE,  //< decoding gradients and index lists
+  STAGE_LOCK_WAIT,    //< waiting for contended model locks
+  STAGE_APPLY,        //< updating the model, without lock waits
+  STAGE_SERIALIZE,    //< building the reply
+  STAGE_SEND,         //< writing the reply to the socket
+  STAGE_TOTAL,        //< whole request, queue wait included
+  NUM_PS_STAGES       //< keep last
+};
+
+/**
+  * Latencies (ns) of every stage of every PS_OP and traffic counters kept
+  * by the parameter server. Each worker thread writes to its own
+  * histograms so recording takes no locks; readers sum all threads.
+  */
+class PSMetrics {
+ public:
+  /**
+    * @param num_threads Number of threads handling requests
+    */
+  explicit PSMetrics(uint32_t num_threads);
+
+  /**
+    * Times the request handled by the calling thread from its creation to
+    * its destruction. Code running for the request reports to it through
+    * the static functions of PSMetrics
+    */
+  class RequestTimer {
+   public:
+    /**
+      * @param start_us When the request was noticed (get_time_us)
+      */
+    RequestTimer(PSMetrics* metrics, uint32_t thread_number, uint64_t start_us);
+    ~RequestTimer();
+
+    /**
+      * Requests are only recorded once their operation is known
+      */
+    void set_operation(uint32_t operation) { operation_ = operation; }
+
+    /**
+      * Account for a request read before it was handled
+      */
+    void add_read(uint64_t bytes, uint64_t ns);
+
+   private:
+    friend class PSMetrics;
+
+    void lap(PSStage stage);
+
+    PSMetrics* metrics_;
+    uint32_t thread_number_;
+    uint32_t operation_ = NUM_PS_OPS;
+    uint64_t queue_wait_ns_;
+    uint64_t start_ns_;
+    IOCounters io_start_;
+    uint64_t lap_ns_;       //< end of the previous lap
+    uint64_t lap_io_ns_;    //< socket I/O time at the previous lap
+    uint64_t lap_lock_ns_;  //< lock wait at the previous lap
+    uint64_t lock_wait_ns_ = 0;
+    uint64_t lock_hold_ns_ = 0;
+    uint64_t read_bytes_ = 0;  //< see add_read
+    uint64_t read_ns_ = 0;
+    uint64_t stage_ns_[NUM_PS_STAGES] = {0};
+    bool has_stage_[NUM_PS_STAGES] = {false};
+  };
+
+  /**
+    * Add the time since the previous lap (or the start of the request) to
+    * stage, minus the socket I/O and lock waits, which have stages of their
+    * own. Does nothing outside of a request
+    */
+  static void lap(PSStage stage);
+
+  /**
+    * Whether the calling thread is handling a timed request
+    */
+  static bool is_timing();
+  static void add_lock_wait(uint64_t ns);
+  static void add_lock_hold(uint64_t ns);
+
+  /**
+    * Add the counts of a stage of an operation over all threads to counts
+    */
+  void add_to(uint32_t operation,
+              PSStage stage,
+              std::vector<uint64_t>* counts) const;
+
+  /**
+    * Counters and percentiles of every operation since the server started
+    * @param ssp_json Clocks of the tasks (see SSPClock), empty if not used
+    */
+  std::string to_json(const std::map<int, std::string>& operation_to_name,
+                      uint64_t uptime_sec,
+                      const std::string& ssp_json = "") const;
+
+  static std::string stage_name(PSStage stage);
+
+ private:
+  struct alignas(64) ThreadMetrics {
+    ThreadMetrics();
+
+    LatencyHistogram stages[NUM_PS_OPS][NUM_PS_STAGES];
+    std::atomic<uint64_t> bytes_in[NUM_PS_OPS];
+    std::atomic<uint64_t> bytes_out[NUM_PS_OPS];
+    std::atomic<uint64_t> lock_hold_ns;  //< time model locks were held
+  };
+
+  // single writer counters
+  static void add(std::atomic<uint64_t>* counter, uint64_t value) {
+    counter->store(counter->load(std::memory_order_relaxed) + value,
+                   std::memory_order_relaxed);
+  }
+
+  uint32_t num_threads_;
+  std::unique_ptr<ThreadMetrics[]> threads_;
+};
+
+inline bool try_acquire(std::mutex* lock) { return lock->try_lock(); }
+inline void acquire(std::mutex* lock) { lock->lock(); }
+inline void release(std::mutex* lock) { lock->unlock(); }
+inline bool try_acquire(SpinLock* lock) { return lock->trywait(); }
+inline void acquire(SpinLock* lock) { lock->wait(); }
+inline void release(SpinLock* lock) { lock->signal(); }
+
+/**
+  * Holds a model lock for its lifetime and reports to the request being
+  * handled how long it waited for it (only if it was contended, so an
+  * uncontended lock costs no clock reads) and how long it held it
+  */
+template <typename Lock>
+class TimedLock {
+ public:
+  /**
+    * @param time_hold Whether to measure the hold time (skipped for locks
+    *        held for a handful of instructions)
+    */
+  explicit TimedLock(Lock* lock, bool time_hold = true) : lock_(lock) {
+    bool timing = PSMetrics::is_timing();
+    if (!try_acquire(lock)) {
+      uint64_t start = timing ? get_monotonic_time_ns() : 0;
+      acquire(lock);
+      if (timing) {
+        PSMetrics::add_lock_wait(get_monotonic_time_ns() - start);
+      }
+    }
+    if (timing && time_hold) {
+      acquired_ns_ = get_monotonic_time_ns();
+    }
+  }
+
+  ~TimedLock() {
+    release(lock_);
+    if (acquired_ns_ != 0) {
+      PSMetrics::add_lock_hold(get_monotonic_time_ns() - acquired_ns_);
+    }
+  }
+
+  TimedLock(const TimedLock&) = delete;
+  TimedLock& operator=(const TimedLock&) = delete;
+
+ private:
+  Lock* lock_;
+  uint64_t acquired_ns_ = 0;
+};
+
+}  // namespace cirrus
+
+#endif  // _PS_METRICS_H_
@@ -1,20 +1,54 @@
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <stdexcept>
 #include "PSSparseServerInterface.h"
 #include "Constants.h"
 #include "MFModel.h"
 #include "Checksum.h"
-#include "Constants.h"
+#include "WireFormat.h"
+#include "Quantization.h"
 
 #undef DEBUG
 
 #define MAX_MSG_SIZE (1024*1024)
+#define CLOCK_RETRY_MAX_US (10 * 1000)  //< longest wait between clock retries
 
 namespace cirrus {
 
 PSSparseServerInterface::PSSparseServerInterface(const std::string& ip, int port) :
   ip(ip), port(port) {
+  create_socket();
+}
+
+PSSparseServerInterface::PSSparseServerInterface(const std::string& ip,
+                                                 int port,
+                                                 const Configuration& config)
+    : ip(ip), port(port) {
+  quantization_ = config.get_grad_quantization();
+  multiplex_ = config.get_worker_multiplex();
+  shm_ring_size_ = config.get_shm_ring_size_kb() * 1024;
+  const auto& shards = config.get_ps_shards();
+  if (shards.empty()) {
+    if (!multiplex_) {
+      create_socket();
+    }
+    return;
+  }
 
+  lr_map_.reset(new ShardMap(ShardMap::lr_weights(config)));
+  users_map_.reset(new ShardMap(ShardMap::mf_users(config)));
+  items_map_.reset(new ShardMap(ShardMap::mf_items(config)));
+  for (const auto& shard : shards) {
+    shards_.push_back(
+        std::make_unique<PSSparseServerInterface>(shard.first, shard.second));
+    shards_.back()->set_gradient_quantization(quantization_);
+    shards_.back()->multiplex_ = multiplex_;
+    shards_.back()->shm_ring_size_ = shm_ring_size_;
+  }
+}
+
+void PSSparseServerInterface::create_socket() {
   if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
     throw std::runtime_error("Error when creating socket.");
   }
@@ -34,104 +68,384 @@ PSSparseServerInterface::PSSparseServerInterface(const std::string& ip, int port
 }
 
 void PSSparseServerInterface::connect() {
+  if (is_sharded()) {
+    // shards that are already connected are skipped so callers can retry
+    for (auto& shard : shards_) {
+      shard->connect();
+    }
+    return;
+  }
+  if (connected) {
+    return;
+  }
+  if (multiplex_) {
+    // the socket made by the constructor is not used
+    if (sock != -1) {
+      close(sock);
+      sock = -1;
+    }
+    mux_ = MuxConnection::get(ip, port);
+    connected = true;
+    negotiate_wire_format(LATEST_WIRE_FORMAT);
+    return;
+  }
   int ret = ::connect(sock, (struct sockaddr*) &serv_addr, sizeof(serv_addr));
   if (ret < 0) {
     throw std::runtime_error("Failed to make contact with server with ip: " +
                              ip + " port: " + std::to_string(port) + "\n");
   }
+  connected = true;
+  negotiate_wire_format(LATEST_WIRE_FORMAT);
+  if (shm_ring_size_ > 0 && is_local_address(ip)) {
+    attach_shm();
+  }
+}
+
+/**
+  * FORMAT of message to send is:
+  * operation (uint32_t)
+  * size of the rest of the message (uint32_t)
+  * size of each ring (uint64_t)
+  * name of the shared memory segment
+  */
+void PSSparseServerInterface::attach_shm() {
+  std::unique_ptr<ShmSegment> segment;
+  try {
+    segment = ShmSegment::create(shm_ring_size_);
+  } catch (const std::runtime_error& e) {
+    std::cout << "Not using shared memory: " << e.what() << std::endl;
+    return;
+  }
+  const std::string& name = segment->name();
+  std::vector<char> msg(sizeof(uint32_t) * 2 + sizeof(uint64_t) +
+                        name.size());
+  char* data = msg.data();
+  store_value<uint32_t>(data, ATTACH_SHM);
+  store_value<uint32_t>(data, sizeof(uint64_t) + name.size());
+  store_value<uint64_t>(data, shm_ring_size_);
+  std::copy(name.begin(), name.end(), data);
+  uint32_t attached = 0;
+  if (send_all(sock, msg.data(), msg.size()) == -1 ||
+      read_all(sock, &attached, sizeof(uint32_t)) == 0) {
+    throw std::runtime_error("Error attaching shared memory");
+  }
+  // the parameter server has mapped the segment or given up on it
+  segment->unlink();
+  if (attached == 1) {
+    shm_ = std::move(segment);
+    int server_sock = sock;
+    shm_alive_ = [server_sock]() { return socket_peer_open(server_sock); };
+  }
+}
+
+uint32_t PSSparseServerInterface::negotiate_wire_format(uint32_t format) {
+  if (is_sharded()) {
+    uint32_t agreed = format;
+    for (auto& shard : shards_) {
+      agreed = std::min(agreed, shard->negotiate_wire_format(format));
+    }
+    return agreed;
+  }
+  uint32_t data[2] = {NEGOTIATE_WIRE_FORMAT, format};
+  if (send_request(data, sizeof(data)) == -1 ||
+      read_reply(&wire_format_, sizeof(uint32_t)) == 0) {
+    throw std::runtime_error("Error negotiating wire format");
+  }
+  return wire_format_;
+}
+
+ssize_t PSSparseServerInterface::send_request(const void* data, size_t size) {
+  if (shm_) {
+    return shm_->requests().write(data, size, shm_alive_) ? size : -1;
+  }
+  if (!mux_) {
+    return send_all(sock, const_cast<void*>(data), size);
+  }
+  last_request_id_ = mux_->send(data, size);
+  awaiting_reply_ = true;
+  return size;
+}
+
+ssize_t PSSparseServerInterface::read_reply(void* data, size_t size) {
+  if (shm_) {
+    return shm_->replies().read(data, size, shm_alive_) ? size : 0;
+  }
+  if (!mux_) {
+    return read_all(sock, data, size);
+  }
+  if (awaiting_reply_) {
+    reply_ = mux_->wait_reply(last_request_id_);
+    reply_pos_ = 0;
+    awaiting_reply_ = false;
+  }
+  if (reply_.size() - reply_pos_ < size) {
+    return 0;
+  }
+  std::memcpy(data, reply_.data() + reply_pos_, size);
+  reply_pos_ += size;
+  return size;
+}
+
+void PSSparseServerInterface::set_gradient_quantization(uint32_t quantization) {
+  if (quantization >= NUM_QUANTIZATIONS) {
+    throw std::runtime_error("Unknown quantization");
+  }
+  quantization_ = quantization;
+  for (auto& shard : shards_) {
+    shard->set_gradient_quantization(quantization);
+  }
+}
+
+uint64_t PSSparseServerInterface::lr_gradient_size_bound(
+    const LRSparseGradient& gradient) const {
+  return wire_format_ != WIRE_FORMAT_RAW ? gradient.getCompactSizeBound()
+                                         : gradient.getSerializedSize();
+}
+
+uint32_t PSSparseServerInterface::serialize_lr_gradient(
+    const LRSparseGradient& gradient,
+    char* mem) const {
+  if (wire_format_ != WIRE_FORMAT_RAW) {
+    return gradient.serializeCompact(mem, wire_format_, quantization_);
+  }
+  gradient.serialize(mem);
+  return gradient.getSerializedSize();
+}
+
+char* PSSparseServerInterface::serialize_lr_indices(
+    const std::vector<uint32_t>& indices,
+    char* mem) const {
+  if (wire_format_ != WIRE_FORMAT_RAW) {
+    return encode_sorted_indices(indices.data(), indices.size(), mem);
+  }
+  std::copy(indices.begin(), indices.end(), reinterpret_cast<uint32_t*>(mem));
+  return mem + indices.size() * sizeof(uint32_t);
 }
 
 PSSparseServerInterface::~PSSparseServerInterface() {
+  // closing the rings lets the parameter server know right away
+  shm_.reset();
   if (sock != -1) {
     close(sock);
   }
 }
 
 void PSSparseServerInterface::send_lr_gradient(const LRSparseGradient& gradient) {
-  uint32_t operation = SEND_LR_GRADIENT;
+  if (is_sharded()) {
+    send_lr_gradient_sharded(gradient);
+    return;
+  }
 #ifdef DEBUG
   std::cout << "Sending gradient" << std::endl;
 #endif
-  int ret = send(sock, &operation, sizeof(uint32_t), 0);
-  if (ret == -1) {
-    throw std::runtime_error("Error sending operation");
+  uint64_t msg_size_bound =
+      sizeof(uint32_t) * 2 + lr_gradient_size_bound(gradient);
+  if (send_buffer_.size() < msg_size_bound) {
+    send_buffer_.resize(msg_size_bound);
   }
-
-  uint32_t size = gradient.getSerializedSize();
+  char* data = send_buffer_.data();
+  store_value<uint32_t>(data, SEND_LR_GRADIENT);
+  uint32_t size = serialize_lr_gradient(gradient, data + sizeof(uint32_t));
+  store_value<uint32_t>(data, size);
 #ifdef DEBUG
   std::cout << "Sending gradient with size: " << size << std::endl;
 #endif
-  ret = send(sock, &size, sizeof(uint32_t), 0);
-  if (ret == -1) {
-    throw std::runtime_error("Error sending grad size");
-  }
-  
-  char data[size];
-  gradient.serialize(data);
-  ret = send_all(sock, data, size);
-  if (ret == 0) {
+  if (send_request(send_buffer_.data(), sizeof(uint32_t) * 2 + size) ==
+      -1) {
     throw std::runtime_error("Error sending grad");
   }
 }
 
-void PSSparseServerInterface::get_lr_sparse_model_inplace(const SparseDataset& ds, SparseLRModel& lr_model,
-    const Configuration& config) {
-#ifdef DEBUG
-  std::cout << "Getting LR sparse model inplace" << std::endl;
-#endif
-  // we don't know the number of weights to start with
-  char* msg = new char[MAX_MSG_SIZE];
-  char* msg_begin = msg; // need to keep this pointer to delete later
-
-  uint32_t num_weights = 0;
-  store_value<uint32_t>(msg, num_weights); // just make space for the number of weights
-  for (const auto& sample : ds.data_) {
-    for (const auto& w : sample) {
-      store_value<uint32_t>(msg, w.first); // encode the index
-      num_weights++;
-    }
-  }
-  msg = msg_begin;
-  store_value<uint32_t>(msg, num_weights); // store correct value here
-#ifdef DEBUG
-  assert(std::distance(msg_begin, msg) < MAX_MSG_SIZE);
-  std::cout << std::endl;
-#endif
-
-#ifdef DEBUG
-  std::cout << "Sending operation and size" << std::endl;
-#endif
-  uint32_t operation = GET_LR_SPARSE_MODEL;
-  if (send_all(sock, &operation, sizeof(uint32_t)) == -1) {
-    throw std::runtime_error("Error getting sparse lr model");
+/**
+  * FORMAT of message to send is:
+  * operation (uint32_t)
+  * size of the rest of the message (uint32_t)
+  * N number of indices (uint32_t)
+  * list of N indices (N * uint32_t, or encoded in WIRE_FORMAT_VARINT)
+  */
+void PSSparseServerInterface::send_lr_sparse_request(
+    const std::vector<uint32_t>& indices) {
+  uint32_t num_weights = indices.size();
+  if ((num_weights + 1) * sizeof(uint32_t) > MAX_MSG_SIZE) {
+    throw std::runtime_error("Too many weights requested");
   }
-  uint32_t msg_size = sizeof(uint32_t) + sizeof(uint32_t) * num_weights;
+  std::vector<char> msg(sizeof(uint32_t) * 3 +
+                        max_encoded_indices_size(num_weights));
+  char* data = msg.data() + sizeof(uint32_t) * 2;
+  store_value<uint32_t>(data, num_weights);
+  data = serialize_lr_indices(indices, data);
+  uint32_t msg_size = data - msg.data();
+  data = msg.data();
+  store_value<uint32_t>(data, GET_LR_SPARSE_MODEL);
+  store_value<uint32_t>(data, msg_size - sizeof(uint32_t) * 2);
 #ifdef DEBUG
   std::cout << "msg_size: " << msg_size
     << " num_weights: " << num_weights
     << std::endl;
 #endif
-  send_all(sock, &msg_size, sizeof(uint32_t));
-  if (send_all(sock, msg_begin, msg_size) == -1) {
+  if (send_request(msg.data(), msg_size) == -1) {
     throw std::runtime_error("Error getting sparse lr model");
   }
-  uint32_t to_receive_size = sizeof(FEATURE_TYPE) * num_weights;
+}
 
+void PSSparseServerInterface::read_lr_sparse_reply(FEATURE_TYPE* weights,
+                                                   uint32_t num_weights) {
+  uint32_t to_receive_size = sizeof(FEATURE_TYPE) * num_weights;
 #ifdef DEBUG
   std::cout << "Receiving " << to_receive_size << " bytes" << std::endl;
 #endif
-  char* buffer = new char[to_receive_size];
-  read_all(sock, buffer, to_receive_size); //XXX this takes 2ms once every 5 runs
+  //XXX this takes 2ms once every 5 runs
+  if (read_reply(weights, to_receive_size) == 0) {
+    throw std::runtime_error("Error getting sparse lr model");
+  }
+}
+
+/**
+  * FORMAT of message to send is:
+  * operation (uint32_t)
+  * size of the rest of the message (uint32_t)
+  * size of the gradient (uint32_t)
+  * serialized gradient
+  * N number of indices (uint32_t)
+  * list of N indices
+  * Gradient and indices are in the negotiated wire format
+  * The reply is the same as for send_lr_sparse_request
+  */
+void PSSparseServerInterface::send_lr_gradient_sparse_request(
+    const LRSparseGradient& gradient,
+    const std::vector<uint32_t>& indices) {
+  uint32_t num_weights = indices.size();
+  if ((num_weights + 1) * sizeof(uint32_t) > MAX_MSG_SIZE) {
+    throw std::runtime_error("Too many weights requested");
+  }
+  std::vector<char> msg(sizeof(uint32_t) * 4 +
+                        lr_gradient_size_bound(gradient) +
+                        max_encoded_indices_size(num_weights));
+  char* data = msg.data() + sizeof(uint32_t) * 2;
+  uint32_t gradient_size =
+      serialize_lr_gradient(gradient, data + sizeof(uint32_t));
+  store_value<uint32_t>(data, gradient_size);
+  data += gradient_size;
+  store_value<uint32_t>(data, num_weights);
+  data = serialize_lr_indices(indices, data);
+  uint32_t msg_size = data - msg.data();
+  data = msg.data();
+  store_value<uint32_t>(data, SEND_LR_GRADIENT_GET_SPARSE_MODEL);
+  store_value<uint32_t>(data, msg_size - sizeof(uint32_t) * 2);
+  if (send_request(msg.data(), msg_size) == -1) {
+    throw std::runtime_error("Error sending gradient");
+  }
+}
+
+std::vector<uint32_t> PSSparseServerInterface::lr_sparse_indices(
+    const SparseDataset& ds) {
+  std::vector<uint32_t> indices;
+  for (const auto& sample : ds.data_) {
+    for (const auto& w : sample) {
+      indices.push_back(w.first);
+    }
+  }
+  // hot features show up in most samples of a minibatch but we only need
+  // their weight once. Sorted indices also let the server read the model
+  // in order
+  std::sort(indices.begin(), indices.end());
+  indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+  return indices;
+}
+
+void PSSparseServerInterface::get_lr_sparse_model_inplace(const SparseDataset& ds, SparseLRModel& lr_model,
+    const Configuration& config) {
+#ifdef DEBUG
+  std::cout << "Getting LR sparse model inplace" << std::endl;
+#endif
+  std::vector<uint32_t> indices = lr_sparse_indices(ds);
+
+  if (is_sharded()) {
+    get_lr_sparse_model_sharded(nullptr, indices, lr_model, config);
+    return;
+  }
+
+  send_lr_sparse_request(indices);
+  std::vector<FEATURE_TYPE> weights(indices.size());
+  read_lr_sparse_reply(weights.data(), indices.size());
 
 #ifdef DEBUG
   std::cout << "Loading model from memory" << std::endl;
 #endif
   // build a truly sparse model and return
   // XXX this copy could be avoided
-  lr_model.loadSerializedSparse((FEATURE_TYPE*)buffer, (uint32_t*)msg, num_weights, config);
-  
-  delete[] msg_begin;
-  delete[] buffer;
+  lr_model.loadSerializedSparse(weights.data(), indices.data(), indices.size(),
+                                config);
+}
+
+void PSSparseServerInterface::send_lr_gradient_get_sparse_model(
+    const LRSparseGradient& gradient,
+    const SparseDataset& ds,
+    SparseLRModel& lr_model,
+    const Configuration& config) {
+  std::vector<uint32_t> indices = lr_sparse_indices(ds);
+
+  if (is_sharded()) {
+    get_lr_sparse_model_sharded(&gradient, indices, lr_model, config);
+    return;
+  }
+
+  send_lr_gradient_sparse_request(gradient, indices);
+  std::vector<FEATURE_TYPE> weights(indices.size());
+  read_lr_sparse_reply(weights.data(), indices.size());
+  lr_model.loadSerializedSparse(weights.data(), indices.data(), indices.size(),
+                                config);
+}
+
+void PSSparseServerInterface::get_lr_sparse_model_sharded(
+    const LRSparseGradient* gradient,
+    const std::vector<uint32_t>& indices,
+    SparseLRModel& lr_model,
+    const Configuration& config) {
+  uint32_t num_shards = shards_.size();
+  // local indices asked from each shard and their position in indices
+  std::vector<std::vector<uint32_t>> shard_indices(num_shards);
+  std::vector<std::vector<uint32_t>> shard_positions(num_shards);
+  for (uint32_t i = 0; i < indices.size(); ++i) {
+    uint32_t shard = lr_map_->shard_of(indices[i]);
+    shard_indices[shard].push_back(lr_map_->to_local(indices[i]));
+    shard_positions[shard].push_back(i);
+  }
+  std::vector<LRSparseGradient> shard_gradients;
+  if (gradient != nullptr) {
+    shard_gradients = split_lr_gradient(*gradient);
+  }
+
+  // all requests are in flight before we wait for the first reply
+  for (uint32_t shard = 0; shard < num_shards; ++shard) {
+    bool has_gradient =
+        gradient != nullptr && !shard_gradients[shard].weights.empty();
+    if (has_gradient && !shard_indices[shard].empty()) {
+      shards_[shard]->send_lr_gradient_sparse_request(shard_gradients[shard],
+                                                      shard_indices[shard]);
+    } else if (has_gradient) {
+      shards_[shard]->send_lr_gradient(shard_gradients[shard]);
+    } else if (!shard_indices[shard].empty()) {
+      shards_[shard]->send_lr_sparse_request(shard_indices[shard]);
+    }
+  }
+
+  std::vector<FEATURE_TYPE> weights(indices.size());
+  std::vector<FEATURE_TYPE> shard_weights;
+  for (uint32_t shard = 0; shard < num_shards; ++shard) {
+    if (shard_indices[shard].empty()) {
+      continue;
+    }
+    shard_weights.resize(shard_indices[shard].size());
+    shards_[shard]->read_lr_sparse_reply(shard_weights.data(),
+                                         shard_weights.size());
+    for (uint32_t i = 0; i < shard_weights.size(); ++i) {
+      weights[shard_positions[shard][i]] = shard_weights[i];
+    }
+  }
+
+  lr_model.loadSerializedSparse(weights.data(), indices.data(), indices.size(),
+                                config);
 }
 
 SparseLRModel PSSparseServerInterface::get_lr_sparse_model(const SparseDataset& ds, const Configuration& config) {
@@ -140,20 +454,21 @@ SparseLRModel PSSparseServerInterface::get_lr_sparse_model(const SparseDataset&
   return std::move(model);
 }
 
-std::unique_ptr<CirrusModel> PSSparseServerInterface::get_full_model(
-    bool isCollaborative //XXX use a better argument here
-    ) {
-#ifdef DEBUG
-  std::cout << "Getting full model isCollaborative: " << isCollaborative << std::endl;
-#endif
+void PSSparseServerInterface::send_full_model_request(bool isCollaborative) {
+  uint32_t operation = isCollaborative ? GET_MF_FULL_MODEL : GET_LR_FULL_MODEL;
+  if (send_request(&operation, sizeof(uint32_t)) == -1) {
+    throw std::runtime_error("Error talking to PS");
+  }
+}
+
+std::unique_ptr<CirrusModel> PSSparseServerInterface::read_full_model_reply(
+    bool isCollaborative) {
   if (isCollaborative) {
-    uint32_t operation = GET_MF_FULL_MODEL;
-    send_all(sock, &operation, sizeof(uint32_t));
     uint32_t to_receive_size;
-    read_all(sock, &to_receive_size, sizeof(uint32_t));
+    read_reply(&to_receive_size, sizeof(uint32_t));
 
     char* buffer = new char[to_receive_size];
-    read_all(sock, buffer, to_receive_size);
+    read_reply(buffer, to_receive_size);
     
     std::cout
       << " buffer checksum: " << crc32(buffer, to_receive_size)
@@ -165,17 +480,15 @@ std::unique_ptr<CirrusModel> PSSparseServerInterface::get_full_model(
     delete[] buffer;
     return model;
   } else {
-    uint32_t operation = GET_LR_FULL_MODEL;
-    send_all(sock, &operation, sizeof(uint32_t));
     int model_size;
-    if (read_all(sock, &model_size, sizeof(int)) == 0) {
+    if (read_reply(&model_size, sizeof(int)) == 0) {
       throw std::runtime_error("Error talking to PS");
     }
     char* model_data = new char[sizeof(int) + model_size * sizeof(FEATURE_TYPE)];
     char*model_data_ptr = model_data;
     store_value<int>(model_data_ptr, model_size);
 
-    if (read_all(sock, model_data_ptr, model_size * sizeof(FEATURE_TYPE)) == 0) {
+    if (read_reply(model_data_ptr, model_size * sizeof(FEATURE_TYPE)) == 0) {
       throw std::runtime_error("Error talking to PS");
     }
     std::unique_ptr<CirrusModel> model = std::make_unique<SparseLRModel>(0);
@@ -186,6 +499,146 @@ std::unique_ptr<CirrusModel> PSSparseServerInterface::get_full_model(
   }
 }
 
+std::unique_ptr<CirrusModel> PSSparseServerInterface::get_full_model(
+    bool isCollaborative //XXX use a better argument here
+    ) {
+#ifdef DEBUG
+  std::cout << "Getting full model isCollaborative: " << isCollaborative << std::endl;
+#endif
+  if (is_sharded()) {
+    return get_full_model_sharded(isCollaborative);
+  }
+  send_full_model_request(isCollaborative);
+  return read_full_model_reply(isCollaborative);
+}
+
+std::unique_ptr<CirrusModel> PSSparseServerInterface::get_full_model_sharded(
+    bool isCollaborative) {
+  for (auto& shard : shards_) {
+    shard->send_full_model_request(isCollaborative);
+  }
+
+  if (isCollaborative) {
+    std::unique_ptr<MFModel> model;
+    for (uint32_t shard = 0; shard < shards_.size(); ++shard) {
+      std::unique_ptr<CirrusModel> part =
+          shards_[shard]->read_full_model_reply(true);
+      MFModel* shard_model = dynamic_cast<MFModel*>(part.get());
+      if (!model) {
+        model = std::make_unique<MFModel>(users_map_->size(),
+                                          items_map_->size(),
+                                          shard_model->get_nfactors());
+      } else if (shard_model->get_nfactors() != model->get_nfactors()) {
+        throw std::runtime_error("Shards have different numbers of factors");
+      }
+      // bias and factors of a user or item are contiguous
+      const uint64_t row_size =
+          (1 + model->get_nfactors()) * sizeof(FEATURE_TYPE);
+      for (uint64_t i = 0; i < users_map_->shard_size(shard); ++i) {
+        uint64_t user = users_map_->to_global(shard, i);
+        std::memcpy(&model->get_user_bias(user),
+                    &shard_model->get_user_bias(i), row_size);
+      }
+      for (uint64_t i = 0; i < items_map_->shard_size(shard); ++i) {
+        uint64_t item = items_map_->to_global(shard, i);
+        std::memcpy(&model->get_item_bias(item),
+                    &shard_model->get_item_bias(i), row_size);
+      }
+    }
+    return std::move(model);
+  } else {
+    std::vector<FEATURE_TYPE> weights(lr_map_->size());
+    for (uint32_t shard = 0; shard < shards_.size(); ++shard) {
+      std::unique_ptr<CirrusModel> part =
+          shards_[shard]->read_full_model_reply(false);
+      SparseLRModel* shard_model = dynamic_cast<SparseLRModel*>(part.get());
+      for (uint64_t i = 0; i < shard_model->size(); ++i) {
+        weights[lr_map_->to_global(shard, i)] = shard_model->get_nth_weight(i);
+      }
+    }
+    return std::make_unique<SparseLRModel>(weights.data(), weights.size());
+  }
+}
+
+void PSSparseServerInterface::send_lr_delta_request() {
+  char msg[sizeof(uint32_t) + sizeof(uint64_t)];
+  char* data = msg;
+  store_value<uint32_t>(data, GET_LR_MODEL_DELTA);
+  store_value<uint64_t>(data, lr_model_version_);
+  if (send_request(msg, sizeof(msg)) == -1) {
+    throw std::runtime_error("Error talking to PS");
+  }
+}
+
+void PSSparseServerInterface::read_lr_delta_reply(SparseLRModel* model,
+                                                  const ShardMap* map,
+                                                  uint32_t shard) {
+  // if the reply is cut short the model is not up to date anymore
+  lr_model_version_ = 0;
+
+  char header[sizeof(uint64_t) + sizeof(uint32_t) * 3];
+  if (read_reply(header, sizeof(header)) == 0) {
+    throw std::runtime_error("Error talking to PS");
+  }
+  const char* data = header;
+  uint64_t version = load_value<uint64_t>(data);
+  uint64_t num_weights = load_value<uint32_t>(data);
+  uint64_t page_size = load_value<uint32_t>(data);
+  uint64_t num_pages = load_value<uint32_t>(data);
+
+  std::vector<uint32_t> pages(num_pages);
+  if (num_pages > 0 &&
+      read_reply(pages.data(), num_pages * sizeof(uint32_t)) == 0) {
+    throw std::runtime_error("Error talking to PS");
+  }
+  uint64_t weights_size = 0;
+  for (const auto& page : pages) {
+    weights_size += std::min(page_size, num_weights - page * page_size);
+  }
+  std::vector<FEATURE_TYPE> weights(weights_size);
+  if (weights_size > 0 &&
+      read_reply(weights.data(), weights_size * sizeof(FEATURE_TYPE)) ==
+          0) {
+    throw std::runtime_error("Error talking to PS");
+  }
+
+  if (map == nullptr && model->weights_.size() != num_weights) {
+    model->weights_.resize(num_weights);
+  }
+  const FEATURE_TYPE* w = weights.data();
+  for (const auto& page : pages) {
+    uint64_t begin = page * page_size;
+    uint64_t end = std::min(begin + page_size, num_weights);
+    if (map == nullptr) {
+      std::copy(w, w + (end - begin), model->weights_.begin() + begin);
+      w += end - begin;
+    } else {
+      for (uint64_t i = begin; i < end; ++i) {
+        model->weights_[map->to_global(shard, i)] = *w++;
+      }
+    }
+  }
+  lr_model_version_ = version;
+}
+
+void PSSparseServerInterface::get_lr_model_delta(SparseLRModel* model) {
+  if (!is_sharded()) {
+    send_lr_delta_request();
+    read_lr_delta_reply(model, nullptr, 0);
+    return;
+  }
+
+  if (model->weights_.size() != lr_map_->size()) {
+    model->weights_.resize(lr_map_->size());
+  }
+  for (auto& shard : shards_) {
+    shard->send_lr_delta_request();
+  }
+  for (uint32_t shard = 0; shard < shards_.size(); ++shard) {
+    shards_[shard]->read_lr_delta_reply(model, lr_map_.get(), shard);
+  }
+}
+
 // Collaborative filtering
 
 /**
@@ -197,97 +650,275 @@ std::unique_ptr<CirrusModel> PSSparseServerInterface::get_full_model(
   * magic number (MAGIC_NUMBER) (uint32_t)
   * list of K item ids (K * uint32_t)
   */
+void PSSparseServerInterface::send_mf_sparse_request(
+    const std::vector<uint32_t>& item_ids,
+    uint32_t user_base,
+    uint32_t minibatch_size) {
+  uint32_t item_ids_count = item_ids.size();
+  if ((item_ids_count + 4) * sizeof(uint32_t) > MAX_MSG_SIZE) {
+    throw std::runtime_error("Too many items requested");
+  }
+  std::vector<uint32_t> msg;
+  msg.reserve(item_ids_count + 6);
+  msg.push_back(GET_MF_SPARSE_MODEL);
+  msg.push_back(sizeof(uint32_t) * 4 + sizeof(uint32_t) * item_ids_count);
+  msg.push_back(item_ids_count);
+  msg.push_back(user_base);
+  msg.push_back(minibatch_size);
+  msg.push_back(MAGIC_NUMBER); // magic value
+  msg.insert(msg.end(), item_ids.begin(), item_ids.end());
+  if (send_request(msg.data(), msg.size() * sizeof(uint32_t)) == -1) {
+    throw std::runtime_error("Error getting sparse mf model");
+  }
+}
+
+/**
+  * FORMAT of the reply
+  * size of the records (uint32_t)
+  * number of factors F (uint32_t)
+  * one record per user of the minibatch, then one per requested item:
+  * id (uint32_t), bias and F factors (FEATURE_TYPE)
+  */
+std::vector<char> PSSparseServerInterface::read_mf_sparse_reply(
+    uint32_t* nfactors) {
+  uint32_t to_receive_size;
+  if (read_reply(&to_receive_size, sizeof(uint32_t)) == 0 ||
+      read_reply(nfactors, sizeof(uint32_t)) == 0) {
+    throw std::runtime_error("Error getting sparse mf model");
+  }
+  if (*nfactors == 0 || *nfactors > MAX_NUM_FACTORS) {
+    throw std::runtime_error("Wrong number of factors: " +
+                             std::to_string(*nfactors));
+  }
+
+  std::vector<char> buffer(to_receive_size);
+  if (to_receive_size > 0 &&
+      read_reply(buffer.data(), to_receive_size) == 0) {
+    throw std::runtime_error("Error getting sparse mf model");
+  }
+  return buffer;
+}
+
 SparseMFModel PSSparseServerInterface::get_sparse_mf_model(
     const SparseDataset& ds, uint32_t user_base, uint32_t minibatch_size) {
-  char* msg = new char[MAX_MSG_SIZE];
-  char* msg_begin = msg; // need to keep this pointer to delete later
-  uint32_t item_ids_count = 0;
-  store_value<uint32_t>(msg, 0); // we will write this value later
-  store_value<uint32_t>(msg, user_base);
-  store_value<uint32_t>(msg, minibatch_size);
-  store_value<uint32_t>(msg, MAGIC_NUMBER); // magic value
+  std::vector<uint32_t> item_ids;
   bool seen[17770] = {false};
   for (const auto& sample : ds.data_) {
     for (const auto& w : sample) {
       uint32_t movieId = w.first;
       if (seen[movieId])
           continue;
-      store_value<uint32_t>(msg, movieId);
+      item_ids.push_back(movieId);
       seen[movieId] = true;
-      item_ids_count++;
     }
   }
-  msg = msg_begin;
-  store_value<uint32_t>(msg, item_ids_count); // store correct value here
-  uint32_t operation = GET_MF_SPARSE_MODEL;
-  send_all(sock, &operation, sizeof(uint32_t));
-  uint32_t msg_size = sizeof(uint32_t) * 4 + sizeof(uint32_t) * item_ids_count;
-  send_all(sock, &msg_size, sizeof(uint32_t));
-  if (send_all(sock, msg_begin, msg_size) == -1) {
-    throw std::runtime_error("Error getting sparse mf model");
-  }
-  uint32_t to_receive_size;
-  read_all(sock, &to_receive_size, sizeof(uint32_t));
 
-  char* buffer = new char[to_receive_size];
-  if (read_all(sock, buffer, to_receive_size) == 0) {
-    throw std::runtime_error("");
+  if (is_sharded()) {
+    return get_sparse_mf_model_sharded(item_ids, user_base, minibatch_size);
   }
 
-  // build a sparse model and return
-  SparseMFModel model((FEATURE_TYPE*)buffer, minibatch_size, item_ids_count);
-  
-  delete[] msg_begin;
-  delete[] buffer;
+  send_mf_sparse_request(item_ids, user_base, minibatch_size);
+  uint32_t nfactors = 0;
+  std::vector<char> buffer = read_mf_sparse_reply(&nfactors);
 
+  // build a sparse model and return
+  SparseMFModel model(buffer.data(), minibatch_size, item_ids.size(),
+                      nfactors);
   return std::move(model);
 }
 
-void PSSparseServerInterface::send_mf_gradient(const MFSparseGradient& gradient) {
-  uint32_t operation = SEND_MF_GRADIENT;
-  if (send(sock, &operation, sizeof(uint32_t), 0) == -1) {
-    throw std::runtime_error("Error sending operation");
+/**
+  * Users of the minibatch owned by the same shard have contiguous local ids
+  * (with both shard schemes) so each shard gets a (base, count) range.
+  * Each reply holds one record per user followed by one record per item.
+  * Records are put back in the order of a single server reply, with
+  * their ids translated back to global ids.
+  */
+SparseMFModel PSSparseServerInterface::get_sparse_mf_model_sharded(
+    const std::vector<uint32_t>& item_ids,
+    uint32_t user_base,
+    uint32_t minibatch_size) {
+  uint32_t num_shards = shards_.size();
+  std::vector<uint32_t> shard_user_base(num_shards, 0);
+  std::vector<uint32_t> shard_user_count(num_shards, 0);
+  for (uint32_t user = user_base; user < user_base + minibatch_size; ++user) {
+    uint32_t shard = users_map_->shard_of(user);
+    if (shard_user_count[shard]++ == 0) {
+      shard_user_base[shard] = users_map_->to_local(user);
+    }
+  }
+  std::vector<std::vector<uint32_t>> shard_items(num_shards);
+  for (const auto& item : item_ids) {
+    shard_items[items_map_->shard_of(item)].push_back(
+        items_map_->to_local(item));
   }
 
+  for (uint32_t shard = 0; shard < num_shards; ++shard) {
+    if (shard_user_count[shard] > 0 || !shard_items[shard].empty()) {
+      shards_[shard]->send_mf_sparse_request(
+          shard_items[shard], shard_user_base[shard], shard_user_count[shard]);
+    }
+  }
+
+  std::vector<std::vector<char>> replies(num_shards);
+  uint32_t nfactors = 0;
+  for (uint32_t shard = 0; shard < num_shards; ++shard) {
+    if (shard_user_count[shard] > 0 || !shard_items[shard].empty()) {
+      uint32_t shard_nfactors = 0;
+      replies[shard] = shards_[shard]->read_mf_sparse_reply(&shard_nfactors);
+      if (nfactors != 0 && shard_nfactors != nfactors) {
+        throw std::runtime_error("Shards have different numbers of factors");
+      }
+      nfactors = shard_nfactors;
+    }
+  }
+
+  const uint64_t record_size =
+      sizeof(uint32_t) + (nfactors + 1) * sizeof(FEATURE_TYPE);
+  std::vector<char> buffer((minibatch_size + item_ids.size()) * record_size);
+  char* buffer_ptr = buffer.data();
+  std::vector<const char*> cursors(num_shards);
+  for (uint32_t shard = 0; shard < num_shards; ++shard) {
+    cursors[shard] = replies[shard].data();
+  }
+  auto copy_record = [&](uint32_t shard, uint32_t global_id) {
+    std::copy(cursors[shard], cursors[shard] + record_size, buffer_ptr);
+    store_value<uint32_t>(buffer_ptr, global_id);
+    buffer_ptr += record_size - sizeof(uint32_t);
+    cursors[shard] += record_size;
+  };
+  for (uint32_t user = user_base; user < user_base + minibatch_size; ++user) {
+    copy_record(users_map_->shard_of(user), user);
+  }
+  for (const auto& item : item_ids) {
+    copy_record(items_map_->shard_of(item), item);
+  }
+
+  SparseMFModel model(buffer.data(), minibatch_size, item_ids.size(),
+                      nfactors);
+  return model;
+}
+
+void PSSparseServerInterface::send_mf_gradient(const MFSparseGradient& gradient) {
+  if (is_sharded()) {
+    send_mf_gradient_sharded(gradient);
+    return;
+  }
+  bool compact = wire_format_ != WIRE_FORMAT_RAW;
+  uint64_t msg_size_bound =
+      sizeof(uint32_t) * 2 + (compact ? gradient.getCompactSizeBound()
+                                      : gradient.getSerializedSize());
+  if (send_buffer_.size() < msg_size_bound) {
+    send_buffer_.resize(msg_size_bound);
+  }
+  char* data = send_buffer_.data();
+  store_value<uint32_t>(data, SEND_MF_GRADIENT);
   uint32_t size = gradient.getSerializedSize();
-  if (send(sock, &size, sizeof(uint32_t), 0) == -1) {
-    throw std::runtime_error("Error sending grad size");
+  if (compact) {
+    size = gradient.serializeCompact(data + sizeof(uint32_t), wire_format_,
+                                     quantization_);
+  } else {
+    gradient.serialize(data + sizeof(uint32_t));
   }
-  
-  char* data = new char[size];
-  gradient.serialize(data);
-  if (send_all(sock, data, size) == 0) {
+  store_value<uint32_t>(data, size);
+  if (send_request(send_buffer_.data(), sizeof(uint32_t) * 2 + size) ==
+      -1) {
     throw std::runtime_error("Error sending grad");
   }
-  delete[] data;
+}
+
+std::vector<LRSparseGradient> PSSparseServerInterface::split_lr_gradient(
+    const LRSparseGradient& gradient) {
+  std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> shard_weights(
+      shards_.size());
+  for (const auto& w : gradient.weights) {
+    shard_weights[lr_map_->shard_of(w.first)].push_back(
+        std::make_pair(lr_map_->to_local(w.first), w.second));
+  }
+  std::vector<LRSparseGradient> shard_gradients;
+  shard_gradients.reserve(shards_.size());
+  for (auto& weights : shard_weights) {
+    shard_gradients.emplace_back(std::move(weights));
+    shard_gradients.back().setVersion(gradient.getVersion());
+  }
+  return shard_gradients;
+}
+
+void PSSparseServerInterface::send_lr_gradient_sharded(
+    const LRSparseGradient& gradient) {
+  std::vector<LRSparseGradient> shard_gradients = split_lr_gradient(gradient);
+  for (uint32_t shard = 0; shard < shards_.size(); ++shard) {
+    if (!shard_gradients[shard].weights.empty()) {
+      shards_[shard]->send_lr_gradient(shard_gradients[shard]);
+    }
+  }
+}
+
+void PSSparseServerInterface::send_mf_gradient_sharded(
+    const MFSparseGradient& gradient) {
+  std::vector<MFSparseGradient> shard_gradients(
+      shards_.size(), MFSparseGradient(gradient.nfactors));
+  MFGradientView view = gradient.view();
+  for (uint32_t i = 0; i < view.users.size; ++i) {
+    int user = view.users.ids[i];
+    MFSparseGradient& shard_gradient =
+        shard_gradients[users_map_->shard_of(user)];
+    uint32_t j = shard_gradient.add_user(users_map_->to_local(user));
+    shard_gradient.user_bias(j) = view.users.biases[i];
+    std::copy_n(view.users.factors + static_cast<uint64_t>(i) * view.nfactors,
+                view.nfactors, shard_gradient.user_factors(j));
+  }
+  for (uint32_t i = 0; i < view.items.size; ++i) {
+    int item = view.items.ids[i];
+    MFSparseGradient& shard_gradient =
+        shard_gradients[items_map_->shard_of(item)];
+    uint32_t j = shard_gradient.add_item(items_map_->to_local(item));
+    shard_gradient.item_bias(j) = view.items.biases[i];
+    std::copy_n(view.items.factors + static_cast<uint64_t>(i) * view.nfactors,
+                view.nfactors, shard_gradient.item_factors(j));
+  }
+  for (uint32_t shard = 0; shard < shards_.size(); ++shard) {
+    MFSparseGradient& shard_gradient = shard_gradients[shard];
+    if (shard_gradient.num_users() == 0 && shard_gradient.num_items() == 0) {
+      continue;
+    }
+    shard_gradient.setVersion(gradient.getVersion());
+    shards_[shard]->send_mf_gradient(shard_gradient);
+  }
 }
 
 uint32_t PSSparseServerInterface::register_task(uint32_t id,
                                                 uint32_t remaining_time_sec) {
+  if (is_sharded()) {
+    return shards_[0]->register_task(id, remaining_time_sec);
+  }
 #ifdef DEBUG
   std::cout << "Registering task id: " << id
             << " remaining_time_sec: " << remaining_time_sec << std::endl;
 #endif
 
   uint32_t data[3] = {REGISTER_TASK, id, remaining_time_sec};
-  if (send_all(sock, data, sizeof(uint32_t) * 3) == -1) {
+  if (send_request(data, sizeof(uint32_t) * 3) == -1) {
     throw std::runtime_error("Error registering task");
   }
 
   uint32_t status;
-  if (read_all(sock, &status, sizeof(uint32_t)) == 0) {
+  if (read_reply(&status, sizeof(uint32_t)) == 0) {
     throw std::runtime_error("Error getting task register return");
   }
   return status;
 }
 
 uint32_t PSSparseServerInterface::deregister_task(uint32_t id) {
+  if (is_sharded()) {
+    return shards_[0]->deregister_task(id);
+  }
 #ifdef DEBUG
   std::cout << "Deregistering task id: " << id << std::endl;
 #endif
 
   uint32_t data[2] = {DEREGISTER_TASK, id};
-  if (send_all(sock, data, sizeof(uint32_t) * 2) == -1) {
+  if (send_request(data, sizeof(uint32_t) * 2) == -1) {
     throw std::runtime_error("Error registering task");
   }
 
@@ -295,27 +926,63 @@ uint32_t PSSparseServerInterface::deregister_task(uint32_t id) {
   std::cout << "Deregistering reading reply: " << std::endl;
 #endif
   uint32_t status;
-  if (read_all(sock, &status, sizeof(uint32_t)) == 0) {
+  if (read_reply(&status, sizeof(uint32_t)) == 0) {
     throw std::runtime_error("Error getting task register return");
   }
   return status;
 }
 
+bool PSSparseServerInterface::advance_clock(uint32_t id, uint64_t clock) {
+  if (is_sharded()) {
+    return shards_[0]->advance_clock(id, clock);
+  }
+
+  char data[sizeof(uint32_t) * 2 + sizeof(uint64_t)];
+  char* ptr = data;
+  store_value<uint32_t>(ptr, ADVANCE_CLOCK);
+  store_value<uint32_t>(ptr, id);
+  store_value<uint64_t>(ptr, clock);
+  if (send_request(data, sizeof(data)) == -1) {
+    throw std::runtime_error("Error sending clock");
+  }
+
+  uint32_t may_pull = 0;
+  if (read_reply(&may_pull, sizeof(uint32_t)) == 0) {
+    throw std::runtime_error("Error getting clock reply");
+  }
+  return may_pull;
+}
+
+void PSSparseServerInterface::wait_for_clock(uint32_t id, uint64_t clock) {
+  uint64_t wait_us = 100;
+  while (!advance_clock(id, clock)) {
+    usleep(wait_us);
+    wait_us = std::min<uint64_t>(wait_us * 2, CLOCK_RETRY_MAX_US);
+  }
+}
+
 void PSSparseServerInterface::set_status(uint32_t id, uint32_t status) {
+  if (is_sharded()) {
+    shards_[0]->set_status(id, status);
+    return;
+  }
   std::cout << "Setting status id: " << id << " status: " << status << std::endl;
   uint32_t data[3] = {SET_TASK_STATUS, id, status};
-  if (send_all(sock, data, sizeof(uint32_t) * 3) == -1) {
+  if (send_request(data, sizeof(uint32_t) * 3) == -1) {
     throw std::runtime_error("Error setting task status");
   }
 }
 
 uint32_t PSSparseServerInterface::get_status(uint32_t id) {
+  if (is_sharded()) {
+    return shards_[0]->get_status(id);
+  }
   uint32_t data[2] = {GET_TASK_STATUS, id};
-  if (send_all(sock, data, sizeof(uint32_t) * 2) == -1) {
+  if (send_request(data, sizeof(uint32_t) * 2) == -1) {
     throw std::runtime_error("Error getting task status");
   }
   uint32_t status;
-  if (read_all(sock, &status, sizeof(uint32_t)) == 0) {
+  if (read_reply(&status, sizeof(uint32_t)) == 0) {
     throw std::runtime_error("Error getting task status");
   }
   return status;
@@ -325,41 +992,49 @@ void PSSparseServerInterface::set_value(const std::string& key,
                                         char* data,
                                         uint32_t size) {
   assert(key.size() <= KEY_SIZE);
+  if (is_sharded()) {
+    shards_[0]->set_value(key, data, size);
+    return;
+  }
 
   char key_char[KEY_SIZE] = {0};
   std::copy(key.data(), key.data() + key.size(), key_char);
 
-  uint32_t operation = SET_VALUE;
-  if (send_all(sock, &operation, sizeof(operation)) != sizeof(operation)) {
-    throw std::runtime_error("Error sending operation");
-  }
-  if (send_all(sock, key_char, KEY_SIZE) != KEY_SIZE) {
-    throw std::runtime_error("Error sending key name");
+  // one message, so the request is not split with request ids
+  uint64_t msg_size = sizeof(uint32_t) * 2 + KEY_SIZE + size;
+  if (send_buffer_.size() < msg_size) {
+    send_buffer_.resize(msg_size);
   }
-  if (send_all(sock, &size, sizeof(uint32_t)) != sizeof(uint32_t)) {
-    throw std::runtime_error("Error sending value size");
-  }
-  if (send_all(sock, data, size) != size) {
-    throw std::runtime_error("Error sending value data");
+  char* msg = send_buffer_.data();
+  store_value<uint32_t>(msg, SET_VALUE);
+  std::copy(key_char, key_char + KEY_SIZE, msg);
+  msg += KEY_SIZE;
+  store_value<uint32_t>(msg, size);
+  std::copy(data, data + size, msg);
+  if (send_request(send_buffer_.data(), msg_size) !=
+      static_cast<ssize_t>(msg_size)) {
+    throw std::runtime_error("Error sending value");
   }
 }
 
 std::pair<std::shared_ptr<char>, uint32_t> PSSparseServerInterface::get_value(
     const std::string& key) {
+  if (is_sharded()) {
+    return shards_[0]->get_value(key);
+  }
   char key_char[KEY_SIZE] = {0};
   std::copy(key.data(), key.data() + key.size(), key_char);
 
-  uint32_t operation = GET_VALUE;
-  if (send_all(sock, &operation, sizeof(operation)) != sizeof(operation)) {
-    throw std::runtime_error("Error sending operation");
-  }
-
-  if (send_all(sock, key_char, KEY_SIZE) != KEY_SIZE) {
+  char msg[sizeof(uint32_t) + KEY_SIZE];
+  char* msg_data = msg;
+  store_value<uint32_t>(msg_data, GET_VALUE);
+  std::copy(key_char, key_char + KEY_SIZE, msg_data);
+  if (send_request(msg, sizeof(msg)) != sizeof(msg)) {
     throw std::runtime_error("Error sending key name");
   }
 
   uint32_t size = 0;
-  if (read_all(sock, &size, sizeof(uint32_t)) != sizeof(uint32_t)) {
+  if (read_reply(&size, sizeof(uint32_t)) != sizeof(uint32_t)) {
     throw std::runtime_error("Error reading key value");
   }
 
@@ -371,12 +1046,122 @@ std::pair<std::shared_ptr<char>, uint32_t> PSSparseServerInterface::get_value(
   std::shared_ptr<char> value_data =
       std::shared_ptr<char>(new char[size], std::default_delete<char[]>());
 
-  if (read_all(sock, value_data.get(), size) != size) {
+  if (read_reply(value_data.get(), size) != size) {
     throw std::runtime_error("Error receiving value data");
   }
 
   return std::make_pair(value_data, size);
 }
 
+/**
+  * FORMAT of message to send is:
+  * operation (uint32_t)
+  * size of the rest of the message (uint32_t)
+  * number of values N (uint32_t)
+  * N times: key (KEY_SIZE bytes), size of the value (uint32_t), value
+  */
+void PSSparseServerInterface::multi_set_value(
+    const std::vector<std::string>& keys,
+    const std::vector<std::pair<const char*, uint32_t>>& values) {
+  if (keys.size() != values.size()) {
+    throw std::runtime_error("Number of keys and values differ");
+  }
+  if (is_sharded()) {
+    shards_[0]->multi_set_value(keys, values);
+    return;
+  }
+
+  uint64_t msg_size = sizeof(uint32_t) * 3;
+  for (const auto& value : values) {
+    msg_size += KEY_SIZE + sizeof(uint32_t) + value.second;
+  }
+  std::vector<char> msg(msg_size, 0);
+  char* data = msg.data();
+  store_value<uint32_t>(data, MULTI_SET_VALUE);
+  store_value<uint32_t>(data, msg_size - sizeof(uint32_t) * 2);
+  store_value<uint32_t>(data, keys.size());
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    assert(keys[i].size() <= KEY_SIZE);
+    std::copy(keys[i].begin(), keys[i].end(), data);
+    data += KEY_SIZE;
+    store_value<uint32_t>(data, values[i].second);
+    std::copy(values[i].first, values[i].first + values[i].second, data);
+    data += values[i].second;
+  }
+  if (send_request(msg.data(), msg_size) != static_cast<ssize_t>(msg_size)) {
+    throw std::runtime_error("Error sending values");
+  }
+}
+
+/**
+  * FORMAT of message to send is:
+  * operation (uint32_t)
+  * size of the rest of the message (uint32_t)
+  * number of keys N (uint32_t)
+  * N keys (KEY_SIZE bytes each)
+  */
+std::vector<std::pair<std::shared_ptr<char>, uint32_t>>
+PSSparseServerInterface::multi_get_value(const std::vector<std::string>& keys) {
+  if (is_sharded()) {
+    return shards_[0]->multi_get_value(keys);
+  }
+
+  uint64_t msg_size = sizeof(uint32_t) * 3 + keys.size() * KEY_SIZE;
+  std::vector<char> msg(msg_size, 0);
+  char* data = msg.data();
+  store_value<uint32_t>(data, MULTI_GET_VALUE);
+  store_value<uint32_t>(data, msg_size - sizeof(uint32_t) * 2);
+  store_value<uint32_t>(data, keys.size());
+  for (const auto& key : keys) {
+    assert(key.size() <= KEY_SIZE);
+    std::copy(key.begin(), key.end(), data);
+    data += KEY_SIZE;
+  }
+  if (send_request(msg.data(), msg_size) != static_cast<ssize_t>(msg_size)) {
+    throw std::runtime_error("Error sending keys");
+  }
+
+  std::vector<std::pair<std::shared_ptr<char>, uint32_t>> values;
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    uint32_t size = 0;
+    if (read_reply(&size, sizeof(uint32_t)) != sizeof(uint32_t)) {
+      throw std::runtime_error("Error reading value size");
+    }
+    std::shared_ptr<char> value;
+    if (size != 0) {
+      value.reset(new char[size], std::default_delete<char[]>());
+      if (read_reply(value.get(), size) != size) {
+        throw std::runtime_error("Error reading value");
+      }
+    }
+    values.push_back(std::make_pair(value, size));
+  }
+  return values;
+}
+
+std::string PSSparseServerInterface::get_metrics() {
+  if (is_sharded()) {
+    std::string metrics = "[";
+    for (uint64_t i = 0; i < shards_.size(); ++i) {
+      metrics += (i == 0 ? "" : ", ") + shards_[i]->get_metrics();
+    }
+    return metrics + "]";
+  }
+
+  uint32_t operation = GET_METRICS;
+  if (send_request(&operation, sizeof(operation)) != sizeof(operation)) {
+    throw std::runtime_error("Error sending operation");
+  }
+  uint32_t size = 0;
+  if (read_reply(&size, sizeof(uint32_t)) != sizeof(uint32_t)) {
+    throw std::runtime_error("Error reading metrics size");
+  }
+  std::string metrics(size, '\0');
+  if (read_reply(&metrics[0], size) != size) {
+    throw std::runtime_error("Error reading metrics");
+  }
+  return metrics;
+}
+
 } // namespace cirrus
 
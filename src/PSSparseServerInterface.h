@@ -11,30 +11,88 @@
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <vector>
+#include "Configuration.h"
 #include "ModelGradient.h"
 #include "Utils.h"
 #include "SparseLRModel.h"
 #include "SparseMFModel.h"
 #include "Model.h"
+#include "MuxConnection.h"
+#include "ShardMap.h"
+#include "ShmRing.h"
 
 namespace cirrus {
 
+/**
+  * Client of the parameter server
+  * When the configuration has ps_shards the models are partitioned across
+  * several parameter servers. Model requests and gradients are then split
+  * per shard, sent to all shards before waiting for any reply, and the
+  * replies are merged back. All other operations go to the first shard.
+  * With worker_multiplex the interfaces of a process share one connection
+  * per parameter server (see MuxConnection), so several threads can each
+  * use their own interface without a connection per thread.
+  * Otherwise, when the parameter server runs on the same host, requests and
+  * replies go through shared memory rings (shm_ring_size_kb) instead of
+  * the socket.
+  */
 class PSSparseServerInterface {
  public:
   PSSparseServerInterface(const std::string& ip, int port);
+
+  /**
+    * Talks to the shards in config.get_ps_shards() or to ip:port when
+    * there are no shards
+    */
+  PSSparseServerInterface(const std::string& ip,
+                          int port,
+                          const Configuration& config);
   virtual ~PSSparseServerInterface();
 
+  /**
+    * Connect and agree on the latest wire format the server supports
+    */
   void connect();
 
+  /**
+    * Ask the server to use a WireFormat for the requests of this connection
+    * @return Format the server agreed to (it may not support format)
+    */
+  uint32_t negotiate_wire_format(uint32_t format);
+
+  /**
+    * Quantize the values of the gradients sent from now on, once the
+    * connection uses WIRE_FORMAT_QUANTIZED (full precision otherwise)
+    */
+  void set_gradient_quantization(uint32_t quantization);
+
   void send_lr_gradient(const LRSparseGradient&);
   void send_mf_gradient(const MFSparseGradient&);
   
   SparseLRModel get_lr_sparse_model(const SparseDataset& ds, const Configuration& config);
   void get_lr_sparse_model_inplace(const SparseDataset& ds, SparseLRModel&, const Configuration& config);
+
+  /**
+    * Send the gradient of a minibatch and get the LR weights of the next
+    * minibatch ds in a single round trip. The weights are read after the
+    * gradient is applied
+    */
+  void send_lr_gradient_get_sparse_model(const LRSparseGradient& gradient,
+                                         const SparseDataset& ds,
+                                         SparseLRModel& lr_model,
+                                         const Configuration& config);
   SparseMFModel get_sparse_mf_model(const SparseDataset& ds, uint32_t, uint32_t);
 
   std::unique_ptr<CirrusModel> get_full_model(bool isCollaborativeFiltering); //XXX use a better argument here
 
+  /**
+    * Patch model with the LR weights that changed on the parameter server
+    * since the previous call. The first call fetches the whole model.
+    * Always pass the same model
+    */
+  void get_lr_model_delta(SparseLRModel* model);
+
   void set_status(uint32_t id, uint32_t status);
   uint32_t get_status(uint32_t id);
 
@@ -53,6 +111,23 @@ class PSSparseServerInterface {
    */
   std::pair<std::shared_ptr<char>, uint32_t> get_value(const std::string& key);
 
+  /*
+   * Set several key-value pairs with a single request
+   * @param keys Key names
+   * @param values Value (data and size in bytes) of each key
+   */
+  void multi_set_value(
+      const std::vector<std::string>& keys,
+      const std::vector<std::pair<const char*, uint32_t>>& values);
+
+  /*
+   * Get the values of several keys with a single request
+   * @param keys Key names
+   * @return Value and size of each key, null for keys not set
+   */
+  std::vector<std::pair<std::shared_ptr<char>, uint32_t>> multi_get_value(
+      const std::vector<std::string>& keys);
+
   /*
    * Marks task as running on the parameter server
    * Used to guarantee there are no duplicate tasks
@@ -70,11 +145,119 @@ class PSSparseServerInterface {
    */
   uint32_t deregister_task(uint32_t id);
 
+  /*
+   * Report the clock of a task in stale synchronous parallel mode
+   * (ssp_staleness): the number of minibatches it finished
+   * @param id Id the task registered with
+   * @return Whether the task may pull the model of its next minibatch.
+   *         Always true for unregistered tasks or with SSP disabled
+   */
+  bool advance_clock(uint32_t id, uint64_t clock);
+
+  /*
+   * Report the clock of a task until the parameter server lets it pull
+   * the model of its next minibatch, waiting longer between each try
+   */
+  void wait_for_clock(uint32_t id, uint64_t clock);
+
+  /**
+    * Latency histograms and traffic counters of the parameter server in
+    * JSON (see PSMetrics). With shards, a JSON array with the metrics of
+    * each shard
+    */
+  std::string get_metrics();
+
+  /**
+    * Whether requests go through shared memory rather than a socket
+    */
+  bool uses_shared_memory() const { return shm_ != nullptr; }
+
+  /**
+    * LR model indices of the samples of a minibatch, sorted and without
+    * duplicates
+    */
+  static std::vector<uint32_t> lr_sparse_indices(const SparseDataset& ds);
+
  private:
+  void create_socket();
+  // move the requests of the connection to a shared memory segment, if
+  // the parameter server takes it
+  void attach_shm();
+
+  // a whole request, and the next bytes of the reply to the last request.
+  // Return like send_all / read_all
+  ssize_t send_request(const void* data, size_t size);
+  ssize_t read_reply(void* data, size_t size);
+
+  bool is_sharded() const { return !shards_.empty(); }
+
+  // single server requests. Sharded requests are built out of these
+  // serialization of requests in the negotiated wire format
+  uint64_t lr_gradient_size_bound(const LRSparseGradient& gradient) const;
+  uint32_t serialize_lr_gradient(const LRSparseGradient& gradient,
+                                 char* mem) const;
+  char* serialize_lr_indices(const std::vector<uint32_t>& indices,
+                             char* mem) const;
+
+  void send_lr_sparse_request(const std::vector<uint32_t>& indices);
+  void send_lr_gradient_sparse_request(const LRSparseGradient& gradient,
+                                       const std::vector<uint32_t>& indices);
+  void read_lr_sparse_reply(FEATURE_TYPE* weights, uint32_t num_weights);
+  void send_mf_sparse_request(const std::vector<uint32_t>& item_ids,
+                              uint32_t user_base,
+                              uint32_t minibatch_size);
+  // records of the users and items, and their number of factors
+  std::vector<char> read_mf_sparse_reply(uint32_t* nfactors);
+  void send_full_model_request(bool isCollaborative);
+  std::unique_ptr<CirrusModel> read_full_model_reply(bool isCollaborative);
+  void send_lr_delta_request();
+  // map translates the indices of this shard (nullptr if not sharded)
+  void read_lr_delta_reply(SparseLRModel* model,
+                           const ShardMap* map,
+                           uint32_t shard);
+
+  // gradient (if not null) goes to the shards along with the requests
+  void get_lr_sparse_model_sharded(const LRSparseGradient* gradient,
+                                   const std::vector<uint32_t>& indices,
+                                   SparseLRModel& lr_model,
+                                   const Configuration& config);
+  SparseMFModel get_sparse_mf_model_sharded(
+      const std::vector<uint32_t>& item_ids,
+      uint32_t user_base,
+      uint32_t minibatch_size);
+  std::unique_ptr<CirrusModel> get_full_model_sharded(bool isCollaborative);
+  // one gradient per shard, with local indices
+  std::vector<LRSparseGradient> split_lr_gradient(const LRSparseGradient&);
+  void send_lr_gradient_sharded(const LRSparseGradient&);
+  void send_mf_gradient_sharded(const MFSparseGradient&);
+
   std::string ip;
   int port;
   int sock = -1;
+  bool connected = false;
   struct sockaddr_in serv_addr;
+  uint64_t lr_model_version_ = 0;  //< version of the last LR model delta
+  uint32_t wire_format_ = 0;  //< WireFormat agreed with the server
+  uint32_t quantization_ = 0;  //< Quantization of the gradients sent
+  // serialized gradients, reused so sending a gradient does not allocate
+  std::vector<char> send_buffer_;
+
+  bool multiplex_ = false;  //< share the connection with other interfaces
+  std::shared_ptr<MuxConnection> mux_;
+  std::vector<char> reply_;  //< reply to the last request, with mux_
+  uint64_t reply_pos_ = 0;   //< bytes of reply_ read
+  uint32_t last_request_id_ = 0;
+  bool awaiting_reply_ = false;  //< reply_ is not the last request's yet
+
+  uint64_t shm_ring_size_ = 0;  //< 0: requests go through the socket
+  std::unique_ptr<ShmSegment> shm_;  //< rings attached by the server
+  std::function<bool()> shm_alive_;  //< the server is still there
+
+  // one connection per shard (empty with a single parameter server)
+  std::vector<std::unique_ptr<PSSparseServerInterface>> shards_;
+  std::unique_ptr<ShardMap> lr_map_;     //< shards of the LR weights
+  std::unique_ptr<ShardMap> users_map_;  //< shards of the MF users
+  std::unique_ptr<ShardMap> items_map_;  //< shards of the MF items
 };
 
 } // namespace cirrus
@@ -4,22 +4,87 @@
 #include "Utils.h"
 #include "Constants.h"
 #include "Checksum.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
 #include <signal.h>
 #include "OptimizationMethod.h"
 #include "AdaGrad.h"
 #include "Momentum.h"
 #include "SGD.h"
 #include "Nesterov.h"
+#include "ModelUpdater.h"
+#include "ShardMap.h"
+#include "WireFormat.h"
 
 #undef DEBUG
 
 #define MAX_CONNECTIONS (nworkers * 2 + 1) // (2 x # workers + 1)
-#define THREAD_MSG_BUFFER_SIZE 1000000
+// idle request and reply buffers kept for reuse
+#define BUFFER_POOL_MAX_IDLE (256 * 1024 * 1024)
 
 #define TIMEOUT_THRESHOLD_SEC (3)
 
+#define EPOLL_MAX_EVENTS 64
+// connections on sockets above this are rejected
+#define MAX_SOCKETS 65536
+#define EPOLL_TIMEOUT_MS 100
+
+// io_uring instance of each worker thread (io_uring mode)
+#define IO_URING_ENTRIES 256
+#define IO_URING_NUM_BUFFERS 256  //< buffers receives pick from
+#define IO_URING_BUFFER_SIZE (16 * 1024)
+#define IO_URING_TIMEOUT_MS 100
+
 namespace cirrus {
 
+// what an io_uring completion is for, in the low bits of its user data
+// (the socket is in the others)
+enum UringOperation : uint64_t {
+  URING_ACCEPT = 0,
+  URING_RECV = 1,
+  URING_SEND = 2,
+};
+#define URING_OPERATION_BITS 2
+
+static uint64_t uring_data(int sock, UringOperation operation) {
+  return (static_cast<uint64_t>(sock) << URING_OPERATION_BITS) | operation;
+}
+
+/**
+  * A connection of an io_uring thread and its I/O in flight. It is only
+  * closed once nothing is in flight anymore
+  */
+struct UringConnection {
+  explicit UringConnection(Connection* conn) : conn(conn) {}
+
+  Connection* conn;
+  bool receiving = true;      //< multishot receive armed
+  bool sending = false;       //< send of replies in flight
+  bool closing = false;       //< close once nothing is in flight
+  std::vector<char> replies;  //< replies being sent
+  uint64_t sent = 0;          //< bytes of replies sent
+};
+
+// send what is left of the replies handed over, or the next ones
+static void send_replies(IoUring* ring, UringConnection* uconn) {
+  if (uconn->sending || uconn->closing) {
+    return;
+  }
+  if (uconn->sent == uconn->replies.size()) {
+    if (!uconn->conn->has_pending_replies()) {
+      return;
+    }
+    uconn->conn->take_replies(&uconn->replies);
+    uconn->sent = 0;
+  }
+  uint64_t size = std::min<uint64_t>(uconn->replies.size() - uconn->sent,
+                                     UINT32_MAX);
+  ring->send(uconn->conn->sock(), uconn->replies.data() + uconn->sent, size,
+             uring_data(uconn->conn->sock(), URING_SEND));
+  uconn->sending = true;
+}
+
 PSSparseServerTask::PSSparseServerTask(uint64_t model_size,
                                        uint64_t batch_size,
                                        uint64_t samples_per_batch,
@@ -27,7 +92,8 @@ PSSparseServerTask::PSSparseServerTask(uint64_t model_size,
                                        uint64_t nworkers,
                                        uint64_t worker_id,
                                        const std::string& ps_ip,
-                                       uint64_t ps_port)
+                                       uint64_t ps_port,
+                                       uint32_t shard_id)
     : MLTask(model_size,
              batch_size,
              samples_per_batch,
@@ -37,18 +103,28 @@ PSSparseServerTask::PSSparseServerTask(uint64_t model_size,
              ps_ip,
              ps_port),
       main_thread(0),
+      shard_id(shard_id),
+      metrics(new PSMetrics(NUM_PS_WORK_THREADS + MAX_SHM_CLIENTS)),
+      server_start_us(get_time_us()),
+      buffer_pool(new BufferPool(BUFFER_POOL_MAX_IDLE)),
       kill_signal(false),
       threads_barrier(new pthread_barrier_t, destroy_pthread_barrier) {
   std::cout << "PSSparseServerTask is built" << std::endl;
 
   std::atomic_init(&gradientUpdatesCount, 0UL);
   std::atomic_init(&thread_count, 0);
+  std::atomic_init(&num_connections, 0U);
+  std::atomic_init(&next_epoll_thread, 0UL);
 
   set_operation_maps();
 
-  for (int i = 0; i < NUM_PS_WORK_THREADS; i++) {
-    thread_msg_buffer[i].reset(new char[THREAD_MSG_BUFFER_SIZE]);
+  // create barrier for all poll threads
+  if (pthread_barrier_init(threads_barrier.get(), nullptr, NUM_POLL_THREADS) !=
+      0) {
+    throw std::runtime_error("Error in threads barrier");
   }
+
+  connections.reset(new std::unique_ptr<Connection>[MAX_SOCKETS]);
 }
 
 void PSSparseServerTask::set_operation_maps() {
@@ -68,45 +144,65 @@ void PSSparseServerTask::set_operation_maps() {
   operation_to_name[KILL_SIGNAL] = "KILL_SIGNAL";
   operation_to_name[SET_VALUE] = "SET_VALUE";
   operation_to_name[GET_VALUE] = "GET_VALUE";
+  operation_to_name[GET_LR_MODEL_DELTA] = "GET_LR_MODEL_DELTA";
+  operation_to_name[SEND_LR_GRADIENT_GET_SPARSE_MODEL] =
+      "SEND_LR_GRADIENT_GET_SPARSE_MODEL";
+  operation_to_name[NEGOTIATE_WIRE_FORMAT] = "NEGOTIATE_WIRE_FORMAT";
+  operation_to_name[GET_METRICS] = "GET_METRICS";
+  operation_to_name[MULTI_GET_VALUE] = "MULTI_GET_VALUE";
+  operation_to_name[MULTI_SET_VALUE] = "MULTI_SET_VALUE";
+  operation_to_name[ADVANCE_CLOCK] = "ADVANCE_CLOCK";
+  operation_to_name[ENABLE_REQUEST_IDS] = "ENABLE_REQUEST_IDS";
+  operation_to_name[ATTACH_SHM] = "ATTACH_SHM";
 
   using namespace std::placeholders;
   operation_to_f[SEND_LR_GRADIENT] = std::bind(
-      &PSSparseServerTask::process_send_lr_gradient, this, _1, _2, _3, _4);
+      &PSSparseServerTask::process_send_lr_gradient, this, _1, _2, _3);
   operation_to_f[SEND_MF_GRADIENT] = std::bind(
-      &PSSparseServerTask::process_send_mf_gradient, this, _1, _2, _3, _4);
+      &PSSparseServerTask::process_send_mf_gradient, this, _1, _2, _3);
   operation_to_f[GET_LR_SPARSE_MODEL] = std::bind(
-      &PSSparseServerTask::process_get_lr_sparse_model, this, _1, _2, _3, _4);
+      &PSSparseServerTask::process_get_lr_sparse_model, this, _1, _2, _3);
   operation_to_f[GET_MF_SPARSE_MODEL] = std::bind(
-      &PSSparseServerTask::process_get_mf_sparse_model, this, _1, _2, _3, _4);
+      &PSSparseServerTask::process_get_mf_sparse_model, this, _1, _2, _3);
   operation_to_f[GET_MF_FULL_MODEL] = std::bind(
-      &PSSparseServerTask::process_get_mf_full_model, this, _1, _2, _3, _4);
+      &PSSparseServerTask::process_get_mf_full_model, this, _1, _2, _3);
   operation_to_f[GET_LR_FULL_MODEL] = std::bind(
-      &PSSparseServerTask::process_get_lr_full_model, this, _1, _2, _3, _4);
+      &PSSparseServerTask::process_get_lr_full_model, this, _1, _2, _3);
   operation_to_f[SET_TASK_STATUS] = std::bind(
-      &PSSparseServerTask::process_set_task_status, this, _1, _2, _3, _4);
+      &PSSparseServerTask::process_set_task_status, this, _1, _2, _3);
   operation_to_f[GET_TASK_STATUS] = std::bind(
-      &PSSparseServerTask::process_get_task_status, this, _1, _2, _3, _4);
+      &PSSparseServerTask::process_get_task_status, this, _1, _2, _3);
   operation_to_f[GET_NUM_CONNS] = std::bind(
-      &PSSparseServerTask::process_get_num_conns, this, _1, _2, _3, _4);
+      &PSSparseServerTask::process_get_num_conns, this, _1, _2, _3);
   operation_to_f[GET_NUM_UPDATES] = std::bind(
-      &PSSparseServerTask::process_get_num_updates, this, _1, _2, _3, _4);
+      &PSSparseServerTask::process_get_num_updates, this, _1, _2, _3);
   operation_to_f[REGISTER_TASK] = std::bind(
-      &PSSparseServerTask::process_register_task, this, _1, _2, _3, _4);
+      &PSSparseServerTask::process_register_task, this, _1, _2, _3);
   operation_to_f[DEREGISTER_TASK] = std::bind(
-      &PSSparseServerTask::process_deregister_task, this, _1, _2, _3, _4);
+      &PSSparseServerTask::process_deregister_task, this, _1, _2, _3);
   operation_to_f[SET_VALUE] =
-      std::bind(&PSSparseServerTask::process_set_value, this, _1, _2, _3, _4);
+      std::bind(&PSSparseServerTask::process_set_value, this, _1, _2, _3);
   operation_to_f[GET_VALUE] =
-      std::bind(&PSSparseServerTask::process_get_value, this, _1, _2, _3, _4);
-}
-
-std::shared_ptr<char> PSSparseServerTask::serialize_lr_model(
-    const SparseLRModel& lr_model, uint64_t* model_size) const {
-  *model_size = lr_model.getSerializedSize();
-  auto d = std::shared_ptr<char>(
-      new char[*model_size], std::default_delete<char[]>());
-  lr_model.serializeTo(d.get());
-  return d;
+      std::bind(&PSSparseServerTask::process_get_value, this, _1, _2, _3);
+  operation_to_f[GET_LR_MODEL_DELTA] = std::bind(
+      &PSSparseServerTask::process_get_lr_model_delta, this, _1, _2, _3);
+  operation_to_f[SEND_LR_GRADIENT_GET_SPARSE_MODEL] =
+      std::bind(&PSSparseServerTask::process_send_lr_gradient_get_sparse_model,
+                this, _1, _2, _3);
+  operation_to_f[NEGOTIATE_WIRE_FORMAT] = std::bind(
+      &PSSparseServerTask::process_negotiate_wire_format, this, _1, _2, _3);
+  operation_to_f[GET_METRICS] = std::bind(
+      &PSSparseServerTask::process_get_metrics, this, _1, _2, _3);
+  operation_to_f[MULTI_GET_VALUE] = std::bind(
+      &PSSparseServerTask::process_multi_get_value, this, _1, _2, _3);
+  operation_to_f[MULTI_SET_VALUE] = std::bind(
+      &PSSparseServerTask::process_multi_set_value, this, _1, _2, _3);
+  operation_to_f[ADVANCE_CLOCK] = std::bind(
+      &PSSparseServerTask::process_advance_clock, this, _1, _2, _3);
+  operation_to_f[ENABLE_REQUEST_IDS] = std::bind(
+      &PSSparseServerTask::process_enable_request_ids, this, _1, _2, _3);
+  operation_to_f[ATTACH_SHM] = std::bind(
+      &PSSparseServerTask::process_attach_shm, this, _1, _2, _3);
 }
 
 bool PSSparseServerTask::testRemove(struct pollfd x, int poll_id) {
@@ -120,81 +216,115 @@ bool PSSparseServerTask::testRemove(struct pollfd x, int poll_id) {
 
 bool PSSparseServerTask::process_send_mf_gradient(
     int sock,
-    const Request& req,
-    std::vector<char>& thread_buffer,
+    Request& req,
     int) {
   uint32_t incoming_size = 0;
-  if (read_all(sock, &incoming_size, sizeof(uint32_t)) == 0) {
-    handle_failed_read(&req.poll_fd);
+  if (!req.read(&incoming_size, sizeof(uint32_t))) {
+    handle_failed_read(req);
     return false;
   }
 #ifdef DEBUG
   std::cout << "APPLY_GRADIENT_REQ incoming size: " << incoming_size
             << std::endl;
 #endif
-  if (incoming_size > thread_buffer.size()) {
-    throw std::runtime_error("Not enough buffer");
-  }
-  if (read_all(req.sock, thread_buffer.data(), incoming_size) == 0) {
+  const char* data = req.next(incoming_size);
+  if (data == nullptr) {
+    handle_failed_read(req);
     return false;
   }
 
+  // raw gradients are applied in place, from the receive buffer, unless
+  // an earlier request of the connection left them unaligned
+  uint32_t format = req.conn->wire_format;
+  std::vector<FEATURE_TYPE> aligned;
+  if (format == WIRE_FORMAT_RAW &&
+      reinterpret_cast<uintptr_t>(data) % alignof(FEATURE_TYPE) != 0) {
+    aligned.resize(incoming_size / sizeof(FEATURE_TYPE) + 1);
+    std::memcpy(aligned.data(), data, incoming_size);
+    data = reinterpret_cast<const char*>(aligned.data());
+  }
   MFSparseGradient gradient;
-  gradient.loadSerialized(thread_buffer.data());
+  MFGradientView view;
+  if (format != WIRE_FORMAT_RAW) {
+    gradient.loadSerializedCompact(data, incoming_size, format);
+    view = gradient.view();
+  } else {
+    view = MFGradientView::of_serialized(data, incoming_size);
+  }
+  // a gradient that does not fit the model fails the connection before any
+  // of it is applied
+  view.check_bounds(mf_model->get_nusers(), mf_model->get_nitems(),
+                    mf_model->get_nfactors());
+  PSMetrics::lap(STAGE_DESERIALIZE);
 
-  model_lock.lock();
 #ifdef DEBUG
   std::cout << "Doing sgd update" << std::endl;
 #endif
-  mf_model->sgd_update(
-      task_config.get_learning_rate(), &gradient);
+  model_updater->apply_mf_gradient(mf_model.get(), view);
+  PSMetrics::lap(STAGE_APPLY);
 #ifdef DEBUG
   std::cout
     << "sgd update done"
     << " checksum: " << mf_model->checksum()
     << std::endl;
 #endif
-  model_lock.unlock();
   gradientUpdatesCount++;
   return true;
 }
 
 bool PSSparseServerTask::process_send_lr_gradient(
     int sock,
-    const Request& req,
-    std::vector<char>& thread_buffer,
-    int) {
+    Request& req,
+    int thread_number) {
   // read 4 bytes of the size of the remaining message
   uint32_t incoming_size = 0;
-  if (read_all(sock, &incoming_size, sizeof(uint32_t)) == 0) {
-    handle_failed_read(&req.poll_fd);
+  if (!req.read(&incoming_size, sizeof(uint32_t))) {
+    handle_failed_read(req);
     return false;
   }
 #ifdef DEBUG
   std::cout << "APPLY_GRADIENT_REQ incoming size: " << incoming_size
             << std::endl;
 #endif
-  if (incoming_size > thread_buffer.size()) {
-    throw std::runtime_error("Not enough buffer");
-  }
-  //buffer.resize(incoming_size);
-  try {
-    if (read_all(req.sock, thread_buffer.data(), incoming_size) == 0) {
-      return false;
-    }
-  } catch (...) {
-    throw std::runtime_error("Uhandled error");
+  const char* data = req.next(incoming_size);
+  if (data == nullptr) {
+    handle_failed_read(req);
+    return false;
   }
 
+  apply_lr_gradient(data, incoming_size, req.conn->wire_format,
+                    thread_number);
+  return true;
+}
+
+void PSSparseServerTask::apply_lr_gradient(const char* data,
+                                           uint32_t size,
+                                           uint32_t format,
+                                           int thread_number) {
   LRSparseGradient gradient(0);
-  gradient.loadSerialized(thread_buffer.data());
+  if (format != WIRE_FORMAT_RAW) {
+    gradient.loadSerializedCompact(data, size, format);
+  } else {
+    gradient.loadSerialized(data);
+  }
+  PSMetrics::lap(STAGE_DESERIALIZE);
 
-  model_lock.lock();
-  opt_method->sgd_update(
-      lr_model, &gradient);
-  model_lock.unlock();
+  if (gradient_coalescer) {
+    if (gradient_coalescer->add(thread_number, gradient)) {
+      flush_coalesced_gradients(thread_number);
+    }
+  } else {
+    model_updater->apply_lr_gradient(lr_model, opt_method.get(), gradient);
+  }
+  PSMetrics::lap(STAGE_APPLY);
   gradientUpdatesCount++;
-  return true;
+}
+
+void PSSparseServerTask::flush_coalesced_gradients(uint32_t window) {
+  static thread_local LRSparseGradient merged(0);
+  if (gradient_coalescer->take(window, &merged)) {
+    model_updater->apply_lr_gradient(lr_model, opt_method.get(), merged);
+  }
 }
 
 // XXX we have to refactor this ASAP
@@ -202,185 +332,309 @@ bool PSSparseServerTask::process_send_lr_gradient(
 
 bool PSSparseServerTask::process_get_mf_sparse_model(
     int sock,
-    const Request& req,
-    std::vector<char>& thread_buffer,
+    Request& req,
     int thread_number) {
   uint32_t incoming_size = 0;
-  if (read_all(sock, &incoming_size, sizeof(uint32_t)) == 0) {
-    handle_failed_read(&req.poll_fd);
-    return false;
-  }
   uint32_t k_items = 0;
   uint32_t base_user_id = 0;
   uint32_t minibatch_size = 0;
   uint32_t magic_value = 0;
+  if (!req.read(&incoming_size, sizeof(uint32_t)) ||
+      !req.read(&k_items, sizeof(uint32_t)) ||
+      !req.read(&base_user_id, sizeof(uint32_t)) ||
+      !req.read(&minibatch_size, sizeof(uint32_t)) ||
+      !req.read(&magic_value, sizeof(uint32_t))) {
+    handle_failed_read(req);
+    return false;
+  }
 
-  read_all(req.sock, &k_items, sizeof(uint32_t));
-  read_all(req.sock, &base_user_id, sizeof(uint32_t));
-  read_all(req.sock, &minibatch_size, sizeof(uint32_t));
-  read_all(req.sock, &magic_value, sizeof(uint32_t));
-
-  assert(k_items > 0);
-  assert(minibatch_size > 0);
   if (magic_value != MAGIC_NUMBER) {
     throw std::runtime_error("Wrong message");
   }
-  read_all(req.sock, thread_buffer.data(), k_items * sizeof(uint32_t));
+  // with a sharded PS some requests can ask for no users or no items:
+  // k_items and minibatch_size can be 0 and the reply then has no records
+  const char* item_ids = req.next(k_items * sizeof(uint32_t));
+  if (item_ids == nullptr) {
+    handle_failed_read(req);
+    return false;
+  }
+  uint32_t nfactors = mf_model->get_nfactors();
   uint32_t to_send_size =
-      minibatch_size *
-          (sizeof(uint32_t) + (NUM_FACTORS + 1) * sizeof(FEATURE_TYPE)) +
-      k_items * (sizeof(uint32_t) + (NUM_FACTORS + 1) * sizeof(FEATURE_TYPE));
+      (minibatch_size + k_items) *
+      (sizeof(uint32_t) + (nfactors + 1) * sizeof(FEATURE_TYPE));
 #ifdef DEBUG
   std::cout << "k_items: " << k_items << std::endl;
   std::cout << "base_user_id: " << base_user_id << std::endl;
   std::cout << "minibatch_size: " << minibatch_size << std::endl;
 #endif
 
+  BufferPool::Buffer buffer = buffer_pool->get(to_send_size);
   SparseMFModel sparse_mf_model((uint64_t) 0, 0, 0);
   sparse_mf_model.serializeFromDense(*mf_model, base_user_id, minibatch_size,
-                                     k_items, thread_buffer.data(),
-                                     thread_msg_buffer[thread_number].get());
-  //uint32_t to_send_size = data_to_send.size();
-  if (send_all(req.sock, &to_send_size, sizeof(uint32_t)) == -1) {
-    return false;
-  }
-  if (send_all(req.sock, thread_msg_buffer[thread_number].get(),
-               to_send_size) == -1) {
-    return false;
-  }
+                                     k_items, item_ids, buffer.data());
+  PSMetrics::lap(STAGE_SERIALIZE);
+  req.reply(&to_send_size, sizeof(uint32_t));
+  req.reply(&nfactors, sizeof(uint32_t));
+  req.reply(buffer.data(), to_send_size);
   return true;
 }
 
 bool PSSparseServerTask::process_get_lr_sparse_model(
     int sock,
-    const Request& req,
-    std::vector<char>& thread_buffer,
+    Request& req,
     int) {
   // need to parse the buffer to get the indices of the model we want
   // to send back to the client
   uint32_t incoming_size = 0;
-  if (read_all(sock, &incoming_size, sizeof(uint32_t)) == 0) {
-    handle_failed_read(&req.poll_fd);
+  if (!req.read(&incoming_size, sizeof(uint32_t))) {
+    handle_failed_read(req);
     return false;
   }
-  if (incoming_size > thread_buffer.size()) {
-    throw std::runtime_error("Not enough buffer");
-  }
 #ifdef DEBUG
   std::cout << "GET_MODEL_REQ incoming size: " << incoming_size << std::endl;
 #endif
-  try {
-    if (read_all(req.sock, thread_buffer.data(), incoming_size) == 0) {
-      return false;
-    }
-  } catch (...) {
-    throw std::runtime_error("Uhandled error");
+  const char* data = req.next(incoming_size);
+  if (data == nullptr || incoming_size < sizeof(uint32_t)) {
+    handle_failed_read(req);
+    return false;
   }
-
-  const char* data = thread_buffer.data();
+  const char* end = data + incoming_size;
   uint64_t num_entries = load_value<uint32_t>(data);
 
-  uint32_t to_send_size = num_entries * sizeof(FEATURE_TYPE);
-  assert(to_send_size < 1024 * 1024);
-  char data_to_send[1024 * 1024]; // 1MB
-  char* data_to_send_ptr = data_to_send;
+  uint64_t to_send_size = num_entries * sizeof(FEATURE_TYPE);
+  const uint32_t* indices =
+      read_lr_indices(data, end, num_entries, req.conn->wire_format);
+  PSMetrics::lap(STAGE_DESERIALIZE);
 
 #ifdef DEBUG
   std::cout << "Sending back: " << num_entries
     << " weights from model. Size: " << to_send_size
     << std::endl;
 #endif
+  BufferPool::Buffer buffer = buffer_pool->get(to_send_size);
+  lookup_lr_weights(indices, num_entries, buffer.data());
+  PSMetrics::lap(STAGE_SERIALIZE);
+  req.reply(buffer.data(), to_send_size);
+  return true;
+}
+
+const uint32_t* PSSparseServerTask::read_lr_indices(const char* data,
+                                                   const char* end,
+                                                   uint32_t num_entries,
+                                                   uint32_t format) {
+  if (format == WIRE_FORMAT_RAW) {
+    if (static_cast<uint64_t>(end - data) < num_entries * sizeof(uint32_t)) {
+      throw std::runtime_error("Truncated index list");
+    }
+    return reinterpret_cast<const uint32_t*>(data);
+  }
+  static thread_local std::vector<uint32_t> indices;
+  indices.resize(num_entries);
+  decode_sorted_indices(data, end, num_entries, indices.data());
+  return indices.data();
+}
+
+/**
+  * Clients send sorted indices so this is a forward walk over the model
+  */
+void PSSparseServerTask::lookup_lr_weights(const uint32_t* indices,
+                                           uint32_t num_entries,
+                                           char* out) {
   for (uint32_t i = 0; i < num_entries; ++i) {
-    uint32_t entry_index = load_value<uint32_t>(data);
+    uint32_t entry_index = indices[i];
     double weight = lr_model->get_nth_weight(entry_index);
     opt_method->edit_weight(weight);
-    store_value<FEATURE_TYPE>(
-        data_to_send_ptr,
-        weight);
+    store_value<FEATURE_TYPE>(out, weight);
   }
-  if (send_all(req.sock, data_to_send, to_send_size) == -1) {
+}
+
+/**
+  * FORMAT of the request
+  * size of the rest of the message (uint32_t)
+  * size of the gradient (uint32_t)
+  * serialized LRSparseGradient
+  * N number of indices (uint32_t)
+  * list of N indices (N * uint32_t)
+  * The gradient is applied before the N weights are sent back
+  */
+bool PSSparseServerTask::process_send_lr_gradient_get_sparse_model(
+    int sock,
+    Request& req,
+    int thread_number) {
+  uint32_t incoming_size = 0;
+  if (!req.read(&incoming_size, sizeof(uint32_t))) {
+    handle_failed_read(req);
+    return false;
+  }
+  const char* data = req.next(incoming_size);
+  if (data == nullptr || incoming_size < sizeof(uint32_t)) {
+    handle_failed_read(req);
     return false;
   }
+  const char* end = data + incoming_size;
+  uint32_t format = req.conn->wire_format;
+  uint32_t gradient_size = load_value<uint32_t>(data);
+  if (gradient_size + sizeof(uint32_t) * 2 > incoming_size) {
+    throw std::runtime_error("Wrong message");
+  }
+  apply_lr_gradient(data, gradient_size, format, thread_number);
+  data += gradient_size;
+
+  uint32_t num_entries = load_value<uint32_t>(data);
+  uint64_t to_send_size = num_entries * sizeof(FEATURE_TYPE);
+  const uint32_t* indices = read_lr_indices(data, end, num_entries, format);
+  PSMetrics::lap(STAGE_DESERIALIZE);
+  BufferPool::Buffer buffer = buffer_pool->get(to_send_size);
+  lookup_lr_weights(indices, num_entries, buffer.data());
+  PSMetrics::lap(STAGE_SERIALIZE);
+  req.reply(buffer.data(), to_send_size);
   return true;
 }
 
 bool PSSparseServerTask::process_get_mf_full_model(
     int sock,
-    const Request& req,
-    std::vector<char>& thread_buffer,
+    Request& req,
     int) {
-  model_lock.lock();
-  auto mf_model_copy = *mf_model;
-  model_lock.unlock();
-  uint32_t model_size = mf_model_copy.getSerializedSize();
-
-  if (thread_buffer.size() < model_size) {
-    std::cout << "thread_buffer.size(): " << thread_buffer.size()
-      << " model_size: " << model_size << std::endl;
-    throw std::runtime_error("Thread buffer too small");
-  }
+  uint32_t model_size = mf_model->getSerializedSize();
+  BufferPool::Buffer buffer = buffer_pool->get(model_size);
 
-  mf_model_copy.serializeTo(thread_buffer.data());
+  // copy-on-write snapshot, updates keep going while we copy
+  model_updater->serialize_mf_model(*mf_model, buffer.data());
+  PSMetrics::lap(STAGE_SERIALIZE);
   std::cout
     << "Serializing mf model"
-    << " mode checksum: " << mf_model_copy.checksum()
-    << " buffer checksum: " << crc32(thread_buffer.data(), model_size)
+    << " buffer checksum: " << crc32(buffer.data(), model_size)
     << std::endl;
-  if (send_all(req.sock, &model_size, sizeof(uint32_t)) == -1) {
-    return false;
-  }
-  if (send_all(req.sock, thread_buffer.data(), model_size) == -1) {
-    return false;
-  }
+  req.reply(&model_size, sizeof(uint32_t));
+  req.reply(buffer.data(), model_size);
   return true;
 }
 
 bool PSSparseServerTask::process_get_lr_full_model(
     int sock,
-    const Request& req,
-    std::vector<char>& thread_buffer,
+    Request& req,
     int) {
-  model_lock.lock();
-  auto lr_model_copy = *lr_model;
-  model_lock.unlock();
-
   // TODO: This should be largest non-zero weight in model. That way
   // we can reduce the model size, espeically for a large model split across
   // multiple PS
-  uint32_t model_size = lr_model_copy.getSerializedSize();
+  uint32_t model_size = lr_model->getSerializedSize();
+  BufferPool::Buffer buffer = buffer_pool->get(model_size);
 
-  if (thread_buffer.size() < model_size) {
-    std::string error_str = "buffer with size " +
-                            std::to_string(thread_buffer.size()) +
-                            "too small: " + std::to_string(model_size);
-    throw std::runtime_error(error_str);
-  }
+  // copy-on-write snapshot, updates keep going while we copy
+  model_updater->serialize_lr_model(*lr_model, buffer.data());
+  PSMetrics::lap(STAGE_SERIALIZE);
+  req.reply(buffer.data(), model_size);
+  return true;
+}
 
-  lr_model_copy.serializeTo(thread_buffer.data());
-  if (send_all(req.sock, thread_buffer.data(), model_size) == -1)
+/**
+  * FORMAT of the request:
+  * version returned by the previous request or 0 (uint64_t)
+  * FORMAT of the reply:
+  * version to ask next time (uint64_t)
+  * number of weights of the model (uint32_t)
+  * weights per page (uint32_t)
+  * number of pages changed N (uint32_t)
+  * page numbers (N * uint32_t)
+  * weights of each page (FEATURE_TYPE), the last page of the model can be
+  * shorter. Like sparse model requests, weights are edited by the
+  * optimization method (e.g., Nesterov)
+  */
+bool PSSparseServerTask::process_get_lr_model_delta(
+    int sock,
+    Request& req,
+    int) {
+  uint64_t since;
+  if (!req.read(&since, sizeof(uint64_t))) {
+    handle_failed_read(req);
     return false;
+  }
+
+  static thread_local std::vector<uint32_t> pages;
+  uint64_t version = model_updater->lr_changed_pages(since, &pages);
+
+  uint64_t num_weights = lr_model->size();
+  uint64_t reply_size = sizeof(uint64_t) + sizeof(uint32_t) * 3 +
+                        pages.size() * sizeof(uint32_t) +
+                        pages.size() * PageVersions::PAGE_SIZE *
+                            sizeof(FEATURE_TYPE);
+  BufferPool::Buffer buffer = buffer_pool->get(reply_size);
+  char* data = buffer.data();
+  store_value<uint64_t>(data, version);
+  store_value<uint32_t>(data, num_weights);
+  store_value<uint32_t>(data, PageVersions::PAGE_SIZE);
+  store_value<uint32_t>(data, pages.size());
+  for (const auto& page : pages) {
+    store_value<uint32_t>(data, page);
+  }
+  for (const auto& page : pages) {
+    uint64_t begin = page * PageVersions::PAGE_SIZE;
+    uint64_t end = std::min(begin + PageVersions::PAGE_SIZE, num_weights);
+    // weights as lookup_lr_weights sends them to workers
+    for (uint64_t i = begin; i < end; ++i) {
+      double weight = lr_model->get_nth_weight(i);
+      opt_method->edit_weight(weight);
+      store_value<FEATURE_TYPE>(data, weight);
+    }
+  }
+
+  uint64_t to_send = data - buffer.data();
+  PSMetrics::lap(STAGE_SERIALIZE);
+  req.reply(buffer.data(), to_send);
   return true;
 }
 
-void PSSparseServerTask::handle_failed_read(struct pollfd* pfd) {
-  if (close(pfd->fd) != 0) {
-    std::cout << "Error closing socket. errno: " << errno << std::endl;
+/**
+  * FORMAT of the request
+  * highest wire format supported by the client (uint32_t)
+  * The reply is the format used from now on by this connection (uint32_t)
+  */
+bool PSSparseServerTask::process_negotiate_wire_format(
+    int sock,
+    Request& req,
+    int) {
+  uint32_t format = 0;
+  if (!req.read(&format, sizeof(uint32_t))) {
+    handle_failed_read(req);
+    return false;
   }
-  num_connections--;
-  std::cout << "PS closing connection after process(): " << num_connections
-            << std::endl;
-  pfd->fd = -1;
-  pfd->revents = 0;
+  if (format > LATEST_WIRE_FORMAT) {
+    format = LATEST_WIRE_FORMAT;
+  }
+  req.conn->wire_format = format;
+  req.reply(&format, sizeof(uint32_t));
+  return true;
+}
+
+/**
+  * FORMAT of the reply
+  * size of the metrics (uint32_t)
+  * metrics in JSON (see PSMetrics::to_json)
+  */
+bool PSSparseServerTask::process_get_metrics(int sock,
+                                             Request& req,
+                                             int) {
+  std::string json = metrics->to_json(
+      operation_to_name, (get_time_us() - server_start_us) / 1000000,
+      ssp_clock ? ssp_clock->to_json() : "");
+  uint32_t size = json.size();
+  req.reply(&size, sizeof(uint32_t));
+  req.reply(json.data(), size);
+  return true;
+}
+
+void PSSparseServerTask::handle_failed_read(Request& req) {
+  std::cout << "PS malformed request on socket: " << req.sock << std::endl;
+  req.conn->set_failed();
 }
 
 bool PSSparseServerTask::process_set_task_status(
     int sock,
-    const Request& req,
-    std::vector<char>& thread_buffer,
+    Request& req,
     int) {
   uint32_t data[2] = {0};  // id + status
-  if (read_all(sock, data, sizeof(uint32_t) * 2) == 0) {
-    handle_failed_read(&req.poll_fd);
+  if (!req.read(data, sizeof(uint32_t) * 2)) {
+    handle_failed_read(req);
     return false;
   }
 #ifdef debug
@@ -394,11 +648,11 @@ bool PSSparseServerTask::process_set_task_status(
 
 bool PSSparseServerTask::process_get_task_status(
     int sock,
-    const Request& req,
-    std::vector<char>& thread_buffer,
+    Request& req,
     int) {
   uint32_t task_id;
-  if (read_all(sock, &task_id, sizeof(uint32_t)) == 0) {
+  if (!req.read(&task_id, sizeof(uint32_t))) {
+    handle_failed_read(req);
     return false;
   }
 #ifdef debug
@@ -408,38 +662,30 @@ bool PSSparseServerTask::process_get_task_status(
   if (task_to_status.find(task_id) == task_to_status.end() ||
       task_to_status[task_id] == false) {
     uint32_t status = 0;
-    if (send_all(sock, &status, sizeof(uint32_t)) != sizeof(uint32_t)) {
-      return false;
-    }
+    req.reply(&status, sizeof(uint32_t));
   } else {
     uint32_t status = 1;
-    if (send_all(sock, &status, sizeof(uint32_t)) != sizeof(uint32_t)) {
-      return false;
-    }
+    req.reply(&status, sizeof(uint32_t));
   }
   return true;
 }
 
 bool PSSparseServerTask::process_get_num_updates(
     int sock,
-    const Request& req,
-    std::vector<char>& thread_buffer,
+    Request& req,
     int) {
   std::cout << "Retrieve info: " << num_updates << std::endl;
-  if (send_all(sock, &num_updates, sizeof(uint32_t)) != sizeof(uint32_t)) {
-    throw std::runtime_error("Error sending number of connections");
-  }
+  req.reply(&num_updates, sizeof(uint32_t));
   return true;
 }
 
 bool PSSparseServerTask::process_register_task(int sock,
-                                               const Request& req,
-                                               std::vector<char>& thread_buffer,
+                                               Request& req,
                                                int) {
   // read the task id
   uint32_t data[2];  // task_id + remaining_time (sec)
-  if (read_all(sock, &data, sizeof(uint32_t) * 2) == 0) {
-    handle_failed_read(&req.poll_fd);
+  if (!req.read(&data, sizeof(uint32_t) * 2)) {
+    handle_failed_read(req);
     return false;
   }
 
@@ -460,14 +706,14 @@ bool PSSparseServerTask::process_register_task(int sock,
     registered_tasks.insert(task_id);
     task_to_remaining_time[task_id] = remaining_time;
     task_to_starttime[task_id] = std::chrono::steady_clock::now();
+    if (ssp_clock) {
+      ssp_clock->add_task(task_id);
+    }
   }
 
   register_lock.unlock();
 
-  if (send_all(sock, &task_reg, sizeof(uint32_t)) != sizeof(uint32_t)) {
-    std::cout << "Error sending reply" << std::endl;
-    return false;
-  }
+  req.reply(&task_reg, sizeof(uint32_t));
 
   num_tasks++;
 
@@ -475,84 +721,121 @@ bool PSSparseServerTask::process_register_task(int sock,
 }
 
 bool PSSparseServerTask::process_get_num_conns(int sock,
-                                               const Request& req,
-                                               std::vector<char>& thread_buffer,
+                                               Request& req,
                                                int) {
   // NOTE: Consider changing this to flatbuffer serialization?
-  std::cout << "Retrieve info: " << num_connections << std::endl;
-  if (send_all(sock, &num_connections, sizeof(uint32_t)) != sizeof(uint32_t)) {
-    throw std::runtime_error("Error sending number of connections");
-  }
+  uint32_t conns = num_connections;
+  std::cout << "Retrieve info: " << conns << std::endl;
+  req.reply(&conns, sizeof(uint32_t));
 
   return true;
 }
 
 bool PSSparseServerTask::process_get_value(int sock,
-                                           const Request& req,
-                                           std::vector<char>& thread_buffer,
+                                           Request& req,
                                            int) {
-  char key[KEY_SIZE + 1] = {0};
-
   // read the key (KEY_SIZE bytes)
-  if (read_all(sock, &key, KEY_SIZE) == 0) {
-    handle_failed_read(&req.poll_fd);
+  const char* key = req.next(KEY_SIZE);
+  if (key == nullptr) {
+    handle_failed_read(req);
     return false;
   }
+  reply_value(req, key);
+  return true;
+}
 
-  // XXX can use string_view here?
-  auto map_iterator = key_value_map.find(std::string(key));
-  if (map_iterator == key_value_map.end()) {
+void PSSparseServerTask::reply_value(const Request& req, const char* key) {
+  bool found = kv_store->get(key, [&req](const char* value, uint32_t size) {
+    req.reply(&size, sizeof(uint32_t));
+    req.reply(value, size);
+  });
+  if (!found) {
     uint32_t not_found = 0;
-    if (send_all(sock, &not_found, sizeof(char)) != sizeof(char)) {
-      return false;
-    }
-  } else {
-    uint32_t value_size = map_iterator->second.first;
-    if (send_all(sock, &value_size, sizeof(uint32_t)) != sizeof(uint32_t)) {
-      return false;
-    }
-    if (send_all(sock, map_iterator->second.second.get(), value_size) !=
-        value_size) {
-      return false;
-    }
+    req.reply(&not_found, sizeof(uint32_t));
   }
-  return true;
 }
 
 bool PSSparseServerTask::process_set_value(int sock,
-                                           const Request& req,
-                                           std::vector<char>& thread_buffer,
+                                           Request& req,
                                            int) {
-  struct {
-    char key[KEY_SIZE];
-    uint32_t value_size;
-  } msg;
-
-  memset(&msg, 0, sizeof(msg));
+  if (!read_and_set_value(req)) {
+    handle_failed_read(req);
+    return false;
+  }
+  return true;
+}
 
-  // read the key (KEY_SIZE bytes)
-  if (read_all(sock, msg.key, KEY_SIZE) == 0) {
-    handle_failed_read(&req.poll_fd);
+bool PSSparseServerTask::read_and_set_value(Request& req) {
+  // key (KEY_SIZE bytes), size of the value (uint32_t) and value
+  const char* key = req.next(KEY_SIZE);
+  uint32_t value_size = 0;
+  if (key == nullptr || !req.read(&value_size, sizeof(uint32_t))) {
     return false;
   }
-  if (read_all(sock, &msg.value_size, sizeof(uint32_t)) == 0) {
-    handle_failed_read(&req.poll_fd);
+  const char* value = req.next(value_size);
+  if (value == nullptr) {
     return false;
   }
+  if (!kv_store->set(key, value, value_size)) {
+    std::cout << "Value of " << value_size
+              << " bytes too large for the key-value store" << std::endl;
+  }
+  return true;
+}
 
-  std::shared_ptr<char> value_data = std::shared_ptr<char>(
-      new char[msg.value_size], std::default_delete<char[]>());
-
-  // read the key value
-  if (read_all(sock, value_data.get(), msg.value_size) == 0) {
-    handle_failed_read(&req.poll_fd);
+/**
+  * FORMAT of the request
+  * size of the rest of the message (uint32_t)
+  * number of keys N (uint32_t)
+  * N keys (KEY_SIZE bytes each)
+  * FORMAT of the reply
+  * for each key, in order: size of the value (uint32_t, 0 if the key is
+  * not set) followed by the value
+  */
+bool PSSparseServerTask::process_multi_get_value(int sock,
+                                                 Request& req,
+                                                 int) {
+  uint32_t incoming_size = 0;
+  uint32_t num_keys = 0;
+  if (!req.read(&incoming_size, sizeof(uint32_t)) ||
+      !req.read(&num_keys, sizeof(uint32_t))) {
+    handle_failed_read(req);
+    return false;
+  }
+  const char* keys = req.next(static_cast<uint64_t>(num_keys) * KEY_SIZE);
+  if (keys == nullptr) {
+    handle_failed_read(req);
     return false;
   }
+  for (uint32_t i = 0; i < num_keys; ++i) {
+    reply_value(req, keys + i * KEY_SIZE);
+  }
+  return true;
+}
 
-  // XXX here we do 1 deallocation and one allocation
-  // XXX can use string view?
-  key_value_map[std::string(msg.key)] =
-      std::make_pair(msg.value_size, value_data);
+/**
+  * FORMAT of the request
+  * size of the rest of the message (uint32_t)
+  * number of values N (uint32_t)
+  * N times: key (KEY_SIZE bytes), size of the value (uint32_t), value
+  * There is no reply, like for SET_VALUE
+  */
+bool PSSparseServerTask::process_multi_set_value(int sock,
+                                                 Request& req,
+                                                 int) {
+  uint32_t incoming_size = 0;
+  uint32_t num_values = 0;
+  if (!req.read(&incoming_size, sizeof(uint32_t)) ||
+      !req.read(&num_values, sizeof(uint32_t))) {
+    handle_failed_read(req);
+    return false;
+  }
+  for (uint32_t i = 0; i < num_values; ++i) {
+    if (!read_and_set_value(req)) {
+      handle_failed_read(req);
+      return false;
+    }
+  }
   return true;
 }
 
@@ -568,6 +851,10 @@ uint32_t PSSparseServerTask::declare_task_dead(uint32_t task_id) {
 
   task_to_remaining_time[task_id] = -1;
   task_to_starttime.erase(task_id);
+  if (ssp_clock) {
+    // the others no longer wait for this task
+    ssp_clock->remove_task(task_id);
+  }
 
   num_tasks--;
 
@@ -576,13 +863,12 @@ uint32_t PSSparseServerTask::declare_task_dead(uint32_t task_id) {
 
 bool PSSparseServerTask::process_deregister_task(
     int sock,
-    const Request& req,
-    std::vector<char>& thread_buffer,
+    Request& req,
     int) {
   // read the task id
   uint32_t task_id = 0;
-  if (read_all(sock, &task_id, sizeof(uint32_t)) == 0) {
-    handle_failed_read(&req.poll_fd);
+  if (!req.read(&task_id, sizeof(uint32_t))) {
+    handle_failed_read(req);
     return false;
   }
 
@@ -607,16 +893,178 @@ bool PSSparseServerTask::process_deregister_task(
 
   register_lock.unlock();
 
-  if (send_all(sock, &ret, sizeof(uint32_t)) != sizeof(uint32_t)) {
-    std::cout << "Error sending reply" << std::endl;
+  req.reply(&ret, sizeof(uint32_t));
+  return true;
+}
+
+/**
+  * FORMAT of the request
+  * task id (uint32_t)
+  * clock of the task (uint64_t): minibatches it finished
+  *
+  * FORMAT of the reply
+  * 1 if the task may pull the model of its next minibatch, 0 if it is too
+  * far ahead of the slowest live task and has to ask again (uint32_t)
+  */
+bool PSSparseServerTask::process_advance_clock(int sock,
+                                               Request& req,
+                                               int) {
+  uint32_t task_id = 0;
+  uint64_t clock = 0;
+  if (!req.read(&task_id, sizeof(uint32_t)) ||
+      !req.read(&clock, sizeof(uint64_t))) {
+    handle_failed_read(req);
+    return false;
+  }
+  uint32_t may_pull = !ssp_clock || ssp_clock->advance(task_id, clock);
+  req.reply(&may_pull, sizeof(uint32_t));
+  return true;
+}
+
+/**
+  * Following requests start with an id (uint32_t), and their replies are
+  * sent as: request id (uint32_t), size of the reply (uint32_t), reply.
+  * Lets a client thread send a request while others wait for their reply
+  *
+  * FORMAT of the reply (without id)
+  * 1 (uint32_t)
+  */
+bool PSSparseServerTask::process_enable_request_ids(int,
+                                                    Request& req,
+                                                    int) {
+  uint32_t enabled = 1;
+  req.reply(&enabled, sizeof(uint32_t));
+  req.conn->enable_request_ids();
+  return true;
+}
+
+/**
+  * FORMAT of the request
+  * size of the rest of the request (uint32_t)
+  * size of each ring of the segment (uint64_t)
+  * name of the shared memory segment made by the worker (rest)
+  *
+  * FORMAT of the reply (on the socket)
+  * 1 if the next requests of the worker come through the segment, 0 if
+  * they keep coming through the socket (uint32_t)
+  * The worker keeps the socket open while it uses the segment
+  */
+bool PSSparseServerTask::process_attach_shm(int, Request& req, int) {
+  uint32_t size = 0;
+  uint64_t ring_size = 0;
+  const char* name = nullptr;
+  if (!req.read(&size, sizeof(uint32_t)) || size < sizeof(uint64_t) ||
+      !req.read(&ring_size, sizeof(uint64_t)) ||
+      (name = req.next(size - sizeof(uint64_t))) == nullptr) {
+    handle_failed_read(req);
     return false;
   }
+  uint32_t attached = 0;
+  if (!req.shm) {
+    try {
+      attached = add_shm_client(std::string(name, size - sizeof(uint64_t)),
+                                ring_size, req);
+    } catch (const std::runtime_error& e) {
+      std::cout << "Error attaching shared memory: " << e.what()
+                << std::endl;
+    }
+  }
+  req.reply(&attached, sizeof(uint32_t));
   return true;
 }
 
+bool PSSparseServerTask::add_shm_client(const std::string& name,
+                                        uint64_t ring_size,
+                                        const Request& req) {
+  std::lock_guard<std::mutex> guard(shm_lock);
+  std::vector<bool> used(MAX_SHM_CLIENTS, false);
+  for (auto it = shm_clients.begin(); it != shm_clients.end();) {
+    if ((*it)->done) {
+      (*it)->thread.join();
+      it = shm_clients.erase(it);
+    } else {
+      used[(*it)->thread_number - NUM_PS_WORK_THREADS] = true;
+      ++it;
+    }
+  }
+  auto slot = std::find(used.begin(), used.end(), false);
+  if (slot == used.end()) {
+    return false;
+  }
+
+  auto client = std::make_unique<ShmClient>();
+  client->segment = ShmSegment::attach(name, ring_size);
+  client->conn.reset(new Connection(-1, buffer_pool.get()));
+  client->conn->wire_format = req.conn->wire_format;
+  client->thread_number = NUM_PS_WORK_THREADS + (slot - used.begin());
+  client->sock = dup(req.sock);
+  if (client->sock == -1) {
+    throw std::runtime_error("Error duplicating socket");
+  }
+  ShmClient* ptr = client.get();
+  client->alive = [this, ptr]() {
+    return !kill_signal && socket_peer_open(ptr->sock);
+  };
+  client->thread =
+      std::thread(&PSSparseServerTask::serve_shm_client, this, ptr);
+  shm_clients.push_back(std::move(client));
+  std::cout << "PS serving worker over shared memory " << name << std::endl;
+  return true;
+}
+
+void PSSparseServerTask::serve_shm_client(ShmClient* client) {
+  ShmRing& requests = client->segment->requests();
+  Connection* conn = client->conn.get();
+  // requests split over several fragments are put back together here
+  std::vector<char> pending;
+  auto serve = [this, client, conn](const char* data, uint64_t size) {
+    Request req(conn, -1, nullptr);
+    req.shm = client;
+    req.data = data;
+    req.end = data + size;
+    req.start_time_us = get_time_us();
+    return handle_request(req, client->thread_number) && !conn->failed();
+  };
+
+  while (requests.wait_readable(client->alive)) {
+    uint64_t available = 0;
+    const char* data = requests.front(&available);
+    uint64_t size = 0;
+    if (pending.empty()) {
+      if (!Connection::frame_size(data, available, &size)) {
+        break;
+      }
+      if (size != 0 && size <= available) {
+        // served in place, the gradients are not copied
+        bool keep_serving = serve(data, size);
+        requests.consume(size);
+        if (!keep_serving) {
+          break;
+        }
+        continue;
+      }
+    }
+    pending.insert(pending.end(), data, data + available);
+    requests.consume(available);
+    if (!Connection::frame_size(pending.data(), pending.size(), &size)) {
+      break;
+    }
+    if (size != 0 && size <= pending.size()) {
+      if (!serve(pending.data(), size)) {
+        break;
+      }
+      pending.erase(pending.begin(), pending.begin() + size);
+    }
+  }
+
+  requests.close();
+  client->segment->replies().close();
+  close(client->sock);
+  client->done = true;
+  std::cout << "PS done serving worker over shared memory" << std::endl;
+}
+
 void PSSparseServerTask::gradient_f() {
-  std::vector<char> thread_buffer;
-  thread_buffer.resize(120 * 1024 * 1024); // 120 MB
   struct timespec ts;
   int thread_number = thread_count++;
   while (!kill_signal) {
@@ -640,34 +1088,19 @@ void PSSparseServerTask::gradient_f() {
     to_process.pop();
     to_process_lock.unlock();
 
-    int sock = req.poll_fd.fd;
-
-    // first read 4 bytes for operation ID
-    uint32_t operation = 0;
-    if (read_all(sock, &operation, sizeof(uint32_t)) == 0) {
-      handle_failed_read(&req.poll_fd);
-      continue;
-    }
-
-#ifdef DEBUG
-    std::cout << "Operation: " << operation << " - "
-              << operation_to_name[operation] << std::endl;
-#endif
-
-    if (operation_to_f.find(operation) == operation_to_f.end()) {
-      throw std::runtime_error("Unknown operation");
+    if (!serve_requests(req.conn, req.id, req.poll_fd, req.start_time_us,
+                        thread_number)) {
+      break;
     }
 
-    if (operation == KILL_SIGNAL) {
-      std::cout << "Received kill signal!" << std::endl;
-      kill_server();
-      break;
+    // We reactivate events from the client socket here, the poll thread
+    // writes the replies the socket did not take
+    if (req.conn->failed()) {
+      close_connection(req.conn, req.poll_fd);
     } else {
-      operation_to_f[operation](sock, req, thread_buffer, thread_number);
+      req.poll_fd->events =
+          req.conn->has_pending_replies() ? POLLOUT : POLLIN;
     }
-
-    // We reactivate events from the client socket here
-    req.poll_fd.events = POLLIN;
     //pthread_kill(main_thread, SIGUSR1);
 
     assert(write(pipefds[req.id][1], "a", 1) == 1); // wake up poll()
@@ -680,53 +1113,415 @@ void PSSparseServerTask::gradient_f() {
   std::cout << "Gradient F is ending" << std::endl;
 }
 
-/**
- * FORMAT
- * incoming size (uint32_t)
- * buffer with previous size
- */
-bool PSSparseServerTask::process(struct pollfd& poll_fd, int thread_id) {
-  int sock = poll_fd.fd;
+bool PSSparseServerTask::serve_requests(Connection* conn,
+                                        int id,
+                                        struct pollfd* poll_fd,
+                                        uint64_t start_time_us,
+                                        int thread_number) {
+  while (conn->has_request() &&
+         (!conn->has_pending_replies() || conn->writes_deferred()) &&
+         !conn->failed()) {
+    Request req(conn, id, poll_fd);
+    req.data = conn->request();
+    req.end = req.data + conn->request_size();
+    req.start_time_us = start_time_us;
+    bool keep_running = handle_request(req, thread_number);
+    conn->end_request();
+    conn->pop_request();
+    if (!keep_running) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PSSparseServerTask::handle_request(Request& req, int thread_number) {
+  int sock = req.sock;
+  PSMetrics::RequestTimer timer(metrics.get(), thread_number,
+                                req.start_time_us);
+  timer.add_read(req.end - req.data, req.conn->request_read_ns());
+
+  // first 4 bytes are the operation ID
+  uint32_t operation = 0;
+  if (!req.read(&operation, sizeof(uint32_t))) {
+    handle_failed_read(req);
+    return true;
+  }
+
 #ifdef DEBUG
-  std::cout << "Processing socket: " << sock << std::endl;
+  std::cout << "Operation: " << operation << " - "
+            << operation_to_name[operation] << std::endl;
 #endif
 
-  uint32_t incoming_size = 0;
-#ifdef DEBUG 
-  std::cout << "incoming size: " << incoming_size << std::endl;
+  if (operation == KILL_SIGNAL) {
+    std::cout << "Received kill signal!" << std::endl;
+    kill_server();
+    return false;
+  }
+
+  if (operation_to_f.find(operation) == operation_to_f.end()) {
+    std::cout << "PS unknown operation: " << operation << std::endl;
+    handle_failed_read(req);
+    return true;
+  }
+
+  timer.set_operation(operation);
+  try {
+    operation_to_f[operation](sock, req, thread_number);
+  } catch (const std::runtime_error& e) {
+    // requests come from the workers: one that can't be decoded or applied
+    // fails its connection, not the server
+    std::cout << "PS error handling operation " << operation << ": "
+              << e.what() << std::endl;
+    handle_failed_read(req);
+  }
+  return true;
+}
+
+void PSSparseServerTask::epoll_thread_fn() {
+  int thread_number = thread_count++;
+  int epoll_fd = epoll_fds[thread_number];
+
+  std::cout << "Starting epoll loop for thread: " << thread_number
+            << std::endl;
+
+  struct epoll_event events[EPOLL_MAX_EVENTS];
+  while (!kill_signal) {
+    int num_events =
+        epoll_wait(epoll_fd, events, EPOLL_MAX_EVENTS, EPOLL_TIMEOUT_MS);
+    if (num_events == -1) {
+      if (errno != EINTR) {
+        throw std::runtime_error("Server error calling epoll_wait.");
+      }
+      continue;
+    }
+
+    for (int i = 0; i < num_events && !kill_signal; ++i) {
+      // the server socket is registered with a null pointer
+      if (events[i].data.ptr == nullptr) {
+        accept_connections();
+        continue;
+      }
+
+      // connections are owned by the thread whose epoll instance they are in
+      Connection* conn = static_cast<Connection*>(events[i].data.ptr);
+      bool open = (events[i].events & EPOLLOUT) ? conn->flush()
+                                                : conn->read_available();
+      // requests read before the client went away are still served
+      if (!serve_requests(conn, thread_number, nullptr, get_time_us(),
+                          thread_number)) {
+        break;
+      }
+      if (!open || conn->failed()) {
+        close_connection(conn, nullptr);
+      } else {
+        set_epoll_events(epoll_fd, conn);
+      }
+    }
+  }
+
+  close(epoll_fd);
+  std::cout << "Epoll thread is ending" << std::endl;
+}
+
+void PSSparseServerTask::accept_connections() {
+  struct sockaddr_in cli_addr;
+  socklen_t clilen = sizeof(cli_addr);
+
+  // the server socket is non-blocking and shared by all threads, so
+  // whoever wakes up accepts until there is nothing left
+  while (true) {
+    int newsock = accept(server_sock_,
+                         reinterpret_cast<struct sockaddr*>(&cli_addr),
+                         &clilen);
+    if (newsock < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        return;
+      }
+      throw std::runtime_error("Error accepting socket");
+    }
+    std::cout << "PS new connection!" << std::endl;
+
+    // If at capacity, reject connection
+    if (num_connections > (MAX_CONNECTIONS - 1)) {
+      std::cout << "Rejecting connection " << num_connections << std::endl;
+      close(newsock);
+      continue;
+    }
+
+    if (!add_connection(newsock)) {
+      close(newsock);
+      continue;
+    }
+
+    Connection* conn = connections[newsock].get();
+    conn->events = EPOLLIN | EPOLLRDHUP;
+    struct epoll_event ev;
+    ev.events = conn->events;
+    ev.data.ptr = conn;
+    int thread = next_epoll_thread++ % NUM_PS_WORK_THREADS;
+    if (epoll_ctl(epoll_fds[thread], EPOLL_CTL_ADD, newsock, &ev) == -1) {
+      throw std::runtime_error("Error adding connection to epoll");
+    }
+  }
+}
+
+void PSSparseServerTask::io_uring_thread_fn() {
+  int thread_number = thread_count++;
+
+  std::cout << "Starting io_uring loop for thread: " << thread_number
+            << std::endl;
+
+  // declared first, freed after the ring that may still point to them
+  std::unordered_map<int, std::unique_ptr<UringConnection>> uconns;
+  IoUring ring(IO_URING_ENTRIES);
+  ring.provide_buffers(IO_URING_NUM_BUFFERS, IO_URING_BUFFER_SIZE);
+  ring.accept_multishot(server_sock_, uring_data(server_sock_, URING_ACCEPT));
+
+  std::vector<IoUring::Completion> completions;
+  while (!kill_signal) {
+    ring.submit_and_wait(IO_URING_TIMEOUT_MS, &completions);
+
+    for (const auto& completion : completions) {
+      int sock = completion.user_data >> URING_OPERATION_BITS;
+      auto operation = static_cast<UringOperation>(
+          completion.user_data & ((1 << URING_OPERATION_BITS) - 1));
+
+      if (operation == URING_ACCEPT) {
+        if (!completion.more) {
+          ring.accept_multishot(server_sock_,
+                                uring_data(server_sock_, URING_ACCEPT));
+        }
+        if (completion.result < 0) {
+          continue;
+        }
+        int newsock = completion.result;
+        std::cout << "PS new connection!" << std::endl;
+        if (num_connections > (MAX_CONNECTIONS - 1)) {
+          std::cout << "Rejecting connection " << num_connections << std::endl;
+          close(newsock);
+          continue;
+        }
+        if (!add_connection(newsock)) {
+          close(newsock);
+          continue;
+        }
+        Connection* conn = connections[newsock].get();
+        conn->defer_writes();
+        uconns[newsock].reset(new UringConnection(conn));
+        ring.recv_multishot(newsock, uring_data(newsock, URING_RECV));
+        continue;
+      }
+
+      UringConnection* uconn = uconns[sock].get();
+      Connection* conn = uconn->conn;
+      if (operation == URING_RECV) {
+        if (completion.buffer >= 0) {
+          if (completion.result > 0 && !uconn->closing) {
+            conn->receive(ring.buffer(completion.buffer), completion.result);
+          }
+          ring.recycle_buffer(completion.buffer);
+        }
+        bool ended = false;  //< the client went away
+        if (!completion.more) {
+          // running out of buffers stops the receive, not the connection
+          if (!uconn->closing &&
+              (completion.result > 0 || completion.result == -ENOBUFS)) {
+            ring.recv_multishot(sock, uring_data(sock, URING_RECV));
+          } else {
+            uconn->receiving = false;
+            ended = true;
+          }
+        }
+        // requests read before the client went away are still served
+        if (!serve_requests(conn, thread_number, nullptr, get_time_us(),
+                            thread_number)) {
+          break;
+        }
+        if (ended) {
+          conn->set_failed();
+        }
+      } else {
+        uconn->sending = false;
+        if (completion.result < 0) {
+          conn->set_failed();
+        } else {
+          uconn->sent += completion.result;
+        }
+      }
+
+      if (conn->failed() && !uconn->closing) {
+        uconn->closing = true;
+        // ends the receive or the send still in flight
+        shutdown(sock, SHUT_RDWR);
+      }
+      send_replies(&ring, uconn);
+      if (uconn->closing && !uconn->receiving && !uconn->sending) {
+        uconns.erase(sock);
+        close_connection(conn, nullptr);
+      }
+    }
+  }
+
+  std::cout << "io_uring thread is ending" << std::endl;
+}
+
+bool PSSparseServerTask::add_connection(int sock) {
+  if (sock >= MAX_SOCKETS) {
+    std::cout << "Rejecting connection on socket " << sock << std::endl;
+    return false;
+  }
+  // sockets do not need O_NONBLOCK, Connection never does blocking calls
+  connections[sock].reset(new Connection(sock, buffer_pool.get()));
+  num_connections++;
+  return true;
+}
+
+void PSSparseServerTask::close_connection(Connection* conn,
+                                          struct pollfd* poll_fd) {
+  int sock = conn->sock();
+  // the socket number can be taken by a new connection once it is closed
+  if (poll_fd) {
+    poll_fd->fd = -1;
+    poll_fd->revents = 0;
+  }
+  connections[sock].reset();
+  // closing the socket also removes it from the epoll instance
+  if (close(sock) != 0) {
+    std::cout << "Error closing socket. errno: " << errno << std::endl;
+  }
+  num_connections--;
+  std::cout << "PS closing connection " << num_connections << std::endl;
+}
+
+void PSSparseServerTask::set_epoll_events(int epoll_fd, Connection* conn) {
+  // replies that did not fit in the socket are written before reading
+  // more requests
+  uint32_t events =
+      conn->has_pending_replies() ? EPOLLOUT : (EPOLLIN | EPOLLRDHUP);
+  if (events == conn->events) {
+    return;
+  }
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = conn;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->sock(), &ev) == -1) {
+    throw std::runtime_error("Error updating connection in epoll");
+  }
+  conn->events = events;
+}
+
+bool PSSparseServerTask::process(struct pollfd& poll_fd, int thread_id) {
+#ifdef DEBUG
+  std::cout << "Processing socket: " << poll_fd.fd << std::endl;
 #endif
+  Connection* conn = connections[poll_fd.fd].get();
   to_process_lock.lock();
-  poll_fd.events = 0; // explain this
-  to_process.push(Request(sock, thread_id, incoming_size, poll_fd));
+  // the poll thread leaves the connection alone until the worker thread
+  // gives it back
+  poll_fd.events = 0;
+  to_process.push(Request(conn, thread_id, &poll_fd));
+  to_process.back().start_time_us = get_time_us();
   to_process_lock.unlock();
   sem_post(&sem_new_req);
   return true;
 }
 
 void PSSparseServerTask::start_server() {
-  lr_model.reset(new SparseLRModel(model_size));
+  // with ps_shards this server only keeps its own shard of each model
+  uint64_t lr_size = model_size;
+  uint64_t nusers = task_config.get_users();
+  uint64_t nitems = task_config.get_items();
+  if (!task_config.get_ps_shards().empty()) {
+    if (shard_id >= task_config.get_ps_shards().size()) {
+      throw std::runtime_error("Wrong shard id: " + std::to_string(shard_id));
+    }
+    ShardMap::Scheme scheme =
+        ShardMap::scheme_from_string(task_config.get_ps_shard_scheme());
+    uint32_t num_shards = task_config.get_ps_shards().size();
+    lr_size = ShardMap(scheme, num_shards, model_size).shard_size(shard_id);
+    nusers = ShardMap(scheme, num_shards, nusers).shard_size(shard_id);
+    nitems = ShardMap(scheme, num_shards, nitems).shard_size(shard_id);
+    std::cout << "Serving shard " << shard_id << " of " << num_shards
+              << " lr weights: " << lr_size << " users: " << nusers
+              << " items: " << nitems << std::endl;
+  }
+
+  lr_model.reset(new SparseLRModel(lr_size));
   lr_model->randomize();
 
-  mf_model.reset(new MFModel(task_config.get_users(), task_config.get_items(),
-                             NUM_FACTORS));
+  mf_model.reset(new MFModel(nusers, nitems, task_config.get_num_factors()));
   mf_model->randomize();
 
-  sem_init(&sem_new_req, 0, 0);
+  model_updater.reset(new ModelUpdater(
+      ModelUpdater::mode_from_string(task_config.get_ps_update_mode()),
+      lr_size, nusers, nitems));
+  model_updater->check_optimizer(*opt_method);
+  kv_store.reset(new KVStore(task_config.get_kv_store_max_mb() * 1024 * 1024,
+                             buffer_pool.get()));
+  if (task_config.get_ssp_staleness() >= 0) {
+    ssp_clock.reset(new SSPClock(task_config.get_ssp_staleness()));
+  }
 
-  for (uint32_t i = 0; i < NUM_PS_WORK_THREADS; ++i) {
-    gradient_thread.push_back(std::make_unique<std::thread>(
-          std::bind(&PSSparseServerTask::gradient_f, this)));
+  if (!task_config.get_checkpoint_path().empty()) {
+    uint64_t start = get_time_us();
+    if (restore_model_file(checkpoint_filename())) {
+      std::cout << "Restored models from " << checkpoint_filename() << " in "
+                << (get_time_us() - start) / 1000 << " ms" << std::endl;
+    } else {
+      std::cout << "No checkpoint at " << checkpoint_filename() << std::endl;
+    }
   }
 
-  // create barrier for all poll threads
-  if (pthread_barrier_init(threads_barrier.get(), nullptr, NUM_POLL_THREADS) !=
-      0) {
-    throw std::runtime_error("Error in threads barrier");
+  if (task_config.get_grad_coalesce_window() > 1) {
+    gradient_coalescer.reset(new GradientCoalescer(
+        NUM_PS_WORK_THREADS + MAX_SHM_CLIENTS,
+        task_config.get_grad_coalesce_window(),
+        task_config.get_grad_coalesce_max_delay_ms() * 1000));
+    coalesce_thread = std::make_unique<std::thread>(
+        std::bind(&PSSparseServerTask::coalesce_flush_loop, this));
   }
 
-  for (int i = 0; i < NUM_POLL_THREADS; i++) {
-    server_threads.push_back(std::make_unique<std::thread>(
-        std::bind(&PSSparseServerTask::main_poll_thread_fn, this, i)));
+  if (task_config.get_ps_server_mode() == "epoll") {
+    create_server_socket();
+    int flags = fcntl(server_sock_, F_GETFL, 0);
+    if (flags == -1 ||
+        fcntl(server_sock_, F_SETFL, flags | O_NONBLOCK) == -1) {
+      throw std::runtime_error("Error setting server socket as non-blocking");
+    }
+
+    // Every thread waits for new connections. EPOLLEXCLUSIVE avoids waking
+    // up all of them for each connection
+    for (int i = 0; i < NUM_PS_WORK_THREADS; ++i) {
+      epoll_fds[i] = epoll_create1(0);
+      if (epoll_fds[i] == -1) {
+        throw std::runtime_error("Error creating epoll instance");
+      }
+      struct epoll_event ev;
+      ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+      ev.data.ptr = nullptr;
+      if (epoll_ctl(epoll_fds[i], EPOLL_CTL_ADD, server_sock_, &ev) == -1) {
+        throw std::runtime_error("Error adding server socket to epoll");
+      }
+    }
+
+    for (int i = 0; i < NUM_PS_WORK_THREADS; ++i) {
+      server_threads.push_back(std::make_unique<std::thread>(
+          std::bind(&PSSparseServerTask::epoll_thread_fn, this)));
+    }
+  } else if (task_config.get_ps_server_mode() == "io_uring") {
+    if (!IoUring::supported()) {
+      throw std::runtime_error(
+          "ps_server_mode io_uring is not supported here, use poll or epoll");
+    }
+    // every thread accepts on the server socket with its own io_uring
+    create_server_socket();
+    for (int i = 0; i < NUM_PS_WORK_THREADS; ++i) {
+      server_threads.push_back(std::make_unique<std::thread>(
+          std::bind(&PSSparseServerTask::io_uring_thread_fn, this)));
+    }
+  } else {
+    start_poll_server();
   }
 
   // start checkpoing thread
@@ -736,6 +1531,20 @@ void PSSparseServerTask::start_server() {
   }
 }
 
+void PSSparseServerTask::start_poll_server() {
+  sem_init(&sem_new_req, 0, 0);
+
+  for (uint32_t i = 0; i < NUM_PS_WORK_THREADS; ++i) {
+    gradient_thread.push_back(std::make_unique<std::thread>(
+          std::bind(&PSSparseServerTask::gradient_f, this)));
+  }
+
+  for (int i = 0; i < NUM_POLL_THREADS; i++) {
+    server_threads.push_back(std::make_unique<std::thread>(
+        std::bind(&PSSparseServerTask::main_poll_thread_fn, this, i)));
+  }
+}
+
 void PSSparseServerTask::kill_server() {
   kill_signal = 1;
 }
@@ -745,41 +1554,7 @@ void PSSparseServerTask::main_poll_thread_fn(int poll_id) {
   if (poll_id == 0) {
     std::cout << "Starting server, poll id " << poll_id << std::endl;
 
-    server_sock_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sock_ < 0) {
-      throw std::string("Server error creating socket");
-    }
-
-    int opt = 1;
-    if (setsockopt(server_sock_, IPPROTO_TCP,
-                TCP_NODELAY, &opt, sizeof(opt))) {
-      throw std::runtime_error("Error setting socket options.");
-    }
-    if (setsockopt(server_sock_, SOL_SOCKET,
-                SO_REUSEADDR, &opt, sizeof(opt))) {
-      throw std::runtime_error("Error forcing port binding");
-    }
-
-    if (setsockopt(server_sock_, SOL_SOCKET,
-                SO_REUSEPORT, &opt, sizeof(opt))) {
-      throw std::runtime_error("Error forcing port binding");
-    }
-
-    struct sockaddr_in serv_addr;
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-    serv_addr.sin_port = htons(ps_port);
-    std::memset(serv_addr.sin_zero, 0, sizeof(serv_addr.sin_zero));
-
-    int ret = bind(server_sock_,
-            reinterpret_cast<sockaddr*> (&serv_addr), sizeof(serv_addr));
-    if (ret < 0) {
-      throw std::runtime_error("Error binding in port " + to_string(ps_port));
-    }
-
-    if (listen(server_sock_, SOMAXCONN) == -1) {
-      throw std::runtime_error("Error listening on port " + to_string(ps_port));
-    }
+    create_server_socket();
     fdses[0].at(0).fd = server_sock_;
     fdses[0].at(0).events = POLLIN;
     fdses[0].at(1).fd = pipefds[poll_id][0];
@@ -798,6 +1573,44 @@ void PSSparseServerTask::main_poll_thread_fn(int poll_id) {
   loop(poll_id);
 }
 
+void PSSparseServerTask::create_server_socket() {
+  server_sock_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (server_sock_ < 0) {
+    throw std::string("Server error creating socket");
+  }
+
+  int opt = 1;
+  if (setsockopt(server_sock_, IPPROTO_TCP,
+              TCP_NODELAY, &opt, sizeof(opt))) {
+    throw std::runtime_error("Error setting socket options.");
+  }
+  if (setsockopt(server_sock_, SOL_SOCKET,
+              SO_REUSEADDR, &opt, sizeof(opt))) {
+    throw std::runtime_error("Error forcing port binding");
+  }
+
+  if (setsockopt(server_sock_, SOL_SOCKET,
+              SO_REUSEPORT, &opt, sizeof(opt))) {
+    throw std::runtime_error("Error forcing port binding");
+  }
+
+  struct sockaddr_in serv_addr;
+  serv_addr.sin_family = AF_INET;
+  serv_addr.sin_addr.s_addr = INADDR_ANY;
+  serv_addr.sin_port = htons(ps_port);
+  std::memset(serv_addr.sin_zero, 0, sizeof(serv_addr.sin_zero));
+
+  int ret = bind(server_sock_,
+          reinterpret_cast<sockaddr*> (&serv_addr), sizeof(serv_addr));
+  if (ret < 0) {
+    throw std::runtime_error("Error binding in port " + to_string(ps_port));
+  }
+
+  if (listen(server_sock_, SOMAXCONN) == -1) {
+    throw std::runtime_error("Error listening on port " + to_string(ps_port));
+  }
+}
+
 void PSSparseServerTask::loop(int poll_id) {
   struct sockaddr_in cli_addr;
   socklen_t clilen = sizeof(cli_addr);
@@ -831,16 +1644,11 @@ void PSSparseServerTask::loop(int poll_id) {
         if (curr_fd.fd == -1) {
           continue;
         }
-        if (curr_fd.revents != POLLIN) {
-          //LOG<ERROR>("Non read event on socket: ", curr_fd.fd);
-          if (curr_fd.revents & POLLHUP) {
-            std::cout << "PS closing connection " << num_connections
-                      << std::endl;
-            num_connections--;
-            close(curr_fd.fd);
-            curr_fd.fd = -1;
+        if (poll_id == 0 && curr_fd.fd == server_sock_) {
+          if (!(curr_fd.revents & POLLIN)) {
+            curr_fd.revents = 0;
+            continue;
           }
-        } else if (poll_id == 0 && curr_fd.fd == server_sock_) {
           std::cout << "PS new connection!" << std::endl;
           int newsock = accept(server_sock_,
               reinterpret_cast<struct sockaddr*> (&cli_addr),
@@ -857,28 +1665,31 @@ void PSSparseServerTask::loop(int poll_id) {
           } else if (poll_id == 0 && curr_indexes[poll_id] == max_fds) {
             throw std::runtime_error("We reached capacity");
             close(newsock);
-          } else if (poll_id == 0) {
+          } else if (poll_id == 0 && add_connection(newsock)) {
             int r = rand() % NUM_POLL_THREADS;
             std::cout << "Random: " << r << std::endl;
             fdses[r][curr_indexes[r]].fd = newsock;
             fdses[r][curr_indexes[r]].events = POLLIN;
             curr_indexes[r]++;
-            num_connections++;
-
+          } else {
+            close(newsock);
           }
-        } else {
+        } else if (curr_fd.revents != 0 && curr_fd.events != 0) {
+          // connections without events are being served by a worker thread
+          Connection* conn = connections[curr_fd.fd].get();
+          bool open = (curr_fd.revents & POLLOUT) ? conn->flush()
+                                                  : conn->read_available();
+          if (conn->has_request() && !conn->has_pending_replies() &&
+              !conn->failed()) {
 #ifdef DEBUG
-          std::cout << "Calling process" << std::endl;
+            std::cout << "Calling process" << std::endl;
 #endif
-          if (!process(curr_fd, poll_id)) {
-            if (close(curr_fd.fd) != 0) {
-              std::cout << "Error closing socket. errno: " << errno
-                        << std::endl;
-            }
-            num_connections--;
-            std::cout << "PS closing connection after process(): "
-                      << num_connections << std::endl;
-            curr_fd.fd = -1;
+            // the worker thread closes the connection if needed
+            process(curr_fd, poll_id);
+          } else if (!open || conn->failed()) {
+            close_connection(conn, &curr_fd);
+          } else {
+            curr_fd.events = conn->has_pending_replies() ? POLLOUT : POLLIN;
           }
         }
         curr_fd.revents = 0; // Reset the event flags
@@ -902,6 +1713,8 @@ void sig_handler(int) {
 void PSSparseServerTask::check_tasks_lifetime() {
   auto now = std::chrono::steady_clock::now();
 
+  // declare_task_dead removes tasks from task_to_starttime
+  std::vector<uint32_t> dead_tasks;
   for (const auto& task : task_to_starttime) {
     uint32_t task_id = task.first;
     auto start_time = task.second;
@@ -914,9 +1727,12 @@ void PSSparseServerTask::check_tasks_lifetime() {
               << std::endl;
 
     if (elapsed_sec > task_to_remaining_time[task_id] + TIMEOUT_THRESHOLD_SEC) {
-      declare_task_dead(task_id);
+      dead_tasks.push_back(task_id);
     }
   }
+  for (const auto& task_id : dead_tasks) {
+    declare_task_dead(task_id);
+  }
 }
 
 /**
@@ -981,6 +1797,12 @@ void PSSparseServerTask::run(const Configuration& config) {
                 << " #conns: " << num_connections << " #tasks: " << num_tasks
                 << std::endl;
       gradientUpdatesCount = 0;
+      print_op_latencies();
+      dump_metrics();
+      if (gradient_coalescer) {
+        std::cout << "Coalesced LR updates applied (total): "
+                  << gradient_coalescer->get_num_flushes() << std::endl;
+      }
 
       register_lock.lock();
       check_tasks_lifetime();
@@ -1002,6 +1824,62 @@ void PSSparseServerTask::run(const Configuration& config) {
     std::cout << "Joining check thread" << std::endl;
     thread.get()->join();
   }
+  if (coalesce_thread) {
+    std::cout << "Joining coalesce thread" << std::endl;
+    coalesce_thread->join();
+  }
+  std::lock_guard<std::mutex> guard(shm_lock);
+  for (auto& client : shm_clients) {
+    std::cout << "Joining shared memory client thread" << std::endl;
+    client->thread.join();
+  }
+  shm_clients.clear();
+}
+
+void PSSparseServerTask::print_op_latencies() {
+  for (int op = 0; op < NUM_PS_OPS; ++op) {
+    std::vector<uint64_t> counts(LatencyHistogram::NUM_BUCKETS, 0);
+    metrics->add_to(op, STAGE_TOTAL, &counts);
+
+    // histograms are cumulative, we only report the last interval
+    std::vector<uint64_t>& last = last_op_latency[op];
+    last.resize(counts.size(), 0);
+    uint64_t num_reqs = 0;
+    for (uint64_t i = 0; i < counts.size(); ++i) {
+      std::swap(counts[i], last[i]);
+      counts[i] = last[i] - counts[i];
+      num_reqs += counts[i];
+    }
+    if (num_reqs == 0) {
+      continue;
+    }
+    std::cout << operation_to_name[op] << " #reqs: " << num_reqs
+              << " p50 (us): "
+              << LatencyHistogram::percentile(counts, 50) / 1000
+              << " p99 (us): "
+              << LatencyHistogram::percentile(counts, 99) / 1000
+              << std::endl;
+  }
+}
+
+/**
+  * Readers of metrics_path never see a partially written file
+  */
+void PSSparseServerTask::dump_metrics() {
+  std::string path = task_config.get_metrics_path();
+  if (path.empty()) {
+    return;
+  }
+  std::string tmp_path = path + ".tmp";
+  std::ofstream out(tmp_path, std::ofstream::trunc);
+  out << metrics->to_json(operation_to_name,
+                          (get_time_us() - server_start_us) / 1000000,
+                          ssp_clock ? ssp_clock->to_json() : "")
+      << std::endl;
+  out.close();
+  if (!out || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::cout << "Error writing metrics to " << path << std::endl;
+  }
 }
 
 void PSSparseServerTask::checkpoint_model_loop() {
@@ -1009,21 +1887,67 @@ void PSSparseServerTask::checkpoint_model_loop() {
     // checkpoint disabled
     return;
   }
+  uint64_t last_checkpoint = get_time_us();
+  while (!kill_signal) {
+    sleep(1);
+    if (get_time_us() - last_checkpoint <
+        task_config.get_checkpoint_frequency() * 1000000) {
+      continue;
+    }
+    uint64_t start = get_time_us();
+    checkpoint_model_file(checkpoint_filename());
+    last_checkpoint = get_time_us();
+    std::cout << "Checkpointed models to " << checkpoint_filename()
+              << " in " << (last_checkpoint - start) / 1000 << " ms"
+              << std::endl;
+  }
+  // save the last updates before exiting
+  checkpoint_model_file(checkpoint_filename());
+}
 
+void PSSparseServerTask::coalesce_flush_loop() {
+  // check 4 times per delay so gradients wait at most 1.25x the limit
+  uint64_t period_us =
+      std::max<uint64_t>(gradient_coalescer->get_max_delay_us() / 4, 100);
   while (!kill_signal) {
-    sleep(task_config.get_checkpoint_frequency());
-    // checkpoint to s3
+    usleep(period_us);
+    for (uint32_t i = 0; i < gradient_coalescer->get_num_windows(); ++i) {
+      if (gradient_coalescer->is_stale(i)) {
+        flush_coalesced_gradients(i);
+      }
+    }
+  }
+  // don't lose the last windows
+  for (uint32_t i = 0; i < gradient_coalescer->get_num_windows(); ++i) {
+    flush_coalesced_gradients(i);
   }
 }
 
 void PSSparseServerTask::checkpoint_model_file(
     const std::string& filename) const {
-  uint64_t model_size;
-  std::shared_ptr<char> data = serialize_lr_model(*lr_model, &model_size);
+  // the snapshot is copied straight into the checkpoint file
+  ModelCheckpoint::save(
+      filename, ModelUpdater::checkpoint_header(*lr_model, *mf_model),
+      [this](FEATURE_TYPE* weights) {
+        model_updater->copy_checkpoint(*lr_model, *mf_model, weights);
+      });
+}
 
-  std::ofstream fout(filename.c_str(), std::ofstream::binary);
-  fout.write(data.get(), model_size);
-  fout.close();
+bool PSSparseServerTask::restore_model_file(const std::string& filename) {
+  ModelCheckpoint checkpoint;
+  if (!checkpoint.open(filename)) {
+    return false;
+  }
+  model_updater->load_checkpoint(checkpoint, lr_model.get(), mf_model.get());
+  return true;
+}
+
+std::string PSSparseServerTask::checkpoint_filename() const {
+  if (task_config.get_ps_shards().empty()) {
+    return task_config.get_checkpoint_path();
+  }
+  return task_config.get_checkpoint_path() + ".shard" +
+         std::to_string(shard_id);
 }
 
 void PSSparseServerTask::destroy_pthread_barrier(pthread_barrier_t* barrier) {
@@ -0,0 +1,72 @@
+#include "PageVersions.h"
+
+#include <thread>
+
+namespace cirrus {
+
+PageVersions::PageVersions(uint64_t size)
+    : size_(size),
+      num_pages_((size + PAGE_SIZE - 1) / PAGE_SIZE),
+      page_version_(new std::atomic<uint64_t>[num_pages_]) {
+  for (uint64_t i = 0; i < num_pages_; ++i) {
+    std::atomic_init(&page_version_[i], 0UL);
+  }
+  std::atomic_init(&version_, 0UL);
+  std::atomic_init(&active_[0], 0UL);
+  std::atomic_init(&active_[1], 0UL);
+  std::atomic_init(&tracking_, false);
+}
+
+PageVersions::Update::Update(PageVersions* versions) : versions_(versions) {
+  // a reader that starts a new version between the load and the increment
+  // may not have seen us, so register again in the new version
+  while (true) {
+    version_ = versions_->version_.load();
+    versions_->active_[version_ & 1]++;
+    if (versions_->version_.load() == version_) {
+      break;
+    }
+    versions_->active_[version_ & 1]--;
+  }
+  mark_ = version_ + 1;
+  // loaded after registering, so an update that skips marking is waited
+  // for by the changed_since() call that turns tracking on
+  tracking_ = versions_->tracking_.load();
+}
+
+PageVersions::Update::~Update() {
+  versions_->active_[version_ & 1].fetch_sub(1, std::memory_order_release);
+}
+
+uint64_t PageVersions::changed_since(uint64_t since,
+                                     std::vector<uint32_t>* pages) {
+  std::lock_guard<std::mutex> guard(readers_lock_);
+  if (!tracking_.load()) {
+    // no page was marked so far
+    tracking_ = true;
+    since = 0;
+  }
+  uint64_t version = ++version_;
+
+  // updates that started in the previous version mark their pages with
+  // version. Wait for them so none of their pages is missed
+  while (active_[(version - 1) & 1].load(std::memory_order_acquire) != 0) {
+    std::this_thread::yield();
+  }
+
+  // a version we never handed out (e.g., the server restarted)
+  if (since > version) {
+    since = 0;
+  }
+
+  pages->clear();
+  for (uint64_t i = 0; i < num_pages_; ++i) {
+    if (page_version_[i].load(std::memory_order_relaxed) >= since) {
+      pages->push_back(i);
+    }
+  }
+  // updates that started in this version mark their pages with version + 1
+  return version + 1;
+}
+
+}  // namespace cirrus
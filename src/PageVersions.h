@@ -0,0 +1,90 @@
+#ifndef _PAGE_VERSIONS_H_
+#define _PAGE_VERSIONS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cirrus {
+
+/**
+  * Tracks which pages of a model changed since a given model version.
+  * Each call to changed_since() starts a new version. Updates mark the
+  * pages they write with the version that follows the one they started in,
+  * and changed_since() waits for the updates that started in the previous
+  * version to finish. A client that asks for the pages changed since the
+  * version it got last time never misses an update.
+  *
+  * Pages are only marked once changed_since() was called, so servers
+  * without delta pulls only pay for registering updates.
+  */
+class PageVersions {
+ public:
+  static const uint64_t PAGE_SIZE = 1024;  //< weights per page
+
+  /**
+    * @param size Number of weights of the model
+    */
+  explicit PageVersions(uint64_t size);
+
+  /**
+    * Registers an update for as long as it is in scope
+    */
+  class Update {
+   public:
+    explicit Update(PageVersions* versions);
+    ~Update();
+
+    /**
+      * Whether pages need to be marked
+      */
+    bool tracking() const { return tracking_; }
+
+    /**
+      * Mark the page of weight index as changed
+      */
+    void mark(uint64_t index) {
+      if (index >= versions_->size_) {
+        return;
+      }
+      std::atomic<uint64_t>& page =
+          versions_->page_version_[index / PAGE_SIZE];
+      uint64_t current = page.load(std::memory_order_relaxed);
+      while (current < mark_ &&
+             !page.compare_exchange_weak(current, mark_,
+                                         std::memory_order_relaxed)) {
+      }
+    }
+
+   private:
+    PageVersions* versions_;
+    uint64_t version_;  //< version the update started in
+    uint64_t mark_;     //< version pages are marked with
+    bool tracking_;     //< whether changed_since() was ever called
+  };
+
+  /**
+    * Start a new version and get the pages that changed since a version
+    * @param since Version returned by the previous call (0 for all pages)
+    * @param pages Sorted page numbers
+    * @return Version to pass next time
+    */
+  uint64_t changed_since(uint64_t since, std::vector<uint32_t>* pages);
+
+  uint64_t num_pages() const { return num_pages_; }
+
+ private:
+  uint64_t size_;
+  uint64_t num_pages_;
+  std::unique_ptr<std::atomic<uint64_t>[]> page_version_;
+  std::atomic<uint64_t> version_;
+  std::atomic<uint64_t> active_[2];  //< updates in flight per version parity
+  std::atomic<bool> tracking_;       //< set by the first changed_since()
+  std::mutex readers_lock_;
+};
+
+}  // namespace cirrus
+
+#endif  // _PAGE_VERSIONS_H_
@@ -0,0 +1,135 @@
+#include "Quantization.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace cirrus {
+
+// random bits for stochastic rounding, one generator per thread
+static uint32_t rounding_noise() {
+  static thread_local std::mt19937 generator(std::random_device{}());
+  return generator();
+}
+
+uint32_t quantization_from_name(const std::string& name) {
+  for (uint32_t q = 0; q < NUM_QUANTIZATIONS; ++q) {
+    if (quantization_name(q) == name) {
+      return q;
+    }
+  }
+  throw std::runtime_error("Unknown quantization: " + name);
+}
+
+std::string quantization_name(uint32_t quantization) {
+  switch (quantization) {
+    case QUANTIZE_NONE:
+      return "none";
+    case QUANTIZE_FP16:
+      return "fp16";
+    case QUANTIZE_BF16:
+      return "bf16";
+    case QUANTIZE_INT8:
+      return "int8";
+    default:
+      throw std::runtime_error("Unknown quantization");
+  }
+}
+
+uint16_t float_to_half(float value, uint32_t noise) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(float));
+  uint16_t sign = (bits >> 16) & 0x8000;
+  uint32_t abs = bits & 0x7fffffff;
+  if (abs >= 0x7f800000) {
+    // inf stays inf, nan stays nan
+    return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+  }
+  if (abs >= 0x477fe000) {
+    // gradients are clipped to the largest half (65504) instead of inf
+    return sign | 0x7bff;
+  }
+  if (abs >= 0x38800000) {
+    // normal half: adding noise to the 13 dropped mantissa bits rounds up
+    // with a probability proportional to the dropped fraction
+    abs += noise & 0x1fff;
+    uint32_t half = (abs - 0x38000000) >> 13;
+    return sign | std::min<uint32_t>(half, 0x7bff);
+  }
+  // subnormal half: a multiple of 2^-24
+  float scaled = std::fabs(value) * 16777216.0f;
+  uint32_t half = static_cast<uint32_t>(scaled);
+  if (scaled - half > (noise >> 8) * (1.0f / 16777216.0f)) {
+    half++;
+  }
+  return sign | half;
+}
+
+uint16_t float_to_bfloat16(float value, uint32_t noise) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(float));
+  if ((bits & 0x7f800000) == 0x7f800000) {
+    // keep nans quiet when the low mantissa bits are dropped
+    return (bits >> 16) | ((bits & 0x7fffff) ? 0x40 : 0);
+  }
+  uint32_t rounded = bits + (noise & 0xffff);
+  if ((rounded & 0x7f800000) == 0x7f800000) {
+    // clip to the largest finite bfloat16
+    return ((bits >> 16) & 0x8000) | 0x7f7f;
+  }
+  return rounded >> 16;
+}
+
+/** FORMAT of the quantized values
+  * QUANTIZE_NONE: count * FEATURE_TYPE
+  * QUANTIZE_FP16, QUANTIZE_BF16: count * uint16_t
+  * QUANTIZE_INT8: scale (float), count * int8_t
+  *   (a value is scale * int8, scale = largest absolute value / 127)
+  */
+char* quantize_values(const FEATURE_TYPE* values,
+                      uint64_t count,
+                      uint32_t quantization,
+                      char* out) {
+  switch (quantization) {
+    case QUANTIZE_NONE:
+      std::memcpy(out, values, count * sizeof(FEATURE_TYPE));
+      return out + count * sizeof(FEATURE_TYPE);
+    case QUANTIZE_FP16:
+      for (uint64_t i = 0; i < count; ++i) {
+        uint16_t half = float_to_half(values[i], rounding_noise());
+        std::memcpy(out, &half, sizeof(uint16_t));
+        out += sizeof(uint16_t);
+      }
+      return out;
+    case QUANTIZE_BF16:
+      for (uint64_t i = 0; i < count; ++i) {
+        uint16_t bfloat16 = float_to_bfloat16(values[i], rounding_noise());
+        std::memcpy(out, &bfloat16, sizeof(uint16_t));
+        out += sizeof(uint16_t);
+      }
+      return out;
+    case QUANTIZE_INT8: {
+      float max_abs = 0;
+      for (uint64_t i = 0; i < count; ++i) {
+        max_abs = std::max<float>(max_abs, std::fabs(values[i]));
+      }
+      float scale = max_abs / 127;
+      std::memcpy(out, &scale, sizeof(float));
+      out += sizeof(float);
+      for (uint64_t i = 0; i < count; ++i) {
+        float q = 0;
+        if (scale > 0) {
+          float uniform = (rounding_noise() >> 8) * (1.0f / 16777216.0f);
+          q = std::floor(values[i] / scale + uniform);
+          q = std::max(-127.0f, std::min(127.0f, q));
+        }
+        *out++ = static_cast<int8_t>(q);
+      }
+      return out;
+    }
+    default:
+      throw std::runtime_error("Unknown quantization");
+  }
+}
+
+}  // namespace cirrus
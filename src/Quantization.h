@@ -0,0 +1,153 @@
+#ifndef _QUANTIZATION_H_
+#define _QUANTIZATION_H_
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "config.h"
+
+namespace cirrus {
+
+/**
+  * Encodings of the gradient values sent in WIRE_FORMAT_QUANTIZED.
+  * Values are rounded stochastically so the quantization error is zero
+  * on average and small gradients are not always rounded away.
+  */
+enum Quantization : uint32_t {
+  QUANTIZE_NONE = 0,  //< FEATURE_TYPE values
+  QUANTIZE_FP16 = 1,  //< IEEE half precision
+  QUANTIZE_BF16 = 2,  //< upper 16 bits of a float
+  QUANTIZE_INT8 = 3,  //< int8 times a float scale shared by the values
+  NUM_QUANTIZATIONS   //< keep last
+};
+
+/**
+  * Quantization with the given name (none, fp16, bf16 or int8)
+  */
+uint32_t quantization_from_name(const std::string& name);
+std::string quantization_name(uint32_t quantization);
+
+/**
+  * Max number of bytes taken by count quantized values
+  */
+inline uint64_t max_quantized_size(uint64_t count) {
+  return sizeof(float) + count * sizeof(FEATURE_TYPE);
+}
+
+/**
+  * Quantize count values
+  * @param out Has room for max_quantized_size(count) bytes
+  * @return End of the quantized values
+  */
+char* quantize_values(const FEATURE_TYPE* values,
+                      uint64_t count,
+                      uint32_t quantization,
+                      char* out);
+
+/**
+  * Round value to a half, up or down with a probability given by its
+  * distance to both halves
+  * @param noise Uniformly distributed random bits
+  */
+uint16_t float_to_half(float value, uint32_t noise);
+uint16_t float_to_bfloat16(float value, uint32_t noise);
+
+inline float half_to_float(uint16_t half) {
+  uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+  uint32_t bits;
+  if (exponent == 0) {
+    // zero or subnormal: mantissa * 2^-24
+    float value = mantissa * (1.0f / 16777216.0f);
+    std::memcpy(&bits, &value, sizeof(float));
+    bits |= sign;
+  } else if (exponent == 0x1f) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float value;
+  std::memcpy(&value, &bits, sizeof(float));
+  return value;
+}
+
+inline float bfloat16_to_float(uint16_t bfloat16) {
+  uint32_t bits = static_cast<uint32_t>(bfloat16) << 16;
+  float value;
+  std::memcpy(&value, &bits, sizeof(float));
+  return value;
+}
+
+/**
+  * Decode count values written by quantize_values, calling
+  * store(i, value) for the i-th value so callers write the values where
+  * they are used instead of into a temporary array
+  * @param end End of the buffer holding in
+  * @return End of the quantized values
+  */
+template <typename Store>
+const char* dequantize_values(const char* in,
+                              const char* end,
+                              uint64_t count,
+                              uint32_t quantization,
+                              Store store) {
+  uint64_t value_size = 0;
+  float scale = 0;
+  switch (quantization) {
+    case QUANTIZE_NONE:
+      value_size = sizeof(FEATURE_TYPE);
+      break;
+    case QUANTIZE_FP16:
+    case QUANTIZE_BF16:
+      value_size = sizeof(uint16_t);
+      break;
+    case QUANTIZE_INT8:
+      value_size = sizeof(int8_t);
+      if (end - in < static_cast<int64_t>(sizeof(float))) {
+        throw std::runtime_error("Truncated quantized values");
+      }
+      std::memcpy(&scale, in, sizeof(float));
+      in += sizeof(float);
+      break;
+    default:
+      throw std::runtime_error("Unknown quantization");
+  }
+  if (static_cast<uint64_t>(end - in) < count * value_size) {
+    throw std::runtime_error("Truncated quantized values");
+  }
+
+  for (uint64_t i = 0; i < count; ++i) {
+    switch (quantization) {
+      case QUANTIZE_NONE: {
+        FEATURE_TYPE value;
+        std::memcpy(&value, in, sizeof(FEATURE_TYPE));
+        store(i, value);
+        break;
+      }
+      case QUANTIZE_FP16: {
+        uint16_t half;
+        std::memcpy(&half, in, sizeof(uint16_t));
+        store(i, half_to_float(half));
+        break;
+      }
+      case QUANTIZE_BF16: {
+        uint16_t bfloat16;
+        std::memcpy(&bfloat16, in, sizeof(uint16_t));
+        store(i, bfloat16_to_float(bfloat16));
+        break;
+      }
+      case QUANTIZE_INT8:
+        store(i, scale * static_cast<int8_t>(*in));
+        break;
+    }
+    in += value_size;
+  }
+  return in;
+}
+
+}  // namespace cirrus
+
+#endif  // _QUANTIZATION_H_
@@ -12,6 +12,14 @@ class SGD : public OptimizationMethod {
     void sgd_update(
         std::unique_ptr<SparseLRModel>& lr_model, 
         const ModelGradient* gradient);
+
+    // defined here so that ModelUpdater can inline it
+    void update_weight(FEATURE_TYPE& weight,
+                       FEATURE_TYPE&,
+                       FEATURE_TYPE value) const final {
+      weight += learning_rate * value;
+    }
+    bool allows_concurrent_updates() const override { return true; }
 };
 
 }  // namespace cirrus
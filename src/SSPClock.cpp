@@ -0,0 +1,60 @@
+#include "SSPClock.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace cirrus {
+
+SSPClock::SSPClock(uint64_t staleness) : staleness_(staleness) {}
+
+void SSPClock::add_task(uint64_t task_id) {
+  std::lock_guard<std::mutex> guard(lock_);
+  clocks_.insert(std::make_pair(task_id, 0));
+}
+
+void SSPClock::remove_task(uint64_t task_id) {
+  std::lock_guard<std::mutex> guard(lock_);
+  clocks_.erase(task_id);
+}
+
+bool SSPClock::advance(uint64_t task_id, uint64_t clock) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = clocks_.find(task_id);
+  if (it == clocks_.end()) {
+    return true;
+  }
+  it->second = std::max(it->second, clock);
+  return it->second - min_clock() <= staleness_;
+}
+
+uint64_t SSPClock::min_clock() const {
+  uint64_t min_clock = UINT64_MAX;
+  for (const auto& task : clocks_) {
+    min_clock = std::min(min_clock, task.second);
+  }
+  return min_clock;
+}
+
+std::string SSPClock::to_json() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  uint64_t min = clocks_.empty() ? 0 : min_clock();
+  uint64_t max = 0;
+  for (const auto& task : clocks_) {
+    max = std::max(max, task.second);
+  }
+
+  std::ostringstream out;
+  out << "{\"staleness\": " << staleness_
+      << ", \"num_tasks\": " << clocks_.size()
+      << ", \"min_clock\": " << min << ", \"max_clock\": " << max
+      << ", \"spread\": " << (max - min) << ", \"clocks\": {";
+  bool first = true;
+  for (const auto& task : clocks_) {
+    out << (first ? "" : ", ") << "\"" << task.first << "\": " << task.second;
+    first = false;
+  }
+  out << "}}";
+  return out.str();
+}
+
+}  // namespace cirrus
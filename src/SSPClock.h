@@ -0,0 +1,59 @@
+#ifndef _SSP_CLOCK_H_
+#define _SSP_CLOCK_H_
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace cirrus {
+
+/**
+  * Clocks of the live tasks of a parameter server in stale synchronous
+  * parallel mode. The clock of a task is the number of minibatches it
+  * finished. A task may pull the model for its next minibatch while its
+  * clock is at most staleness clocks ahead of the slowest live task.
+  *
+  * Tasks are live from their registration until they deregister or miss
+  * their deadline. Tasks that never registered are not throttled.
+  */
+class SSPClock {
+ public:
+  explicit SSPClock(uint64_t staleness);
+
+  /**
+    * Start tracking a task, with clock 0
+    */
+  void add_task(uint64_t task_id);
+
+  /**
+    * Stop tracking a task, it no longer holds back the others
+    */
+  void remove_task(uint64_t task_id);
+
+  /**
+    * Record the clock of a task (clocks never go back)
+    * @return Whether the task may pull the model of its next minibatch
+    */
+  bool advance(uint64_t task_id, uint64_t clock);
+
+  uint64_t get_staleness() const { return staleness_; }
+
+  /**
+    * FORMAT
+    * {"staleness": N, "num_tasks": N, "min_clock": N, "max_clock": N,
+    *  "spread": N, "clocks": {"<task id>": N, ...}}
+    */
+  std::string to_json() const;
+
+ private:
+  uint64_t min_clock() const;  //< lock_ held
+
+  uint64_t staleness_;
+  mutable std::mutex lock_;
+  std::map<uint64_t, uint64_t> clocks_;  //< clock of each live task
+};
+
+}  // namespace cirrus
+
+#endif  // _SSP_CLOCK_H_
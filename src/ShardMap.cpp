@@ -0,0 +1,61 @@
+#include "ShardMap.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace cirrus {
+
+ShardMap::ShardMap(Scheme scheme, uint32_t num_shards, uint64_t size)
+    : scheme_(scheme), num_shards_(num_shards), size_(size) {
+  if (num_shards_ == 0) {
+    throw std::runtime_error("ShardMap needs at least one shard");
+  }
+  chunk_ = (size_ + num_shards_ - 1) / num_shards_;
+  if (chunk_ == 0) {
+    chunk_ = 1;
+  }
+}
+
+ShardMap::Scheme ShardMap::scheme_from_string(const std::string& scheme) {
+  if (scheme == "range") {
+    return RANGE;
+  } else if (scheme == "hash") {
+    return HASH;
+  }
+  throw std::runtime_error("Unknown shard scheme: " + scheme);
+}
+
+ShardMap ShardMap::from_config(const Configuration& config, uint64_t size) {
+  uint32_t num_shards = config.get_ps_shards().size();
+  return ShardMap(scheme_from_string(config.get_ps_shard_scheme()),
+                  num_shards == 0 ? 1 : num_shards, size);
+}
+
+ShardMap ShardMap::lr_weights(const Configuration& config) {
+  // same size the parameter server uses for the LR model
+  return from_config(config, (1ULL << config.get_model_bits()) + 1);
+}
+
+ShardMap ShardMap::mf_users(const Configuration& config) {
+  return from_config(config, config.get_users());
+}
+
+ShardMap ShardMap::mf_items(const Configuration& config) {
+  return from_config(config, config.get_items());
+}
+
+uint64_t ShardMap::shard_size(uint32_t shard) const {
+  if (scheme_ == RANGE) {
+    uint64_t begin = shard * chunk_;
+    if (begin >= size_) {
+      return 0;
+    }
+    return std::min(chunk_, size_ - begin);
+  }
+  if (shard >= size_) {
+    return 0;
+  }
+  return (size_ - shard + num_shards_ - 1) / num_shards_;
+}
+
+}  // namespace cirrus
@@ -0,0 +1,72 @@
+#ifndef _SHARD_MAP_H_
+#define _SHARD_MAP_H_
+
+#include <cstdint>
+#include <string>
+
+#include "Configuration.h"
+
+namespace cirrus {
+
+/**
+  * Partitions an index space [0, size) across a number of parameter
+  * server shards. Each shard stores its part of the space using local
+  * (dense) indices.
+  * Schemes:
+  * range: shard i owns the i-th contiguous chunk of the index space
+  * hash: index x is owned by shard x % num_shards
+  */
+class ShardMap {
+ public:
+  enum Scheme { RANGE, HASH };
+
+  /**
+    * @param scheme How indices are assigned to shards
+    * @param num_shards Number of shards
+    * @param size Size of the whole index space
+    */
+  ShardMap(Scheme scheme, uint32_t num_shards, uint64_t size);
+
+  static Scheme scheme_from_string(const std::string& scheme);
+
+  /**
+    * Shard maps for each of the models kept by the parameter server
+    * (one shard when the configuration has no ps_shards)
+    */
+  static ShardMap lr_weights(const Configuration& config);
+  static ShardMap mf_users(const Configuration& config);
+  static ShardMap mf_items(const Configuration& config);
+
+  uint32_t num_shards() const { return num_shards_; }
+  uint64_t size() const { return size_; }
+
+  uint32_t shard_of(uint64_t index) const {
+    return scheme_ == RANGE ? index / chunk_ : index % num_shards_;
+  }
+
+  uint64_t to_local(uint64_t index) const {
+    return scheme_ == RANGE ? index % chunk_ : index / num_shards_;
+  }
+
+  uint64_t to_global(uint32_t shard, uint64_t local) const {
+    return scheme_ == RANGE ? shard * chunk_ + local
+                            : local * num_shards_ + shard;
+  }
+
+  /**
+    * Number of indices owned by a shard
+    */
+  uint64_t shard_size(uint32_t shard) const;
+
+ private:
+  static ShardMap from_config(const Configuration& config, uint64_t size);
+
+  Scheme scheme_;
+  uint32_t num_shards_;
+  uint64_t size_;
+  uint64_t chunk_;  //< indices per shard (range scheme)
+};
+
+}  // namespace cirrus
+
+#endif  // _SHARD_MAP_H_
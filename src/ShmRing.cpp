@@ -0,0 +1,345 @@
+#include "ShmRing.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+namespace cirrus {
+
+#define SPIN_CHECKS (200)  //< checks before sleeping on the futex
+#define MIN_RING_SIZE (4096)
+
+static const uint64_t FRAGMENT_HEADER_SIZE = sizeof(uint64_t);
+// fragment header of the unused end of the ring, before wrapping around
+static const uint64_t WRAP_MARKER = UINT64_MAX;
+
+struct ShmRing::Header {
+  alignas(64) std::atomic<uint64_t> head{0};  //< bytes written (producer)
+  alignas(64) std::atomic<uint64_t> tail{0};  //< bytes read (consumer)
+  alignas(64) std::atomic<uint32_t> data_seq{0};  //< bumped by writes
+  std::atomic<uint32_t> data_waiters{0};          //< consumer asleep
+  std::atomic<uint32_t> room_seq{0};              //< bumped by reads
+  std::atomic<uint32_t> room_waiters{0};          //< producer asleep
+  std::atomic<uint32_t> closed{0};
+};
+
+static uint64_t align8(uint64_t size) {
+  return (size + 7) & ~7UL;
+}
+
+static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+/**
+  * Futexes are not private: the other process wakes us up
+  */
+static void futex_wait(std::atomic<uint32_t>* word,
+                       uint32_t expected,
+                       uint32_t timeout_ms) {
+  struct timespec timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected,
+          &timeout, nullptr, 0);
+}
+
+static void futex_wake(std::atomic<uint32_t>* word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX,
+          nullptr, nullptr, 0);
+}
+
+// bump seq and wake up whoever sleeps on it
+static void notify(std::atomic<uint32_t>* seq, std::atomic<uint32_t>* waiters) {
+  seq->fetch_add(1);
+  if (waiters->load() != 0) {
+    futex_wake(seq);
+  }
+}
+
+uint64_t ShmRing::region_size(uint64_t capacity) {
+  return sizeof(Header) + capacity;
+}
+
+ShmRing::ShmRing(void* region, uint64_t capacity, bool init)
+    : header_(static_cast<Header*>(region)),
+      data_(static_cast<char*>(region) + sizeof(Header)),
+      capacity_(capacity) {
+  if (capacity % 8 != 0 || capacity < MIN_RING_SIZE) {
+    throw std::runtime_error("Wrong shared memory ring size");
+  }
+  if (init) {
+    new (region) Header();
+  }
+}
+
+bool ShmRing::wait(std::atomic<uint32_t>* seq,
+                   std::atomic<uint32_t>* waiters,
+                   const std::function<bool()>& ready,
+                   const std::function<bool()>& alive) {
+  // spinning only helps if the peer runs on another cpu meanwhile
+  static const uint32_t spin_checks =
+      std::thread::hardware_concurrency() > 1 ? SPIN_CHECKS : 0;
+  for (uint32_t i = 0; i < spin_checks; ++i) {
+    if (ready()) {
+      return true;
+    }
+    if (closed()) {
+      return false;
+    }
+    cpu_relax();
+  }
+  // checking ready after announcing the waiter and reading seq means a
+  // notify in between either is seen or changes seq (no lost wake up)
+  while (true) {
+    waiters->store(1);
+    uint32_t value = seq->load();
+    if (ready()) {
+      waiters->store(0);
+      return true;
+    }
+    if (closed()) {
+      waiters->store(0);
+      return false;
+    }
+    futex_wait(seq, value, WAIT_TIMEOUT_MS);
+    waiters->store(0);
+    if (ready()) {
+      return true;
+    }
+    if (closed() || !alive()) {
+      return false;
+    }
+  }
+}
+
+bool ShmRing::wait_room(uint64_t bytes, const std::function<bool()>& alive) {
+  uint64_t head = header_->head.load(std::memory_order_relaxed);
+  return wait(&header_->room_seq, &header_->room_waiters,
+              [this, head, bytes]() {
+                return capacity_ - (head - header_->tail.load()) >= bytes;
+              },
+              alive);
+}
+
+void ShmRing::publish(uint64_t head) {
+  header_->head.store(head);
+  notify(&header_->data_seq, &header_->data_waiters);
+}
+
+/**
+  * FORMAT of a fragment (8 bytes aligned)
+  * size of the data (uint64_t), WRAP_MARKER for the end of the ring
+  * data
+  */
+bool ShmRing::write_fragment(const char* data,
+                             uint64_t size,
+                             const std::function<bool()>& alive) {
+  uint64_t head = header_->head.load(std::memory_order_relaxed);
+  uint64_t pos = head % capacity_;
+  uint64_t fragment_size = FRAGMENT_HEADER_SIZE + align8(size);
+  if (capacity_ - pos < fragment_size) {
+    // the fragment goes at the start, the end of the ring is skipped
+    if (!wait_room(capacity_ - pos, alive)) {
+      return false;
+    }
+    std::memcpy(data_ + pos, &WRAP_MARKER, sizeof(uint64_t));
+    head += capacity_ - pos;
+    publish(head);
+    pos = 0;
+  }
+  if (!wait_room(fragment_size, alive)) {
+    return false;
+  }
+  std::memcpy(data_ + pos, &size, sizeof(uint64_t));
+  std::memcpy(data_ + pos + FRAGMENT_HEADER_SIZE, data, size);
+  publish(head + fragment_size);
+  return true;
+}
+
+bool ShmRing::write(const void* data,
+                    uint64_t size,
+                    const std::function<bool()>& alive) {
+  const char* ptr = static_cast<const char*>(data);
+  while (size > 0) {
+    uint64_t fragment = std::min(size, max_fragment_size());
+    if (closed() || !write_fragment(ptr, fragment, alive)) {
+      return false;
+    }
+    ptr += fragment;
+    size -= fragment;
+  }
+  return true;
+}
+
+bool ShmRing::readable() {
+  uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+  uint64_t head = header_->head.load();
+  while (tail != head) {
+    uint64_t pos = tail % capacity_;
+    uint64_t size;
+    std::memcpy(&size, data_ + pos, sizeof(uint64_t));
+    if (size != WRAP_MARKER) {
+      return true;
+    }
+    tail += capacity_ - pos;
+    header_->tail.store(tail);
+    notify(&header_->room_seq, &header_->room_waiters);
+  }
+  return false;
+}
+
+bool ShmRing::wait_readable(const std::function<bool()>& alive) {
+  return wait(&header_->data_seq, &header_->data_waiters,
+              [this]() { return readable(); }, alive);
+}
+
+const char* ShmRing::front(uint64_t* size) {
+  if (!readable()) {
+    *size = 0;
+    return nullptr;
+  }
+  uint64_t pos = header_->tail.load(std::memory_order_relaxed) % capacity_;
+  uint64_t fragment_size;
+  std::memcpy(&fragment_size, data_ + pos, sizeof(uint64_t));
+  *size = fragment_size - offset_;
+  return data_ + pos + FRAGMENT_HEADER_SIZE + offset_;
+}
+
+void ShmRing::consume(uint64_t size) {
+  uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+  uint64_t fragment_size;
+  std::memcpy(&fragment_size, data_ + tail % capacity_, sizeof(uint64_t));
+  offset_ += size;
+  if (offset_ < fragment_size) {
+    return;
+  }
+  offset_ = 0;
+  header_->tail.store(tail + FRAGMENT_HEADER_SIZE + align8(fragment_size));
+  notify(&header_->room_seq, &header_->room_waiters);
+}
+
+bool ShmRing::read(void* data,
+                   uint64_t size,
+                   const std::function<bool()>& alive) {
+  char* ptr = static_cast<char*>(data);
+  while (size > 0) {
+    if (!wait_readable(alive)) {
+      return false;
+    }
+    uint64_t available = 0;
+    const char* fragment = front(&available);
+    uint64_t n = std::min(size, available);
+    std::memcpy(ptr, fragment, n);
+    consume(n);
+    ptr += n;
+    size -= n;
+  }
+  return true;
+}
+
+void ShmRing::close() {
+  header_->closed.store(1);
+  notify(&header_->data_seq, &header_->data_waiters);
+  notify(&header_->room_seq, &header_->room_waiters);
+}
+
+bool ShmRing::closed() const {
+  return header_->closed.load() != 0;
+}
+
+std::unique_ptr<ShmSegment> ShmSegment::create(uint64_t ring_size) {
+  if (ring_size % 8 != 0 || ring_size < MIN_RING_SIZE) {
+    throw std::runtime_error("Wrong shared memory ring size");
+  }
+  static std::atomic<uint32_t> num_segments(0);
+  std::string name = "/cirrus-" + std::to_string(getpid()) + "-" +
+                     std::to_string(num_segments++);
+  uint64_t size = ShmRing::region_size(ring_size) * 2;
+
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd == -1) {
+    throw std::runtime_error("Error creating shared memory segment. errno: " +
+                             std::to_string(errno));
+  }
+  // reserving the memory now fails here rather than with a SIGBUS later
+  if (ftruncate(fd, size) != 0 || posix_fallocate(fd, 0, size) != 0) {
+    close(fd);
+    shm_unlink(name.c_str());
+    throw std::runtime_error("Error reserving shared memory");
+  }
+  void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    shm_unlink(name.c_str());
+    throw std::runtime_error("Error mapping shared memory");
+  }
+  return std::unique_ptr<ShmSegment>(
+      new ShmSegment(name, mem, ring_size, true));
+}
+
+std::unique_ptr<ShmSegment> ShmSegment::attach(const std::string& name,
+                                               uint64_t ring_size) {
+  if (ring_size % 8 != 0 || ring_size < MIN_RING_SIZE) {
+    throw std::runtime_error("Wrong shared memory ring size");
+  }
+  uint64_t size = ShmRing::region_size(ring_size) * 2;
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd == -1) {
+    throw std::runtime_error("Error opening shared memory segment " + name);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) != size) {
+    close(fd);
+    throw std::runtime_error("Wrong size of shared memory segment " + name);
+  }
+  void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    throw std::runtime_error("Error mapping shared memory");
+  }
+  return std::unique_ptr<ShmSegment>(
+      new ShmSegment(name, mem, ring_size, false));
+}
+
+ShmSegment::ShmSegment(const std::string& name,
+                       void* mem,
+                       uint64_t ring_size,
+                       bool owner)
+    : name_(name),
+      mem_(mem),
+      size_(ShmRing::region_size(ring_size) * 2),
+      linked_(owner) {
+  char* region = static_cast<char*>(mem);
+  requests_.reset(new ShmRing(region, ring_size, owner));
+  replies_.reset(
+      new ShmRing(region + ShmRing::region_size(ring_size), ring_size, owner));
+}
+
+ShmSegment::~ShmSegment() {
+  requests_->close();
+  replies_->close();
+  unlink();
+  munmap(mem_, size_);
+}
+
+void ShmSegment::unlink() {
+  if (linked_) {
+    shm_unlink(name_.c_str());
+    linked_ = false;
+  }
+}
+
+}  // namespace cirrus
@@ -0,0 +1,158 @@
+#ifndef _SHM_RING_H_
+#define _SHM_RING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace cirrus {
+
+/**
+  * Single producer, single consumer byte stream in memory shared by two
+  * processes.
+  *
+  * Written data is split into fragments that are contiguous in the ring,
+  * so the consumer can use a fragment in place (front / consume) instead
+  * of copying it out. Data written with a single write call that fits in
+  * a fragment (up to a quarter of the ring) stays in one fragment.
+  *
+  * Waiting sides spin briefly and then sleep on a futex in the shared
+  * memory. The other side only makes the wake up system call when a
+  * waiter is asleep. Sleeps time out every WAIT_TIMEOUT_MS to ask the
+  * alive callback whether the peer is still there.
+  */
+class ShmRing {
+ public:
+  static const uint32_t WAIT_TIMEOUT_MS = 100;
+
+  /**
+    * Bytes of shared memory a ring of capacity bytes takes
+    */
+  static uint64_t region_size(uint64_t capacity);
+
+  /**
+    * @param region region_size(capacity) bytes of shared memory
+    * @param capacity Bytes of data of the ring (multiple of 8)
+    * @param init Whether to initialize the ring (the side creating it)
+    */
+  ShmRing(void* region, uint64_t capacity, bool init);
+
+  /**
+    * Write data, waiting for room in the ring
+    * @param alive Whether the peer is still there, asked while waiting
+    * @return false if the ring is closed or the peer is gone
+    */
+  bool write(const void* data,
+             uint64_t size,
+             const std::function<bool()>& alive);
+
+  /**
+    * Wait until there is data to read
+    * @return false if the ring is closed (and drained) or the peer is gone
+    */
+  bool wait_readable(const std::function<bool()>& alive);
+
+  /**
+    * The unread bytes of the first fragment (nullptr if nothing to read)
+    */
+  const char* front(uint64_t* size);
+
+  /**
+    * Mark the first size bytes of front() as read. Room is only given
+    * back to the producer once the whole fragment is read
+    */
+  void consume(uint64_t size);
+
+  /**
+    * Read exactly size bytes, across fragments
+    * @return false if the ring is closed or the peer is gone first
+    */
+  bool read(void* data, uint64_t size, const std::function<bool()>& alive);
+
+  /**
+    * Wake up and fail both sides. Data already written can still be read
+    */
+  void close();
+  bool closed() const;
+
+ private:
+  struct Header;
+
+  uint64_t max_fragment_size() const { return capacity_ / 4; }
+  bool write_fragment(const char* data,
+                      uint64_t size,
+                      const std::function<bool()>& alive);
+  // wait until the producer has bytes of room
+  bool wait_room(uint64_t bytes, const std::function<bool()>& alive);
+  // publish the bytes written up to head
+  void publish(uint64_t head);
+  // skip wrap markers, true if a fragment can be read
+  bool readable();
+  // wait on seq until ready() is true
+  bool wait(std::atomic<uint32_t>* seq,
+            std::atomic<uint32_t>* waiters,
+            const std::function<bool()>& ready,
+            const std::function<bool()>& alive);
+
+  Header* header_;
+  char* data_;
+  uint64_t capacity_;
+  uint64_t offset_ = 0;  //< bytes of the first fragment read (consumer)
+};
+
+/**
+  * POSIX shared memory segment with the two rings of a worker connected
+  * to a parameter server over shared memory: requests (worker to parameter
+  * server) and replies.
+  */
+class ShmSegment {
+ public:
+  /**
+    * Create a segment with a new name. Fails if the memory can't be
+    * reserved
+    * @param ring_size Bytes of data of each ring (multiple of 8)
+    */
+  static std::unique_ptr<ShmSegment> create(uint64_t ring_size);
+
+  /**
+    * Map a segment made by create
+    */
+  static std::unique_ptr<ShmSegment> attach(const std::string& name,
+                                            uint64_t ring_size);
+
+  /**
+    * Close the rings and unmap the segment. The segment made by create is
+    * also unlinked if it still is linked
+    */
+  ~ShmSegment();
+
+  ShmSegment(const ShmSegment&) = delete;
+  ShmSegment& operator=(const ShmSegment&) = delete;
+
+  const std::string& name() const { return name_; }
+
+  /**
+    * Remove the name of the segment. The memory stays mapped
+    */
+  void unlink();
+
+  ShmRing& requests() { return *requests_; }
+  ShmRing& replies() { return *replies_; }
+
+ private:
+  ShmSegment(const std::string& name, void* mem, uint64_t ring_size,
+             bool owner);
+
+  std::string name_;
+  void* mem_;
+  uint64_t size_;
+  bool linked_;  //< name still to be unlinked by this side
+  std::unique_ptr<ShmRing> requests_;
+  std::unique_ptr<ShmRing> replies_;
+};
+
+}  // namespace cirrus
+
+#endif  // _SHM_RING_H_
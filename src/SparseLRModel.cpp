@@ -382,10 +382,18 @@ void SparseLRModel::loadSerializedSparse(const FEATURE_TYPE* weights,
                                          const Configuration& config) {
   is_sparse_ = true;
   assert(num_weights > 0 && num_weights < 10000000);
-  weights_sparse_.reserve((1 << config.get_model_bits()));
+  // weights not in the reply are never read by minibatch_grad_sparse so
+  // they can keep stale values
+  uint64_t model_size = (1ULL << config.get_model_bits()) + 1;
+  if (weights_sparse_.size() < model_size) {
+    weights_sparse_.resize(model_size);
+  }
   for (uint64_t i = 0; i < num_weights; ++i) {
     uint32_t index = load_value<uint32_t>(weight_indices);
     FEATURE_TYPE value = load_value<FEATURE_TYPE>(weights);
+    if (index >= model_size) {
+      throw std::runtime_error("Weight index out of bounds");
+    }
     weights_sparse_[index] = value;
   }
 }
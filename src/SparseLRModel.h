@@ -21,6 +21,8 @@ class SparseLRModel : public CirrusModel {
     friend class Momentum;
     friend class Nesterov;
     friend class SGD;
+    friend class ModelUpdater;
+    friend class PSSparseServerInterface;
     /**
       * SparseLRModel constructor
       * @param d Features dimension
@@ -46,6 +48,12 @@ class SparseLRModel : public CirrusModel {
     void loadSerialized(const void* mem) override;
     void loadSerialized(const void* mem, int server_id, int num_ps);
 
+    /**
+      * Set the weights of a subset of the model
+      * @param weights Value of each index in weight_indices
+      * @param weight_indices Indices of the weights (any order)
+      * @param num_weights Number of weights
+      */
     void loadSerializedSparse(const FEATURE_TYPE* weights,
                               const uint32_t* weight_indices,
                               uint64_t num_weights,
@@ -167,8 +175,11 @@ class SparseLRModel : public CirrusModel {
       */
     void check() const;
 
+    /**
+      * Weight n of the model, or of the pulled weights of a sparse model
+      */
     FEATURE_TYPE get_nth_weight(uint64_t n) const override {
-      return weights_[n];
+      return is_sparse_ ? weights_sparse_[n] : weights_[n];
     }
 
     FEATURE_TYPE get_nth_weight_nesterov(
@@ -4,6 +4,7 @@
 #include <Eigen/Dense>
 #include <Checksum.h>
 #include <algorithm>
+#include <cstring>
 #include <ModelGradient.h>
 
 // #define DEBUG
@@ -35,16 +36,19 @@ SparseMFModel::SparseMFModel(uint64_t users, uint64_t items, uint64_t nfactors)
     initialize_weights(users , items, nfactors);
 }
 
-SparseMFModel::SparseMFModel(const void* data, uint64_t minibatch_size, uint64_t num_items) {
+SparseMFModel::SparseMFModel(const void* data,
+                             uint64_t minibatch_size,
+                             uint64_t num_items,
+                             uint64_t nfactors) {
   initialize_weights(0, 0, 0);
-  loadSerialized(data, minibatch_size, num_items);
+  loadSerialized(data, minibatch_size, num_items, nfactors);
 }
 
 std::unique_ptr<CirrusModel> SparseMFModel::deserialize(void* data, uint64_t /*size*/) const {
   throw std::runtime_error("Not implemented");
   uint32_t* data_p = reinterpret_cast<uint32_t*>(data);
   return std::make_unique<SparseMFModel>(
-      reinterpret_cast<void*>(data_p), 10, 10);
+      reinterpret_cast<void*>(data_p), 10, 10, NUM_FACTORS);
 }
 
 std::pair<std::unique_ptr<char[]>, uint64_t>
@@ -93,7 +97,10 @@ uint64_t SparseMFModel::getSerializedSize() const {
   return 0;
 }
 
-void SparseMFModel::loadSerialized(const void* data, uint64_t minibatch_size, uint64_t num_item_ids) {
+void SparseMFModel::loadSerialized(const void* data,
+                                   uint64_t minibatch_size,
+                                   uint64_t num_item_ids,
+                                   uint64_t nfactors) {
 #ifdef DEBUG
   std::cout << "SparseMFModel::loadSerialized nusers: "
     << nusers_
@@ -101,9 +108,9 @@ void SparseMFModel::loadSerialized(const void* data, uint64_t minibatch_size, ui
     << " nfactors_: " << nfactors_
     << std::endl;
 #endif
-  // data has minibatch_size vectors of size NUM_FACTORS (user weights)
+  // data has minibatch_size vectors of size nfactors (user weights)
   // followed by the same (item weights)
-  nfactors_ = NUM_FACTORS;
+  nfactors_ = nfactors;
   for (uint64_t i = 0; i < minibatch_size; ++i) {
     std::tuple<int, FEATURE_TYPE,
       std::vector<FEATURE_TYPE>> user_model;
@@ -111,7 +118,8 @@ void SparseMFModel::loadSerialized(const void* data, uint64_t minibatch_size, ui
     FEATURE_TYPE user_bias = load_value<FEATURE_TYPE>(data);
     std::get<0>(user_model) = user_id;
     std::get<1>(user_model) = user_bias;
-    for (uint64_t j = 0; j < NUM_FACTORS; ++j) {
+    std::get<2>(user_model).reserve(nfactors_);
+    for (uint64_t j = 0; j < nfactors_; ++j) {
       FEATURE_TYPE user_weight = load_value<FEATURE_TYPE>(data);
       std::get<2>(user_model).push_back(user_weight);
     }
@@ -125,8 +133,8 @@ void SparseMFModel::loadSerialized(const void* data, uint64_t minibatch_size, ui
     uint32_t item_id = load_value<uint32_t>(data);
     FEATURE_TYPE item_bias = load_value<FEATURE_TYPE>(data);
     std::get<0>(item_model) = item_bias;
-    std::get<1>(item_model).resize(NUM_FACTORS);
-    for (uint64_t j = 0; j < NUM_FACTORS; ++j) {
+    std::get<1>(item_model).resize(nfactors_);
+    for (uint64_t j = 0; j < nfactors_; ++j) {
       FEATURE_TYPE item_weight = load_value<FEATURE_TYPE>(data);
       std::get<1>(item_model)[j] = item_weight;
     }
@@ -168,20 +176,19 @@ std::unique_ptr<ModelGradient> SparseMFModel::minibatch_grad(
             const Configuration& config,
             uint64_t base_user) {
   FEATURE_TYPE learning_rate = config.get_learning_rate();
-  auto gradient = std::make_unique<MFSparseGradient>();
-  std::vector<FEATURE_TYPE> item_weights_grad_map[17770];
-  std::vector<int> item_weights_lst;
+  auto gradient = std::make_unique<MFSparseGradient>(nfactors_);
+  gradient->reserve(dataset.data_.size(), 0);
+  // index of each item in the gradient, -1 until it is rated
+  std::vector<int> item_index(std::size(item_models), -1);
   double training_rmse = 0;
   uint64_t training_rmse_count = 0;
 
   // iterate all pairs user rating
   for (uint64_t user_from_0 = 0; user_from_0 < dataset.data_.size(); ++user_from_0) {
-    std::vector<FEATURE_TYPE> user_weights_grad(NUM_FACTORS);
     uint64_t real_user_id = base_user + user_from_0;
 
     // we have to populate this value in case this user doesn't have any ratings
-    // XXX we should probably optimize this
-    gradient->users_bias_grad[real_user_id] = 0;
+    uint32_t user_index = gradient->add_user(real_user_id);
     for (uint64_t j = 0; j < dataset.data_[user_from_0].size(); ++j) {
       // first user matches the model in user_models[0]
       uint64_t itemId = dataset.data_[user_from_0][j].first;
@@ -193,17 +200,24 @@ std::unique_ptr<ModelGradient> SparseMFModel::minibatch_grad(
       training_rmse += error * error;
       training_rmse_count++;
 
+      if (item_index[itemId] == -1) {
+        item_index[itemId] = gradient->add_item(itemId);
+      }
+      FEATURE_TYPE* user_weights_grad = gradient->user_factors(user_index);
+      FEATURE_TYPE* item_weights_grad =
+          gradient->item_factors(item_index[itemId]);
+
       // compute gradient for user bias
       FEATURE_TYPE& user_bias = std::get<1>(user_models[user_from_0]);
       float delta = learning_rate * (error - user_bias_reg_ * user_bias);
-      gradient->users_bias_grad[real_user_id] += delta;
+      gradient->user_bias(user_index) += delta;
       user_bias += delta;
 
 
       // compute gradient for item bias
       FEATURE_TYPE& item_bias = item_models[itemId].first;
       delta = learning_rate * (error - item_bias_reg_ * item_bias);
-      gradient->items_bias_grad[itemId] += delta;
+      gradient->item_bias(item_index[itemId]) += delta;
       item_bias += delta;
 
 #ifdef DEBUG
@@ -227,24 +241,15 @@ std::unique_ptr<ModelGradient> SparseMFModel::minibatch_grad(
         }
 #endif
       }
-      //XXX moving this after this inner loop
-      //gradient->users_weights_grad.push_back(std::make_pair(real_user_id, std::move(user_weights_grad)));
 
       // update item latent factors
       for (uint64_t k = 0; k < nfactors_; ++k) {
-        //std::cout << "k: " << k << std::endl;
         FEATURE_TYPE delta_item_w =
           learning_rate *
           (error * get_user_weights(user_from_0, k) -
                  item_fact_reg_ * get_item_weights(itemId, k));
         item_models[itemId].second[k] += delta_item_w;
-
-        if (item_weights_grad_map[itemId].size() == 0) {
-          item_weights_grad_map[itemId].resize(NUM_FACTORS);
-          item_weights_lst.push_back(itemId);
-        }
-        //std::cout << "UPDATE HERE " << std::endl;
-        item_weights_grad_map[itemId][k] += delta_item_w;
+        item_weights_grad[k] += delta_item_w;
 #ifdef DEBUG
         if (std::isnan(get_item_weights(itemId, k)) ||
             std::isinf(get_item_weights(itemId, k))) {
@@ -259,26 +264,12 @@ std::unique_ptr<ModelGradient> SparseMFModel::minibatch_grad(
         }
 #endif
       }
-      //gradient->items_weights_grad.push_back(
-      //    std::make_pair(itemId, std::move(item_weights_grad)));
     }
-    gradient->users_weights_grad.push_back(
-        std::make_pair(real_user_id, std::move(user_weights_grad)));
-    //std::cout 
-    //  << "user weights size: " << gradient->users_weights_grad.size()
-    //  << " user bias size: " << gradient->users_bias_grad.size() << std::endl;
-  }
-
-  for (const auto& item_id : item_weights_lst) {
-    auto& item_weights = item_weights_grad_map[item_id];
-    gradient->items_weights_grad.push_back(
-        std::make_pair(item_id, std::move(item_weights)));
   }
 
 #ifdef DEBUG
   std::cout << "Training rmse: " << std::sqrt(training_rmse / training_rmse_count) << std::endl;
   gradient->print();
-  gradient->check();
 #endif
 
   return gradient;
@@ -325,31 +316,24 @@ void SparseMFModel::serializeFromDense(
     const char* item_data_ptr, char* holder) const {
 
   char* data_to_send_ptr = holder;
+  // bias and factors are contiguous in the rows of the dense model
+  const uint64_t row_size =
+      (1 + mf_model.get_nfactors()) * sizeof(FEATURE_TYPE);
 
   // first we store data about users
   for (uint32_t i = base_user_id; i < base_user_id + minibatch_size; ++i) {
     store_value<uint32_t>(data_to_send_ptr, i); // user id
-    store_value<FEATURE_TYPE>(
-        data_to_send_ptr,
-        mf_model.get_user_bias(i));  // bias
-    for (uint32_t j = 0; j < NUM_FACTORS; ++j) {
-      store_value<FEATURE_TYPE>(
-          data_to_send_ptr,
-          mf_model.get_user_weights(i, j));
-    }   
+    std::memcpy(data_to_send_ptr, &mf_model.get_user_bias(i), row_size);
+    data_to_send_ptr += row_size;
   }
 
   // now we store data about items
   for (uint32_t i = 0; i < k_items; ++i) {
     uint32_t item_id = load_value<uint32_t>(item_data_ptr);
-    //std::cout << "item_id: " << item_id << std::endl;
     store_value<uint32_t>(data_to_send_ptr, item_id);
-    store_value<FEATURE_TYPE>(data_to_send_ptr, mf_model.get_item_bias(item_id));
-    for (uint32_t j = 0; j < NUM_FACTORS; ++j) {
-      store_value<FEATURE_TYPE>(data_to_send_ptr, mf_model.get_item_weights(item_id, j));
-    }
+    std::memcpy(data_to_send_ptr, &mf_model.get_item_bias(item_id), row_size);
+    data_to_send_ptr += row_size;
   }
-
 }
 
 } // namespace cirrus
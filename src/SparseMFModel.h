@@ -26,8 +26,12 @@ class SparseMFModel : public CirrusModel {
       * @param w Serialized data
       * @param minibatch_size 
       * @param num_items
+      * @param nfactors Number of factors of each user and item
       */
-    SparseMFModel(const void* w, uint64_t minibatch_size, uint64_t num_items);
+    SparseMFModel(const void* w,
+                  uint64_t minibatch_size,
+                  uint64_t num_items,
+                  uint64_t nfactors);
     SparseMFModel(uint64_t users, uint64_t items, uint64_t factors);
 
     /**
@@ -40,7 +44,7 @@ class SparseMFModel : public CirrusModel {
      * @param mem Memory where model is serialized
      */
     void loadSerialized(const void*) { throw std::runtime_error("Not implemented"); }
-    void loadSerialized(const void* mem, uint64_t, uint64_t);
+    void loadSerialized(const void* mem, uint64_t, uint64_t, uint64_t);
 
     /**
       * serializes this model into memory
@@ -209,10 +209,17 @@ class SpinLock : public Lock {
 
     /**
       * This function busywaits until it obtains the lock.
+      * After a while it starts yielding the cpu in case the holder of
+      * the lock has been descheduled.
       */
     void wait() final {
-        while (lock.test_and_set(std::memory_order_acquire))
-            continue;
+        int spins = 0;
+        while (lock.test_and_set(std::memory_order_acquire)) {
+            if (++spins == 128) {
+                std::this_thread::yield();
+                spins = 0;
+            }
+        }
     }
 
     /**
@@ -4,16 +4,32 @@
 #include <Configuration.h>
 
 #include "config.h"
+#include "Constants.h"
 #include "LRModel.h"
 #include "MFModel.h"
 #include "SparseLRModel.h"
 #include "PSSparseServerInterface.h"
 #include "S3SparseIterator.h"
 #include "OptimizationMethod.h"
+#include "ModelUpdater.h"
+#include "GradientCoalescer.h"
+#include "BufferPool.h"
+#include "Connection.h"
+#include "KVStore.h"
+#include "GradientCompressor.h"
+#include "PSMetrics.h"
+#include "SSPClock.h"
+#include "WorkerPipeline.h"
+#include "AsyncGradientSender.h"
+#include "ShmRing.h"
+#include "IoUring.h"
 
 #include <chrono>
+#include <cstring>
+#include <list>
 #include <map>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -21,6 +37,7 @@
 #include <netinet/tcp.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -82,9 +99,12 @@ class LogisticSparseTaskS3 : public MLTask {
    private:
     class SparseModelGet {
       public:
-        SparseModelGet(const std::string& ps_ip, int ps_port) :
+        SparseModelGet(const std::string& ps_ip,
+                       int ps_port,
+                       const Configuration& config) :
           ps_ip(ps_ip), ps_port(ps_port) {
-            psi = std::make_unique<PSSparseServerInterface>(ps_ip, ps_port);
+            psi = std::make_unique<PSSparseServerInterface>(
+                ps_ip, ps_port, config);
             psi->connect();
         }
 
@@ -97,6 +117,10 @@ class LogisticSparseTaskS3 : public MLTask {
                                    const Configuration& config) {
           psi->get_lr_sparse_model_inplace(ds, model, config);
         }
+        // stale synchronous parallel mode (see ssp_staleness)
+        void wait_for_clock(uint32_t task_id, uint64_t clock) {
+          psi->wait_for_clock(task_id, clock);
+        }
 
       private:
         std::unique_ptr<PSSparseServerInterface> psi;
@@ -107,11 +131,31 @@ class LogisticSparseTaskS3 : public MLTask {
     bool get_dataset_minibatch(std::shared_ptr<SparseDataset>& dataset,
                                S3SparseIterator& s3_iter);
     void push_gradient(LRSparseGradient*);
+    // push the gradient and pull the model of the next minibatch, which
+    // replaces dataset
+    void push_gradient_pull_model(LRSparseGradient*,
+                                  std::shared_ptr<SparseDataset>& dataset,
+                                  S3SparseIterator& s3_iter,
+                                  SparseLRModel& model);
+
+    // data and model of a minibatch fetched by the pipeline
+    struct PipelineWork {
+      explicit PipelineWork(uint64_t model_size) : model(model_size) {}
+
+      std::shared_ptr<SparseDataset> dataset;
+      SparseLRModel model;
+    };
+    using Pipeline =
+        WorkerPipeline<PipelineWork, std::unique_ptr<ModelGradient>>;
 
     std::mutex redis_lock;
   
     std::unique_ptr<SparseModelGet> sparse_model_get;
     PSSparseServerInterface* psint;
+    // top-k compression of the gradients sent (null if disabled)
+    std::unique_ptr<GradientCompressor> gradient_compressor;
+    // sends gradients in the background (null if disabled)
+    std::unique_ptr<AsyncGradientSender> gradient_sender;
 };
 
 class PSSparseTask : public MLTask {
@@ -248,33 +292,169 @@ class PSSparseServerTask : public MLTask {
                      uint64_t nworkers,
                      uint64_t worker_id,
                      const std::string& ps_ip,
-                     uint64_t ps_port);
+                     uint64_t ps_port,
+                     uint32_t shard_id = 0);
 
   void run(const Configuration& config);
 
+  /**
+    * Worker served over shared memory (ATTACH_SHM) by a thread of its own.
+    * Requests are served in place in the request ring and replies are
+    * written to the reply ring
+    */
+  struct ShmClient {
+    std::unique_ptr<ShmSegment> segment;
+    std::unique_ptr<Connection> conn;  //< state of the client (wire format)
+    int sock = -1;  //< copy of the socket of the worker, to see it leave
+    uint32_t thread_number = 0;  //< metrics and coalescing window
+    std::function<bool()> alive;  //< worker still there, server running
+    std::atomic<bool> done{false};
+    std::thread thread;
+
+    void reply(const void* data, uint64_t size) {
+      if (!segment->replies().write(data, size, alive)) {
+        conn->set_failed();
+      }
+    }
+  };
+
+  /**
+    * A complete request of a connection. Handlers read its arguments and
+    * queue their replies through it
+    */
   struct Request {
    public:
-    Request(int sock, int id, uint32_t incoming_size, struct pollfd& poll_fd)
-        : sock(sock), id(id), incoming_size(incoming_size), poll_fd(poll_fd) {}
+    Request(Connection* conn, int id, struct pollfd* poll_fd)
+        : conn(conn), sock(conn->sock()), id(id), poll_fd(poll_fd) {}
+
+    /**
+      * Copy the next size bytes of the request to data
+      * Returns false if the request is shorter
+      */
+    bool read(void* data, uint64_t size) {
+      const char* ptr = next(size);
+      if (ptr == nullptr) {
+        return false;
+      }
+      std::memcpy(data, ptr, size);
+      return true;
+    }
 
+    /**
+      * The next size bytes of the request, nullptr if it is shorter
+      */
+    const char* next(uint64_t size) {
+      if (static_cast<uint64_t>(end - data) < size) {
+        return nullptr;
+      }
+      const char* ptr = data;
+      data += size;
+      return ptr;
+    }
+
+    void reply(const void* reply_data, uint64_t size) const {
+      if (shm) {
+        shm->reply(reply_data, size);
+        return;
+      }
+      conn->reply(reply_data, size);
+    }
+
+    Connection* conn;
+    ShmClient* shm = nullptr;    //< replies go over shared memory
     int sock;
     int id;
-    uint32_t incoming_size;
-    struct pollfd& poll_fd;
+    struct pollfd* poll_fd;      //< poll mode only
+    const char* data = nullptr;  //< unread arguments of the request
+    const char* end = nullptr;
+    uint64_t start_time_us = 0;  //< when the request was read (latency)
   };
 
  private:
   /**
-    * Handle the situation when a socket read fails within worker threads
+    * Handle a request shorter than what its arguments say. The connection
+    * is closed once the request is done
     */
-  void handle_failed_read(struct pollfd* pfd);
+  void handle_failed_read(Request& req);
   void checkpoint_model_loop();      //< periodically checkpoint model
+  void coalesce_flush_loop();        //< flush stale coalesced gradients
+  void flush_coalesced_gradients(uint32_t window);  //< apply merged grads
+  // apply (or coalesce) a serialized LR gradient
+  void apply_lr_gradient(const char* data,
+                         uint32_t size,
+                         uint32_t format,
+                         int thread_number);
+  // the num_entries LR indices serialized at data, in the wire format
+  const uint32_t* read_lr_indices(const char* data,
+                                  const char* end,
+                                  uint32_t num_entries,
+                                  uint32_t format);
+  // copy the LR weights of num_entries indices into out
+  void lookup_lr_weights(const uint32_t* indices,
+                         uint32_t num_entries,
+                         char* out);
   void start_server();               //< start server thread
+  void start_poll_server();          //< start poll and worker threads
   void main_poll_thread_fn(int id);  //< setup polling thread and call poll()
 
   bool testRemove(struct pollfd x, int id);  //< clean dead connections
   void loop(int id);                         //< listen for requests
-  bool process(struct pollfd&, int id);      //< process a request
+  // hand a connection with a complete request to the worker threads
+  bool process(struct pollfd&, int id);
+
+  /**
+    * Serve the requests buffered by a connection, stopping at the first
+    * reply that could not be written right away (unless its owner writes
+    * replies later anyway)
+    * Returns false if the server has been told to shut down
+    */
+  bool serve_requests(Connection* conn,
+                      int id,
+                      struct pollfd* poll_fd,
+                      uint64_t start_time_us,
+                      int thread_number);
+  // add a new connection on sock, false if sock can't be served
+  bool add_connection(int sock);
+  // close a connection and free it. poll_fd is its entry in poll mode
+  void close_connection(Connection* conn, struct pollfd* poll_fd);
+  // make an epoll instance wait for what conn needs (read or write)
+  void set_epoll_events(int epoll_fd, Connection* conn);
+
+  void create_server_socket();  //< bind and listen on ps_port
+
+  /**
+    * Serve a worker attached over shared memory until it leaves or the
+    * server shuts down
+    */
+  void serve_shm_client(ShmClient* client);
+  // attach the segment of a worker and start serving it, false if the
+  // server can't take more shared memory clients
+  bool add_shm_client(const std::string& name,
+                      uint64_t ring_size,
+                      const Request& req);
+
+  /**
+    * epoll mode: every worker thread waits on its own epoll instance and
+    * reads, processes and replies to requests of the connections it owns
+    */
+  void epoll_thread_fn();
+  void accept_connections();  //< accept and hand connections round-robin
+
+  /**
+    * io_uring mode: like epoll mode, but every worker thread submits the
+    * receives and sends of its connections to its own io_uring instance
+    * and gets their completions, many at a time, in one system call
+    */
+  void io_uring_thread_fn();
+
+  /**
+    * Read operation id from a connection and call the respective handler
+    * Returns false if the server has been told to shut down
+    */
+  bool handle_request(Request&, int thread_number);
+
+  void print_op_latencies();  //< per-op latency of the last interval
+  void dump_metrics();        //< write metrics to the metrics_path file
 
   void set_operation_maps();  //< set maps related to requests
 
@@ -282,41 +462,48 @@ class PSSparseServerTask : public MLTask {
     * Model/ML related methods
     */
 
-  // checkpoint model to file
+  // checkpoint models to file (see ModelCheckpoint)
   void checkpoint_model_file(const std::string&) const;
 
-  // serialize lr model
-  std::shared_ptr<char> serialize_lr_model(const SparseLRModel&,
-                                           uint64_t* model_size) const;
+  // load models from a checkpoint file, false if there is none
+  bool restore_model_file(const std::string&);
+
+  // checkpoint file of this server (one per shard)
+  std::string checkpoint_filename() const;
 
   // worker thread function
   void gradient_f();
 
   // message handling
-  bool process_get_lr_sparse_model(int,
-                                   const Request&,
-                                   std::vector<char>&,
-                                   int);
-  bool process_get_mf_sparse_model(int,
-                                   const Request&,
-                                   std::vector<char>&,
-                                   int);
-  bool process_send_lr_gradient(int, const Request&, std::vector<char>&, int);
-  bool process_send_mf_gradient(int, const Request&, std::vector<char>&, int);
-  bool process_get_lr_full_model(int, const Request&, std::vector<char>&, int);
-  bool process_get_mf_full_model(int, const Request&, std::vector<char>&, int);
-  bool process_get_task_status(int, const Request&, std::vector<char>&, int);
-  bool process_set_task_status(int, const Request&, std::vector<char>&, int);
-  bool process_get_num_conns(int, const Request&, std::vector<char>&, int);
-  bool process_get_num_updates(int, const Request&, std::vector<char>&, int);
-  bool process_get_last_time_error(int,
-                                   const Request&,
-                                   std::vector<char>&,
-                                   int);
-  bool process_get_value(int, const Request&, std::vector<char>&, int);
-  bool process_set_value(int, const Request&, std::vector<char>&, int);
-  bool process_register_task(int, const Request&, std::vector<char>&, int);
-  bool process_deregister_task(int, const Request&, std::vector<char>&, int);
+  bool process_get_lr_sparse_model(int, Request&, int);
+  bool process_get_mf_sparse_model(int, Request&, int);
+  bool process_send_lr_gradient(int, Request&, int);
+  bool process_send_mf_gradient(int, Request&, int);
+  bool process_get_lr_full_model(int, Request&, int);
+  bool process_get_mf_full_model(int, Request&, int);
+  bool process_get_lr_model_delta(int, Request&, int);
+  bool process_send_lr_gradient_get_sparse_model(int, Request&, int);
+  bool process_negotiate_wire_format(int, Request&, int);
+  bool process_get_metrics(int, Request&, int);
+  bool process_get_task_status(int, Request&, int);
+  bool process_set_task_status(int, Request&, int);
+  bool process_get_num_conns(int, Request&, int);
+  bool process_get_num_updates(int, Request&, int);
+  bool process_get_last_time_error(int, Request&, int);
+  bool process_get_value(int, Request&, int);
+  bool process_set_value(int, Request&, int);
+  bool process_multi_get_value(int, Request&, int);
+  bool process_multi_set_value(int, Request&, int);
+  bool process_register_task(int, Request&, int);
+  bool process_deregister_task(int, Request&, int);
+  bool process_advance_clock(int, Request&, int);
+  bool process_enable_request_ids(int, Request&, int);
+  bool process_attach_shm(int, Request&, int);
+
+  // reply with the value of key (size and value, or 0 if not set)
+  void reply_value(const Request& req, const char* key);
+  // read a key, size and value from req into the key-value store
+  bool read_and_set_value(Request& req);
 
   void kill_server();
 
@@ -348,11 +535,20 @@ class PSSparseServerTask : public MLTask {
 
   // thread to checkpoint model
   std::vector<std::unique_ptr<std::thread>> checkpoint_thread;
+  // thread that applies coalesced gradients that waited too long
+  std::unique_ptr<std::thread> coalesce_thread;
   pthread_t main_thread;
   std::mutex to_process_lock;      //< lock for queue of requests
   sem_t sem_new_req;               //< semaphore for queue of requests
   std::queue<Request> to_process;  //< list of requests
-  std::mutex model_lock;  //< to coordinate access to the last computed model
+  // applies gradients to the models (see ps_update_mode)
+  std::unique_ptr<ModelUpdater> model_updater;
+  // merges LR gradients before applying them (see grad_coalesce_window)
+  std::unique_ptr<GradientCoalescer> gradient_coalescer;
+
+  // epoll instance of each worker thread (epoll mode)
+  int epoll_fds[NUM_PS_WORK_THREADS] = {0};
+  std::atomic<uint64_t> next_epoll_thread;  //< round-robin of new conns
 
   // file descriptors for pipes
   int pipefds[NUM_POLL_THREADS][2] = {{0}};
@@ -372,14 +568,29 @@ class PSSparseServerTask : public MLTask {
   std::unique_ptr<SparseLRModel> lr_model;  //< last computed model
   std::unique_ptr<MFModel> mf_model;        //< last computed model
   Configuration task_config;                //< config for parameter server
-  uint32_t num_connections = 0;             //< num of current connections
+  uint32_t shard_id;  //< shard of the models held by this server (ps_shards)
+  std::atomic<uint32_t> num_connections;    //< num of current connections
   uint32_t num_tasks = 0;                   //< num of currently reg. tasks
 
   std::map<int, bool> task_to_status;            //< keep track of task status
   std::map<int, std::string> operation_to_name;  //< request id to name
 
-  // per-thread buffer
-  std::shared_ptr<char[]> thread_msg_buffer[NUM_PS_WORK_THREADS];
+  // latency of each stage of each operation, traffic and lock counters
+  std::unique_ptr<PSMetrics> metrics;
+  uint64_t server_start_us;  //< when the server was built (metrics uptime)
+  // latency counts seen in the previous call to print_op_latencies()
+  std::vector<uint64_t> last_op_latency[NUM_PS_OPS];
+
+  // buffers requests are read into and replies are built in
+  std::unique_ptr<BufferPool> buffer_pool;
+  std::unique_ptr<KVStore> kv_store;  //< values of SET_VALUE / GET_VALUE
+  // clocks of the tasks in stale synchronous parallel mode (null if off)
+  std::unique_ptr<SSPClock> ssp_clock;
+  // state of each connection, indexed by socket
+  std::unique_ptr<std::unique_ptr<Connection>[]> connections;
+  // workers served over shared memory, at most MAX_SHM_CLIENTS
+  std::list<std::unique_ptr<ShmClient>> shm_clients;
+  std::mutex shm_lock;
   std::atomic<int> thread_count;  //< keep track of each thread's id
 
   uint32_t num_updates = 0;       //< Last measured num updates
@@ -389,13 +600,8 @@ class PSSparseServerTask : public MLTask {
   std::unique_ptr<pthread_barrier_t, void (*)(pthread_barrier_t*)>
       threads_barrier;
 
-  std::unordered_map<
-      uint32_t,
-      std::function<bool(int, const Request&, std::vector<char>&, int)>>
+  std::unordered_map<uint32_t, std::function<bool(int, Request&, int)>>
       operation_to_f;
-
-  std::unordered_map<std::string, std::pair<uint32_t, std::shared_ptr<char>>>
-      key_value_map;
 };
 
 class MFNetflixTask : public MLTask {
@@ -419,9 +625,12 @@ class MFNetflixTask : public MLTask {
    private:
     class MFModelGet {
       public:
-        MFModelGet(const std::string& ps_ip, int ps_port) :
+        MFModelGet(const std::string& ps_ip,
+                   int ps_port,
+                   const Configuration& config) :
           ps_ip(ps_ip), ps_port(ps_port) {
-            psi = std::make_unique<PSSparseServerInterface>(ps_ip, ps_port);
+            psi = std::make_unique<PSSparseServerInterface>(
+                ps_ip, ps_port, config);
             psi->connect();
         }
 
@@ -431,6 +640,11 @@ class MFNetflixTask : public MLTask {
           return psi->get_sparse_mf_model(ds, user_base_index, mb_size);
         }
 
+        // stale synchronous parallel mode (see ssp_staleness)
+        void wait_for_clock(uint32_t task_id, uint64_t clock) {
+          psi->wait_for_clock(task_id, clock);
+        }
+
       private:
         std::unique_ptr<PSSparseServerInterface> psi;
         std::string ps_ip;
@@ -442,6 +656,18 @@ class MFNetflixTask : public MLTask {
                               S3SparseIterator& s3_iter);
    void push_gradient(MFSparseGradient&);
 
+   // data, model and index of the first sample of a minibatch fetched by
+   // the pipeline
+   struct PipelineWork {
+     PipelineWork() : model(0UL, 0UL, 0UL) {}
+
+     std::shared_ptr<SparseDataset> dataset;
+     SparseMFModel model;
+     uint64_t sample_index = 0;
+   };
+   using Pipeline =
+       WorkerPipeline<PipelineWork, std::unique_ptr<ModelGradient>>;
+
    std::unique_ptr<MFModelGet> mf_model_get;
    std::unique_ptr<PSSparseServerInterface> psint;
 };
@@ -3,8 +3,11 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
+#include <ifaddrs.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <unistd.h>
+#include <cerrno>
 #include <cstring>
 
 #include "MurmurHash3.h"
@@ -99,11 +102,24 @@ void sleep_forever() {
   }
 }
 
+static thread_local IOCounters io_counters;
+
+const IOCounters& thread_io_counters() {
+  return io_counters;
+}
+
+uint64_t get_monotonic_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_nsec + ts.tv_sec * 1000000000UL;
+}
+
 int64_t send_all(int sock, void* data, size_t len) {
 #ifdef DEBUG
   std::cout << "send_all len: " << len << std::endl;
 #endif
   uint64_t bytes_sent = 0;
+  uint64_t start_ns = get_monotonic_time_ns();
 
   while (bytes_sent < len) {
     int64_t retval = send(sock, reinterpret_cast<char*>(data) + bytes_sent,
@@ -114,6 +130,8 @@ int64_t send_all(int sock, void* data, size_t len) {
     }
     bytes_sent += retval;
   }   
+  io_counters.bytes_sent += bytes_sent;
+  io_counters.send_ns += get_monotonic_time_ns() - start_ns;
 #ifdef DEBUG
   std::cout << "send_all done" << std::endl;
 #endif
@@ -125,6 +143,7 @@ ssize_t read_all(int sock, void* data, size_t len) {
   std::cout << "read_all len: " << len << std::endl;
 #endif
   uint64_t bytes_read = 0;
+  uint64_t start_ns = get_monotonic_time_ns();
 
   while (bytes_read < len) {
 #ifdef DEBUG
@@ -146,12 +165,77 @@ ssize_t read_all(int sock, void* data, size_t len) {
     }
     bytes_read += retval;
   }
+  io_counters.bytes_read += bytes_read;
+  io_counters.read_ns += get_monotonic_time_ns() - start_ns;
 #ifdef DEBUG
   std::cout << "read_all done" << std::endl;
 #endif
   return bytes_read;
 }
 
+ssize_t read_some(int sock, void* data, size_t len) {
+  uint64_t start_ns = get_monotonic_time_ns();
+  ssize_t retval = recv(sock, data, len, MSG_DONTWAIT);
+  io_counters.read_ns += get_monotonic_time_ns() - start_ns;
+  if (retval == -1) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0
+                                                                       : -1;
+  } else if (retval == 0) {
+    return -1;  // end of file
+  }
+  io_counters.bytes_read += retval;
+  return retval;
+}
+
+ssize_t send_some(int sock, const void* data, size_t len) {
+  uint64_t start_ns = get_monotonic_time_ns();
+  // a client that went away is an error, not a SIGPIPE
+  ssize_t retval = send(sock, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  io_counters.send_ns += get_monotonic_time_ns() - start_ns;
+  if (retval == -1) {
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0
+                                                                       : -1;
+  }
+  io_counters.bytes_sent += retval;
+  return retval;
+}
+
+bool socket_peer_open(int sock) {
+  struct pollfd fd;
+  fd.fd = sock;
+  fd.events = POLLRDHUP;
+  fd.revents = 0;
+  if (poll(&fd, 1, 0) == -1) {
+    return errno == EINTR;
+  }
+  return (fd.revents & (POLLRDHUP | POLLHUP | POLLERR | POLLNVAL)) == 0;
+}
+
+bool is_local_address(const std::string& ip) {
+  struct in_addr addr;
+  if (inet_pton(AF_INET, ip.c_str(), &addr) != 1) {
+    return false;
+  }
+  if ((ntohl(addr.s_addr) >> 24) == 127) {
+    return true;
+  }
+  struct ifaddrs* interfaces = nullptr;
+  if (getifaddrs(&interfaces) != 0) {
+    return false;
+  }
+  bool local = false;
+  for (struct ifaddrs* i = interfaces; i != nullptr; i = i->ifa_next) {
+    if (i->ifa_addr != nullptr && i->ifa_addr->sa_family == AF_INET &&
+        reinterpret_cast<struct sockaddr_in*>(i->ifa_addr)->sin_addr.s_addr ==
+            addr.s_addr) {
+      local = true;
+      break;
+    }
+  }
+  freeifaddrs(interfaces);
+  return local;
+}
+
 uint64_t hash_f(const char* s) {
   uint64_t seed = 100;
   uint64_t hash_otpt[2]= {0};
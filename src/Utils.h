@@ -147,6 +147,45 @@ ssize_t send_all(int sock, void* data, size_t len);
 
 ssize_t read_all(int sock, void* data, size_t len);
 
+/**
+  * Single read / send that does not block, whatever the socket mode
+  * @return Bytes moved, 0 if the call would block, -1 on error or if the
+  *         peer closed the connection
+  */
+ssize_t read_some(int sock, void* data, size_t len);
+ssize_t send_some(int sock, const void* data, size_t len);
+
+/**
+  * Whether the peer of a connected socket is still there (does not block)
+  */
+bool socket_peer_open(int sock);
+
+/**
+  * Whether an IPv4 address is one of this host
+  */
+bool is_local_address(const std::string& ip);
+
+/**
+  * Bytes moved and time (ns) spent by the socket functions above in a
+  * thread
+  */
+struct IOCounters {
+  uint64_t bytes_read = 0;
+  uint64_t bytes_sent = 0;
+  uint64_t read_ns = 0;
+  uint64_t send_ns = 0;
+};
+
+/**
+  * Counters of the calling thread
+  */
+const IOCounters& thread_io_counters();
+
+/**
+  * Monotonic clock in ns, for measuring intervals
+  */
+uint64_t get_monotonic_time_ns();
+
 uint64_t hash_f(const char* s);
 
 } // namespace cirrus
@@ -0,0 +1,62 @@
+#include "WireFormat.h"
+
+#include <stdexcept>
+
+namespace cirrus {
+
+char* encode_sorted_indices(const uint32_t* indices,
+                            uint64_t count,
+                            char* out) {
+  uint8_t* ptr = reinterpret_cast<uint8_t*>(out);
+  uint32_t previous = 0;
+  for (uint64_t i = 0; i < count; ++i) {
+    if (indices[i] < previous) {
+      throw std::runtime_error("Indices are not sorted");
+    }
+    uint32_t delta = indices[i] - previous;
+    previous = indices[i];
+    while (delta >= 0x80) {
+      *ptr++ = static_cast<uint8_t>(delta | 0x80);
+      delta >>= 7;
+    }
+    *ptr++ = static_cast<uint8_t>(delta);
+  }
+  return reinterpret_cast<char*>(ptr);
+}
+
+const char* decode_sorted_indices(const char* in,
+                                  const char* end,
+                                  uint64_t count,
+                                  uint32_t* indices) {
+  const uint8_t* ptr = reinterpret_cast<const uint8_t*>(in);
+  const uint8_t* last = reinterpret_cast<const uint8_t*>(end);
+  uint32_t previous = 0;
+  for (uint64_t i = 0; i < count; ++i) {
+    if (ptr == last) {
+      throw std::runtime_error("Truncated index list");
+    }
+    // deltas of sorted indices mostly fit in one byte
+    uint32_t delta = *ptr++;
+    if (delta >= 0x80) {
+      delta &= 0x7f;
+      uint32_t shift = 7;
+      uint8_t byte;
+      do {
+        if (ptr == last || shift > 28) {
+          throw std::runtime_error("Malformed index list");
+        }
+        byte = *ptr++;
+        delta |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        shift += 7;
+      } while (byte & 0x80);
+    }
+    if (previous + delta < previous) {
+      throw std::runtime_error("Indices are not sorted");
+    }
+    previous += delta;
+    indices[i] = previous;
+  }
+  return reinterpret_cast<const char*>(ptr);
+}
+
+}  // namespace cirrus
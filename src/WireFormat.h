@@ -0,0 +1,56 @@
+#ifndef _WIRE_FORMAT_H_
+#define _WIRE_FORMAT_H_
+
+#include <cstdint>
+
+namespace cirrus {
+
+/**
+  * Encodings of the index lists sent to parameter servers (LR model
+  * requests, LR and MF gradients). A client asks for a format with
+  * NEGOTIATE_WIRE_FORMAT and the server answers with the highest format
+  * both sides support. Connections start in WIRE_FORMAT_RAW so older
+  * clients keep working.
+  */
+enum WireFormat : uint32_t {
+  WIRE_FORMAT_RAW = 0,     //< every index as a 4-byte int
+  WIRE_FORMAT_VARINT = 1,  //< sorted indices as varints of their deltas
+  WIRE_FORMAT_QUANTIZED = 2,  //< VARINT and gradient values quantized as
+                              //< set by the client (see Quantization.h)
+  NUM_WIRE_FORMATS         //< keep last
+};
+
+static const uint32_t LATEST_WIRE_FORMAT = NUM_WIRE_FORMATS - 1;
+
+/**
+  * Max number of bytes taken by count encoded indices
+  */
+inline uint64_t max_encoded_indices_size(uint64_t count) {
+  return count * 5;
+}
+
+/**
+  * Encode sorted indices as the difference to the previous index (the
+  * first one as is), 7 bits per byte with the high bit set on all but
+  * the last byte of each index
+  * @param out Has room for max_encoded_indices_size(count) bytes
+  * @return End of the encoded indices
+  */
+char* encode_sorted_indices(const uint32_t* indices,
+                            uint64_t count,
+                            char* out);
+
+/**
+  * Decode count indices written by encode_sorted_indices. Throws
+  * std::runtime_error if the list is truncated, malformed or not sorted
+  * @param end End of the buffer holding in, checked before every read
+  * @return End of the encoded indices
+  */
+const char* decode_sorted_indices(const char* in,
+                                  const char* end,
+                                  uint64_t count,
+                                  uint32_t* indices);
+
+}  // namespace cirrus
+
+#endif  // _WIRE_FORMAT_H_
@@ -0,0 +1,163 @@
+#ifndef _WORKER_PIPELINE_H_
+#define _WORKER_PIPELINE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cirrus {
+
+/**
+  * Overlaps the network I/O of a worker with its gradient computations.
+  * A background thread fetches the work of the next minibatches (data and
+  * model weights) and pushes the gradients the worker hands over, while
+  * the worker computes.
+  *
+  * The model of minibatch i is fetched once the gradients of all
+  * minibatches up to i - depth - 1 are pushed, so it misses at most the
+  * last depth gradients of the worker. With depth 1 the model of i + 1 is
+  * pulled while i is computed and the gradient of i - 1 is pushed.
+  *
+  * Gradients are pushed in order, before the next fetch starts.
+  * Work objects (depth + 1 of them) are reused across minibatches.
+  */
+template <typename Work, typename Gradient>
+class WorkerPipeline {
+ public:
+  /**
+    * @param depth Most gradients of the worker a model may miss (> 0)
+    * @param make_work Creates an empty work object
+    * @param fetch Fills a work object with the next minibatch
+    * @param push Sends a gradient
+    */
+  WorkerPipeline(uint32_t depth,
+                 const std::function<std::unique_ptr<Work>()>& make_work,
+                 std::function<void(Work*)> fetch,
+                 std::function<void(Gradient&)> push)
+      : depth_(depth), fetch_(std::move(fetch)), push_(std::move(push)) {
+    for (uint32_t i = 0; i < depth + 1; ++i) {
+      work_.push_back(make_work());
+      free_.push_back(work_.back().get());
+    }
+    thread_ = std::thread(&WorkerPipeline::io_loop, this);
+  }
+
+  /**
+    * Push the gradients still queued and stop the I/O thread
+    */
+  ~WorkerPipeline() {
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  WorkerPipeline(const WorkerPipeline&) = delete;
+  WorkerPipeline& operator=(const WorkerPipeline&) = delete;
+
+  /**
+    * Hand back the work of the previous minibatch and wait for the next one
+    * Rethrows the errors of the I/O thread
+    */
+  Work& next() {
+    std::unique_lock<std::mutex> lock(lock_);
+    if (current_) {
+      free_.push_back(current_);
+      current_ = nullptr;
+      cv_.notify_all();
+    }
+    cv_.wait(lock, [this]() { return !ready_.empty() || error_; });
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    current_ = ready_.front();
+    ready_.pop_front();
+    return *current_;
+  }
+
+  /**
+    * Queue the gradient of the current minibatch
+    * Rethrows the errors of the I/O thread
+    */
+  void push(Gradient gradient) {
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      if (error_) {
+        std::rethrow_exception(error_);
+      }
+      gradients_.push_back(std::move(gradient));
+    }
+    cv_.notify_all();
+  }
+
+ private:
+  bool can_fetch() const {
+    return !free_.empty() && num_pushed_ + depth_ >= num_fetched_;
+  }
+
+  void io_loop() {
+    std::unique_lock<std::mutex> lock(lock_);
+    try {
+      while (true) {
+        cv_.wait(lock, [this]() {
+          return stop_ || !gradients_.empty() || can_fetch();
+        });
+        if (!gradients_.empty()) {
+          Gradient gradient = std::move(gradients_.front());
+          gradients_.pop_front();
+          lock.unlock();
+          push_(gradient);
+          lock.lock();
+          ++num_pushed_;
+        } else if (stop_) {
+          return;
+        } else {
+          Work* work = free_.front();
+          free_.pop_front();
+          lock.unlock();
+          fetch_(work);
+          lock.lock();
+          ready_.push_back(work);
+          ++num_fetched_;
+        }
+        cv_.notify_all();
+      }
+    } catch (...) {
+      if (!lock.owns_lock()) {
+        lock.lock();
+      }
+      error_ = std::current_exception();
+      cv_.notify_all();
+    }
+  }
+
+  uint64_t depth_;
+  std::function<void(Work*)> fetch_;
+  std::function<void(Gradient&)> push_;
+
+  std::vector<std::unique_ptr<Work>> work_;
+  std::mutex lock_;
+  std::condition_variable cv_;
+  std::deque<Work*> free_;
+  std::deque<Work*> ready_;      //< fetched, in minibatch order
+  Work* current_ = nullptr;      //< being computed by the worker
+  std::deque<Gradient> gradients_;
+  uint64_t num_fetched_ = 0;
+  uint64_t num_pushed_ = 0;
+  bool stop_ = false;
+  std::exception_ptr error_;
+
+  std::thread thread_;
+};
+
+}  // namespace cirrus
+
+#endif  // _WORKER_PIPELINE_H_
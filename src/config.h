@@ -30,8 +30,10 @@ using FEATURE_TYPE = float;
 
 #define LIMIT_NUMBER_PASSES 3
 
-// number of factors for neflix workload
+// default number of factors for neflix workload (see num_factors:)
 #define NUM_FACTORS 10
+// most factors of a MF model, checked on the wire
+#define MAX_NUM_FACTORS 1024
 
 // define the number of poll threads
 #define NUM_POLL_THREADS 3
@@ -39,5 +41,8 @@ using FEATURE_TYPE = float;
 // define number of parameter server working threads
 #define NUM_PS_WORK_THREADS 4
 
+// most workers served over shared memory at once (a server thread each)
+#define MAX_SHM_CLIENTS 64
+
 // fixed size number of characters for key name
 #define KEY_SIZE (10)
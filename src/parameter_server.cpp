@@ -16,6 +16,7 @@ DEFINE_int64(rank, -1, "rank");
 DEFINE_string(config, "", "config");
 DEFINE_string(ps_ip, PS_IP, "parameter server ip");
 DEFINE_int64(ps_port, PS_PORT, "parameter server port");
+DEFINE_int64(ps_shard_id, 0, "model shard served by this parameter server");
 DEFINE_bool(testing, false, "testing mode");
 DEFINE_int64(test_iters, -1, "iterations to test for convergence");
 DEFINE_double(test_threshold,
@@ -31,6 +32,7 @@ void run_tasks(int rank,
                const cirrus::Configuration& config,
                const std::string& ps_ip,
                uint64_t ps_port,
+               uint32_t ps_shard_id,
                bool testing,
                int test_iters,
                double test_threshold) {
@@ -41,7 +43,7 @@ void run_tasks(int rank,
   if (rank == PS_SPARSE_SERVER_TASK_RANK) {
     cirrus::PSSparseServerTask st((1 << config.get_model_bits()) + 1,
         batch_size, samples_per_batch, features_per_sample,
-        nworkers, rank, ps_ip, ps_port);
+        nworkers, rank, ps_ip, ps_port, ps_shard_id);
     st.run(config);
   } else if (rank >= WORKERS_BASE && rank < WORKERS_BASE + nworkers) {
     /**
@@ -96,6 +98,7 @@ void print_arguments() {
   // rank starts at 0
   std::cout << "./parameter_server --config config_file "
       << "--nworkers nworkers --rank rank [--ps_ip ps_ip] [--ps_port ps_port]"
+      << " [--ps_shard_id shard_id]"
       << std::endl
       << " RANKS:" << std::endl
       << "0: load task" << std::endl
@@ -171,7 +174,7 @@ int main(int argc, char** argv) {
     throw std::runtime_error("Please specify a valid test accuracy threshold");
   }
   run_tasks(rank, nworkers, batch_size, config, FLAGS_ps_ip, FLAGS_ps_port,
-            FLAGS_testing, FLAGS_test_iters, FLAGS_test_threshold);
+            FLAGS_ps_shard_id, FLAGS_testing, FLAGS_test_iters, FLAGS_test_threshold);
 
   std::cout << "Test successful" << std::endl;
 
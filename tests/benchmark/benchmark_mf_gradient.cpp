@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <Constants.h>
+#include <MFKernels.h>
+#include <MFModel.h>
+#include <ModelGradient.h>
+#include <Utils.h>
+#include <config.h>
+
+using namespace cirrus;
+
+/**
+  * Compares MFSparseGradient, which keeps users and items in flat arrays,
+  * with the layout it replaced (biases in maps, one vector of factors per
+  * user and item). Times building a gradient as SparseMFModel does,
+  * serializing it, loading it on the parameter server and applying it.
+  * The flat gradient is also applied in place from the serialized bytes,
+  * as the parameter server does with WIRE_FORMAT_RAW
+  * usage: benchmark_mf_gradient [iterations]
+  */
+
+#define MF_USERS 100000
+#define MF_ITEMS 17770
+#define GRAD_USERS 20        // users in each gradient (minibatch size)
+#define RATINGS_PER_USER 25  // items rated by each user
+#define NUM_GRADIENTS 64     // gradients cycled through
+
+// the previous MFSparseGradient, serialized in the same raw format order
+struct NestedMFGradient {
+  std::unordered_map<int, FEATURE_TYPE> users_bias_grad;
+  std::unordered_map<int, FEATURE_TYPE> items_bias_grad;
+  std::vector<std::pair<int, std::vector<FEATURE_TYPE>>> users_weights_grad;
+  std::vector<std::pair<int, std::vector<FEATURE_TYPE>>> items_weights_grad;
+
+  uint64_t getSerializedSize() const {
+    return sizeof(uint32_t) * 5 +
+           (users_bias_grad.size() + items_bias_grad.size()) *
+               (2 * sizeof(int) + (1 + NUM_FACTORS) * sizeof(FEATURE_TYPE));
+  }
+
+  void serialize(void* mem) const {
+    store_value<uint32_t>(mem, MAGIC_NUMBER);
+    store_value<uint32_t>(mem, users_bias_grad.size());
+    store_value<uint32_t>(mem, items_bias_grad.size());
+    store_value<uint32_t>(mem, NUM_FACTORS);
+    for (const auto* biases : {&users_bias_grad, &items_bias_grad}) {
+      for (const auto& bias : *biases) {
+        store_value<int>(mem, bias.first);
+        store_value<FEATURE_TYPE>(mem, bias.second);
+      }
+    }
+    for (const auto* weights : {&users_weights_grad, &items_weights_grad}) {
+      for (const auto& row : *weights) {
+        store_value<int>(mem, row.first);
+        for (const auto& weight : row.second) {
+          store_value<FEATURE_TYPE>(mem, weight);
+        }
+      }
+    }
+    store_value<uint32_t>(mem, 0x1338);
+  }
+
+  void loadSerialized(const void* mem) {
+    load_value<uint32_t>(mem);
+    uint32_t users_size = load_value<uint32_t>(mem);
+    uint32_t items_size = load_value<uint32_t>(mem);
+    uint32_t nfactors = load_value<uint32_t>(mem);
+    for (uint32_t i = 0; i < users_size; ++i) {
+      int id = load_value<int>(mem);
+      users_bias_grad[id] = load_value<FEATURE_TYPE>(mem);
+    }
+    for (uint32_t i = 0; i < items_size; ++i) {
+      int id = load_value<int>(mem);
+      items_bias_grad[id] = load_value<FEATURE_TYPE>(mem);
+    }
+    for (auto* weights : {&users_weights_grad, &items_weights_grad}) {
+      uint32_t size = weights == &users_weights_grad ? users_size : items_size;
+      for (uint32_t i = 0; i < size; ++i) {
+        std::pair<int, std::vector<FEATURE_TYPE>> row;
+        row.first = load_value<int>(mem);
+        row.second.reserve(nfactors);
+        for (uint32_t j = 0; j < nfactors; ++j) {
+          row.second.push_back(load_value<FEATURE_TYPE>(mem));
+        }
+        weights->push_back(std::move(row));
+      }
+    }
+    load_value<uint32_t>(mem);
+  }
+
+  void apply(MFModel* model) const {
+    const MFKernels& kernels = MFKernels::get(NUM_FACTORS);
+    for (const auto& v : users_bias_grad) {
+      model->get_user_bias(v.first) += v.second;
+    }
+    for (const auto& v : items_bias_grad) {
+      model->get_item_bias(v.first) += v.second;
+    }
+    for (const auto& v : users_weights_grad) {
+      kernels.add(&model->get_user_weights(v.first, 0), v.second.data(),
+                  NUM_FACTORS);
+    }
+    for (const auto& v : items_weights_grad) {
+      kernels.add(&model->get_item_weights(v.first, 0), v.second.data(),
+                  NUM_FACTORS);
+    }
+  }
+};
+
+// items rated by the users of each gradient
+std::vector<std::vector<std::vector<int>>> make_ratings(uint64_t seed) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> item(0, MF_ITEMS - 1);
+  std::vector<std::vector<std::vector<int>>> ratings(NUM_GRADIENTS);
+  for (auto& gradient_ratings : ratings) {
+    gradient_ratings.resize(GRAD_USERS);
+    for (auto& user_ratings : gradient_ratings) {
+      for (int i = 0; i < RATINGS_PER_USER; ++i) {
+        user_ratings.push_back(item(gen));
+      }
+    }
+  }
+  return ratings;
+}
+
+// one entry per user and rated item, filled the way
+// SparseMFModel::minibatch_grad fills its gradient
+NestedMFGradient build_nested(const std::vector<std::vector<int>>& ratings,
+                              int base_user) {
+  NestedMFGradient gradient;
+  std::vector<std::vector<FEATURE_TYPE>> item_weights(MF_ITEMS);
+  std::vector<int> items;
+  for (uint64_t u = 0; u < ratings.size(); ++u) {
+    std::vector<FEATURE_TYPE> user_weights(NUM_FACTORS);
+    gradient.users_bias_grad[base_user + u] = 0;
+    for (const auto& item : ratings[u]) {
+      gradient.users_bias_grad[base_user + u] += 0.001;
+      gradient.items_bias_grad[item] += 0.001;
+      if (item_weights[item].empty()) {
+        item_weights[item].resize(NUM_FACTORS);
+        items.push_back(item);
+      }
+      for (uint64_t k = 0; k < NUM_FACTORS; ++k) {
+        user_weights[k] += 0.001;
+        item_weights[item][k] += 0.001;
+      }
+    }
+    gradient.users_weights_grad.push_back(
+        std::make_pair(base_user + u, std::move(user_weights)));
+  }
+  for (const auto& item : items) {
+    gradient.items_weights_grad.push_back(
+        std::make_pair(item, std::move(item_weights[item])));
+  }
+  return gradient;
+}
+
+MFSparseGradient build_flat(const std::vector<std::vector<int>>& ratings,
+                            int base_user) {
+  MFSparseGradient gradient;
+  gradient.reserve(ratings.size(), 0);
+  std::vector<int> item_index(MF_ITEMS, -1);
+  for (uint64_t u = 0; u < ratings.size(); ++u) {
+    uint32_t user = gradient.add_user(base_user + u);
+    for (const auto& item : ratings[u]) {
+      if (item_index[item] == -1) {
+        item_index[item] = gradient.add_item(item);
+      }
+      gradient.user_bias(user) += 0.001;
+      gradient.item_bias(item_index[item]) += 0.001;
+      FEATURE_TYPE* user_factors = gradient.user_factors(user);
+      FEATURE_TYPE* item_factors = gradient.item_factors(item_index[item]);
+      for (uint64_t k = 0; k < NUM_FACTORS; ++k) {
+        user_factors[k] += 0.001;
+        item_factors[k] += 0.001;
+      }
+    }
+  }
+  return gradient;
+}
+
+// average time of f over iterations calls, in us
+template <typename F>
+double time_us(int iterations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    f(i % NUM_GRADIENTS);
+  }
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+int main(int argc, char* argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+
+  std::vector<std::vector<std::vector<int>>> ratings = make_ratings(42);
+  std::vector<int> base_users(NUM_GRADIENTS);
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<int> user(0, MF_USERS - GRAD_USERS);
+  for (auto& base_user : base_users) {
+    base_user = user(gen);
+  }
+  MFModel model(MF_USERS, MF_ITEMS, NUM_FACTORS);
+
+  std::vector<NestedMFGradient> nested;
+  std::vector<MFSparseGradient> flat;
+  for (int i = 0; i < NUM_GRADIENTS; ++i) {
+    nested.push_back(build_nested(ratings[i], base_users[i]));
+    flat.push_back(build_flat(ratings[i], base_users[i]));
+  }
+  std::vector<std::vector<char>> nested_data(NUM_GRADIENTS);
+  std::vector<std::vector<char>> flat_data(NUM_GRADIENTS);
+
+  double nested_build = time_us(iterations, [&](int i) {
+    nested[i] = build_nested(ratings[i], base_users[i]);
+  });
+  double flat_build = time_us(iterations, [&](int i) {
+    flat[i] = build_flat(ratings[i], base_users[i]);
+  });
+  double nested_serialize = time_us(iterations, [&](int i) {
+    nested_data[i].resize(nested[i].getSerializedSize());
+    nested[i].serialize(nested_data[i].data());
+  });
+  double flat_serialize = time_us(iterations, [&](int i) {
+    flat_data[i].resize(flat[i].getSerializedSize());
+    flat[i].serialize(flat_data[i].data());
+  });
+  double nested_load = time_us(iterations, [&](int i) {
+    NestedMFGradient gradient;
+    gradient.loadSerialized(nested_data[i].data());
+  });
+  double flat_load = time_us(iterations, [&](int i) {
+    MFSparseGradient gradient;
+    gradient.loadSerialized(flat_data[i].data());
+  });
+  double view_load = time_us(iterations, [&](int i) {
+    MFGradientView::of_serialized(flat_data[i].data(), flat_data[i].size());
+  });
+  double nested_apply =
+      time_us(iterations, [&](int i) { nested[i].apply(&model); });
+  double flat_apply =
+      time_us(iterations, [&](int i) { model.add_gradient(flat[i].view()); });
+  double nested_receive = time_us(iterations, [&](int i) {
+    NestedMFGradient gradient;
+    gradient.loadSerialized(nested_data[i].data());
+    gradient.apply(&model);
+  });
+  double view_receive = time_us(iterations, [&](int i) {
+    model.add_gradient(MFGradientView::of_serialized(flat_data[i].data(),
+                                                     flat_data[i].size()));
+  });
+
+  std::cout << "users/items per gradient: " << flat[0].num_users() << "/"
+            << flat[0].num_items() << ", bytes: " << flat_data[0].size()
+            << std::endl;
+  std::cout << "us per gradient\tnested\tflat" << std::endl;
+  std::cout << "build\t" << nested_build << "\t" << flat_build << std::endl;
+  std::cout << "serialize\t" << nested_serialize << "\t" << flat_serialize
+            << std::endl;
+  std::cout << "deserialize\t" << nested_load << "\t" << flat_load
+            << " (view: " << view_load << ")" << std::endl;
+  std::cout << "apply\t" << nested_apply << "\t" << flat_apply << std::endl;
+  std::cout << "deserialize+apply\t" << nested_receive << "\t"
+            << view_receive << " (view)" << std::endl;
+  return 0;
+}
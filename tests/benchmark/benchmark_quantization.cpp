@@ -0,0 +1,140 @@
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <Configuration.h>
+#include <ModelGradient.h>
+#include <Quantization.h>
+#include <SparseDataset.h>
+#include <SparseLRModel.h>
+#include <WireFormat.h>
+#include <config.h>
+
+using namespace cirrus;
+
+/**
+  * Compares the convergence of LR trained with full precision and with
+  * quantized gradients. Every gradient goes through the serialization the
+  * parameter server receives and the loss is the one reported by
+  * ErrorSparseTask (SparseLRModel::calc_loss over a test set)
+  * usage: benchmark_quantization [epochs]
+  */
+
+#define MODEL_BITS 16
+#define NUM_FEATURES 20      // non-zero features per sample
+#define TRAIN_SAMPLES 50000
+#define TEST_SAMPLES 5000
+#define MINIBATCH_SIZE 20
+#define LEARNING_RATE 0.1
+
+// samples labeled by a logistic model with true_weights, in datasets of
+// dataset_size samples
+std::vector<SparseDataset> make_datasets(
+    const std::vector<FEATURE_TYPE>& true_weights,
+    uint64_t num_samples,
+    uint64_t dataset_size,
+    uint64_t seed) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> index(0, (1 << MODEL_BITS) - 1);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::vector<SparseDataset> datasets;
+  std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> samples;
+  std::vector<FEATURE_TYPE> labels;
+  for (uint64_t i = 0; i < num_samples; ++i) {
+    std::vector<std::pair<int, FEATURE_TYPE>> sample;
+    double dot = 0;
+    for (int j = 0; j < NUM_FEATURES; ++j) {
+      sample.push_back(std::make_pair(index(gen), 1.0));
+      dot += true_weights[sample.back().first];
+    }
+    samples.push_back(std::move(sample));
+    labels.push_back(uniform(gen) < 1 / (1 + std::exp(-dot)) ? 1 : 0);
+    if (samples.size() == dataset_size) {
+      datasets.emplace_back(std::move(samples), std::move(labels));
+      samples.clear();
+      labels.clear();
+    }
+  }
+  return datasets;
+}
+
+int main(int argc, char** argv) {
+  int epochs = argc > 1 ? atoi(argv[1]) : 5;
+
+  Configuration config;
+  config.parse_line("model_bits: " + std::to_string(MODEL_BITS));
+  config.parse_line("minibatch_size: " + std::to_string(MINIBATCH_SIZE));
+  config.parse_line("epsilon: 0.0001");
+
+  std::mt19937 gen(42);
+  std::normal_distribution<double> normal(0, 1);
+  std::vector<FEATURE_TYPE> true_weights(1 << MODEL_BITS);
+  for (auto& w : true_weights) {
+    w = normal(gen);
+  }
+  std::vector<SparseDataset> train =
+      make_datasets(true_weights, TRAIN_SAMPLES, MINIBATCH_SIZE, 1);
+  SparseDataset test =
+      make_datasets(true_weights, TEST_SAMPLES, TEST_SAMPLES, 2)[0];
+
+  std::vector<std::vector<double>> losses(NUM_QUANTIZATIONS);
+  std::vector<uint64_t> bytes(NUM_QUANTIZATIONS);
+  for (uint32_t q = 0; q < NUM_QUANTIZATIONS; ++q) {
+    SparseLRModel server_model(1 << MODEL_BITS);
+    SparseLRModel worker_model(0);
+    std::vector<char> data;
+    for (int epoch = 0; epoch < epochs; ++epoch) {
+      for (const auto& minibatch : train) {
+        // pull the weights of the minibatch as a worker would
+        std::vector<uint32_t> indices;
+        std::vector<FEATURE_TYPE> weights;
+        for (uint64_t i = 0; i < minibatch.num_samples(); ++i) {
+          for (const auto& feat : minibatch.get_row(i)) {
+            indices.push_back(feat.first);
+            weights.push_back(server_model.get_nth_weight(feat.first));
+          }
+        }
+        worker_model.loadSerializedSparse(weights.data(), indices.data(),
+                                          indices.size(), config);
+
+        std::unique_ptr<ModelGradient> gradient =
+            worker_model.minibatch_grad_sparse(minibatch, config);
+        const LRSparseGradient* lr_gradient =
+            dynamic_cast<const LRSparseGradient*>(gradient.get());
+        data.resize(lr_gradient->getCompactSizeBound());
+        uint64_t size = lr_gradient->serializeCompact(
+            data.data(), WIRE_FORMAT_QUANTIZED, q);
+        bytes[q] += size;
+
+        LRSparseGradient received(0);
+        received.loadSerializedCompact(data.data(), size,
+                                       WIRE_FORMAT_QUANTIZED);
+        server_model.sgd_update(LEARNING_RATE, &received);
+      }
+      losses[q].push_back(server_model.calc_loss(test, 0).first /
+                          TEST_SAMPLES);
+    }
+  }
+
+  std::cout << "epoch";
+  for (uint32_t q = 0; q < NUM_QUANTIZATIONS; ++q) {
+    std::cout << "\t" << quantization_name(q);
+  }
+  std::cout << std::endl;
+  for (int epoch = 0; epoch < epochs; ++epoch) {
+    std::cout << epoch;
+    for (uint32_t q = 0; q < NUM_QUANTIZATIONS; ++q) {
+      std::cout << "\t" << losses[q][epoch];
+    }
+    std::cout << std::endl;
+  }
+  std::cout << "MB sent";
+  for (uint32_t q = 0; q < NUM_QUANTIZATIONS; ++q) {
+    std::cout << "\t" << bytes[q] / (1024.0 * 1024.0);
+  }
+  std::cout << std::endl;
+  return 0;
+}
@@ -0,0 +1,159 @@
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <AdaGrad.h>
+#include <GradientCoalescer.h>
+#include <MFModel.h>
+#include <ModelGradient.h>
+#include <ModelUpdater.h>
+#include <SparseLRModel.h>
+#include <Utils.h>
+#include <config.h>
+
+using namespace cirrus;
+
+/**
+  * Measures how many gradients/sec the parameter server update engine
+  * applies as we add threads, for each ps_update_mode (LR also with
+  * gradient coalescing on top of the global mode)
+  * usage: benchmark_updates [max_threads] [seconds_per_run]
+  */
+
+#define MODEL_BITS 20
+#define LR_GRAD_SIZE 2000     // entries in each LR gradient
+#define MF_USERS 100000
+#define MF_ITEMS 17770
+#define MF_GRAD_USERS 20      // users in each MF gradient
+#define MF_GRAD_ITEMS 200     // items in each MF gradient
+#define NUM_GRADIENTS 256     // pregenerated gradients per thread
+#define COALESCE_WINDOW 32    // gradients merged by the coalescer
+
+std::vector<LRSparseGradient> make_lr_gradients(uint64_t seed) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> index(0, (1 << MODEL_BITS) - 1);
+  std::vector<LRSparseGradient> gradients;
+  for (int i = 0; i < NUM_GRADIENTS; ++i) {
+    std::vector<std::pair<int, FEATURE_TYPE>> entries;
+    for (int j = 0; j < LR_GRAD_SIZE; ++j) {
+      entries.push_back(std::make_pair(index(gen), 0.001));
+    }
+    gradients.push_back(LRSparseGradient(std::move(entries)));
+  }
+  return gradients;
+}
+
+std::vector<MFSparseGradient> make_mf_gradients(uint64_t seed) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> user(0, MF_USERS - MF_GRAD_USERS);
+  std::uniform_int_distribution<int> item(0, MF_ITEMS - 1);
+  std::vector<MFSparseGradient> gradients(NUM_GRADIENTS);
+  for (auto& gradient : gradients) {
+    int base_user = user(gen);
+    for (int i = 0; i < MF_GRAD_USERS; ++i) {
+      uint32_t j = gradient.add_user(base_user + i);
+      gradient.user_bias(j) = 0.001;
+      std::fill_n(gradient.user_factors(j), NUM_FACTORS, 0.001);
+    }
+    for (int i = 0; i < MF_GRAD_ITEMS; ++i) {
+      uint32_t j = gradient.add_item(item(gen));
+      gradient.item_bias(j) = 0.001;
+      std::fill_n(gradient.item_factors(j), NUM_FACTORS, 0.001);
+    }
+  }
+  return gradients;
+}
+
+double run_lr(ModelUpdater::Mode mode,
+              bool coalesce,
+              int num_threads,
+              int secs) {
+  std::unique_ptr<SparseLRModel> model(new SparseLRModel(1 << MODEL_BITS));
+  AdaGrad opt_method(0.01, 1e-8);
+  ModelUpdater updater(mode, 1 << MODEL_BITS, 0, 0);
+  GradientCoalescer coalescer(num_threads, COALESCE_WINDOW, 1000000);
+
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> updates(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.push_back(std::thread([&, t]() {
+      std::vector<LRSparseGradient> gradients = make_lr_gradients(t);
+      LRSparseGradient merged(0);
+      uint64_t count = 0;
+      while (!stop) {
+        const LRSparseGradient& gradient = gradients[count % NUM_GRADIENTS];
+        if (!coalesce) {
+          updater.apply_lr_gradient(model, &opt_method, gradient);
+        } else if (coalescer.add(t, gradient) && coalescer.take(t, &merged)) {
+          updater.apply_lr_gradient(model, &opt_method, merged);
+        }
+        count++;
+      }
+      updates += count;
+    }));
+  }
+  sleep(secs);
+  stop = true;
+  for (auto& t : threads) {
+    t.join();
+  }
+  return 1.0 * updates / secs;
+}
+
+double run_mf(ModelUpdater::Mode mode, int num_threads, int secs) {
+  MFModel model(MF_USERS, MF_ITEMS, NUM_FACTORS);
+  ModelUpdater updater(mode, 0, MF_USERS, MF_ITEMS);
+
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> updates(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.push_back(std::thread([&, t]() {
+      std::vector<MFSparseGradient> gradients = make_mf_gradients(t);
+      uint64_t count = 0;
+      while (!stop) {
+        updater.apply_mf_gradient(&model,
+                                  gradients[count % NUM_GRADIENTS].view());
+        count++;
+      }
+      updates += count;
+    }));
+  }
+  sleep(secs);
+  stop = true;
+  for (auto& t : threads) {
+    t.join();
+  }
+  return 1.0 * updates / secs;
+}
+
+int main(int argc, char* argv[]) {
+  int max_threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+  int secs = argc > 2 ? atoi(argv[2]) : 2;
+
+  std::vector<std::string> modes = {"global", "striped", "hogwild"};
+  std::cout << "model threads mode updates/sec" << std::endl;
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    for (const auto& mode : modes) {
+      double lr =
+          run_lr(ModelUpdater::mode_from_string(mode), false, threads, secs);
+      std::cout << "LR " << threads << " " << mode << " " << lr << std::endl;
+    }
+    double lr = run_lr(ModelUpdater::GLOBAL, true, threads, secs);
+    std::cout << "LR " << threads << " global+coalesce " << lr << std::endl;
+  }
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    for (const auto& mode : modes) {
+      double mf = run_mf(ModelUpdater::mode_from_string(mode), threads, secs);
+      std::cout << "MF " << threads << " " << mode << " " << mf << std::endl;
+    }
+  }
+  return 0;
+}
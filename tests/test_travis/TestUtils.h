@@ -0,0 +1,16 @@
+#ifndef _TEST_UTILS_H_
+#define _TEST_UTILS_H_
+
+#include <stdexcept>
+#include <string>
+
+/**
+  * Fail the test with "Wrong <what>" unless condition holds
+  */
+inline void check(bool condition, const std::string& what) {
+  if (!condition) {
+    throw std::runtime_error("Wrong " + what);
+  }
+}
+
+#endif  // _TEST_UTILS_H_
@@ -0,0 +1,26 @@
+#include <Configuration.h>
+#include <Tasks.h>
+
+#include <string>
+
+// usage: ps_mode ps_server_mode port ["option: value" ...]
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    throw std::runtime_error(
+        "usage: ps_mode ps_server_mode port [\"option: value\" ...]");
+  }
+  cirrus::Configuration config("configs/test_config.cfg");
+  config.parse_line(std::string("ps_server_mode: ") + argv[1]);
+  for (int i = 3; i < argc; ++i) {
+    config.parse_line(argv[i]);
+  }
+  config.check();
+  uint64_t port = std::stoi(argv[2]);
+  cirrus::PSSparseServerTask st(
+      (1 << config.get_model_bits()) + 1, config.get_minibatch_size(),
+      config.get_minibatch_size(), config.get_num_features(), 2, 1, "127.0.0.1",
+      port);
+  st.run(config);
+
+  return 0;
+}
@@ -0,0 +1,23 @@
+#include <Configuration.h>
+#include <Tasks.h>
+
+#include <string>
+
+cirrus::Configuration config =
+    cirrus::Configuration("configs/test_config_sharded.cfg");
+
+// usage: ps_shard shard_id port
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    throw std::runtime_error("usage: ps_shard shard_id port");
+  }
+  uint32_t shard_id = std::stoi(argv[1]);
+  uint64_t port = std::stoi(argv[2]);
+  cirrus::PSSparseServerTask st(
+      (1 << config.get_model_bits()) + 1, config.get_minibatch_size(),
+      config.get_minibatch_size(), config.get_num_features(), 2, 1, "127.0.0.1",
+      port, shard_id);
+  st.run(config);
+
+  return 0;
+}
@@ -0,0 +1,116 @@
+#include <AsyncGradientSender.h>
+#include <Utils.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+std::map<int, FEATURE_TYPE> entries(const LRSparseGradient& gradient) {
+  std::vector<char> data(gradient.getSerializedSize());
+  gradient.serialize(data.data());
+  const char* ptr = data.data() + sizeof(int);
+  int num_weights = load_value<int>(ptr);
+  std::map<int, FEATURE_TYPE> result;
+  for (int i = 0; i < num_weights; ++i) {
+    int index = load_value<int>(ptr);
+    result[index] = load_value<FEATURE_TYPE>(ptr);
+  }
+  return result;
+}
+
+LRSparseGradient make_gradient(
+    std::vector<std::pair<int, FEATURE_TYPE>> weights) {
+  return LRSparseGradient(std::move(weights));
+}
+
+// all gradients get to the server, merged or not
+void test_sums() {
+  std::map<int, FEATURE_TYPE> sent;
+  uint64_t num_sends = 0;
+  uint64_t last_version = 0;
+  {
+    AsyncGradientSender sender(4, [&](const LRSparseGradient& gradient) {
+      // slow network
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      for (const auto& w : entries(gradient)) {
+        sent[w.first] += w.second;
+      }
+      check(gradient.getVersion() > last_version, "version order");
+      last_version = gradient.getVersion();
+      ++num_sends;
+    });
+    for (int i = 0; i < 1000; ++i) {
+      LRSparseGradient gradient = make_gradient({{i % 10, 1}, {100 + i % 7, 2}});
+      gradient.setVersion(i + 1);
+      sender.send(gradient);
+    }
+    sender.flush();
+    check(sender.get_num_sends() == num_sends, "number of sends");
+    check(sender.get_num_merged() + num_sends == 1000, "merged gradients");
+    check(sender.get_num_merged() > 0, "merged gradients when backed up");
+  }
+  check(last_version == 1000, "last version");
+  for (int i = 0; i < 10; ++i) {
+    check(sent[i] == 100, "sum of gradients");
+  }
+  for (int i = 0; i < 7; ++i) {
+    check(sent[100 + i] == (i < 6 ? 286 : 284), "sum of merged gradients");
+  }
+}
+
+// the worker blocks once max_in_flight gradients are queued or being sent
+void test_in_flight() {
+  std::mutex send_lock;
+  send_lock.lock();
+  AsyncGradientSender sender(2, [&](const LRSparseGradient&) {
+    std::lock_guard<std::mutex> guard(send_lock);
+  });
+  LRSparseGradient gradient = make_gradient({{1, 1}});
+  sender.send(gradient);
+  sender.send(gradient);
+  std::atomic<bool> sent(false);
+  std::thread worker([&]() {
+    sender.send(gradient);
+    sent = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  check(!sent, "blocking when full");
+  send_lock.unlock();
+  worker.join();
+  sender.flush();
+}
+
+// errors of the sender thread are rethrown to the worker
+void test_errors() {
+  AsyncGradientSender sender(1, [](const LRSparseGradient&) {
+    throw std::runtime_error("send error");
+  });
+  LRSparseGradient gradient = make_gradient({{1, 1}});
+  bool thrown = false;
+  try {
+    sender.send(gradient);
+    sender.flush();
+  } catch (const std::runtime_error& e) {
+    thrown = std::string(e.what()) == "send error";
+  }
+  check(thrown, "error");
+}
+
+int main() {
+  test_sums();
+  test_in_flight();
+  test_errors();
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
@@ -0,0 +1,3 @@
+#!/bin/bash
+
+timeout 50 ./tests/test_travis/test_async_sender
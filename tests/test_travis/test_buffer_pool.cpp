@@ -0,0 +1,55 @@
+#include <BufferPool.h>
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+// buffers are rounded up to their size class and reused
+void test_reuse() {
+  BufferPool pool(1024 * 1024);
+  BufferPool::Buffer buffer = pool.get(5000);
+  check(buffer.size() == 8192, "size class");
+  check(pool.in_use_bytes() == 8192, "bytes in use");
+  char* data = buffer.data();
+  std::memset(data, 1, buffer.size());
+  buffer.release();
+  check(pool.in_use_bytes() == 0 && pool.idle_bytes() == 8192,
+        "bytes after release");
+
+  BufferPool::Buffer again = pool.get(8000);
+  check(again.data() == data, "reused buffer");
+  check(pool.idle_bytes() == 0, "idle bytes after reuse");
+
+  // moving a buffer does not give it back
+  BufferPool::Buffer moved = std::move(again);
+  check(moved.data() == data && again.data() == nullptr, "moved buffer");
+  check(pool.in_use_bytes() == 8192, "bytes in use after move");
+}
+
+// messages of any size get a buffer, only max_idle_bytes are kept
+void test_large_buffers() {
+  BufferPool pool(8 * 1024 * 1024);
+  {
+    BufferPool::Buffer large = pool.get(3 * 1024 * 1024);
+    check(large.size() == 4 * 1024 * 1024, "large size class");
+    std::memset(large.data(), 1, large.size());
+    BufferPool::Buffer huge = pool.get(150 * 1024 * 1024);
+    check(huge.size() >= 150 * 1024 * 1024, "huge size class");
+    huge.data()[huge.size() - 1] = 1;
+  }
+  check(pool.in_use_bytes() == 0, "bytes in use");
+  check(pool.idle_bytes() == 4 * 1024 * 1024, "idle bytes");
+}
+
+int main() {
+  test_reuse();
+  test_large_buffers();
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
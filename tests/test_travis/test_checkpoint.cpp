@@ -0,0 +1,71 @@
+#include <PSSparseServerInterface.h>
+#include <Configuration.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+using namespace cirrus;
+
+// needs ps_checkpoint running
+// save: updates the models, waits for a checkpoint and records the models
+// check: run after restarting the parameter server, the models must match
+
+#define EXPECTED_FILE "/tmp/cirrus_test_checkpoint.expected"
+
+cirrus::Configuration config =
+    cirrus::Configuration("configs/test_config_checkpoint.cfg");
+
+std::string get_models(PSSparseServerInterface* psi) {
+  std::string models;
+  for (bool is_mf : {false, true}) {
+    std::unique_ptr<CirrusModel> model = psi->get_full_model(is_mf);
+    std::string data(model->getSerializedSize(), 0);
+    model->serializeTo(&data[0]);
+    models += data;
+  }
+  return models;
+}
+
+void update_models(PSSparseServerInterface* psi) {
+  std::vector<std::pair<int, FEATURE_TYPE>> grad_weights = {
+      {1, 1.0}, {1000, -2.0}, {300000, 3.0}};
+  psi->send_lr_gradient(LRSparseGradient(std::move(grad_weights)));
+
+  MFSparseGradient gradient;
+  uint32_t user = gradient.add_user(3);
+  gradient.user_bias(user) = 1.0;
+  std::fill_n(gradient.user_factors(user), NUM_FACTORS, 0.5);
+  uint32_t item = gradient.add_item(7);
+  gradient.item_bias(item) = -1.0;
+  std::fill_n(gradient.item_factors(item), NUM_FACTORS, -0.5);
+  psi->send_mf_gradient(gradient);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    throw std::runtime_error("Usage: test_checkpoint save|check");
+  }
+  std::unique_ptr<PSSparseServerInterface> psi =
+      std::make_unique<PSSparseServerInterface>("127.0.0.1", 1337);
+  psi->connect();
+
+  if (std::string(argv[1]) == "save") {
+    update_models(psi.get());
+    // wait for the next checkpoint
+    sleep(3 * config.get_checkpoint_frequency());
+    std::ofstream fout(EXPECTED_FILE, std::ofstream::binary);
+    fout << get_models(psi.get());
+  } else {
+    std::ifstream fin(EXPECTED_FILE, std::ifstream::binary);
+    std::string expected((std::istreambuf_iterator<char>(fin)),
+                         std::istreambuf_iterator<char>());
+    if (expected.empty() || get_models(psi.get()) != expected) {
+      throw std::runtime_error("Models were not restored");
+    }
+  }
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+rm -f /tmp/cirrus_test_checkpoint /tmp/cirrus_test_checkpoint.expected
+
+timeout 60 ./tests/test_travis/ps_checkpoint&
+PS_PID=$!
+sleep 1
+timeout 50 ./tests/test_travis/test_checkpoint save || exit 1
+
+# simulate a crash, the models come back from the last checkpoint
+kill -9 $PS_PID
+wait $PS_PID
+timeout 60 ./tests/test_travis/ps_checkpoint&
+sleep 1
+timeout 50 ./tests/test_travis/test_checkpoint check
@@ -0,0 +1,169 @@
+#include <Constants.h>
+#include <GradientCoalescer.h>
+#include <PSSparseServerInterface.h>
+#include <Utils.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+// the parameter server merges windows of 10 gradients for at most 50ms
+#define PS_WINDOW_SIZE 10
+#define PS_MAX_DELAY_MS 50
+
+typedef std::vector<std::pair<int, FEATURE_TYPE>> Entries;
+
+// the entries of a gradient in the order they are serialized
+Entries entries(const LRSparseGradient& gradient) {
+  std::vector<char> data(gradient.getSerializedSize());
+  gradient.serialize(data.data());
+  const char* ptr = data.data() + sizeof(int);
+  int num_weights = load_value<int>(ptr);
+  Entries result;
+  for (int i = 0; i < num_weights; ++i) {
+    int index = load_value<int>(ptr);
+    result.push_back(std::make_pair(index, load_value<FEATURE_TYPE>(ptr)));
+  }
+  return result;
+}
+
+LRSparseGradient make_gradient(Entries weights) {
+  return LRSparseGradient(std::move(weights));
+}
+
+void test_merge() {
+  GradientCoalescer coalescer(2, 3, 1000000);
+  check(!coalescer.add(0, make_gradient({{300, 1}, {5, 2}})),
+        "flush before the window is full");
+  check(!coalescer.add(0, make_gradient({{5, 0.5}, {70000, -1}})),
+        "flush before the window is full");
+  // windows fill up independently
+  check(!coalescer.add(1, make_gradient({{9, 4}})),
+        "flush of another window");
+  check(coalescer.add(0, make_gradient({{300, 0.25}})),
+        "flush once the window is full");
+
+  LRSparseGradient merged(0);
+  check(coalescer.take(0, &merged), "take of a full window");
+  check(entries(merged) == Entries({{5, 2.5}, {300, 1.25}, {70000, -1}}),
+        "merged gradient");
+  check(!coalescer.take(0, &merged), "take of an empty window");
+  check(coalescer.get_num_flushes() == 1, "number of flushes");
+
+  check(coalescer.take(1, &merged), "take of a partial window");
+  check(entries(merged) == Entries({{9, 4}}), "partial window");
+  check(coalescer.get_num_flushes() == 2, "number of flushes");
+
+  // a window starts over after a take
+  check(!coalescer.add(0, make_gradient({{1, 1}})), "flush of a new window");
+  check(coalescer.take(0, &merged), "take of a new window");
+  check(entries(merged) == Entries({{1, 1}}), "new window");
+}
+
+// windows grow past their initial table and sort indices of any size
+void test_many_indices() {
+  GradientCoalescer coalescer(1, 2, 1000000);
+  Entries expected;
+  Entries first;
+  Entries second;
+  for (int i = 0; i < 5000; ++i) {
+    int index = (i * 7919) % 5000 * 1000;
+    first.push_back(std::make_pair(index, 1));
+    second.push_back(std::make_pair(index, 2));
+    expected.push_back(std::make_pair(i * 1000, 3));
+  }
+  coalescer.add(0, make_gradient(std::move(first)));
+  check(coalescer.add(0, make_gradient(std::move(second))), "full window");
+  LRSparseGradient merged(0);
+  coalescer.take(0, &merged);
+  check(entries(merged) == expected, "large merged gradient");
+}
+
+void test_stale() {
+  GradientCoalescer coalescer(1, 100, 20000);
+  check(!coalescer.is_stale(0), "stale empty window");
+  coalescer.add(0, make_gradient({{1, 1}}));
+  check(!coalescer.is_stale(0), "stale new window");
+  usleep(30000);
+  // more gradients don't make the window younger
+  coalescer.add(0, make_gradient({{2, 1}}));
+  check(coalescer.is_stale(0), "window past max delay");
+  LRSparseGradient merged(0);
+  coalescer.take(0, &merged);
+  check(!coalescer.is_stale(0), "stale window after take");
+}
+
+// a gradient alone in its window is applied by the flush thread
+void test_ps_delay_flush(int port) {
+  PSSparseServerInterface psi("127.0.0.1", port);
+  psi.connect();
+  std::unique_ptr<CirrusModel> before = psi.get_full_model(false);
+  psi.send_lr_gradient(make_gradient({{11, 1.0}}));
+  usleep(10 * PS_MAX_DELAY_MS * 1000);
+  std::unique_ptr<CirrusModel> after = psi.get_full_model(false);
+  check(after->get_nth_weight(11) != before->get_nth_weight(11),
+        "weight after max delay");
+}
+
+uint32_t get_num_updates(int port) {
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  check(connect(sock, (struct sockaddr*) &addr, sizeof(addr)) == 0,
+        "connect");
+  uint32_t op = GET_NUM_UPDATES;
+  uint32_t num_updates = 0;
+  check(send_all(sock, &op, sizeof(uint32_t)) != -1 &&
+            read_all(sock, &num_updates, sizeof(uint32_t)) != 0,
+        "GET_NUM_UPDATES");
+  close(sock);
+  return num_updates;
+}
+
+// the updates per second the PS reports count the gradients received, not
+// the merged gradients it applied
+void test_ps_update_count(int port) {
+  PSSparseServerInterface psi("127.0.0.1", port);
+  psi.connect();
+  uint64_t sent = 0;
+  uint64_t start = get_time_us();
+  // the PS reports the gradients of the last second, sent at a steady rate
+  while (get_time_us() - start < 2500000) {
+    psi.send_lr_gradient(make_gradient({{static_cast<int>(sent % 1000), 1}}));
+    sent++;
+  }
+  // the gradients sent before are handled in order before the model
+  psi.get_full_model(false);
+  double sent_per_sec = sent * 1000000.0 / (get_time_us() - start);
+  uint32_t num_updates = get_num_updates(port);
+  std::cout << "sent/sec: " << sent_per_sec
+            << " updates/sec reported: " << num_updates << std::endl;
+  check(num_updates > sent_per_sec / 3, "number of updates");
+}
+
+// usage: test_coalescer port
+int main(int argc, char** argv) {
+  test_merge();
+  test_many_indices();
+  test_stale();
+  if (argc > 1) {
+    int port = std::stoi(argv[1]);
+    test_ps_delay_flush(port);
+    test_ps_update_count(port);
+  }
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
@@ -0,0 +1,8 @@
+#!/bin/bash
+
+# the flush thread of the parameter server is tested with a short max delay
+timeout 60 ./tests/test_travis/ps_mode poll 1367 "grad_coalesce_window: 10" \
+    "grad_coalesce_max_delay_ms: 50"&
+sleep 1
+
+timeout 50 ./tests/test_travis/test_coalescer 1367
@@ -0,0 +1,214 @@
+#include <Connection.h>
+#include <Constants.h>
+#include <PSSparseServerInterface.h>
+#include <Utils.h>
+#include <WireFormat.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+void write_all(int sock, const std::vector<char>& data) {
+  if (send(sock, data.data(), data.size(), MSG_NOSIGNAL) !=
+      static_cast<ssize_t>(data.size())) {
+    throw std::runtime_error("Error sending");
+  }
+}
+
+std::vector<char> message(std::initializer_list<uint32_t> values) {
+  std::vector<char> data(values.size() * sizeof(uint32_t));
+  char* ptr = data.data();
+  for (const auto& v : values) {
+    store_value<uint32_t>(ptr, v);
+  }
+  return data;
+}
+
+// a request is only handed out once all of it arrived
+void test_partial_request() {
+  int socks[2];
+  check(socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == 0, "socketpair");
+  BufferPool pool(1024 * 1024);
+  Connection conn(socks[0], &pool);
+
+  write_all(socks[1], message({SEND_LR_GRADIENT, 8, 1}));
+  check(conn.read_available() && !conn.has_request(), "partial request");
+  write_all(socks[1], message({2}));
+  check(conn.read_available() && conn.has_request(), "complete request");
+  check(conn.request_size() == sizeof(uint32_t) * 4, "request size");
+  conn.pop_request();
+  check(!conn.has_request(), "popped request");
+  check(pool.in_use_bytes() == 0, "buffer given back");
+
+  // the peer going away is reported
+  close(socks[1]);
+  check(!conn.read_available(), "closed connection");
+  close(socks[0]);
+}
+
+// requests sent back to back are served one at a time
+void test_pipelined_requests() {
+  int socks[2];
+  check(socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == 0, "socketpair");
+  BufferPool pool(1024 * 1024);
+  Connection conn(socks[0], &pool);
+
+  write_all(socks[1], message({GET_NUM_UPDATES, NEGOTIATE_WIRE_FORMAT, 1,
+                               GET_NUM_CONNS}));
+  check(conn.read_available(), "read");
+  uint64_t sizes[] = {4, 8, 4};
+  for (const auto& size : sizes) {
+    check(conn.has_request() && conn.request_size() == size,
+          "pipelined request size");
+    conn.pop_request();
+  }
+  check(!conn.has_request(), "number of pipelined requests");
+
+  // unknown operations can't be framed
+  write_all(socks[1], message({1000}));
+  check(!conn.read_available() && conn.failed(), "unknown operation");
+  close(socks[0]);
+  close(socks[1]);
+}
+
+// replies the peer does not read are kept until it does
+void test_pending_replies() {
+  int socks[2];
+  check(socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == 0, "socketpair");
+  BufferPool pool(1024 * 1024);
+  Connection conn(socks[0], &pool);
+
+  std::vector<char> reply(4 * 1024 * 1024);
+  for (uint64_t i = 0; i < reply.size(); ++i) {
+    reply[i] = i % 251;
+  }
+  conn.reply(reply.data(), reply.size());
+  check(conn.has_pending_replies(), "pending replies");
+
+  std::vector<char> received(reply.size());
+  std::thread reader(
+      [&]() { read_all(socks[1], received.data(), received.size()); });
+  while (conn.has_pending_replies()) {
+    check(conn.flush(), "flush");
+  }
+  reader.join();
+  check(received == reply, "reply");
+  close(socks[0]);
+  close(socks[1]);
+}
+
+int connect_to_ps() {
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(1337);
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    throw std::runtime_error("Error connecting to the PS");
+  }
+  return sock;
+}
+
+// the server closes the connection of a request it can't decode and keeps
+// serving the others
+void check_rejected(int sock, const std::vector<char>& request) {
+  write_all(sock, request);
+  char byte;
+  check(recv(sock, &byte, 1, 0) == 0, "connection of a malformed request");
+  close(sock);
+
+  PSSparseServerInterface psi("127.0.0.1", 1337);
+  psi.connect();
+  check(!psi.get_metrics().empty(), "request after a malformed request");
+}
+
+// a varint gradient whose second index goes backwards
+void test_unsorted_indices() {
+  int sock = connect_to_ps();
+  write_all(sock, message({NEGOTIATE_WIRE_FORMAT, WIRE_FORMAT_VARINT}));
+  uint32_t format = 0;
+  check(read_all(sock, &format, sizeof(uint32_t)) != 0 &&
+            format == WIRE_FORMAT_VARINT,
+        "negotiated wire format");
+
+  std::vector<char> request = message({SEND_LR_GRADIENT, 0, 1, 2});
+  // 5, then 5 + 0xfffffffe which wraps around to 3
+  for (const auto& byte : {0x05, 0xfe, 0xff, 0xff, 0xff, 0x0f}) {
+    request.push_back(static_cast<char>(byte));
+  }
+  FEATURE_TYPE values[2] = {1.0, 1.0};
+  request.insert(request.end(), reinterpret_cast<char*>(values),
+                 reinterpret_cast<char*>(values + 2));
+  // size of the gradient
+  uint32_t size = request.size() - sizeof(uint32_t) * 2;
+  std::memcpy(&request[sizeof(uint32_t)], &size, sizeof(uint32_t));
+  check_rejected(sock, request);
+}
+
+std::vector<char> mf_gradient_request(const MFSparseGradient& gradient) {
+  std::vector<char> request = message(
+      {SEND_MF_GRADIENT, static_cast<uint32_t>(gradient.getSerializedSize())});
+  uint64_t header_size = request.size();
+  request.resize(header_size + gradient.getSerializedSize());
+  gradient.serialize(request.data() + header_size);
+  return request;
+}
+
+// MF gradients that don't fit the model of the server (test_ps has no users
+// or items)
+void test_wrong_mf_gradient() {
+  MFSparseGradient wrong_rank(NUM_FACTORS + 2);
+  check_rejected(connect_to_ps(), mf_gradient_request(wrong_rank));
+
+  MFSparseGradient wrong_user;
+  uint32_t user = wrong_user.add_user(5);
+  wrong_user.user_bias(user) = 1.0;
+  std::fill_n(wrong_user.user_factors(user), NUM_FACTORS, 1.0);
+  check_rejected(connect_to_ps(), mf_gradient_request(wrong_user));
+}
+
+// clients that stall in the middle of a request don't hold worker threads
+void test_stalled_clients() {
+  std::vector<int> stalled;
+  for (int i = 0; i < NUM_PS_WORK_THREADS; ++i) {
+    int sock = connect_to_ps();
+    write_all(sock, message({SEND_LR_GRADIENT, 1000, 1}));
+    stalled.push_back(sock);
+  }
+
+  std::unique_ptr<PSSparseServerInterface> psi =
+      std::make_unique<PSSparseServerInterface>("127.0.0.1", 1337);
+  psi->connect();
+  std::vector<std::pair<int, FEATURE_TYPE>> grad_weights = {{20, 1.0}};
+  LRSparseGradient gradient(std::move(grad_weights));
+  psi->send_lr_gradient(gradient);
+  check(psi->get_metrics().find("SEND_LR_GRADIENT") != std::string::npos,
+        "metrics");
+
+  for (const auto& sock : stalled) {
+    close(sock);
+  }
+}
+
+int main() {
+  test_partial_request();
+  test_pipelined_requests();
+  test_pending_replies();
+  test_stalled_clients();
+  test_unsorted_indices();
+  test_wrong_mf_gradient();
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
@@ -0,0 +1,144 @@
+#include <GradientCompressor.h>
+#include <Utils.h>
+
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <random>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+#define MODEL_SIZE 10000
+// fewer weights than the residual limit of 20 entries sent
+#define SMALL_MODEL_SIZE 300
+
+std::map<int, FEATURE_TYPE> entries(const LRSparseGradient& gradient) {
+  std::vector<char> data(gradient.getSerializedSize());
+  gradient.serialize(data.data());
+  const char* ptr = data.data() + sizeof(int);
+  int num_weights = load_value<int>(ptr);
+  std::map<int, FEATURE_TYPE> result;
+  for (int i = 0; i < num_weights; ++i) {
+    int index = load_value<int>(ptr);
+    result[index] = load_value<FEATURE_TYPE>(ptr);
+  }
+  return result;
+}
+
+void test_top_k() {
+  GradientCompressor compressor(MODEL_SIZE, 2, 0);
+  std::vector<std::pair<int, FEATURE_TYPE>> weights = {
+      {1, 0.25}, {2, -5}, {3, 0.5}, {4, 3}, {5, -0.75}};
+  LRSparseGradient gradient(std::move(weights));
+  gradient.setVersion(9);
+  LRSparseGradient sent = compressor.compress(gradient);
+  check(sent.getVersion() == 9, "version");
+  check(entries(sent) == std::map<int, FEATURE_TYPE>({{2, -5}, {4, 3}}),
+        "largest entries");
+  check(compressor.get_residual_size() == 3, "residual size");
+
+  // the residual is added to the next gradient
+  std::vector<std::pair<int, FEATURE_TYPE>> next = {{1, 0.5}, {6, 0.25}};
+  sent = compressor.compress(LRSparseGradient(std::move(next)));
+  check(entries(sent) == std::map<int, FEATURE_TYPE>({{1, 0.75}, {5, -0.75}}),
+        "entries with residual");
+  check(compressor.get_residual_size() == 2, "residual size");
+}
+
+// nothing is lost while the residual fits: what was sent plus the
+// residual is what was computed
+void test_error_feedback() {
+  GradientCompressor compressor(SMALL_MODEL_SIZE, 20, 0);
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> index(0, SMALL_MODEL_SIZE - 1);
+  std::normal_distribution<double> value(0, 1);
+  std::vector<double> computed(SMALL_MODEL_SIZE, 0);
+  std::vector<double> sent(SMALL_MODEL_SIZE, 0);
+  for (int i = 0; i < 100; ++i) {
+    std::map<int, FEATURE_TYPE> gradient;
+    while (gradient.size() < 200) {
+      gradient[index(gen)] = value(gen);
+    }
+    for (const auto& w : gradient) {
+      computed[w.first] += w.second;
+    }
+    std::vector<std::pair<int, FEATURE_TYPE>> weights(gradient.begin(),
+                                                      gradient.end());
+    std::map<int, FEATURE_TYPE> compressed =
+        entries(compressor.compress(LRSparseGradient(std::move(weights))));
+    check(compressed.size() == 20, "number of entries sent");
+    for (const auto& w : compressed) {
+      sent[w.first] += w.second;
+    }
+  }
+
+  // flush the residual
+  while (compressor.get_residual_size() > 0) {
+    std::vector<std::pair<int, FEATURE_TYPE>> empty = {{0, 0}};
+    for (const auto& w :
+         entries(compressor.compress(LRSparseGradient(std::move(empty))))) {
+      sent[w.first] += w.second;
+    }
+  }
+  for (int i = 0; i < SMALL_MODEL_SIZE; ++i) {
+    check(std::abs(computed[i] - sent[i]) < 1e-4,
+          "total of weight " + std::to_string(i));
+  }
+}
+
+// past the limit the smallest residuals are dropped
+void test_residual_limit() {
+  GradientCompressor compressor(MODEL_SIZE, 1, 0);
+  std::vector<std::pair<int, FEATURE_TYPE>> weights;
+  for (int i = 1; i <= 20; ++i) {
+    weights.push_back(std::make_pair(i, i));
+  }
+  LRSparseGradient sent =
+      compressor.compress(LRSparseGradient(std::move(weights)));
+  check(entries(sent) == std::map<int, FEATURE_TYPE>({{20, 20}}),
+        "largest entry");
+  check(compressor.get_residual_size() ==
+            GradientCompressor::RESIDUAL_LIMIT - 1,
+        "residual size at the limit");
+  for (int i = 19; i > 20 - (int) GradientCompressor::RESIDUAL_LIMIT; --i) {
+    std::vector<std::pair<int, FEATURE_TYPE>> empty = {{0, 0}};
+    sent = compressor.compress(LRSparseGradient(std::move(empty)));
+    check(entries(sent) == std::map<int, FEATURE_TYPE>({{i, i}}),
+          "entry kept in the residual");
+  }
+}
+
+// the work per gradient is bounded by the residual, which stays within the
+// limit however many weights the gradients touch
+void test_bounded_residual() {
+  GradientCompressor compressor(MODEL_SIZE, 0, 5);
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<int> index(0, MODEL_SIZE - 1);
+  std::normal_distribution<double> value(0, 1);
+  // 10 entries sent per gradient of 200
+  uint64_t limit = 10 * GradientCompressor::RESIDUAL_LIMIT;
+  for (int i = 0; i < 500; ++i) {
+    std::map<int, FEATURE_TYPE> gradient;
+    while (gradient.size() < 200) {
+      gradient[index(gen)] = value(gen);
+    }
+    std::vector<std::pair<int, FEATURE_TYPE>> weights(gradient.begin(),
+                                                      gradient.end());
+    LRSparseGradient sent =
+        compressor.compress(LRSparseGradient(std::move(weights)));
+    check(entries(sent).size() == 10, "number of entries sent");
+    check(compressor.get_residual_size() <= limit, "bounded residual size");
+  }
+}
+
+int main() {
+  test_top_k();
+  test_error_feedback();
+  test_residual_limit();
+  test_bounded_residual();
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
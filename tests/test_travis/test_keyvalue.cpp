@@ -25,5 +25,25 @@ int main() {
     throw std::runtime_error("Wrong value");
   }
 
+  if (psi->get_value("missing").second != 0) {
+    throw std::runtime_error("Wrong size of missing key");
+  }
+
+  // batched requests
+  char small_value[] = "small";
+  psi->multi_set_value({"key1", "key2"},
+                       {{small_value, sizeof(small_value)},
+                        {value, sizeof(value)}});
+  std::vector<std::pair<std::shared_ptr<char>, uint32_t>> values =
+      psi->multi_get_value({"key1", "missing", "key2"});
+  if (values.size() != 3 || values[0].second != sizeof(small_value) ||
+      values[1].second != 0 || values[2].second != sizeof(value)) {
+    throw std::runtime_error("Wrong sizes of multiple values");
+  }
+  if (memcmp(small_value, values[0].first.get(), sizeof(small_value)) ||
+      memcmp(value, values[2].first.get(), sizeof(value))) {
+    throw std::runtime_error("Wrong multiple values");
+  }
+
   return 0;
 }
@@ -0,0 +1,95 @@
+#include <KVStore.h>
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+std::string make_key(uint32_t i) {
+  std::string key(KEY_SIZE, '\0');
+  std::memcpy(&key[0], &i, sizeof(uint32_t));
+  return key;
+}
+
+std::string get(KVStore* store, const std::string& key) {
+  std::string value;
+  store->get(key.data(), [&value](const char* data, uint32_t size) {
+    value.assign(data, size);
+  });
+  return value;
+}
+
+void test_set_get() {
+  BufferPool pool(0);
+  KVStore store(16 * 1024 * 1024, &pool);
+  std::string key = make_key(1);
+  check(!store.get(key.data(), [](const char*, uint32_t) {}), "missing key");
+
+  store.set(key.data(), "value", 5);
+  check(get(&store, key) == "value", "value");
+  std::string large(100000, 'x');
+  store.set(key.data(), large.data(), large.size());
+  check(get(&store, key) == large, "replaced value");
+  check(store.num_entries() == 1, "number of entries");
+
+  // values over the share of a shard are not kept
+  std::string too_large(2 * 1024 * 1024, 'x');
+  check(!store.set(key.data(), too_large.data(), too_large.size()),
+        "too large value");
+  check(store.num_entries() == 0, "entries after too large value");
+}
+
+// the least recently used values go first
+void test_eviction() {
+  BufferPool pool(0);
+  uint64_t max_bytes = 64 * 1024;
+  KVStore store(max_bytes, &pool);
+  std::string value(100, 'v');  // 128 bytes slots
+  std::string first = make_key(0);
+  store.set(first.data(), value.data(), value.size());
+  for (uint32_t i = 1; i < 10000; ++i) {
+    get(&store, first);
+    std::string key = make_key(i);
+    store.set(key.data(), value.data(), value.size());
+    check(store.value_bytes() <= max_bytes, "bytes kept");
+  }
+  check(store.num_entries() < 10000, "evicted entries");
+  check(get(&store, first) == value, "recently used value");
+  check(get(&store, make_key(1)).empty(), "least recently used value");
+  check(get(&store, make_key(9999)) == value, "last value");
+}
+
+void test_concurrent() {
+  BufferPool pool(0);
+  KVStore store(64 * 1024 * 1024, &pool);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < 4; ++t) {
+    threads.emplace_back([&store, t]() {
+      for (uint32_t i = 0; i < 10000; ++i) {
+        std::string key = make_key(t * 10000 + i);
+        std::string value = std::to_string(i);
+        store.set(key.data(), value.data(), value.size());
+        check(get(&store, key) == value, "concurrent value");
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  check(store.num_entries() == 40000, "concurrent entries");
+}
+
+int main() {
+  test_set_get();
+  test_eviction();
+  test_concurrent();
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
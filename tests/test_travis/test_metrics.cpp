@@ -0,0 +1,51 @@
+#include <PSSparseServerInterface.h>
+#include <Configuration.h>
+#include <SparseDataset.h>
+
+#include <iostream>
+
+using namespace cirrus;
+
+cirrus::Configuration config =
+    cirrus::Configuration("configs/test_config.cfg");
+
+void check_contains(const std::string& metrics, const std::string& what) {
+  if (metrics.find(what) == std::string::npos) {
+    throw std::runtime_error("Metrics without " + what + ": " + metrics);
+  }
+}
+
+int main() {
+  std::unique_ptr<PSSparseServerInterface> psi =
+      std::make_unique<PSSparseServerInterface>("127.0.0.1", 1337);
+  psi->connect();
+
+  for (int i = 0; i < 3; ++i) {
+    std::vector<std::pair<int, FEATURE_TYPE>> grad_weights = {{20, 1.0},
+                                                              {4000, -1.0}};
+    LRSparseGradient gradient(std::move(grad_weights));
+    psi->send_lr_gradient(gradient);
+  }
+  std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> samples = {
+      {{20, 1.0}, {4000, 1.0}}};
+  SparseDataset minibatch(std::move(samples));
+  SparseLRModel model(0);
+  psi->get_lr_sparse_model_inplace(minibatch, model, config);
+
+  // requests of a connection are handled in order, so all of them are
+  // recorded by now
+  std::string metrics = psi->get_metrics();
+  std::cout << metrics << std::endl;
+  check_contains(metrics, "\"SEND_LR_GRADIENT\": {\"count\": 3,");
+  check_contains(metrics, "\"GET_LR_SPARSE_MODEL\": {\"count\": 1,");
+  for (const auto& stage : {"read", "deserialize", "apply", "total"}) {
+    check_contains(metrics, "\"" + std::string(stage) + "\": {\"count\": 3,");
+  }
+  for (const auto& stage : {"serialize", "send"}) {
+    check_contains(metrics, "\"" + std::string(stage) + "\": {\"count\": 1,");
+  }
+  check_contains(metrics, "\"lock_hold_ns\": ");
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include <MFKernels.h>
+#include <MFModel.h>
+#include <SparseDataset.h>
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+#define SENTINEL (1234.5)
+
+bool close_to(FEATURE_TYPE a, FEATURE_TYPE b) {
+  return std::abs(a - b) <= 1e-5 + 1e-4 * std::abs(b);
+}
+
+// n random weights followed by a sentinel that must not be written
+std::vector<FEATURE_TYPE> random_row(uint64_t n, std::mt19937* generator) {
+  std::uniform_real_distribution<FEATURE_TYPE> distribution(-1, 1);
+  std::vector<FEATURE_TYPE> row(n + 1, SENTINEL);
+  for (uint64_t i = 0; i < n; ++i) {
+    row[i] = distribution(*generator);
+  }
+  return row;
+}
+
+// the kernels give the results of the generic scalar kernels for rows of
+// n factors
+void test_kernels(const MFKernels& kernels, uint64_t n) {
+  const MFKernels& scalar = *MFKernels::get("scalar", 0);
+  std::mt19937 generator(42 + n);
+  std::vector<FEATURE_TYPE> user = random_row(n, &generator);
+  std::vector<FEATURE_TYPE> item = random_row(n, &generator);
+  std::string what = std::string(kernels.name) + " nfactors: " +
+                     std::to_string(kernels.nfactors) +
+                     " n: " + std::to_string(n);
+
+  check(close_to(kernels.dot(user.data(), item.data(), n),
+                 scalar.dot(user.data(), item.data(), n)),
+        what + " dot");
+
+  std::vector<FEATURE_TYPE> expected_user = user;
+  std::vector<FEATURE_TYPE> expected_item = item;
+  scalar.update(expected_user.data(), expected_item.data(), n, 0.05, 0.8,
+                0.01, 0.02);
+  kernels.update(user.data(), item.data(), n, 0.05, 0.8, 0.01, 0.02);
+  for (uint64_t i = 0; i < n; ++i) {
+    check(close_to(user[i], expected_user[i]) &&
+              close_to(item[i], expected_item[i]),
+          what + " update");
+  }
+  check(user[n] == SENTINEL && item[n] == SENTINEL, what + " update tail");
+
+  expected_user = user;
+  scalar.add(expected_user.data(), item.data(), n);
+  kernels.add(user.data(), item.data(), n);
+  for (uint64_t i = 0; i < n; ++i) {
+    check(close_to(user[i], expected_user[i]), what + " add");
+  }
+  check(user[n] == SENTINEL, what + " add tail");
+}
+
+// every kernel set gives the results of the scalar kernels, for rows
+// with and without a partial vector at the end and for the ranks with
+// specialized kernels
+void test_kernel_set(const std::string& name) {
+  for (uint64_t n = 0; n <= 70; ++n) {
+    test_kernels(*MFKernels::get(name, 0), n);
+  }
+  for (uint64_t nfactors : {8, 16, 32, 64, 128}) {
+    const MFKernels* kernels = MFKernels::get(name, nfactors);
+    check(kernels->nfactors == nfactors, name + " specialized kernels");
+    test_kernels(*kernels, nfactors);
+  }
+  check(MFKernels::get(name, 10)->nfactors == 0, name + " generic kernels");
+}
+
+// rows are cache line aligned, padded with zeros and kept when serialized
+void test_model(uint64_t nfactors) {
+  std::cout << "Model with " << nfactors << " factors" << std::endl;
+  MFModel model(7, 5, nfactors);
+  check(model.get_nfactors() == nfactors, "number of factors");
+  for (uint64_t i = 0; i < 7; ++i) {
+    check(reinterpret_cast<uintptr_t>(model.user_row(i)) % 64 == 0,
+          "row alignment");
+    for (uint64_t j = 1 + nfactors; j < MFModel::row_stride(nfactors); ++j) {
+      check(model.user_row(i)[j] == 0, "row padding");
+    }
+  }
+  check(&model.get_user_weights(3, 0) == model.user_row(3) + 1,
+        "factors after the bias");
+
+  std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> ratings(7);
+  for (int user = 0; user < 7; ++user) {
+    for (int item = 0; item < 5; ++item) {
+      ratings[user].push_back(std::make_pair(item, (user + item) % 5 + 1));
+    }
+  }
+  SparseDataset dataset(std::move(ratings));
+  double before = model.calc_loss(dataset, 0).first;
+  for (int epoch = 0; epoch < 50; ++epoch) {
+    model.sgd_update(0.05, 0, dataset, 0);
+  }
+  check(model.calc_loss(dataset, 0).first < before, "loss after training");
+
+  auto serialized = model.serialize();
+  check(serialized.second == model.getSerializedSize(), "serialized size");
+  MFModel loaded(serialized.first.get(), 0, 0, 0);
+  check(loaded.get_nfactors() == nfactors, "deserialized number of factors");
+  for (uint64_t i = 0; i < 5; ++i) {
+    check(std::memcmp(loaded.item_row(i), model.item_row(i),
+                      MFModel::row_stride(nfactors) *
+                          sizeof(FEATURE_TYPE)) == 0,
+          "deserialized row");
+  }
+
+  bool thrown = false;
+  try {
+    model.get_item_weights(5, 0);
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  check(thrown, "out of bounds item");
+}
+
+int main() {
+  for (const char* name : {"scalar", "avx2", "avx512"}) {
+    if (!MFKernels::get(name, 0)) {
+      std::cout << "Skipping " << name << ", not supported here"
+                << std::endl;
+      continue;
+    }
+    test_kernel_set(name);
+  }
+  std::cout << "Using " << MFKernels::get(NUM_FACTORS).name << " kernels"
+            << std::endl;
+  for (uint64_t nfactors : {static_cast<uint64_t>(NUM_FACTORS), 32UL, 3UL}) {
+    test_model(nfactors);
+  }
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include <PSSparseServerInterface.h>
+#include <Configuration.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace cirrus;
+
+cirrus::Configuration config =
+    cirrus::Configuration("configs/test_config.cfg");
+
+// the model patched with deltas must match the full model
+void check_same_model(PSSparseServerInterface* psi,
+                      const SparseLRModel& model) {
+  std::unique_ptr<CirrusModel> full = psi->get_full_model(false);
+  SparseLRModel* full_lr = dynamic_cast<SparseLRModel*>(full.get());
+  if (full_lr->size() != model.size()) {
+    throw std::runtime_error("Wrong model size");
+  }
+  for (uint64_t i = 0; i < model.size(); ++i) {
+    if (full_lr->get_nth_weight(i) != model.get_nth_weight(i)) {
+      throw std::runtime_error("Wrong weight " + std::to_string(i));
+    }
+  }
+}
+
+// the weights of the indices in a delta must match the weights workers pull,
+// which the optimization method may edit
+void check_pulled_weights(PSSparseServerInterface* psi,
+                          const SparseLRModel& model,
+                          const std::vector<int>& indices) {
+  std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> samples(1);
+  for (const auto& index : indices) {
+    samples[0].push_back(std::make_pair(index, 1.0));
+  }
+  SparseLRModel pulled(0);
+  psi->get_lr_sparse_model_inplace(SparseDataset(std::move(samples)), pulled,
+                                   config);
+  for (const auto& index : indices) {
+    if (pulled.get_nth_weight(index) != model.get_nth_weight(index)) {
+      throw std::runtime_error("Wrong pulled weight " + std::to_string(index));
+    }
+  }
+}
+
+// usage: test_model_delta [port]
+// without a port the parameter server is test_ps, which uses momentum so
+// the weights it sends are not edited and deltas also match the full model
+int main(int argc, char** argv) {
+  int port = argc > 1 ? std::stoi(argv[1]) : 1337;
+  bool edited = argc > 1;
+  std::unique_ptr<PSSparseServerInterface> psi =
+      std::make_unique<PSSparseServerInterface>("127.0.0.1", port);
+  psi->connect();
+
+  // pages are only tracked from the first delta on, gradients applied
+  // before are part of the whole model
+  std::vector<std::pair<int, FEATURE_TYPE>> first_weights = {{7, 1.0}};
+  psi->send_lr_gradient(LRSparseGradient(std::move(first_weights)));
+
+  // the first delta is the whole model
+  SparseLRModel model(0);
+  psi->get_lr_model_delta(&model);
+  check_pulled_weights(psi.get(), model, {7});
+  if (!edited) {
+    check_same_model(psi.get(), model);
+  }
+
+  uint64_t model_size = (1 << config.get_model_bits()) + 1;
+  for (int i = 0; i < 3; ++i) {
+    std::vector<std::pair<int, FEATURE_TYPE>> grad_weights = {
+        {i, 1.0}, {5000 + i, 2.0}, {(int) model_size - 1, -1.0}};
+    LRSparseGradient gradient(std::move(grad_weights));
+    psi->send_lr_gradient(gradient);
+
+    psi->get_lr_model_delta(&model);
+    check_pulled_weights(psi.get(), model,
+                         {i, 5000 + i, (int) model_size - 1});
+    if (!edited) {
+      check_same_model(psi.get(), model);
+    }
+  }
+
+  // nothing changed
+  psi->get_lr_model_delta(&model);
+  check_pulled_weights(psi.get(), model, {2, 5002, (int) model_size - 1});
+  if (!edited) {
+    check_same_model(psi.get(), model);
+  }
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
@@ -0,0 +1,12 @@
+#!/bin/bash
+
+timeout 60 ./tests/test_travis_lr/test_ps&
+sleep 1
+
+timeout 50 ./tests/test_travis/test_model_delta || exit 1
+
+# Nesterov edits the weights sent to workers, deltas included
+timeout 60 ./tests/test_travis/ps_mode poll 1368 "opt_method: nesterov"&
+sleep 1
+
+timeout 50 ./tests/test_travis/test_model_delta 1368
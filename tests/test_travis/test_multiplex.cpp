@@ -0,0 +1,79 @@
+#include <Configuration.h>
+#include <Constants.h>
+#include <MuxConnection.h>
+#include <PSSparseServerInterface.h>
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+#define NUM_THREADS (8)
+#define NUM_ITERATIONS (200)
+
+// replies are matched to their requests whatever the order they are
+// waited for in
+void test_out_of_order() {
+  std::shared_ptr<MuxConnection> mux = MuxConnection::get("127.0.0.1", 1337);
+  check(mux == MuxConnection::get("127.0.0.1", 1337), "shared connection");
+
+  std::vector<uint32_t> ids;
+  for (uint32_t i = 0; i < 10; ++i) {
+    uint32_t request[2] = {GET_TASK_STATUS, 1000 + i};
+    ids.push_back(mux->send(request, sizeof(request)));
+  }
+  uint32_t request = GET_METRICS;
+  uint32_t metrics_id = mux->send(&request, sizeof(request));
+
+  std::vector<char> metrics = mux->wait_reply(metrics_id);
+  uint32_t size = 0;
+  check(metrics.size() > sizeof(uint32_t), "metrics reply");
+  std::memcpy(&size, metrics.data(), sizeof(uint32_t));
+  check(size + sizeof(uint32_t) == metrics.size(), "metrics reply size");
+  for (auto it = ids.rbegin(); it != ids.rend(); ++it) {
+    check(mux->wait_reply(*it).size() == sizeof(uint32_t), "status reply");
+  }
+}
+
+// threads with their own interface share one connection
+void test_threads() {
+  Configuration config;
+  config.parse_line("worker_multiplex: 1");
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < NUM_THREADS; ++t) {
+    threads.emplace_back([&config, t]() {
+      PSSparseServerInterface psi("127.0.0.1", 1337, config);
+      psi.connect();
+      std::string key = "mux" + std::to_string(t);
+      for (uint32_t i = 0; i < NUM_ITERATIONS; ++i) {
+        std::string value = std::to_string(t * NUM_ITERATIONS + i);
+        value.resize(100 + i, 'v');
+        psi.set_value(key, &value[0], value.size());
+        auto ret = psi.get_value(key);
+        check(ret.second == value.size() &&
+                  std::memcmp(ret.first.get(), value.data(), ret.second) ==
+                      0,
+              "value");
+        if (i % 50 == 0) {
+          check(!psi.get_metrics().empty(), "metrics");
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+int main() {
+  test_out_of_order();
+  test_threads();
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
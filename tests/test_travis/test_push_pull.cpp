@@ -0,0 +1,99 @@
+#include <PSSparseServerInterface.h>
+#include <Configuration.h>
+#include <SparseDataset.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+cirrus::Configuration config =
+    cirrus::Configuration("configs/test_config.cfg");
+
+// every sample has the same features so each index is requested once
+// for several samples
+SparseDataset make_minibatch(const std::vector<int>& indices) {
+  std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> samples(3);
+  for (auto& sample : samples) {
+    for (const auto& index : indices) {
+      sample.push_back(std::make_pair(index, 1.0));
+    }
+  }
+  return SparseDataset(std::move(samples));
+}
+
+void test_sparse_indices() {
+  std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> samples = {
+      {{4000, 1.0}, {20, 1.0}, {7, 1.0}},
+      {{20, 1.0}, {4000, 1.0}},
+      {{7, 1.0}, {1, 1.0}, {20, 1.0}}};
+  SparseDataset minibatch(std::move(samples));
+  check(PSSparseServerInterface::lr_sparse_indices(minibatch) ==
+            std::vector<uint32_t>({1, 7, 20, 4000}),
+        "sparse indices");
+}
+
+void test_out_of_range_index() {
+  uint32_t model_size = (1 << config.get_model_bits()) + 1;
+  FEATURE_TYPE weights[2] = {1.0, 2.0};
+  uint32_t indices[2] = {3, model_size - 1};
+  SparseLRModel model(0);
+  model.loadSerializedSparse(weights, indices, 2, config);
+  check(model.get_nth_weight(model_size - 1) == 2.0, "last weight");
+
+  indices[1] = model_size;
+  bool rejected = false;
+  try {
+    model.loadSerializedSparse(weights, indices, 2, config);
+  } catch (const std::runtime_error&) {
+    rejected = true;
+  }
+  check(rejected, "out of range index");
+}
+
+int main() {
+  test_sparse_indices();
+  test_out_of_range_index();
+
+  std::unique_ptr<PSSparseServerInterface> psi =
+      std::make_unique<PSSparseServerInterface>("127.0.0.1", 1337);
+  psi->connect();
+
+  std::vector<int> indices = {1, 20, 300, 4000};
+  SparseLRModel model(0);
+  psi->get_lr_sparse_model_inplace(make_minibatch(indices), model, config);
+
+  std::unique_ptr<CirrusModel> before = psi->get_full_model(false);
+  for (int i = 0; i < 3; ++i) {
+    std::vector<std::pair<int, FEATURE_TYPE>> grad_weights = {{20, 1.0},
+                                                              {4000, -1.0}};
+    LRSparseGradient gradient(std::move(grad_weights));
+    psi->send_lr_gradient_get_sparse_model(
+        gradient, make_minibatch({20, 4000, 5000 + i}), model, config);
+
+    // the weights are read after the gradient was applied
+    std::unique_ptr<CirrusModel> current = psi->get_full_model(false);
+    for (const auto& index : {20, 4000, 5000 + i}) {
+      check(model.get_nth_weight(index) == current->get_nth_weight(index),
+            "pulled weight " + std::to_string(index));
+    }
+  }
+
+  // the gradients were applied and the connection is still in sync
+  std::unique_ptr<CirrusModel> after = psi->get_full_model(false);
+  if (after->get_nth_weight(20) == before->get_nth_weight(20) ||
+      after->get_nth_weight(4000) == before->get_nth_weight(4000)) {
+    throw std::runtime_error("Gradient was not applied");
+  }
+  for (const auto& index : {1, 300, 5000}) {
+    if (after->get_nth_weight(index) != before->get_nth_weight(index)) {
+      throw std::runtime_error("Wrong weight " + std::to_string(index));
+    }
+  }
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
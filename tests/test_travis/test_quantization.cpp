@@ -0,0 +1,148 @@
+#include <PSSparseServerInterface.h>
+#include <Configuration.h>
+#include <Quantization.h>
+#include <Utils.h>
+#include <WireFormat.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+std::vector<FEATURE_TYPE> round_trip(const std::vector<FEATURE_TYPE>& values,
+                                     uint32_t quantization) {
+  std::vector<char> data(max_quantized_size(values.size()));
+  char* end = quantize_values(values.data(), values.size(), quantization,
+                              data.data());
+  std::vector<FEATURE_TYPE> decoded(values.size());
+  check(dequantize_values(data.data(), end, values.size(), quantization,
+                          [&decoded](uint64_t i, FEATURE_TYPE value) {
+                            decoded[i] = value;
+                          }) == end,
+        "dequantized size");
+  return decoded;
+}
+
+void test_codec() {
+  // values representable in every format come back as they are
+  std::vector<FEATURE_TYPE> exact = {0, 1, -2, 64, 127, -127};
+  for (uint32_t q = 0; q < NUM_QUANTIZATIONS; ++q) {
+    check(round_trip(exact, q) == exact, quantization_name(q) + " values");
+    check(quantization_from_name(quantization_name(q)) == q,
+          quantization_name(q) + " name");
+  }
+  check(half_to_float(float_to_half(1e-6, 0)) > 0, "subnormal half");
+  check(half_to_float(float_to_half(1e6, 0)) == 65504, "clipped half");
+
+  // stochastic rounding is unbiased
+  std::vector<FEATURE_TYPE> values(100000, 0.1001);
+  values[0] = 1;  // int8 scale of 1 / 127
+  for (uint32_t q = 1; q < NUM_QUANTIZATIONS; ++q) {
+    std::vector<FEATURE_TYPE> decoded = round_trip(values, q);
+    double sum = 0;
+    for (uint64_t i = 1; i < decoded.size(); ++i) {
+      sum += decoded[i];
+    }
+    double mean = sum / (decoded.size() - 1);
+    check(std::abs(mean - 0.1001) < 1e-4, quantization_name(q) + " mean");
+  }
+
+  bool truncated = false;
+  try {
+    std::vector<char> data(3);
+    dequantize_values(data.data(), data.data() + data.size(), 2,
+                      QUANTIZE_FP16, [](uint64_t, FEATURE_TYPE) {});
+  } catch (const std::runtime_error&) {
+    truncated = true;
+  }
+  check(truncated, "truncated values");
+}
+
+void test_gradients() {
+  std::vector<std::pair<int, FEATURE_TYPE>> weights;
+  for (int i = 0; i < 1000; ++i) {
+    weights.push_back(std::make_pair(i * 3, 0.01 * (i % 50) - 0.25));
+  }
+  LRSparseGradient lr_gradient(std::move(weights));
+  std::vector<char> data(lr_gradient.getCompactSizeBound());
+  uint64_t full_size =
+      lr_gradient.serializeCompact(data.data(), WIRE_FORMAT_QUANTIZED);
+  uint64_t size = lr_gradient.serializeCompact(
+      data.data(), WIRE_FORMAT_QUANTIZED, QUANTIZE_INT8);
+  check(size < full_size / 2, "int8 LR gradient size");
+  LRSparseGradient lr_loaded(0);
+  lr_loaded.loadSerializedCompact(data.data(), size, WIRE_FORMAT_QUANTIZED);
+  std::vector<char> loaded(lr_loaded.getSerializedSize());
+  check(loaded.size() == lr_gradient.getSerializedSize(),
+        "int8 LR gradient size");
+  lr_loaded.serialize(loaded.data());
+  const char* ptr = loaded.data() + sizeof(int) * 2;
+  for (int i = 0; i < 1000; ++i) {
+    int index = load_value<int>(ptr);
+    FEATURE_TYPE value = load_value<FEATURE_TYPE>(ptr);
+    // int8 values are off by less than the scale
+    check(index == i * 3 &&
+              std::abs(value - (0.01 * (i % 50) - 0.25)) <= 0.25 / 127,
+          "int8 LR gradient value " + std::to_string(i));
+  }
+
+  MFSparseGradient mf_gradient;
+  for (int user : {9, 2, 40}) {
+    uint32_t i = mf_gradient.add_user(user);
+    mf_gradient.user_bias(i) = 0.5;
+    std::fill_n(mf_gradient.user_factors(i), NUM_FACTORS, -0.25);
+  }
+  data.resize(mf_gradient.getCompactSizeBound());
+  size = mf_gradient.serializeCompact(data.data(), WIRE_FORMAT_QUANTIZED,
+                                      QUANTIZE_BF16);
+  MFSparseGradient mf_loaded;
+  mf_loaded.loadSerializedCompact(data.data(), size, WIRE_FORMAT_QUANTIZED);
+  MFGradientView mf_view = mf_loaded.view();
+  check(mf_view.users.size == 3 && mf_view.items.size == 0 &&
+            std::vector<FEATURE_TYPE>(mf_view.users.biases,
+                                      mf_view.users.biases + 3) ==
+                std::vector<FEATURE_TYPE>(3, 0.5),
+        "bf16 MF gradient biases");
+  check(mf_view.users.ids[1] == 9 &&
+            std::vector<FEATURE_TYPE>(
+                mf_view.users.factors,
+                mf_view.users.factors + 3 * NUM_FACTORS) ==
+                std::vector<FEATURE_TYPE>(3 * NUM_FACTORS, -0.25),
+        "bf16 MF gradient weights");
+}
+
+// quantized gradients are applied by the parameter server
+void test_server() {
+  PSSparseServerInterface psi("127.0.0.1", 1337);
+  psi.connect();
+  check(psi.negotiate_wire_format(WIRE_FORMAT_QUANTIZED) ==
+            WIRE_FORMAT_QUANTIZED,
+        "negotiation");
+
+  for (uint32_t q = 0; q < NUM_QUANTIZATIONS; ++q) {
+    psi.set_gradient_quantization(q);
+    std::unique_ptr<CirrusModel> before = psi.get_full_model(false);
+    std::vector<std::pair<int, FEATURE_TYPE>> weights = {{10, 1.0},
+                                                         {1000, -0.5}};
+    psi.send_lr_gradient(LRSparseGradient(std::move(weights)));
+    std::unique_ptr<CirrusModel> after = psi.get_full_model(false);
+    for (const auto& index : {10, 1000}) {
+      check(after->get_nth_weight(index) != before->get_nth_weight(index),
+            quantization_name(q) + " weight " + std::to_string(index));
+    }
+    check(after->get_nth_weight(20000) == before->get_nth_weight(20000),
+          quantization_name(q) + " untouched weight");
+  }
+}
+
+int main() {
+  test_codec();
+  test_gradients();
+  test_server();
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
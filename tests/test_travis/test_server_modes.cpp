@@ -0,0 +1,200 @@
+#include <Configuration.h>
+#include <Constants.h>
+#include <IoUring.h>
+#include <PSSparseServerInterface.h>
+#include <SparseDataset.h>
+#include <Utils.h>
+
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+#define NUM_THREADS (4)  //< the server takes 5 connections
+#define NUM_ITERATIONS (200)
+#define NUM_PIPELINED (100)
+#define NUM_RECONNECTS (50)
+
+int connect_to(int port) {
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  int opt = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  check(connect(sock, (struct sockaddr*) &addr, sizeof(addr)) == 0,
+        "connect");
+  return sock;
+}
+
+// requests sent back to back, and a request split across reads
+void test_raw_requests(int port) {
+  int sock = connect_to(port);
+  std::vector<uint32_t> requests;
+  for (uint32_t i = 0; i < NUM_PIPELINED; ++i) {
+    requests.push_back(GET_TASK_STATUS);
+    requests.push_back(2000 + i);
+  }
+  check(send_all(sock, requests.data(), requests.size() * sizeof(uint32_t)) !=
+            -1,
+        "pipelined send");
+  std::vector<uint32_t> statuses(NUM_PIPELINED);
+  check(read_all(sock, statuses.data(), NUM_PIPELINED * sizeof(uint32_t)) !=
+            0,
+        "pipelined replies");
+
+  uint32_t request[2] = {GET_TASK_STATUS, 3000};
+  send_all(sock, &request[0], sizeof(uint32_t));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  send_all(sock, &request[1], sizeof(uint32_t));
+  uint32_t status = 1;
+  check(read_all(sock, &status, sizeof(uint32_t)) != 0 && status == 0,
+        "split request");
+  close(sock);
+}
+
+// more connections over time than the server takes at once, some closed
+// in the middle of a request, so closed connections must free their slot
+void test_reconnects(int port) {
+  for (uint32_t i = 0; i < NUM_RECONNECTS; ++i) {
+    int sock = connect_to(port);
+    uint32_t request[2] = {GET_TASK_STATUS, 4000 + i};
+    if (i % 5 == 4) {
+      send_all(sock, &request[0], sizeof(uint32_t));
+      close(sock);
+      continue;
+    }
+    check(send_all(sock, request, sizeof(request)) != -1, "request");
+    uint32_t status = 1;
+    check(read_all(sock, &status, sizeof(uint32_t)) != 0 && status == 0,
+          "status after reconnecting");
+    close(sock);
+  }
+}
+
+SparseDataset make_minibatch(const std::vector<int>& indices) {
+  std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> samples(1);
+  for (const auto& index : indices) {
+    samples[0].push_back(std::make_pair(index, 1.0));
+  }
+  return SparseDataset(std::move(samples));
+}
+
+// values and gradients bigger than a read, from many clients at once
+void test_clients(int port) {
+  Configuration config("configs/test_config.cfg");
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < NUM_THREADS; ++t) {
+    threads.emplace_back([&config, port, t]() {
+      PSSparseServerInterface psi("127.0.0.1", port);
+      psi.connect();
+      std::string key = "mode" + std::to_string(t);
+      for (uint32_t i = 0; i < NUM_ITERATIONS; ++i) {
+        std::string value = std::to_string(t * NUM_ITERATIONS + i);
+        value.resize(i % 50 == 0 ? 1000000 : 100 + i, 'v');
+        psi.set_value(key, &value[0], value.size());
+        auto ret = psi.get_value(key);
+        check(ret.second == value.size() &&
+                  std::memcmp(ret.first.get(), value.data(), ret.second) ==
+                      0,
+              "value");
+      }
+
+      std::vector<std::pair<int, FEATURE_TYPE>> weights;
+      for (int i = 0; i < 10000; ++i) {
+        weights.push_back(std::make_pair(i * 7 + t, 0.5));
+      }
+      LRSparseGradient gradient(std::move(weights));
+      psi.send_lr_gradient(gradient);
+      SparseLRModel model(0);
+      psi.get_lr_sparse_model_inplace(make_minibatch({1, 7, 14}), model,
+                                      config);
+      check(!psi.get_metrics().empty(), "metrics");
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// round trips of small requests, to compare the server modes
+void time_round_trips(int port, const std::string& mode) {
+  PSSparseServerInterface psi("127.0.0.1", port);
+  psi.connect();
+  std::string value(64, 'v');
+  psi.set_value("latency", &value[0], value.size());
+  uint64_t start = get_time_us();
+  for (uint32_t i = 0; i < 2000; ++i) {
+    psi.get_value("latency");
+  }
+  std::cout << mode << ": " << (get_time_us() - start) / 2000.0
+            << " us per GET_VALUE round trip" << std::endl;
+}
+
+// more operations than the submission queue holds, with more completions
+// than the completion queue holds, before collecting any completion
+void test_io_uring_queues() {
+  int socks[2];
+  check(socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == 0, "socketpair");
+  IoUring ring(2);
+  std::vector<uint32_t> values(NUM_PIPELINED);
+  for (uint32_t i = 0; i < NUM_PIPELINED; ++i) {
+    values[i] = i;
+    ring.send(socks[0], &values[i], sizeof(uint32_t), i);
+  }
+  std::vector<IoUring::Completion> completions;
+  std::vector<bool> completed(NUM_PIPELINED, false);
+  for (uint32_t n = 0; n < NUM_PIPELINED;) {
+    ring.submit_and_wait(1000, &completions);
+    check(!completions.empty(), "io_uring completions");
+    for (const auto& completion : completions) {
+      check(completion.user_data < NUM_PIPELINED &&
+                !completed[completion.user_data] &&
+                completion.result == sizeof(uint32_t),
+            "io_uring completion");
+      completed[completion.user_data] = true;
+      n++;
+    }
+  }
+  // no entry was overwritten before it was submitted
+  std::vector<uint32_t> received(NUM_PIPELINED);
+  check(read_all(socks[1], received.data(),
+                 NUM_PIPELINED * sizeof(uint32_t)) != 0 &&
+            received == values,
+        "io_uring sends");
+  close(socks[0]);
+  close(socks[1]);
+}
+
+// usage: test_server_modes mode port [mode port ...]
+int main(int argc, char** argv) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string mode = argv[i];
+    int port = std::stoi(argv[i + 1]);
+    if (mode == "io_uring") {
+      if (!IoUring::supported()) {
+        std::cout << "Skipping io_uring, not supported here" << std::endl;
+        continue;
+      }
+      test_io_uring_queues();
+    }
+    test_raw_requests(port);
+    test_reconnects(port);
+    test_clients(port);
+    time_round_trips(port, mode);
+  }
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
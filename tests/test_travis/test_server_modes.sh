@@ -0,0 +1,10 @@
+#!/bin/bash
+
+# the same parameter server with each event loop
+timeout 90 ./tests/test_travis/ps_mode poll 1337&
+timeout 90 ./tests/test_travis/ps_mode epoll 1347&
+timeout 90 ./tests/test_travis/ps_mode io_uring 1357&
+sleep 1
+
+timeout 80 ./tests/test_travis/test_server_modes poll 1337 epoll 1347 \
+    io_uring 1357
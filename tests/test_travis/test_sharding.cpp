@@ -0,0 +1,192 @@
+#include <PSSparseServerInterface.h>
+#include <Configuration.h>
+#include <SparseDataset.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace cirrus;
+
+// needs two parameter servers running with configs/test_config_sharded.cfg
+
+#define USER_BASE (48)
+#define MB_SIZE (4)
+
+cirrus::Configuration config =
+    cirrus::Configuration("configs/test_config_sharded.cfg");
+
+void check_equal(double a, double b, const std::string& what) {
+  if (std::fabs(a - b) > 1e-5) {
+    throw std::runtime_error("Wrong " + what + ": " + std::to_string(a) +
+                             " expected: " + std::to_string(b));
+  }
+}
+
+// indices on both sides of the boundary between the two shards
+void test_lr(PSSparseServerInterface* psi) {
+  uint64_t model_size = (1 << config.get_model_bits()) + 1;
+  std::vector<int> indices = {3, 262144, 262145, 400000, (int) model_size - 1};
+
+  std::unique_ptr<CirrusModel> before = psi->get_full_model(false);
+  if (dynamic_cast<SparseLRModel*>(before.get())->size() != model_size) {
+    throw std::runtime_error("Wrong LR model size");
+  }
+
+  std::vector<std::pair<int, FEATURE_TYPE>> grad_weights;
+  for (uint32_t i = 0; i < indices.size(); ++i) {
+    grad_weights.push_back(std::make_pair(indices[i], i + 1.0));
+  }
+  LRSparseGradient gradient(std::move(grad_weights));
+  psi->send_lr_gradient(gradient);
+
+  // the sparse model is gathered from both shards
+  std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> samples(1);
+  for (const auto& index : indices) {
+    samples[0].push_back(std::make_pair(index, 1.0));
+  }
+  SparseDataset ds(std::move(samples));
+  psi->get_lr_sparse_model(ds, config);
+
+  std::unique_ptr<CirrusModel> after = psi->get_full_model(false);
+  for (uint32_t i = 0; i < indices.size(); ++i) {
+    check_equal(after->get_nth_weight(indices[i]),
+                before->get_nth_weight(indices[i]) +
+                    config.get_learning_rate() * (i + 1.0),
+                "lr weight " + std::to_string(indices[i]));
+  }
+  check_equal(after->get_nth_weight(4), before->get_nth_weight(4),
+              "untouched lr weight");
+}
+
+// the LR model patched with deltas from both shards matches the full model
+void test_lr_delta(PSSparseServerInterface* psi) {
+  SparseLRModel model(0);
+  for (int i = 0; i < 2; ++i) {
+    psi->get_lr_model_delta(&model);
+    std::unique_ptr<CirrusModel> full = psi->get_full_model(false);
+    if (dynamic_cast<SparseLRModel*>(full.get())->size() != model.size()) {
+      throw std::runtime_error("Wrong LR delta model size");
+    }
+    for (uint64_t j = 0; j < model.size(); ++j) {
+      check_equal(model.get_nth_weight(j), full->get_nth_weight(j),
+                  "lr delta weight " + std::to_string(j));
+    }
+
+    std::vector<std::pair<int, FEATURE_TYPE>> grad_weights = {{7, 1.0},
+                                                              {300000, 1.0}};
+    psi->send_lr_gradient(LRSparseGradient(std::move(grad_weights)));
+  }
+}
+
+// gradient and model requests split across the shards: shard 1 only gets
+// a gradient and shard 0 only a model request, then both get both
+void test_lr_push_pull(PSSparseServerInterface* psi) {
+  std::vector<std::vector<int>> grad_indices = {{400000}, {3, 400000}};
+  std::vector<std::vector<int>> pull_indices = {{3, 10}, {10, 262145}};
+  for (uint32_t i = 0; i < grad_indices.size(); ++i) {
+    std::unique_ptr<CirrusModel> before = psi->get_full_model(false);
+
+    std::vector<std::pair<int, FEATURE_TYPE>> grad_weights;
+    for (const auto& index : grad_indices[i]) {
+      grad_weights.push_back(std::make_pair(index, 1.0));
+    }
+    std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> samples(1);
+    for (const auto& index : pull_indices[i]) {
+      samples[0].push_back(std::make_pair(index, 1.0));
+    }
+    SparseLRModel model(0);
+    psi->send_lr_gradient_get_sparse_model(
+        LRSparseGradient(std::move(grad_weights)),
+        SparseDataset(std::move(samples)), model, config);
+
+    std::unique_ptr<CirrusModel> after = psi->get_full_model(false);
+    for (const auto& index : grad_indices[i]) {
+      check_equal(after->get_nth_weight(index),
+                  before->get_nth_weight(index) + config.get_learning_rate(),
+                  "push pull lr weight " + std::to_string(index));
+    }
+  }
+}
+
+SparseMFModel get_mf_model(PSSparseServerInterface* psi,
+                           const std::vector<int>& items) {
+  std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> samples(1);
+  for (const auto& item : items) {
+    samples[0].push_back(std::make_pair(item, 1.0));
+  }
+  SparseDataset ds(std::move(samples));
+  return psi->get_sparse_mf_model(ds, USER_BASE, MB_SIZE);
+}
+
+// users and items on both sides of the boundary between the two shards
+void test_mf(PSSparseServerInterface* psi) {
+  std::vector<int> items = {40, 3, 24, 25};
+  SparseMFModel before = get_mf_model(psi, items);
+  if (before.user_models.size() != MB_SIZE) {
+    throw std::runtime_error("Wrong number of users");
+  }
+
+  MFSparseGradient gradient;
+  for (int user = USER_BASE; user < USER_BASE + MB_SIZE; ++user) {
+    uint32_t i = gradient.add_user(user);
+    gradient.user_bias(i) = user;
+    std::fill_n(gradient.user_factors(i), NUM_FACTORS, 0.5);
+  }
+  for (const auto& item : items) {
+    uint32_t i = gradient.add_item(item);
+    gradient.item_bias(i) = item;
+    std::fill_n(gradient.item_factors(i), NUM_FACTORS, -0.5);
+  }
+  psi->send_mf_gradient(gradient);
+
+  SparseMFModel after = get_mf_model(psi, items);
+  std::unique_ptr<CirrusModel> full = psi->get_full_model(true);
+  MFModel* full_mf = dynamic_cast<MFModel*>(full.get());
+
+  for (int i = 0; i < MB_SIZE; ++i) {
+    int user = USER_BASE + i;
+    if (std::get<0>(after.user_models[i]) != user) {
+      throw std::runtime_error("Wrong user id");
+    }
+    check_equal(std::get<1>(after.user_models[i]),
+                std::get<1>(before.user_models[i]) + user, "user bias");
+    check_equal(full_mf->get_user_bias(user),
+                std::get<1>(after.user_models[i]), "full model user bias");
+    for (uint32_t j = 0; j < NUM_FACTORS; ++j) {
+      check_equal(std::get<2>(after.user_models[i])[j],
+                  std::get<2>(before.user_models[i])[j] + 0.5,
+                  "user weight");
+      check_equal(full_mf->get_user_weights(user, j),
+                  std::get<2>(after.user_models[i])[j],
+                  "full model user weight");
+    }
+  }
+  for (const auto& item : items) {
+    check_equal(after.item_models[item].first,
+                before.item_models[item].first + item, "item bias");
+    check_equal(full_mf->get_item_bias(item), after.item_models[item].first,
+                "full model item bias");
+    for (uint32_t j = 0; j < NUM_FACTORS; ++j) {
+      check_equal(after.item_models[item].second[j],
+                  before.item_models[item].second[j] - 0.5, "item weight");
+      check_equal(full_mf->get_item_weights(item, j),
+                  after.item_models[item].second[j],
+                  "full model item weight");
+    }
+  }
+}
+
+int main() {
+  std::unique_ptr<PSSparseServerInterface> psi =
+      std::make_unique<PSSparseServerInterface>("127.0.0.1", 1337, config);
+  psi->connect();
+
+  test_lr(psi.get());
+  test_lr_delta(psi.get());
+  test_lr_push_pull(psi.get());
+  test_mf(psi.get());
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
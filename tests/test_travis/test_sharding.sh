@@ -0,0 +1,8 @@
+#!/bin/bash
+
+# two parameter servers, each holding half of the models
+timeout 60 ./tests/test_travis/ps_shard 0 1337&
+timeout 60 ./tests/test_travis/ps_shard 1 1347&
+sleep 1
+
+timeout 50 ./tests/test_travis/test_sharding
@@ -0,0 +1,131 @@
+#include <Configuration.h>
+#include <PSSparseServerInterface.h>
+#include <ShmRing.h>
+#include <SparseDataset.h>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+#define RING_SIZE (64 * 1024)
+#define NUM_MESSAGES (2000)
+
+bool always_alive() {
+  return true;
+}
+
+std::string make_message(uint32_t i) {
+  // larger than a fragment every now and then
+  uint64_t size = (i % 100 == 0) ? 3 * RING_SIZE / 2 : 1 + (i * 37) % 5000;
+  std::string message(size, static_cast<char>('a' + i % 26));
+  std::memcpy(&message[0], &i, std::min<uint64_t>(size, sizeof(uint32_t)));
+  return message;
+}
+
+// the stream of bytes goes through whatever the fragments
+void test_ring() {
+  std::unique_ptr<ShmSegment> segment = ShmSegment::create(RING_SIZE);
+  std::unique_ptr<ShmSegment> peer =
+      ShmSegment::attach(segment->name(), RING_SIZE);
+  segment->unlink();
+
+  std::thread producer([&segment]() {
+    for (uint32_t i = 0; i < NUM_MESSAGES; ++i) {
+      std::string message = make_message(i);
+      check(segment->requests().write(message.data(), message.size(),
+                                      always_alive),
+            "write");
+    }
+  });
+  for (uint32_t i = 0; i < NUM_MESSAGES; ++i) {
+    std::string expected = make_message(i);
+    std::string message(expected.size(), '\0');
+    if (i % 2 == 0) {
+      check(peer->requests().read(&message[0], message.size(), always_alive),
+            "read");
+    } else {
+      // small messages are a single fragment, read in place
+      check(peer->requests().wait_readable(always_alive), "readable");
+      uint64_t size = 0;
+      const char* data = peer->requests().front(&size);
+      check(size == expected.size(), "fragment size");
+      message.assign(data, size);
+      peer->requests().consume(size);
+    }
+    check(message == expected, "message " + std::to_string(i));
+  }
+  producer.join();
+
+  // closing wakes up the reader, and a peer that left fails waits
+  std::thread closer([&segment]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    segment->replies().close();
+  });
+  char byte;
+  check(!peer->replies().read(&byte, 1, always_alive), "read after close");
+  closer.join();
+  check(!peer->requests().wait_readable([]() { return false; }),
+        "wait for a peer that left");
+}
+
+SparseDataset make_minibatch(const std::vector<int>& indices) {
+  std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> samples(2);
+  for (auto& sample : samples) {
+    for (const auto& index : indices) {
+      sample.push_back(std::make_pair(index, 1.0));
+    }
+  }
+  return SparseDataset(std::move(samples));
+}
+
+// requests and replies of all sizes go through shared memory
+void test_parameter_server(const std::string& ring_size_kb) {
+  Configuration config("configs/test_config.cfg");
+  config.parse_line("shm_ring_size_kb: " + ring_size_kb);
+  PSSparseServerInterface psi("127.0.0.1", 1337, config);
+  psi.connect();
+  check(psi.uses_shared_memory(), "transport");
+
+  std::string value(100000, 'v');
+  psi.set_value("shm", &value[0], value.size());
+  auto ret = psi.get_value("shm");
+  check(ret.second == value.size() &&
+            std::memcmp(ret.first.get(), value.data(), value.size()) == 0,
+        "value");
+
+  std::unique_ptr<CirrusModel> before = psi.get_full_model(false);
+  std::vector<std::pair<int, FEATURE_TYPE>> weights;
+  for (int i = 0; i < 20000; ++i) {
+    weights.push_back(std::make_pair(i * 3, 1.0));
+  }
+  LRSparseGradient gradient(std::move(weights));
+  psi.send_lr_gradient(gradient);
+  SparseLRModel model(0);
+  psi.get_lr_sparse_model_inplace(make_minibatch({3, 30, 31}), model, config);
+  std::unique_ptr<CirrusModel> after = psi.get_full_model(false);
+  check(after->get_nth_weight(3) != before->get_nth_weight(3) &&
+            after->get_nth_weight(31) == before->get_nth_weight(31),
+        "gradient");
+  check(!psi.get_metrics().empty(), "metrics");
+}
+
+int main() {
+  test_ring();
+  test_parameter_server("4");
+  test_parameter_server("1024");
+
+  // the (ip, port) interface keeps using the socket
+  PSSparseServerInterface psi("127.0.0.1", 1337);
+  psi.connect();
+  check(!psi.uses_shared_memory(), "default transport");
+  check(psi.get_value("shm").second == 100000, "value over the socket");
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
@@ -0,0 +1,52 @@
+#include <PSSparseServerInterface.h>
+
+#include <string>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+#define HIGH_TIMEOUT (1000)
+
+// the parameter server runs with ssp_staleness: 2
+
+int main() {
+  std::unique_ptr<PSSparseServerInterface> psi =
+      std::make_unique<PSSparseServerInterface>("127.0.0.1", 1337);
+  psi->connect();
+
+  check(psi->register_task(10, HIGH_TIMEOUT) == 0, "registration");
+  check(psi->register_task(11, HIGH_TIMEOUT) == 0, "registration");
+
+  check(psi->advance_clock(10, 2), "clock within staleness");
+  check(!psi->advance_clock(10, 3), "clock too far ahead");
+  check(psi->advance_clock(11, 1), "clock of slow task");
+  check(psi->advance_clock(10, 3), "clock after slow task advanced");
+  check(!psi->advance_clock(10, 4), "clock too far ahead");
+  // clocks never go back
+  check(!psi->advance_clock(10, 0), "clock going back");
+
+  // tasks that did not register are not throttled
+  check(psi->advance_clock(99, 1000), "clock of unregistered task");
+
+  // tasks that deregister no longer hold the others back
+  check(psi->deregister_task(11) == 0, "deregistration");
+  check(psi->advance_clock(10, 5), "clock after slow task left");
+
+  std::string metrics = psi->get_metrics();
+  check(metrics.find("\"ssp\": {\"staleness\": 2") != std::string::npos,
+        "ssp metrics");
+  check(metrics.find("\"spread\": 0") != std::string::npos, "clock spread");
+
+  // stragglers that miss their deadline are dropped
+  check(psi->register_task(12, 0) == 0, "registration");
+  check(psi->register_task(13, 0) == 0, "registration");
+  check(!psi->advance_clock(10, 6), "clock ahead of stragglers");
+  psi->wait_for_clock(10, 6);
+  check(psi->deregister_task(12) == 1, "straggler dropped");
+  check(psi->deregister_task(13) == 1, "straggler dropped");
+
+  check(psi->deregister_task(10) == 0, "deregistration");
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
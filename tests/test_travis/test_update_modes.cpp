@@ -0,0 +1,114 @@
+#include <AdaGrad.h>
+#include <ModelUpdater.h>
+#include <Momentum.h>
+#include <SGD.h>
+#include <SparseLRModel.h>
+
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+#define MODEL_SIZE 100000
+#define NUM_THREADS 4
+#define NUM_GRADIENTS 2000
+#define GRADIENT_SIZE 500
+
+// the value of an index is the same in every gradient, so the weights end
+// up the same whatever order the threads apply the gradients in as long
+// as the updates of a weight are not interleaved
+FEATURE_TYPE value_of(int index) {
+  return ((index % 7) - 3) * 0.125;
+}
+
+std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> make_gradients() {
+  std::mt19937 gen(42);
+  // a small range of indices so that threads update the same weights
+  std::uniform_int_distribution<int> index(0, 4 * GRADIENT_SIZE);
+  std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> gradients(
+      NUM_GRADIENTS);
+  for (auto& gradient : gradients) {
+    for (int i = 0; i < GRADIENT_SIZE; ++i) {
+      int idx = index(gen);
+      gradient.push_back(std::make_pair(idx, value_of(idx)));
+    }
+  }
+  return gradients;
+}
+
+// every thread applies all the gradients
+std::unique_ptr<SparseLRModel> apply(
+    ModelUpdater::Mode mode,
+    OptimizationMethod* opt_method,
+    const std::vector<std::vector<std::pair<int, FEATURE_TYPE>>>& gradients) {
+  std::unique_ptr<SparseLRModel> model(new SparseLRModel(MODEL_SIZE));
+  ModelUpdater updater(mode, MODEL_SIZE, 0, 0);
+  updater.check_optimizer(*opt_method);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < NUM_THREADS; ++t) {
+    threads.push_back(std::thread([&, t]() {
+      for (uint64_t i = 0; i < gradients.size(); ++i) {
+        // start at different gradients so that the threads overlap
+        auto weights = gradients[(i + t * NUM_GRADIENTS / NUM_THREADS) %
+                                 NUM_GRADIENTS];
+        LRSparseGradient gradient(std::move(weights));
+        updater.apply_lr_gradient(model, opt_method, gradient);
+      }
+    }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return model;
+}
+
+void test_modes(OptimizationMethod* opt_method, double tolerance) {
+  auto gradients = make_gradients();
+  auto global = apply(ModelUpdater::GLOBAL, opt_method, gradients);
+  auto striped = apply(ModelUpdater::STRIPED, opt_method, gradients);
+  auto hogwild = apply(ModelUpdater::HOGWILD, opt_method, gradients);
+
+  double norm = 0;
+  double hogwild_error = 0;
+  for (uint64_t i = 0; i < MODEL_SIZE; ++i) {
+    FEATURE_TYPE expected = global->get_nth_weight(i);
+    norm += std::abs(expected);
+    check(striped->get_nth_weight(i) == expected, "striped weight");
+    hogwild_error += std::abs(hogwild->get_nth_weight(i) - expected);
+  }
+  check(norm > 0, "weights updated");
+  // hogwild loses the updates that race, a thread preempted in the middle
+  // of an update can undo many updates of a weight
+  check(hogwild_error <= tolerance * norm, "hogwild weights");
+}
+
+void test_momentum_rejected() {
+  Momentum momentum(0.1, 0.9);
+  ModelUpdater(ModelUpdater::GLOBAL, MODEL_SIZE, 0, 0)
+      .check_optimizer(momentum);
+  for (auto mode : {ModelUpdater::STRIPED, ModelUpdater::HOGWILD}) {
+    bool rejected = false;
+    try {
+      ModelUpdater(mode, MODEL_SIZE, 0, 0).check_optimizer(momentum);
+    } catch (const std::runtime_error&) {
+      rejected = true;
+    }
+    check(rejected, "momentum with concurrent updates");
+  }
+}
+
+int main() {
+  SGD sgd(0.01);
+  test_modes(&sgd, 0.05);
+  AdaGrad adagrad(0.01, 1e-5);
+  test_modes(&adagrad, 0.05);
+  test_momentum_rejected();
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
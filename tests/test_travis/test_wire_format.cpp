@@ -0,0 +1,231 @@
+#include <PSSparseServerInterface.h>
+#include <Configuration.h>
+#include <SparseDataset.h>
+#include <Utils.h>
+#include <WireFormat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+cirrus::Configuration config =
+    cirrus::Configuration("configs/test_config.cfg");
+
+// factors of the i-th user or item of a MF gradient
+std::vector<FEATURE_TYPE> mf_factors(const MFGradientEntries& entries,
+                                     uint32_t nfactors,
+                                     uint32_t i) {
+  const FEATURE_TYPE* factors = entries.factors + i * nfactors;
+  return std::vector<FEATURE_TYPE>(factors, factors + nfactors);
+}
+
+void test_indices() {
+  std::mt19937 gen(42);
+  std::vector<uint32_t> indices = {0, 0, 127, 128, 16383, 16384, 0xffffffff};
+  for (int i = 0; i < 1000; ++i) {
+    indices.push_back(gen() % (1 << 20));
+  }
+  std::sort(indices.begin(), indices.end());
+
+  std::vector<char> encoded(max_encoded_indices_size(indices.size()));
+  char* end = encode_sorted_indices(indices.data(), indices.size(),
+                                    encoded.data());
+  std::vector<uint32_t> decoded(indices.size());
+  check(decode_sorted_indices(encoded.data(), end, indices.size(),
+                              decoded.data()) == end,
+        "decoded size");
+  check(decoded == indices, "decoded indices");
+
+  bool truncated = false;
+  try {
+    decode_sorted_indices(encoded.data(), end - 1, indices.size(),
+                          decoded.data());
+  } catch (const std::runtime_error&) {
+    truncated = true;
+  }
+  check(truncated, "truncated index list");
+
+  // a delta that wraps around would make the indices unsorted
+  const char unsorted[] = {0x05, '\xfe', '\xff', '\xff', '\xff', 0x0f};
+  bool wrapped = false;
+  try {
+    decode_sorted_indices(unsorted, unsorted + sizeof(unsorted), 2,
+                          decoded.data());
+  } catch (const std::runtime_error&) {
+    wrapped = true;
+  }
+  check(wrapped, "unsorted index list");
+}
+
+void test_gradients() {
+  std::vector<std::pair<int, FEATURE_TYPE>> weights = {
+      {300000, 1.0}, {5, -2.0}, {70, 0.5}};
+  LRSparseGradient lr_gradient(std::move(weights));
+  lr_gradient.setVersion(7);
+  std::vector<char> data(lr_gradient.getCompactSizeBound());
+  uint64_t size = lr_gradient.serializeCompact(data.data());
+  check(size < lr_gradient.getSerializedSize(), "compact LR gradient size");
+
+  LRSparseGradient lr_loaded(0);
+  lr_loaded.loadSerializedCompact(data.data(), size);
+  std::vector<char> expected(lr_gradient.getSerializedSize());
+  std::vector<char> loaded(lr_loaded.getSerializedSize());
+  std::vector<std::pair<int, FEATURE_TYPE>> sorted = {
+      {5, -2.0}, {70, 0.5}, {300000, 1.0}};
+  LRSparseGradient lr_sorted(std::move(sorted));
+  lr_sorted.setVersion(7);
+  lr_sorted.serialize(expected.data());
+  lr_loaded.serialize(loaded.data());
+  check(expected == loaded, "compact LR gradient");
+
+  // the number of weights is checked before anything is allocated
+  std::vector<char> huge(sizeof(int) * 3);
+  char* ptr = huge.data();
+  store_value<int>(ptr, 1);
+  store_value<int>(ptr, 0x7fffffff);
+  bool thrown = false;
+  try {
+    lr_loaded.loadSerializedCompact(huge.data(), huge.size());
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  check(thrown, "LR gradient larger than its message");
+
+  MFSparseGradient mf_gradient;
+  for (int user : {9, 2, 40}) {
+    uint32_t i = mf_gradient.add_user(user);
+    mf_gradient.user_bias(i) = user;
+    std::fill_n(mf_gradient.user_factors(i), NUM_FACTORS, user);
+  }
+  uint32_t item = mf_gradient.add_item(3);
+  mf_gradient.item_bias(item) = -1;
+  std::fill_n(mf_gradient.item_factors(item), NUM_FACTORS, -1);
+  data.resize(mf_gradient.getCompactSizeBound());
+  size = mf_gradient.serializeCompact(data.data());
+  check(size < mf_gradient.getSerializedSize(), "compact MF gradient size");
+
+  // users come back sorted by id
+  MFSparseGradient mf_loaded;
+  mf_loaded.loadSerializedCompact(data.data(), size);
+  MFGradientView mf_view = mf_loaded.view();
+  check(mf_view.users.size == 3 && mf_view.users.ids[0] == 2 &&
+            mf_view.users.biases[0] == 2 && mf_view.users.ids[2] == 40 &&
+            mf_view.users.biases[2] == 40 && mf_view.items.size == 1 &&
+            mf_view.items.biases[0] == -1,
+        "compact MF gradient biases");
+  check(mf_factors(mf_view.users, NUM_FACTORS, 2) ==
+                std::vector<FEATURE_TYPE>(NUM_FACTORS, 40) &&
+            mf_factors(mf_view.items, NUM_FACTORS, 0) ==
+                std::vector<FEATURE_TYPE>(NUM_FACTORS, -1),
+        "compact MF gradient weights");
+
+  // the raw format is read in place
+  data.resize(mf_gradient.getSerializedSize());
+  mf_gradient.serialize(data.data());
+  MFGradientView view =
+      MFGradientView::of_serialized(data.data(), data.size());
+  check(view.nfactors == NUM_FACTORS && view.users.size == 3 &&
+            view.users.ids[0] == 9 && view.users.biases[0] == 9 &&
+            mf_factors(view.users, NUM_FACTORS, 1) ==
+                std::vector<FEATURE_TYPE>(NUM_FACTORS, 2) &&
+            view.items.ids[0] == 3 &&
+            reinterpret_cast<const char*>(view.items.factors) > data.data() &&
+            reinterpret_cast<const char*>(view.items.factors) <
+                data.data() + data.size(),
+        "MF gradient view");
+  thrown = false;
+  try {
+    MFGradientView::of_serialized(data.data(), data.size() - 4);
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  check(thrown, "truncated MF gradient");
+
+  // the number of factors travels with the gradient
+  MFSparseGradient mf_wide(32);
+  uint32_t user = mf_wide.add_user(4);
+  mf_wide.user_bias(user) = 1;
+  std::fill_n(mf_wide.user_factors(user), 32, 0.5);
+  data.resize(mf_wide.getSerializedSize());
+  mf_wide.serialize(data.data());
+  MFSparseGradient mf_wide_loaded;
+  mf_wide_loaded.loadSerialized(data.data());
+  check(mf_wide_loaded.nfactors == 32 &&
+            mf_factors(mf_wide_loaded.view().users, 32, 0) ==
+                std::vector<FEATURE_TYPE>(32, 0.5),
+        "MF gradient with 32 factors");
+  data.resize(mf_wide.getCompactSizeBound());
+  size = mf_wide.serializeCompact(data.data());
+  MFSparseGradient mf_wide_compact;
+  mf_wide_compact.loadSerializedCompact(data.data(), size);
+  check(mf_wide_compact.nfactors == 32 &&
+            mf_factors(mf_wide_compact.view().users, 32, 0) ==
+                std::vector<FEATURE_TYPE>(32, 0.5),
+        "compact MF gradient with 32 factors");
+}
+
+SparseDataset make_minibatch() {
+  std::vector<std::vector<std::pair<int, FEATURE_TYPE>>> samples = {
+      {{1, 1.0}, {20, 0.5}, {300000, 1.0}},
+      {{20, 1.0}, {4000, 2.0}},
+      {{1, 1.0}, {4000, 1.0}, {500000, 0.5}}};
+  std::vector<FEATURE_TYPE> labels = {1, 0, 1};
+  return SparseDataset(std::move(samples), std::move(labels));
+}
+
+std::vector<char> serialized_gradient(PSSparseServerInterface* psi) {
+  SparseDataset ds = make_minibatch();
+  SparseLRModel model(0);
+  psi->get_lr_sparse_model_inplace(ds, model, config);
+  std::unique_ptr<ModelGradient> gradient =
+      model.minibatch_grad_sparse(ds, config);
+  std::vector<char> data(gradient->getSerializedSize());
+  gradient->serialize(data.data());
+  return data;
+}
+
+// old and new clients talk to the same server
+void test_negotiation() {
+  PSSparseServerInterface raw("127.0.0.1", 1337);
+  raw.connect();
+  check(raw.negotiate_wire_format(WIRE_FORMAT_RAW) == WIRE_FORMAT_RAW,
+        "raw negotiation");
+  PSSparseServerInterface varint("127.0.0.1", 1337);
+  varint.connect();
+  check(varint.negotiate_wire_format(NUM_WIRE_FORMATS + 10) ==
+            LATEST_WIRE_FORMAT,
+        "latest negotiation");
+
+  // both connections pull the same weights
+  check(serialized_gradient(&raw) == serialized_gradient(&varint),
+        "model pulled with varint indices");
+
+  // gradients sent in both formats are applied
+  std::unique_ptr<CirrusModel> before = raw.get_full_model(false);
+  std::vector<std::pair<int, FEATURE_TYPE>> raw_weights = {{20, 1.0}};
+  raw.send_lr_gradient(LRSparseGradient(std::move(raw_weights)));
+  std::vector<std::pair<int, FEATURE_TYPE>> varint_weights = {{4000, 1.0},
+                                                              {1, -1.0}};
+  varint.send_lr_gradient(LRSparseGradient(std::move(varint_weights)));
+  std::unique_ptr<CirrusModel> after = varint.get_full_model(false);
+  for (const auto& index : {1, 20, 4000}) {
+    check(after->get_nth_weight(index) != before->get_nth_weight(index),
+          "weight " + std::to_string(index));
+  }
+  check(after->get_nth_weight(300000) == before->get_nth_weight(300000),
+        "untouched weight");
+}
+
+int main() {
+  test_indices();
+  test_gradients();
+  test_negotiation();
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}
@@ -0,0 +1,109 @@
+#include <WorkerPipeline.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TestUtils.h"
+
+using namespace cirrus;
+
+struct Work {
+  uint64_t minibatch = 0;
+  uint64_t num_pushed = 0;  //< gradients pushed when it was fetched
+};
+
+using Pipeline = WorkerPipeline<Work, uint64_t>;
+
+// minibatches come in order and their models miss at most depth gradients
+void test_order_and_staleness(uint32_t depth) {
+  std::atomic<uint64_t> num_pushed(0);
+  uint64_t num_fetched = 0;
+  std::vector<uint64_t> pushed;
+  {
+    Pipeline pipeline(
+        depth,
+        []() { return std::make_unique<Work>(); },
+        [&](Work* work) {
+          work->minibatch = num_fetched++;
+          work->num_pushed = num_pushed;
+        },
+        [&](uint64_t& gradient) {
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+          pushed.push_back(gradient);
+          ++num_pushed;
+        });
+    for (uint64_t i = 0; i < 1000; ++i) {
+      Work& work = pipeline.next();
+      check(work.minibatch == i, "minibatch order");
+      check(work.num_pushed + depth >= i, "staleness");
+      pipeline.push(i);
+    }
+  }
+  // all gradients are pushed once the pipeline is destroyed
+  check(pushed.size() == 1000, "number of gradients pushed");
+  for (uint64_t i = 0; i < pushed.size(); ++i) {
+    check(pushed[i] == i, "gradient order");
+  }
+}
+
+// work objects are reused
+void test_reuse() {
+  std::vector<Work*> created;
+  Pipeline pipeline(
+      2,
+      [&]() {
+        created.push_back(new Work());
+        return std::unique_ptr<Work>(created.back());
+      },
+      [](Work*) {},
+      [](uint64_t&) {});
+  check(created.size() == 3, "number of work objects");
+  for (uint64_t i = 0; i < 100; ++i) {
+    Work& work = pipeline.next();
+    bool found = false;
+    for (Work* w : created) {
+      found = found || w == &work;
+    }
+    check(found, "reused work object");
+    pipeline.push(i);
+  }
+}
+
+// errors of the I/O thread are rethrown to the worker
+void test_errors() {
+  uint64_t num_fetched = 0;
+  Pipeline pipeline(
+      1,
+      []() { return std::make_unique<Work>(); },
+      [&](Work*) {
+        if (num_fetched++ == 3) {
+          throw std::runtime_error("fetch error");
+        }
+      },
+      [](uint64_t&) {});
+  bool thrown = false;
+  try {
+    for (uint64_t i = 0; i < 10; ++i) {
+      pipeline.next();
+      pipeline.push(i);
+    }
+  } catch (const std::runtime_error& e) {
+    thrown = std::string(e.what()) == "fetch error";
+  }
+  check(thrown, "error");
+}
+
+int main() {
+  test_order_and_staleness(1);
+  test_order_and_staleness(4);
+  test_reuse();
+  test_errors();
+
+  std::cout << "Test successful" << std::endl;
+  return 0;
+}